@@ -0,0 +1,35 @@
+/**
+ * aot.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See aot.c for full description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AOT__H__
+#define AOT__H__
+
+#include <stdio.h>
+#include "gunderscript.h"
+
+bool aot_write_functions(VM * vm, char * code, size_t codeLen,
+			 FILE * outFile, char * symbolName,
+			 GSByteCodeFunc * functions, int numFunctions);
+
+#endif /* AOT__H__ */
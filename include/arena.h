@@ -0,0 +1,57 @@
+/**
+ * arena.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See arena.c for full description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARENA__H__
+#define ARENA__H__
+
+#include <stdlib.h>
+#include "gsbool.h"
+
+/* a block of memory that allocations are carved from */
+typedef struct ArenaBlock {
+  struct ArenaBlock * next;       /* the block allocated before this one */
+  size_t size;                    /* number of bytes after the header */
+  size_t used;                    /* number of those bytes handed out */
+} ArenaBlock;
+
+/* an arena of memory that is all freed at once */
+typedef struct Arena {
+  ArenaBlock * blocks;            /* the newest block, which is carved next */
+  size_t blockSize;               /* bytes in a block, unless more is needed */
+} Arena;
+
+Arena * arena_new(size_t blockSize);
+
+void * arena_alloc(Arena * arena, size_t size);
+
+void * arena_realloc(Arena * arena, void * memory, size_t size,
+		     size_t newSize);
+
+char * arena_strndup(Arena * arena, char * string, size_t len);
+
+void arena_reset(Arena * arena);
+
+void arena_free(Arena * arena);
+
+#endif /* ARENA__H__ */
@@ -56,4 +56,6 @@ void buffer_free(Buffer * buffer);
 
 bool buffer_resize(Buffer * buffer, int newSize);
 
+void buffer_truncate(Buffer * buffer, int size);
+
 #endif /* BUFFER__H__ */
@@ -0,0 +1,38 @@
+/**
+ * buildcache.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See buildcache.c for full description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUILDCACHE__H__
+#define BUILDCACHE__H__
+
+#include "vm.h"
+#include "buffer.h"
+#include "profile.h"
+
+/* the number of hex digits in a cache key */
+#define BUILDCACHE_KEY_LEN   16
+
+bool buildcache_key(VM * vm, char * fileName, int optLevel,
+		    Profile * profile, char * key, Buffer * files);
+
+#endif /* BUILDCACHE__H__ */
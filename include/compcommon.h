@@ -32,6 +32,8 @@
 #include "buffer.h"
 #include "lexer.h"
 #include "set.h"
+#include "profile.h"
+#include "arena.h"
 
 /* initial size of all hashtables */
 #define COMPILER_INITIAL_HTSIZE   11
@@ -40,6 +42,16 @@
 /* hashtable load factor upon which it will be rehashed */
 #define COMPILER_HTLOADFACTOR     0.75
 
+/* bytes in each block of the arena that builds allocate from */
+#define COMPILER_ARENA_BLOCKSIZE  16384
+/* initial number of entries in the symbol, scope and name tables */
+#define COMPILER_INITIAL_SYMBOLS  64
+
+/* optimization level of a new compiler. 0 turns the optimizer off */
+#define COMPILER_DEFAULT_OPT_LEVEL  1
+/* the most optimization passes that statistics are kept for */
+#define COMPILER_MAX_PASSES         16
+
 /* errors that can occur during compile time */
 typedef enum {
   COMPILERERR_SUCCESS,
@@ -66,6 +78,8 @@ typedef enum {
   COMPILERERR_SOURCE_FILE_READ_ERR,
   COMPILERERR_MALFORMED_DEPENDS,
   COMPILERERR_FUNCTION_NAME_TOO_LONG,
+  COMPILERERR_NESTED_TOO_DEEP,
+  COMPILERERR_TOO_MANY_VARS,
 } CompilerErr;
 
 /* english translations of compiler errors */
@@ -94,18 +108,67 @@ static const const char * const compilerErrorMessages [] = {
   "Unable to open and read a source file",
   "Malformed \"depends\" statement in script",
   "Function name is too long",
+  "Blocks are nested too deeply (depth > 127)",
+  "Too many variables in one function or block (count > 127)",
 };
 
+/* statistics of an optimization pass, summed over every function built */
+typedef struct PassStats {
+  const char * name;              /* name of the pass, or NULL if not run */
+  int runs;                       /* number of functions it ran on */
+  long instrsIn;                  /* instructions before it ran */
+  long instrsOut;                 /* instructions after it ran */
+  double seconds;                 /* processor time it took */
+} PassStats;
+
+/* a variable in the compiler's flat symbol table */
+typedef struct CompilerSymbol {
+  int name;                       /* id of its interned name */
+  int scope;                      /* index of the scope that declared it */
+  int slot;                       /* its index in the scope's VM stack frame */
+  int shadowed;                   /* symbol with the same name that it hides,
+				   * or -1 */
+} CompilerSymbol;
+
+/* an interned identifier */
+typedef struct CompilerName {
+  char * text;                    /* copy of the name, in the arena */
+  size_t len;
+  unsigned long hash;
+  int binding;                    /* innermost symbol with this name, or -1 */
+} CompilerName;
+
 /* a compiler instance type */
 typedef struct Compiler {
 
   /* a hashset of previously compiled scripts. prevents duplicated includes */
   Set * compiledScripts;
 
-  /* stack of hashtables of symbol structs containing the index at which the
-   * variable will be stored in the frame stack frame in the byte code.
+  /* memory of the symbol and name tables, and anything else that only lives
+   * until the outermost compiler_build() call returns. reset after each build.
+   */
+  Arena * arena;
+  /* the flat symbol table: the variables of every open scope, innermost scope
+   * last. each scope is a VM stack frame, and scopes holds the index in
+   * symbols at which each scope begins.
    */
-  Stk * symTableStk;
+  CompilerSymbol * symbols;
+  int numSymbols;
+  int symbolsSize;
+  int * scopes;
+  int numScopes;
+  int scopesSize;
+  /* identifiers interned by the symbol table, by id, and an open addressed
+   * index of their ids by hash with twice namesSize entries, -1 if unused.
+   */
+  CompilerName * names;
+  int numNames;
+  int namesSize;
+  int * nameIndex;
+  /* addresses of the jumps written for the && and || operators whose right
+   * operands are still being parsed.
+   */
+  Stk * shortCircuitStk;
   /* an instance of virtual machine. this is used during compile time to see
    * what functions are available to the script.
    */
@@ -113,6 +176,10 @@ typedef struct Compiler {
   CompilerErr err;                /* error code value */
   int errorLineNum;               /* line number where error occurred */
   LexerErr lexerErr;              /* the error code passed by the lexer */
+  int optLevel;                   /* optimization level, 0 for none */
+  PassStats passStats[COMPILER_MAX_PASSES]; /* statistics of each pass */
+  int numPassStats;               /* number of passStats entries used */
+  Profile * profile;              /* guides the optimizer, or NULL. not owned */
 } Compiler;
 
 bool tokens_equal(char * token1, size_t num1,
@@ -120,11 +187,15 @@ bool tokens_equal(char * token1, size_t num1,
 
 OpCode operator_to_opcode(char * operator, size_t len);
 
-bool symtblstk_push(Compiler * c);
+bool symtbl_push_scope(Compiler * c);
+
+void symtbl_pop_scope(Compiler * c);
 
-HT * symtblstk_pop(Compiler * c);
+bool symtbl_define(Compiler * c, char * name, size_t nameLen,
+		   bool * prevDefined);
 
-HT * symtblstk_peek(Compiler * c, int offset);
+bool symtbl_lookup(Compiler * c, char * name, size_t nameLen,
+		   int * depth, int * slot);
 
 int operator_precedence(char * operator, size_t operatorLen);
 
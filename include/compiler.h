@@ -36,6 +36,18 @@ bool compiler_build_file(Compiler * compiler, char * fileName);
 
 bool compiler_build(Compiler * compiler, char * input, size_t inputLen);
 
+bool compiler_mark_built(Compiler * compiler, char * fileName);
+
+char * compiler_file_to_string(char * file, size_t * size);
+
+void compiler_set_opt_level(Compiler * compiler, int optLevel);
+
+int compiler_opt_level(Compiler * compiler);
+
+void compiler_set_profile(Compiler * compiler, Profile * profile);
+
+const PassStats * compiler_pass_stats(Compiler * compiler, int * numPasses);
+
 void compiler_set_err(Compiler * compiler, CompilerErr err);
 
 CompilerErr compiler_get_err(Compiler * compiler);
@@ -0,0 +1,60 @@
+/**
+ * gspool.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See gspool.c for full description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GSPOOL__H__
+#define GSPOOL__H__
+
+#include "gunderscript.h"
+
+/**
+ * The function prototype for preparing the instances in a pool. Called once
+ * for each instance when the pool is created, to build scripts, import
+ * bytecode or register host callbacks.
+ * instance: the new instance.
+ * data: the initData pointer given to gspool_new().
+ * returns: true if the instance is ready for use, false to fail the pool.
+ */
+typedef bool (*GSPoolInitCallback) (Gunderscript * instance, void * data);
+
+/* a pool of pre-initialized Gunderscript instances */
+typedef struct GSPool {
+  Gunderscript * instances;       /* all instances owned by the pool */
+  Gunderscript ** idle;           /* stack of instances not in use */
+  int size;                       /* number of instances */
+  int numIdle;                    /* number of instances in idle */
+} GSPool;
+
+GSAPI GSPool * gspool_new(int size, size_t stackSize, int callbacksSize,
+			  bool withCompiler, GSPoolInitCallback init,
+			  void * initData);
+
+GSAPI Gunderscript * gspool_acquire(GSPool * pool);
+
+GSAPI void gspool_release(GSPool * pool, Gunderscript * instance);
+
+GSAPI int gspool_num_idle(GSPool * pool);
+
+GSAPI void gspool_free(GSPool * pool);
+
+#endif /* GSPOOL__H__ */
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include "compiler.h"
 #include "vm.h"
+#include "profile.h"
 
 /* define module function exports */
 #if defined(_MSC_VER)
@@ -42,7 +43,11 @@
 #define GS_BYTECODE_HEADER   "GXS"
 #define GS_BYTECODE_HEADER_SIZE 4
 #define GUNDERSCRIPT_BUILD_DATE     __DATE__
-#define GS_BYTECODE_BUILDDATE_SIZE  35
+#define GS_BYTECODE_BUILDDATE_SIZE  36
+/* version of the bytecode file layout, bumped whenever it changes */
+#define GS_BYTECODE_VERSION         2
+/* every section of a bytecode file starts on a multiple of this */
+#define GS_BYTECODE_ALIGN           8
 #define GS_MAX_FUNCTION_NAME_LEN    80
 
 /* error codes */
@@ -59,6 +64,11 @@ typedef enum {
   GUNDERSCRIPTERR_ALLOC_FAILED,
   GUNDERSCRIPTERR_BUILDERR,
   GUNDERSCRIPTERR_EXECERR,
+  GUNDERSCRIPTERR_NO_SUCH_FUNCTION,
+  GUNDERSCRIPTERR_ALREADY_LOADED,
+  GUNDERSCRIPTERR_SNAPSHOT_UNSUPPORTED,
+  GUNDERSCRIPTERR_BAD_SNAPSHOT,
+  GUNDERSCRIPTERR_BAD_PROFILE,
 } GunderscriptErr;
 
 /* english translations of Gunderscript errors */
@@ -75,27 +85,83 @@ static const char * const gunderscriptErrorMessages [] = {
   "Memory Allocation Failed",
   "Compiler Error",
   "VM Error",
+  "Function does not exist or is not exported",
+  "Instance already has code, build or import into a new instance",
+  "State holds an object that can't be saved in a snapshot",
+  "Not a snapshot file, or snapshot is corrupted",
+  "Not a profile file, or profile is corrupted",
 };
 
+/* bytecode file header. a bytecode file is laid out as this header, the
+ * function table, the constant pool and the code, each section aligned to
+ * GS_BYTECODE_ALIGN, so that it can be mapped into memory and run in place.
+ */
 typedef struct {
   /* stores unique build date/string that is used to check byte code
    * compatibility before it is run
    */
   char header[GS_BYTECODE_HEADER_SIZE];
+  int version;
   char buildDate[GS_BYTECODE_BUILDDATE_SIZE];
-  int byteCodeLen;
-  int numFunctions;
+  int headerSize;                 /* sizeof(GSByteCodeHeader) */
+  int numFunctions;               /* number of GSByteCodeFunc entries */
+  int functionsOffset;            /* file offset of the function table */
+  int constantsOffset;            /* file offset of the constant pool */
+  int constantsLen;               /* length of the constant pool */
+  int codeOffset;                 /* file offset of the code */
+  int byteCodeLen;                /* length of the code */
 } GSByteCodeHeader;
 
+/* function table entry in a bytecode file. entries are sorted by index */
+typedef struct {
+  int nameOffset;                 /* offset of the name in constant pool */
+  int nameLen;                    /* length of the name */
+  int index;                      /* offset of the function in the code */
+  int codeLen;                    /* length of the function's code */
+  int numArgs;                    /* the number of arguments required */
+  int numVars;                    /* the number of variables required */
+  int exported;                   /* nonzero if callable by the host */
+  int reserved;                   /* keeps entries aligned, always zero */
+} GSByteCodeFunc;
+
+/* a program compiled into the host binary by gunderscript_export_c() */
+typedef struct {
+  const char * buildDate;         /* GUNDERSCRIPT_BUILD_DATE of the compiler */
+  int version;                    /* GS_BYTECODE_VERSION of the compiler */
+  const char * code;              /* the code */
+  int codeLen;                    /* length of the code */
+  const char * constants;         /* the function names */
+  int constantsLen;               /* length of constants */
+  const GSByteCodeFunc * functions; /* the function table, sorted by index */
+  int numFunctions;
+  int maxStack;                   /* deepest stack of verified code, or -1 */
+} GSStaticProgram;
+
+/* name of the GSAotProgram in a library built by gunderscript_export_aot() */
+#define GS_AOT_SYMBOL               "gunderscript_aot_program"
+
+/* a program compiled ahead of time by gunderscript_export_aot() */
+typedef struct {
+  const GSStaticProgram * program; /* the program's code and functions */
+  const VMCompiledFunc * compiled; /* the translation of each function, in
+				    * function table order */
+} GSAotProgram;
+
 /* stores an instance of a Gunderscript environment */
 typedef struct Gunderscript {
   Compiler * compiler;
   VM * vm;
   GunderscriptErr err;
-  char * byteCode;
-  int byteCodeLen;
+  char * byteCode;                /* imported bytecode file, or NULL */
+  size_t byteCodeLen;             /* length of byteCode */
+  char * cacheDir;                /* directory of cached builds, or NULL */
+  void * aotLibrary;              /* library of compiled functions, or NULL */
+  Profile * profile;              /* profile that guides builds, or NULL */
+  ProfileRecorder * recorder;     /* counts what runs when profiled, or NULL */
 } Gunderscript;
 
+GSAPI VMRegistry * gunderscript_std_registry();
+
 GSAPI bool gunderscript_new_full(Gunderscript * instance, size_t stackSize,
 		      int callbacksSize);
 
@@ -110,6 +176,15 @@ GSAPI bool gunderscript_build(Gunderscript * instance, char * input, size_t inpu
 
 GSAPI bool gunderscript_build_file(Gunderscript * instance, char * fileName);
 
+GSAPI bool gunderscript_set_cache_dir(Gunderscript * instance, char * dir);
+
+GSAPI bool gunderscript_set_profile(Gunderscript * instance, char * fileName);
+
+GSAPI bool gunderscript_profile_start(Gunderscript * instance);
+
+GSAPI bool gunderscript_profile_write(Gunderscript * instance,
+				      char * fileName);
+
 
 GSAPI CompilerErr gunderscript_build_err(Gunderscript * instance);
 
@@ -120,8 +195,34 @@ GSAPI const char * gunderscript_err_message(Gunderscript * instance);
 GSAPI bool gunderscript_function(Gunderscript * instance, char * entryPoint,
 			   size_t entryPointLen);
 
+GSAPI VMFunc * gunderscript_prepare(Gunderscript * instance, char * entryPoint,
+				    size_t entryPointLen);
+
+GSAPI bool gunderscript_call(Gunderscript * instance, VMFunc * function,
+			     VMArg * args, int numArgs, VMArg * result);
+
+GSAPI bool gunderscript_call_batch(Gunderscript * instance, VMFunc * function,
+				   VMArg * args, int numRecords, VMArg * results,
+				   VMErr * errors, bool continueOnError);
+
+GSAPI bool gunderscript_snapshot(Gunderscript * instance, char * entryPoint,
+				 size_t entryPointLen, char * fileName,
+				 VMArg * state);
+
+GSAPI bool gunderscript_restore(Gunderscript * instance, char * fileName,
+				VMArg * state);
+
 GSAPI VMErr gunderscript_function_err(Gunderscript * instance);
 
+GSAPI void gunderscript_set_budget(Gunderscript * instance, long maxInstructions,
+				   long maxMicros);
+
+GSAPI bool gunderscript_resume(Gunderscript * instance, VMArg * result);
+
+GSAPI bool gunderscript_suspended(Gunderscript * instance);
+
+GSAPI void gunderscript_reset(Gunderscript * instance);
+
 GSAPI int gunderscript_err_line(Gunderscript * instance);
 
 GSAPI void gunderscript_free(Gunderscript * instance);
@@ -132,6 +233,20 @@ GSAPI bool gunderscript_export_bytecode(Gunderscript * instance, char * fileName
 
 GSAPI bool gunderscript_import_bytecode(Gunderscript * instance, char * fileName);
 
+GSAPI bool gunderscript_import_bytecode_lazy(Gunderscript * instance,
+					     char * fileName);
+
+GSAPI bool gunderscript_export_c(Gunderscript * instance, char * fileName,
+				 char * symbolName);
+
+GSAPI bool gunderscript_load_static(Gunderscript * instance,
+				    const GSStaticProgram * program);
+
+GSAPI bool gunderscript_export_aot(Gunderscript * instance, char * fileName,
+				   char * symbolName);
+
+GSAPI bool gunderscript_load_aot(Gunderscript * instance, char * libraryName);
+
 GSAPI const char * gunderscript_build_date();
 
 
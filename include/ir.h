@@ -0,0 +1,87 @@
+/**
+ * ir.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See ir.c for full description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IR__H__
+#define IR__H__
+
+#include "buffer.h"
+#include "vmdefs.h"
+#include "gsbool.h"
+
+/* pseudo opcode of an instruction that a pass removed. it is dropped when the
+ * function is compacted, and jumps to it go to the instruction after it.
+ */
+#define IR_NOP            ((char)-1)
+/* the largest operands of any instruction, other than strings and jump
+ * addresses. those of OP_FOR_STEP_NUM.
+ */
+#define IR_MAX_ARGS       (3 + (2 * sizeof(double)))
+
+/* an instruction of the intermediate representation. jumps refer to the
+ * instruction that they jump to rather than to an address, so that passes can
+ * add and remove instructions without fixing up addresses.
+ */
+typedef struct IRInstr {
+  char op;                        /* the opcode, or IR_NOP */
+  char args[IR_MAX_ARGS];         /* operands, other than a jump address */
+  int argsLen;                    /* number of bytes in args */
+  int target;                     /* instruction jumped to, or -1 */
+  int string;                     /* OP_STR_PUSH text's offset in source */
+  int origin;                     /* 1 + the offset in the function that it
+				   * was lifted from, or 0 if it is new */
+} IRInstr;
+
+/* a function in the intermediate representation */
+typedef struct IRFunc {
+  IRInstr * code;                 /* the instructions */
+  int size;                       /* number of instructions */
+  int capacity;                   /* number of instructions allocated */
+  int start;                      /* address of the function's bytecode */
+  char * source;                  /* copy of the bytecode it was lifted from */
+  int sourceLen;
+} IRFunc;
+
+IRFunc * ir_lift(char * byteCode, int start, int end);
+
+bool ir_lower(IRFunc * func, Buffer * out);
+
+int ir_add_string(IRFunc * func, char * string, int len);
+
+bool ir_append(IRFunc * func, IRInstr * instr);
+
+bool ir_splice(IRFunc * func, int index, IRFunc * insert);
+
+bool ir_insert(IRFunc * func, int index, IRFunc * insert);
+
+bool ir_compact(IRFunc * func);
+
+bool ir_move(IRFunc * func, int from, int to);
+
+int * ir_jump_counts(IRFunc * func);
+
+bool ir_frames(IRFunc * func, int * frame, int * parent);
+
+void ir_free(IRFunc * func);
+
+#endif /* IR__H__ */
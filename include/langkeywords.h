@@ -35,6 +35,8 @@
 #define LANG_FUNCTION_LEN 8
 #define LANG_EXPORTED   "exported"
 #define LANG_EXPORTED_LEN 8
+#define LANG_INLINE     "inline"
+#define LANG_INLINE_LEN   6
 #define LANG_ENDSTATEMENT ";"
 #define LANG_ENDSTATEMENT_LEN 1
 #define LANG_OPARENTH   "("
@@ -64,6 +64,13 @@ typedef enum {
   LEXERTYPE_ARGDELIM,
 } LexerType;
 
+/* a token of a tokenized input */
+typedef struct LexerToken {
+  int offset;                     /* index of its first char in the input */
+  int len;                        /* number of chars in it */
+  LexerType type;
+} LexerToken;
+
 /* Lexer Instance Struct */
 typedef struct Lexer {
   char * input;
@@ -77,6 +84,14 @@ typedef struct Lexer {
   LexerErr err;
   int index;
   int lineNum;
+  LexerToken * tokens;            /* all tokens, if tokenized up front */
+  int numTokens;
+  int tokenIndex;                 /* index in tokens of nextToken */
+  int * lines;                    /* offset at which each line starts */
+  int numLines;
+  LexerErr endErr;                /* error that ended the tokens, if any */
+  int endLineNum;                 /* lineNum after the last token */
+  LexerType endType;              /* nextTokenType after the last token */
 } Lexer;
 
 
@@ -96,6 +111,8 @@ LexerType lexer_token_type(char * token, size_t len, bool definitive);
 
 char * lexer_peek(Lexer * lexer, LexerType * type, size_t * len);
 
+bool lexer_tokenize(Lexer * l);
+
 const char * lexer_err_to_string(LexerErr err);
 
 #endif /* LEXER__H__*/
@@ -26,6 +26,7 @@
 #define LIBARRAY__H__
 
 #include "gunderscript.h"
+#include "vmregistry.h"
 
 #define LIBARRAY_ARRAY_TYPE      "LIBARRAY.0"
 #define LIBARRAY_ARRAY_TYPE_LEN  10
@@ -44,6 +45,6 @@ bool libarray_array_get_type(VMLibData * data, int index, VarType * type);
 bool libarray_array_get(VMLibData * data, int index,
 			void * value, int valueSize);
 
-bool libarray_install(Gunderscript * gunderscript);
+bool libarray_install(VMRegistry * registry);
 
 #endif /* LIBARRAY__H__ */
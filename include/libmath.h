@@ -26,7 +26,8 @@
 #define LIBMATH__H__
 
 #include "gunderscript.h"
+#include "vmregistry.h"
 
-bool libmath_install(Gunderscript * gunderscript);
+bool libmath_install(VMRegistry * registry);
 
 #endif /* LIBMATH__H__ */
@@ -25,6 +25,7 @@
 #define LIBSTR__H__
 
 #include "gunderscript.h"
+#include "vmregistry.h"
 
 #define LIBSTR_STRING_TYPE     "LIBSTR.STR"
 #define LIBSTR_STRING_TYPE_LEN    10
@@ -36,7 +37,7 @@ char * libstr_string(VMLibData * data);
 
 int libstr_string_length(VMLibData * data);
 
-bool libstr_install(Gunderscript * gunderscript);
+bool libstr_install(VMRegistry * registry);
 
 bool libstr_string_append(VMLibData * data, char * string, int stringLen);
 
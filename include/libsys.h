@@ -25,10 +25,11 @@
 #define LIBSYS__H__
 
 #include "gunderscript.h"
+#include "vmregistry.h"
 
 #define LIBSYS_FILE_TYPE     "SYS.FILE"
 #define LIBSYS_FILE_TYPE_LEN    8
 
-bool libsys_install(Gunderscript * gunderscript);
+bool libsys_install(VMRegistry * registry);
 
 #endif /* LIBSYS__H__ */
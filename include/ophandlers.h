@@ -70,6 +70,12 @@ bool op_cond_goto(VM * vm, char * byteCode,
 bool op_goto(VM * vm, char * byteCode, 
 		  size_t byteCodeLen, int * index);
 
+bool op_for_step(VM * vm, char * byteCode, 
+		 size_t byteCodeLen, int * index, bool numLimit);
+
+bool op_switch_num(VM * vm, char * byteCode, 
+		   size_t byteCodeLen, int * index);
+
 bool op_call_ptr_n(VM * vm, char * byteCode, 
 		    size_t byteCodeLen, int * index);
 
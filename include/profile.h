@@ -0,0 +1,97 @@
+/**
+ * profile.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See profile.c for full description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFILE__H__
+#define PROFILE__H__
+
+#include "vm.h"
+#include "ht.h"
+
+/* bits of the types of the operands seen by an operator, 1 << VarType */
+#define PROFILE_TYPE_NULL      (1 << TYPE_NULL)
+#define PROFILE_TYPE_BOOLEAN   (1 << TYPE_BOOLEAN)
+#define PROFILE_TYPE_NUMBER    (1 << TYPE_NUMBER)
+#define PROFILE_TYPE_OBJECT    (1 << TYPE_LIBDATA)
+
+/* counters of a run being profiled, by address in the VM's code */
+struct ProfileRecorder {
+  long * counts;                  /* runs of the instruction at each address */
+  long * taken;                   /* times each conditional jump jumped */
+  char * types;                   /* PROFILE_TYPE_* seen by each operator */
+  long * calls;                   /* calls of the function at each address */
+  int size;                       /* number of addresses counted */
+  long * natives;                 /* calls of each native, by callback index */
+  int numNatives;                 /* number of natives counted */
+  bool failed;                    /* an allocation failed, counts are lost */
+};
+
+/* what was recorded at an instruction of a profiled function */
+typedef struct ProfileSite {
+  int offset;                     /* address of the instruction in the
+				   * unoptimized function */
+  long count;                     /* times it ran */
+  long taken;                     /* times it jumped, if a conditional jump */
+  int types;                      /* PROFILE_TYPE_* seen, if an operator */
+} ProfileSite;
+
+/* what was recorded for a function */
+typedef struct ProfileFunc {
+  long calls;                     /* times it was called */
+  int types;                      /* PROFILE_TYPE_* seen by all its operators */
+  ProfileSite * sites;            /* its instructions, sorted by offset */
+  int numSites;
+  int sitesSize;                  /* number of sites allocated */
+} ProfileFunc;
+
+/* a profile file, loaded for the compiler */
+typedef struct Profile {
+  HT * functions;                 /* ProfileFunc of each function, by name */
+  char * text;                    /* the file, which keys cached builds */
+  size_t textLen;
+} Profile;
+
+typedef struct ProfileRecorder ProfileRecorder;
+
+ProfileRecorder * profile_recorder_new();
+
+void profile_record(ProfileRecorder * recorder, VM * vm, char * byteCode,
+		    size_t byteCodeLen, int index);
+
+void profile_enter(ProfileRecorder * recorder, size_t byteCodeLen,
+		   int index);
+
+bool profile_write(ProfileRecorder * recorder, VM * vm, char * fileName);
+
+void profile_recorder_free(ProfileRecorder * recorder);
+
+Profile * profile_load(char * fileName);
+
+ProfileFunc * profile_function(Profile * profile, char * name,
+			       size_t nameLen);
+
+ProfileSite * profile_site(ProfileFunc * func, int offset);
+
+void profile_free(Profile * profile);
+
+#endif /* PROFILE__H__ */
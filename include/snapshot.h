@@ -0,0 +1,75 @@
+/**
+ * snapshot.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See snapshot.c for full description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNAPSHOT__H__
+#define SNAPSHOT__H__
+
+#include "vm.h"
+#include "buffer.h"
+
+/* first bytes of all snapshot images */
+#define SNAPSHOT_HEADER          "GXSS"
+#define SNAPSHOT_HEADER_SIZE     4
+/* version of the snapshot layout, bumped whenever it changes */
+#define SNAPSHOT_VERSION         1
+/* a value in a snapshot: its type followed by its data */
+#define SNAPSHOT_VALUE_SIZE      (VM_VAR_SIZE + 1)
+
+/* kinds of objects in a snapshot */
+#define SNAPSHOT_STRING          1
+#define SNAPSHOT_ARRAY           2
+
+/* snapshot error codes */
+typedef enum {
+  SNAPSHOTERR_SUCCESS,
+  SNAPSHOTERR_ALLOC_FAILED,
+  SNAPSHOTERR_UNSUPPORTED_TYPE,
+  SNAPSHOTERR_CORRUPTED,
+} SnapshotErr;
+
+/* snapshot image header. it's followed by numObjects objects, each a
+ * SnapshotObject and its contents. in values, objects are referred to by
+ * their position in the image.
+ */
+typedef struct {
+  char header[SNAPSHOT_HEADER_SIZE];
+  int version;
+  int numObjects;
+  char root[SNAPSHOT_VALUE_SIZE]; /* the value that the snapshot holds */
+} SnapshotHeader;
+
+/* an object in a snapshot. strings are followed by their length in bytes and
+ * arrays by their length in values.
+ */
+typedef struct {
+  int kind;                       /* SNAPSHOT_STRING or SNAPSHOT_ARRAY */
+  int length;
+} SnapshotObject;
+
+bool snapshot_write(VM * vm, VMArg * value, Buffer * image, SnapshotErr * err);
+
+bool snapshot_read(VM * vm, char * image, size_t imageLen, VMArg * value,
+		   SnapshotErr * err);
+
+#endif /* SNAPSHOT__H__ */
@@ -57,4 +57,6 @@ bool typestk_pop(TypeStk * stack, void * value,
 
 int typestk_size(TypeStk * stack);
 
+bool typestk_reserve(TypeStk * stack, int count);
+
 #endif /* TYPESTK__H__ */
@@ -0,0 +1,37 @@
+/**
+ * verifier.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See verifier.c for full description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VERIFIER__H__
+#define VERIFIER__H__
+
+#include "vm.h"
+
+int verifier_op_len(char * byteCode, size_t byteCodeLen, int index);
+
+bool verifier_verify_function(VM * vm, VMFunc * function,
+			      VMFunc ** functions, int numFunctions);
+
+bool verifier_verify(VM * vm);
+
+#endif /* VERIFIER__H__ */
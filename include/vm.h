@@ -30,6 +30,11 @@
 #include "buffer.h"
 #include "ht.h"
 
+/* return address of the entry frame pushed by the host. popping this frame
+ * ends the execution and returns control to the host.
+ */
+#define VM_HOST_RETURN       -2
+
 /* Virtual Machine error codes */
 typedef enum {
   VMERR_SUCCESS,                      /* operation succeeded */
@@ -51,6 +56,9 @@ typedef enum {
   VMERR_INVALID_TYPE_ARGUMENT,        /* argument is wrong type */
   VMERR_FILE_CLOSED,                  /* trying to read or write to closed file */
   VMERR_ARGUMENT_OUT_OF_RANGE,        /* index argument is out of range */
+  VMERR_BUDGET_EXHAUSTED,             /* execution budget ran out, resumable */
+  VMERR_VERIFY_FAILED,                /* bytecode did not pass verification */
+  VMERR_NOT_RUN,                      /* batch stopped before this record */
 } VMErr;
 
 /* english translations of vm errors */
@@ -74,6 +82,9 @@ static const char * const vmErrorMessages [] = {
   "Argument to native function is invalid type",
   "Trying to read or write to a closed file.",
   "Argument to native function is out of allowable range",
+  "Execution budget exhausted, call can be resumed",
+  "Bytecode failed verification",
+  "Not run because an earlier record in the batch failed",
 };
 
 typedef struct VMArg {
@@ -82,6 +93,7 @@ typedef struct VMArg {
 } VMArg;
 
 typedef struct VM VM;
+typedef struct VMRegistry VMRegistry;
 
 
 /**
@@ -100,18 +112,44 @@ struct VM {
   FrmStk * frmStk;                /* the stack of stack frames */
   TypeStk * opStk;                /* the stack of operands */
   HT * functionHT;
-  VMCallback * callbacks;         /* the array of native bound functions */
+  VMRegistry * registry;          /* shared native functions, not owned */
+  VMCallback * callbacks;         /* this instance's native functions */
   Buffer * buffer;                /* bytecode buffer */
+  char * image;                   /* external code run instead of buffer */
+  size_t imageLen;                /* length of image */
   HT * callbacksHT;               /* a pointer to the callbacks hashtable */
   int callbacksSize;              /* the size of the callbacks array */
   int numCallbacks;               /* the number of callbacks in array */
   int index;                      /* current execution index */
   VMErr err;                      /* VM error state */
+  long budgetInstructions;        /* instructions per slice, 0 is unlimited */
+  long budgetMicros;              /* microseconds per slice, 0 is unlimited */
+  double sliceStart;              /* time that the current slice started */
+  bool suspended;                 /* stopped by budget, may be resumed */
+  char * resumeCode;              /* bytecode of the suspended execution */
+  size_t resumeCodeLen;           /* length of resumeCode */
+  bool resumeUnchecked;           /* suspended execution is verified code */
+  char * verifiedCode;            /* code that passed verifier_verify() */
+  size_t verifiedCodeLen;         /* length of verifiedCode */
+  int maxStack;                   /* deepest stack of any verified function */
+  char * lazySource;              /* code that functions are loaded from */
+  char * lazyImage;               /* code image that they are loaded into */
+  size_t lazyImageLen;            /* length of lazyImage */
+  struct VMFunc ** lazyFunctions;  /* every function, sorted by index */
+  int numLazyFunctions;
+  struct ProfileRecorder * profile; /* counts what runs, or NULL */
+  struct VMBatch * batch;         /* records for the next vm_run(), or NULL */
 };
 
 
 typedef struct VMLibData VMLibData;
 
+/* a script function compiled to native code ahead of time. it is called with
+ * the function's frame pushed and returns after popping it, with the return
+ * value on the operand stack.
+ */
+typedef bool (*VMCompiledFunc) (VM * vm);
+
 /* a function struct */
 typedef struct VMFunc {
   int index;                      /* the index where the function's 
@@ -119,6 +157,11 @@ typedef struct VMFunc {
   int numArgs;                    /* the number of arguments required */
   int numVars;                    /* the number of variables required */
   bool exported;
+  bool inlineHint;                /* declared inline, for the compiler */
+  int maxStack;                   /* deepest operand stack, once verified */
+  int codeLen;                    /* length of the code, once verified */
+  bool loaded;                    /* false until loaded from a lazy source */
+  VMCompiledFunc compiled;        /* native code of the function, or NULL */
 } VMFunc;
 
 
@@ -127,10 +170,30 @@ VM * vm_new(size_t stackSize, int callbacksSize);
 bool vm_exec(VM * vm, char * byteCode,
 	     size_t byteCodeLen, int startIndex, int numArgs);
 
+void vm_set_budget(VM * vm, long maxInstructions, long maxMicros);
+
+bool vm_call(VM * vm, VMFunc * function, VMArg * args, int numArgs,
+	     VMArg * result);
+
+bool vm_call_batch(VM * vm, VMFunc * function, VMArg * args, int numRecords,
+		   VMArg * results, VMErr * errors, bool continueOnError);
+
+bool vm_take_result(VM * vm, VMArg * result);
+
+bool vm_resume(VM * vm);
+
+bool vm_suspended(VM * vm);
+
+void vm_reset(VM * vm);
+
+void vm_set_registry(VM * vm, VMRegistry * registry);
+
 bool vm_reg_callback(VM * vm, char * name, size_t nameLen, VMCallback callback);
 
 VMCallback vm_callback_from_index(VM * vm, int index);
 
+bool vm_callback_pure(VM * vm, int index);
+
 int vm_callback_index(VM * vm, char * name, size_t nameLen);
 
 int vm_num_callbacks(VM * vm);
@@ -155,13 +218,37 @@ size_t vm_bytecode_size(VM * vm);
 
 char * vm_bytecode(VM * vm);
 
+char * vm_code(VM * vm);
+
+void vm_set_image(VM * vm, char * image, size_t imageLen);
+
+bool vm_verified(VM * vm);
+
+void vm_set_verified(VM * vm, int maxStack);
+
+bool vm_set_lazy_source(VM * vm, char * source, size_t sourceLen);
+
+bool vm_load_function(VM * vm, VMFunc * function);
+
 Buffer * vm_buffer(VM * vm);
 
+void vm_set_profile(VM * vm, struct ProfileRecorder * recorder);
+
 
 
 /* VM native library interface functions */
 void * vmarg_data(VMArg * arg);
 
+void vmarg_set_number(VMArg * arg, double value);
+
+void vmarg_set_boolean(VMArg * arg, bool value);
+
+void vmarg_set_null(VMArg * arg);
+
+void vmarg_set_libdata(VMArg * arg, VMLibData * data);
+
+void vmarg_release(VM * vm, VMArg * arg);
+
 VarType vmarg_type(VMArg arg);
 
 double vmarg_number(VMArg arg, bool * success);
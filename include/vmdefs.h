@@ -81,6 +81,37 @@ typedef enum {
   OP_OR,
   OP_NULL_PUSH,
   OP_RETURN,
+  OP_CALL_LAZY,  /* 31: OP_CALL_B to a function that is not loaded yet */
+
+  /* forms of the operators and of OP_VAR_STOR for operands that the compiler
+   * has proven to be numbers. OP_NUM_STOR also requires that the variable
+   * does not hold an object.
+   */
+  OP_NUM_ADD,
+  OP_NUM_SUB,
+  OP_NUM_MUL,
+  OP_NUM_DIV,
+  OP_NUM_MOD,    /* 36 */
+  OP_NUM_LT,
+  OP_NUM_GT,
+  OP_NUM_LTE,
+  OP_NUM_GTE,
+  OP_NUM_EQUALS, /* 41 */
+  OP_NUM_NOT_EQUALS,
+  OP_NUM_STOR,
+
+  /* the step of a counted loop. adds a number to a variable, compares it with
+   * a variable or a number, and jumps back to the loop's body if the
+   * comparison holds.
+   */
+  OP_FOR_STEP,   /* 44 */
+  OP_FOR_STEP_NUM,
+
+  /* jumps through a table of OP_GOTOs that follows it, by the value of a
+   * variable that is an integer in the table's range, or to the table's last
+   * OP_GOTO if it is not.
+   */
+  OP_SWITCH_NUM, /* 46 */
 } OpCode;
 
 #endif /* VMDEFS__H__ */
@@ -0,0 +1,69 @@
+/**
+ * vmregistry.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See vmregistry.c for full description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VMREGISTRY__H__
+#define VMREGISTRY__H__
+
+#include "vm.h"
+
+/* a native function entry */
+typedef struct VMNative {
+  char * name;                    /* the name the function is called by */
+  size_t nameLen;                 /* the length of name */
+  VMCallback callback;            /* the native implementation */
+  bool pure;                      /* no side effects, primitive result */
+} VMNative;
+
+/* a set of native functions that may be shared by many VMs */
+struct VMRegistry {
+  VMNative * natives;             /* the functions, in registration order */
+  int size;                       /* the size of the natives array */
+  int numNatives;                 /* the number of natives registered */
+  int * table;                    /* perfect hash table of native index + 1 */
+  unsigned int tableMask;         /* the table size minus one */
+  unsigned int seed;              /* hash seed that gives no collisions */
+  bool frozen;                    /* no more natives may be added */
+};
+
+VMRegistry * vmregistry_new(int size);
+
+bool vmregistry_add(VMRegistry * registry, char * name, size_t nameLen,
+		    VMCallback callback);
+
+bool vmregistry_add_pure(VMRegistry * registry, char * name, size_t nameLen,
+			 VMCallback callback);
+
+bool vmregistry_freeze(VMRegistry * registry);
+
+int vmregistry_index(VMRegistry * registry, char * name, size_t nameLen);
+
+VMCallback vmregistry_callback(VMRegistry * registry, int index);
+
+bool vmregistry_pure(VMRegistry * registry, int index);
+
+int vmregistry_size(VMRegistry * registry);
+
+void vmregistry_free(VMRegistry * registry);
+
+#endif /* VMREGISTRY__H__ */
@@ -26,14 +26,27 @@
  */
 
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include "gunderscript.h"
 
 #define GXSMAIN_BUILD_SCRIPT     "build-script"
 #define GXSMAIN_RUN_SCRIPT       "run-script"
 #define GXSMAIN_RUN_BYTECODE     "run-bytecode"
+#define GXSMAIN_BUILD_C          "build-c"
+#define GXSMAIN_BUILD_AOT        "build-aot"
+#define GXSMAIN_RUN_AOT          "run-aot"
+#define GXSMAIN_PROFILE_SCRIPT   "profile-script"
 
 #define GXSMAIN_DEFAULT_MAIN     "main"
+/* environment variable naming a directory for cached builds of scripts */
+#define GXSMAIN_CACHE_DIR_ENV    "GUNDERSCRIPT_CACHE_DIR"
+/* environment variable setting the optimization level of builds */
+#define GXSMAIN_OPT_LEVEL_ENV    "GUNDERSCRIPT_OPT_LEVEL"
+/* environment variable that prints optimizer statistics after builds */
+#define GXSMAIN_PASS_STATS_ENV   "GUNDERSCRIPT_PASS_STATS"
+/* environment variable naming a profile that guides builds */
+#define GXSMAIN_PROFILE_ENV      "GUNDERSCRIPT_PROFILE"
 #define GXSMAIN_MAX_ASSOCIATED_SCRIPT_FN   255
 
 static const size_t stackSize = 100000;  /* environment constants */
@@ -72,13 +85,31 @@ static void print_help() {
   printf("    run-script   [entrypoint] [script.gxs] \n");
   printf("         compiles and runs a script from the specfied \"entrypoint\" function.\n");
   printf("    run-bytecode [entrypoint] [bytecode.gxb] \n");
-  printf("         runs a bytecode file generated with \"build-script\" \n\n\n");
+  printf("         runs a bytecode file generated with \"build-script\" \n");
+  printf("    build-c      [script.gxs] [outputfile.c] \n");
+  printf("         builds a script into C source defining GSStaticProgram gxs_[script]\n");
+  printf("         to be compiled into a host and run with gunderscript_load_static().\n");
+  printf("    build-aot    [script.gxs] [outputfile.c] \n");
+  printf("         builds a script and translates it to C, to be compiled with\n");
+  printf("         cc -O2 -shared -fPIC -I include [outputfile.c] -o [library.so]\n");
+  printf("    run-aot      [entrypoint] [library.so] \n");
+  printf("         runs a library compiled from the output of \"build-aot\" \n");
+  printf("    profile-script [script.gxs] [profile.txt] \n");
+  printf("         runs a script's \"main\" function unoptimized and writes a profile\n");
+  printf("         of what ran, for builds to be optimized with.\n\n\n");
   printf("Autoexecute:\n");
   printf("  Scripts will autoexecute if they are named the same as their copy of Gunderscript.\n");
   printf("  For example:\n");
   printf("\n  If your Gunderscript was called foobar (Linux) or foobar.exe (Windows), then\n");
   printf("  your program could be called foobar.gxs (uncompiled script), or\n");
-  printf("  foobar.gxb (compiled bytecode).");
+  printf("  foobar.gxb (compiled bytecode).\n\n");
+  printf("Environment:\n");
+  printf("  GUNDERSCRIPT_CACHE_DIR: an existing directory in which run-script and\n");
+  printf("  autoexecuted scripts cache their builds to skip compiling next time.\n");
+  printf("  GUNDERSCRIPT_OPT_LEVEL: how much builds are optimized, 0 for none.\n");
+  printf("  GUNDERSCRIPT_PASS_STATS: if set, builds print optimizer statistics.\n");
+  printf("  GUNDERSCRIPT_PROFILE: a profile from \"profile-script\" that guides\n");
+  printf("  how builds are optimized.");
 }
 
 /**
@@ -114,6 +145,72 @@ static void print_error(Gunderscript * ginst) {
   }
 }
 
+/**
+ * Caches builds of scripts in the directory named by the
+ * GUNDERSCRIPT_CACHE_DIR environment variable, if it is set.
+ */
+static void set_cache_dir(Gunderscript * ginst) {
+  char * dir = getenv(GXSMAIN_CACHE_DIR_ENV);
+
+  if(dir != NULL && dir[0] != '\0') {
+    gunderscript_set_cache_dir(ginst, dir);
+  }
+}
+
+/**
+ * Sets the optimization level of builds to the one named by the
+ * GUNDERSCRIPT_OPT_LEVEL environment variable, if it is set.
+ */
+static void set_opt_level(Gunderscript * ginst) {
+  char * level = getenv(GXSMAIN_OPT_LEVEL_ENV);
+
+  if(level != NULL && level[0] != '\0') {
+    compiler_set_opt_level(gunderscript_compiler(ginst), atoi(level));
+  }
+}
+
+/**
+ * Guides the optimizer with the profile named by the GUNDERSCRIPT_PROFILE
+ * environment variable, if it is set.
+ * returns: true upon success, and false if the profile can't be loaded, in
+ * which case the error has been printed.
+ */
+static bool set_profile(Gunderscript * ginst) {
+  char * fileName = getenv(GXSMAIN_PROFILE_ENV);
+
+  if(fileName != NULL && fileName[0] != '\0'
+     && !gunderscript_set_profile(ginst, fileName)) {
+    print_error(ginst);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Prints the time taken and instructions removed by each optimization pass
+ * if the GUNDERSCRIPT_PASS_STATS environment variable is set.
+ */
+static void print_pass_stats(Gunderscript * ginst) {
+  const PassStats * stats;
+  int numPasses;
+  int i;
+
+  if(getenv(GXSMAIN_PASS_STATS_ENV) == NULL) {
+    return;
+  }
+
+  stats = compiler_pass_stats(gunderscript_compiler(ginst), &numPasses);
+  fprintf(stderr, "%-20s %6s %10s %10s %10s\n", "pass", "runs", "instrs in",
+	  "instrs out", "ms");
+  for(i = 0; i < numPasses; i++) {
+    if(stats[i].name != NULL) {
+      fprintf(stderr, "%-20s %6d %10ld %10ld %10.3f\n", stats[i].name,
+	      stats[i].runs, stats[i].instrsIn, stats[i].instrsOut,
+	      stats[i].seconds * 1000.0);
+    }
+  }
+}
+
 /**
  * Moves the NULL character to remove a program extension, if there is one
  */
@@ -140,6 +237,27 @@ static void remove_suffix(char * str) {
   str[i] = '\0';
 }
 
+/**
+ * Makes the C name of a program compiled with build-c from its script's file
+ * name: gxs_ followed by the file name without directories or extension,
+ * with any character that can't be in a C identifier replaced by _.
+ */
+static void c_symbol_name(char * scriptName, char * symbol, size_t symbolSize) {
+  char * base = strrchr(scriptName, '/');
+  size_t i;
+
+  base = base != NULL ? base + 1 : scriptName;
+  strcpy(symbol, "gxs_");
+  strncat(symbol, base, symbolSize - strlen(symbol) - 1);
+  remove_suffix(symbol);
+
+  for(i = 0; symbol[i] != '\0'; i++) {
+    if(!isalnum((unsigned char)symbol[i])) {
+      symbol[i] = '_';
+    }
+  }
+}
+
 /**
  * Execute the script named the same as this executable
  * TODO: this logic in this whole file is really messy, buuuttt, I'm lazy
@@ -162,11 +280,14 @@ static int execute_associated(Gunderscript * ginst, int argc, char * argv[]) {
     }
 
     /* compile the input script */
+    set_cache_dir(ginst);
+    set_opt_level(ginst);
     if(!gunderscript_build_file(ginst, fileName)) {
       print_error(ginst);
       gunderscript_free(ginst);
       return 1;
     }
+    print_pass_stats(ginst);
 
     /* execute the desired entry point */
     if(!gunderscript_function(ginst, GXSMAIN_DEFAULT_MAIN, strlen(GXSMAIN_DEFAULT_MAIN))) {
@@ -190,8 +311,8 @@ static int execute_associated(Gunderscript * ginst, int argc, char * argv[]) {
 	return 1;
       }
 
-      /* import the compiled code from a BIN file */
-      if(!gunderscript_import_bytecode(ginst, fileName)) {
+      /* import the compiled code from a BIN file, loading functions as they run */
+      if(!gunderscript_import_bytecode_lazy(ginst, fileName)) {
 	print_error(ginst);
 	gunderscript_free(ginst);
 	return 1;
@@ -241,11 +362,17 @@ int main(int argc, char * argv[]) {
     }
 
     /* compile the input script */
+    set_opt_level(&ginst);
+    if(!set_profile(&ginst)) {
+      gunderscript_free(&ginst);
+      return 1;
+    }
     if(!gunderscript_build_file(&ginst, argv[2])) {
       print_error(&ginst);
       gunderscript_free(&ginst);
       return 1;
     }
+    print_pass_stats(&ginst);
 
     /* export the compiled code to a BIN file */
     if(!gunderscript_export_bytecode(&ginst, argv[3])) {
@@ -256,6 +383,94 @@ int main(int argc, char * argv[]) {
     gunderscript_free(&ginst);
     return 0;
 
+  } else if(strcmp(argv[1], GXSMAIN_BUILD_C) == 0) {
+    char symbol[GXSMAIN_MAX_ASSOCIATED_SCRIPT_FN];
+
+    /* initialize gunderscript object */
+    if(!gunderscript_new_full(&ginst, stackSize, callbacksSize)) {
+      print_alloc_error();
+      return 1;
+    }
+
+    /* compile the input script */
+    set_opt_level(&ginst);
+    if(!set_profile(&ginst)) {
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    if(!gunderscript_build_file(&ginst, argv[2])) {
+      print_error(&ginst);
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    print_pass_stats(&ginst);
+
+    /* export the compiled code as a C file */
+    c_symbol_name(argv[2], symbol, GXSMAIN_MAX_ASSOCIATED_SCRIPT_FN);
+    if(!gunderscript_export_c(&ginst, argv[3], symbol)) {
+      print_error(&ginst);
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    gunderscript_free(&ginst);
+    return 0;
+
+  } else if(strcmp(argv[1], GXSMAIN_BUILD_AOT) == 0) {
+    char symbol[GXSMAIN_MAX_ASSOCIATED_SCRIPT_FN];
+
+    /* initialize gunderscript object */
+    if(!gunderscript_new_full(&ginst, stackSize, callbacksSize)) {
+      print_alloc_error();
+      return 1;
+    }
+
+    /* compile the input script */
+    set_opt_level(&ginst);
+    if(!set_profile(&ginst)) {
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    if(!gunderscript_build_file(&ginst, argv[2])) {
+      print_error(&ginst);
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    print_pass_stats(&ginst);
+
+    /* translate the compiled code to C */
+    c_symbol_name(argv[2], symbol, GXSMAIN_MAX_ASSOCIATED_SCRIPT_FN);
+    if(!gunderscript_export_aot(&ginst, argv[3], symbol)) {
+      print_error(&ginst);
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    gunderscript_free(&ginst);
+    return 0;
+
+  } else if(strcmp(argv[1], GXSMAIN_RUN_AOT) == 0) {
+
+    /* initialize gunderscript object */
+    if(!gunderscript_new_vm(&ginst, stackSize, callbacksSize)) {
+      print_alloc_error();
+      return 1;
+    }
+
+    /* load the compiled functions */
+    if(!gunderscript_load_aot(&ginst, argv[3])) {
+      print_error(&ginst);
+      gunderscript_free(&ginst);
+      return 1;
+    }
+
+    /* execute the desired entry point */
+    if(!gunderscript_function(&ginst, argv[2], strlen(argv[2]))) {
+      print_error(&ginst);
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    gunderscript_free(&ginst);
+    return 0;
+
   } else if(strcmp(argv[1], GXSMAIN_RUN_SCRIPT) == 0) {
 
     /* initialize gunderscript object */
@@ -265,11 +480,18 @@ int main(int argc, char * argv[]) {
     }
 
     /* compile the input script */
+    set_cache_dir(&ginst);
+    set_opt_level(&ginst);
+    if(!set_profile(&ginst)) {
+      gunderscript_free(&ginst);
+      return 1;
+    }
     if(!gunderscript_build_file(&ginst, argv[3])) {
       print_error(&ginst);
       gunderscript_free(&ginst);
       return 1;
     }
+    print_pass_stats(&ginst);
 
     /* execute the desired entry point */
     if(!gunderscript_function(&ginst, argv[2], strlen(argv[2]))) {
@@ -280,6 +502,34 @@ int main(int argc, char * argv[]) {
     gunderscript_free(&ginst);
     return 0;
 
+  } else if(strcmp(argv[1], GXSMAIN_PROFILE_SCRIPT) == 0) {
+
+    /* initialize gunderscript object */
+    if(!gunderscript_new_full(&ginst, stackSize, callbacksSize)) {
+      print_alloc_error();
+      return 1;
+    }
+
+    /* profiles refer to the code as it is before it is optimized */
+    compiler_set_opt_level(gunderscript_compiler(&ginst), 0);
+    if(!gunderscript_build_file(&ginst, argv[2])) {
+      print_error(&ginst);
+      gunderscript_free(&ginst);
+      return 1;
+    }
+
+    /* count what the entry point runs, then save the counts */
+    if(!gunderscript_profile_start(&ginst)
+       || !gunderscript_function(&ginst, GXSMAIN_DEFAULT_MAIN,
+				 strlen(GXSMAIN_DEFAULT_MAIN))
+       || !gunderscript_profile_write(&ginst, argv[3])) {
+      print_error(&ginst);
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    gunderscript_free(&ginst);
+    return 0;
+
   } else if(strcmp(argv[1], GXSMAIN_RUN_BYTECODE) == 0) {
 
     /* initialize gunderscript object */
@@ -288,8 +538,8 @@ int main(int argc, char * argv[]) {
       return 1;
     }
 
-    /* import the compiled code from a BIN file */
-    if(!gunderscript_import_bytecode(&ginst, argv[3])) {
+    /* import the compiled code from a BIN file, loading functions as they run */
+    if(!gunderscript_import_bytecode_lazy(&ginst, argv[3])) {
       print_error(&ginst);
       gunderscript_free(&ginst);
       return 1;
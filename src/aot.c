@@ -0,0 +1,661 @@
+/**
+ * aot.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * The ahead of time compiler. Translates verified bytecode into C, one C
+ * function per script function, to be compiled by the system C compiler
+ * into a shared library and loaded with gunderscript_load_aot(). Jumps
+ * become gotos and calls between script functions become direct C calls, so
+ * no time is spent decoding and dispatching instructions. Everything else,
+ * including calls to natives, is done by the same op handlers that the
+ * interpreter uses, so the compiled code behaves exactly as it would when
+ * interpreted.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aot.h"
+#include "verifier.h"
+#include "vmdefs.h"
+#include <string.h>
+#include <assert.h>
+
+/* flags for what is known about each byte of a function's code */
+#define AOT_INSTRUCTION      1   /* the start of an instruction */
+#define AOT_TARGET           2   /* the start of a jumped to instruction */
+#define AOT_INVALID          4   /* an instruction that jumps or calls badly */
+
+/* macros at the head of each translation. verified code gets the same fast
+ * paths as the interpreter's unchecked mode in vm_run(), falling back to the
+ * op handler whenever the operands aren't plain values.
+ */
+static const char * const aotPrelude =
+  "#include \"ophandlers.h\"\n"
+  "#include \"vmdefs.h\"\n"
+  "#include <string.h>\n\n"
+  "#define GXS_TOP (vm->opStk->stack + vm->opStk->size)\n"
+  "#define GXS_HANDLER(i, call) \\\n"
+  "  index = (i); if(!(call)) return false\n"
+  "#define GXS_VAR_PUSH(i, depth, slot) { \\\n"
+  "  char * var = frmstk_var_addr(vm->frmStk, depth, slot); \\\n"
+  "  if(*var != TYPE_LIBDATA) { \\\n"
+  "    GXS_TOP->type = *var; \\\n"
+  "    memcpy(GXS_TOP->data, var + 1, VM_VAR_SIZE); \\\n"
+  "    vm->opStk->size++; \\\n"
+  "  } else { \\\n"
+  "    GXS_HANDLER(i, op_var_push(vm, code, codeLen, &index)); \\\n"
+  "  } }\n"
+  "#define GXS_NUM_PUSH(i) { \\\n"
+  "  GXS_TOP->type = TYPE_NUMBER; \\\n"
+  "  memcpy(GXS_TOP->data, code + (i) + 1, sizeof(double)); \\\n"
+  "  vm->opStk->size++; }\n"
+  "#define GXS_BOOL_PUSH(value) { \\\n"
+  "  bool v = (value); \\\n"
+  "  GXS_TOP->type = TYPE_BOOLEAN; \\\n"
+  "  memcpy(GXS_TOP->data, &v, sizeof(bool)); \\\n"
+  "  vm->opStk->size++; }\n"
+  "#define GXS_NULL_PUSH() { \\\n"
+  "  GXS_TOP->type = TYPE_NULL; \\\n"
+  "  memset(GXS_TOP->data, 0, VM_VAR_SIZE); \\\n"
+  "  vm->opStk->size++; }\n"
+  "#define GXS_POP(i) { \\\n"
+  "  if(GXS_TOP[-1].type != TYPE_LIBDATA) { \\\n"
+  "    vm->opStk->size--; \\\n"
+  "  } else { \\\n"
+  "    GXS_HANDLER(i, op_pop(vm, code, codeLen, &index)); \\\n"
+  "  } }\n"
+  "#define GXS_ARITH(i, op, call) { \\\n"
+  "  TypeStkData * top = GXS_TOP; \\\n"
+  "  double a; \\\n"
+  "  double b; \\\n"
+  "  if(top[-1].type == TYPE_NUMBER && top[-2].type == TYPE_NUMBER) { \\\n"
+  "    memcpy(&a, top[-2].data, sizeof(double)); \\\n"
+  "    memcpy(&b, top[-1].data, sizeof(double)); \\\n"
+  "    a = a op b; \\\n"
+  "    memcpy(top[-2].data, &a, sizeof(double)); \\\n"
+  "    vm->opStk->size--; \\\n"
+  "  } else { \\\n"
+  "    GXS_HANDLER(i, call); \\\n"
+  "  } }\n"
+  "#define GXS_COMPARE(i, op, call) { \\\n"
+  "  TypeStkData * top = GXS_TOP; \\\n"
+  "  double a; \\\n"
+  "  double b; \\\n"
+  "  bool result; \\\n"
+  "  if(top[-1].type == TYPE_NUMBER && top[-2].type == TYPE_NUMBER) { \\\n"
+  "    memcpy(&a, top[-2].data, sizeof(double)); \\\n"
+  "    memcpy(&b, top[-1].data, sizeof(double)); \\\n"
+  "    result = a op b; \\\n"
+  "    top[-2].type = TYPE_BOOLEAN; \\\n"
+  "    memcpy(top[-2].data, &result, sizeof(bool)); \\\n"
+  "    vm->opStk->size--; \\\n"
+  "  } else { \\\n"
+  "    GXS_HANDLER(i, call); \\\n"
+  "  } }\n"
+  "#define GXS_NUM_ARITH(op) { \\\n"
+  "  TypeStkData * top = GXS_TOP; \\\n"
+  "  double a; \\\n"
+  "  double b; \\\n"
+  "  memcpy(&a, top[-2].data, sizeof(double)); \\\n"
+  "  memcpy(&b, top[-1].data, sizeof(double)); \\\n"
+  "  a = a op b; \\\n"
+  "  top[-2].type = TYPE_NUMBER; \\\n"
+  "  memcpy(top[-2].data, &a, sizeof(double)); \\\n"
+  "  vm->opStk->size--; }\n"
+  "#define GXS_NUM_COMPARE(op) { \\\n"
+  "  TypeStkData * top = GXS_TOP; \\\n"
+  "  double a; \\\n"
+  "  double b; \\\n"
+  "  bool result; \\\n"
+  "  memcpy(&a, top[-2].data, sizeof(double)); \\\n"
+  "  memcpy(&b, top[-1].data, sizeof(double)); \\\n"
+  "  result = a op b; \\\n"
+  "  top[-2].type = TYPE_BOOLEAN; \\\n"
+  "  memcpy(top[-2].data, &result, sizeof(bool)); \\\n"
+  "  vm->opStk->size--; }\n"
+  "#define GXS_NUM_STOR(depth, slot) { \\\n"
+  "  char * var = frmstk_var_addr(vm->frmStk, depth, slot); \\\n"
+  "  *var = TYPE_NUMBER; \\\n"
+  "  memcpy(var + 1, GXS_TOP[-1].data, VM_VAR_SIZE); }\n"
+  "#define GXS_FOR_STEP_TO(i, var, op, limit, target) { \\\n"
+  "  double a; \\\n"
+  "  double b; \\\n"
+  "  memcpy(&a, var + 1, sizeof(double)); \\\n"
+  "  memcpy(&b, code + (i) + 4, sizeof(double)); \\\n"
+  "  a += b; \\\n"
+  "  memcpy(var + 1, &a, sizeof(double)); \\\n"
+  "  memcpy(&b, limit, sizeof(double)); \\\n"
+  "  if(a op b) goto L##target; }\n"
+  "#define GXS_FOR_STEP(i, depth, slot, op, limitDepth, limitSlot, target, \\\n"
+  "                     call) { \\\n"
+  "  char * var = frmstk_var_addr(vm->frmStk, depth, slot); \\\n"
+  "  char * lim = frmstk_var_addr(vm->frmStk, limitDepth, limitSlot); \\\n"
+  "  if(*var == TYPE_NUMBER && *lim == TYPE_NUMBER) { \\\n"
+  "    GXS_FOR_STEP_TO(i, var, op, lim + 1, target); \\\n"
+  "  } else { \\\n"
+  "    GXS_HANDLER(i, call); \\\n"
+  "    if(index == (target)) goto L##target; \\\n"
+  "  } }\n"
+  "#define GXS_FOR_STEP_NUM(i, depth, slot, op, target, call) { \\\n"
+  "  char * var = frmstk_var_addr(vm->frmStk, depth, slot); \\\n"
+  "  if(*var == TYPE_NUMBER) { \\\n"
+  "    GXS_FOR_STEP_TO(i, var, op, code + (i) + 4 + sizeof(double), \\\n"
+  "                    target); \\\n"
+  "  } else { \\\n"
+  "    GXS_HANDLER(i, call); \\\n"
+  "    if(index == (target)) goto L##target; \\\n"
+  "  } }\n"
+  "#define GXS_COND_GOTO(i, jumpOn, target, call) { \\\n"
+  "  TypeStkData * top = GXS_TOP; \\\n"
+  "  bool value; \\\n"
+  "  if(top[-1].type == TYPE_BOOLEAN) { \\\n"
+  "    memcpy(&value, top[-1].data, sizeof(bool)); \\\n"
+  "    vm->opStk->size--; \\\n"
+  "    if((value != 0) == (jumpOn)) goto L##target; \\\n"
+  "  } else { \\\n"
+  "    GXS_HANDLER(i, call); \\\n"
+  "    if(index == (target)) goto L##target; \\\n"
+  "  } }\n";
+
+/**
+ * Gets the C call of the op handler that runs an instruction which needs
+ * nothing more than its handler.
+ * opCode: the instruction's opcode.
+ * returns: the call, or NULL if the instruction needs more than a handler.
+ */
+static const char * aot_handler(char opCode) {
+  switch(opCode) {
+  case OP_VAR_PUSH:
+    return "op_var_push(vm, code, codeLen, &index)";
+  case OP_VAR_STOR:
+    return "op_var_stor(vm, code, codeLen, &index)";
+  case OP_FRM_PUSH:
+    return "op_frame_push(vm, code, codeLen, &index, false)";
+  case OP_ADD:
+    return "op_add(vm, code, codeLen, &index)";
+  case OP_SUB:
+    return "op_dual_operand_math(vm, code, codeLen, &index, OP_SUB)";
+  case OP_MUL:
+    return "op_dual_operand_math(vm, code, codeLen, &index, OP_MUL)";
+  case OP_DIV:
+    return "op_dual_operand_math(vm, code, codeLen, &index, OP_DIV)";
+  case OP_MOD:
+    return "op_dual_operand_math(vm, code, codeLen, &index, OP_MOD)";
+  case OP_LT:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_LT)";
+  case OP_GT:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_GT)";
+  case OP_LTE:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_LTE)";
+  case OP_GTE:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_GTE)";
+  case OP_EQUALS:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_EQUALS)";
+  case OP_NOT_EQUALS:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_NOT_EQUALS)";
+  case OP_AND:
+    return "op_boolean_logic(vm, code, codeLen, &index, OP_AND)";
+  case OP_OR:
+    return "op_boolean_logic(vm, code, codeLen, &index, OP_OR)";
+  case OP_BOOL_PUSH:
+    return "op_bool_push(vm, code, codeLen, &index)";
+  case OP_NUM_PUSH:
+    return "op_num_push(vm, code, codeLen, &index)";
+  case OP_STR_PUSH:
+    return "op_str_push(vm, code, codeLen, &index)";
+  case OP_CALL_PTR_N:
+    return "op_call_ptr_n(vm, code, codeLen, &index)";
+  case OP_NOT:
+    return "op_not(vm, code, codeLen, &index)";
+  case OP_POP:
+    return "op_pop(vm, code, codeLen, &index)";
+  case OP_NULL_PUSH:
+    return "op_null_push(vm, code, codeLen, &index)";
+  case OP_NUM_ADD:
+    return "op_dual_operand_math(vm, code, codeLen, &index, OP_NUM_ADD)";
+  case OP_NUM_SUB:
+    return "op_dual_operand_math(vm, code, codeLen, &index, OP_NUM_SUB)";
+  case OP_NUM_MUL:
+    return "op_dual_operand_math(vm, code, codeLen, &index, OP_NUM_MUL)";
+  case OP_NUM_DIV:
+    return "op_dual_operand_math(vm, code, codeLen, &index, OP_NUM_DIV)";
+  case OP_NUM_MOD:
+    return "op_dual_operand_math(vm, code, codeLen, &index, OP_NUM_MOD)";
+  case OP_NUM_LT:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_NUM_LT)";
+  case OP_NUM_GT:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_NUM_GT)";
+  case OP_NUM_LTE:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_NUM_LTE)";
+  case OP_NUM_GTE:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_NUM_GTE)";
+  case OP_NUM_EQUALS:
+    return "op_dual_comparison(vm, code, codeLen, &index, OP_NUM_EQUALS)";
+  case OP_NUM_NOT_EQUALS:
+    return "op_dual_comparison(vm, code, codeLen, &index, "
+      "OP_NUM_NOT_EQUALS)";
+  case OP_NUM_STOR:
+    return "op_var_stor(vm, code, codeLen, &index)";
+  case OP_FOR_STEP:
+    return "op_for_step(vm, code, codeLen, &index, false)";
+  case OP_FOR_STEP_NUM:
+    return "op_for_step(vm, code, codeLen, &index, true)";
+  case OP_SWITCH_NUM:
+    return "op_switch_num(vm, code, codeLen, &index)";
+  default:
+    return NULL;
+  }
+}
+
+/**
+ * Gets the C operator of an arithmetic or comparison opcode.
+ * opCode: the opcode.
+ * returns: the operator.
+ */
+static const char * aot_operator(char opCode) {
+  switch(opCode) {
+  case OP_ADD:
+  case OP_NUM_ADD:
+    return "+";
+  case OP_SUB:
+  case OP_NUM_SUB:
+    return "-";
+  case OP_MUL:
+  case OP_NUM_MUL:
+    return "*";
+  case OP_LT:
+  case OP_NUM_LT:
+    return "<";
+  case OP_GT:
+  case OP_NUM_GT:
+    return ">";
+  case OP_LTE:
+  case OP_NUM_LTE:
+    return "<=";
+  case OP_NUM_EQUALS:
+    return "==";
+  case OP_NUM_NOT_EQUALS:
+    return "!=";
+  default:
+    return ">=";
+  }
+}
+
+/**
+ * Finds the function that starts at the given index.
+ * functions: the function table, sorted by index.
+ * numFunctions: the number of functions.
+ * index: the index.
+ * returns: the function, or NULL if no function starts there.
+ */
+static GSByteCodeFunc * aot_function_at(GSByteCodeFunc * functions,
+					int numFunctions, int index) {
+  int low = 0;
+  int high = numFunctions - 1;
+
+  while(low <= high) {
+    int mid = (low + high) / 2;
+
+    if(functions[mid].index == index) {
+      return &functions[mid];
+    } else if(functions[mid].index < index) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Writes the C translation of an OP_SWITCH_NUM. The handler picks the
+ * OP_GOTO of the table, and a C switch goes to its target.
+ * outFile: the file.
+ * code: the program's code.
+ * index: the instruction.
+ * len: the length of the instruction.
+ * handler: the call to the instruction's handler.
+ * returns: true upon success, and false if the write fails.
+ */
+static bool aot_write_switch(FILE * outFile, char * code, int index, int len,
+			     const char * handler) {
+  int count;
+  int i;
+
+  memcpy(&count, code + index + 3 + sizeof(double), sizeof(int));
+  if(fprintf(outFile, "  GXS_HANDLER(%d, %s);\n  switch(index) {\n", index,
+	     handler) < 0) {
+    return false;
+  }
+  for(i = 0; i <= count; i++) {
+    int entry = index + len + (i * (1 + sizeof(int)));
+    int target;
+
+    memcpy(&target, code + entry + 1, sizeof(int));
+    if(fprintf(outFile, "  case %d: goto L%d;\n", entry, target) < 0) {
+      return false;
+    }
+  }
+  return fprintf(outFile, "  }\n") >= 0;
+}
+
+/**
+ * Writes the C translation of one instruction.
+ * outFile: the file.
+ * symbolName: the C name of the program.
+ * code: the program's code.
+ * index: the instruction.
+ * len: the length of the instruction.
+ * kind: the AOT_* flags of each byte of the function, starting at start.
+ * start: the index of the start of the function.
+ * functions: the function table, sorted by index.
+ * numFunctions: the number of functions.
+ * returns: true upon success, and false if the write fails.
+ */
+static bool aot_write_instruction(FILE * outFile, char * symbolName,
+				  char * code, int index, int len, char * kind,
+				  int start, GSByteCodeFunc * functions,
+				  int numFunctions) {
+  const char * handler = aot_handler(code[index]);
+  int target = 0;
+
+  if((kind[index - start] & AOT_TARGET)
+     && fprintf(outFile, " L%d:\n", index) < 0) {
+    return false;
+  }
+
+  if(kind[index - start] & AOT_INVALID) {
+    return fprintf(outFile, "  vm_set_err(vm, VMERR_INVALID_ADDR); "
+		   "return false;\n") >= 0;
+  }
+
+  if(len >= 1 + sizeof(int)) {
+    memcpy(&target, code + index + len - sizeof(int), sizeof(int));
+  }
+
+  switch(code[index]) {
+  case OP_VAR_PUSH:
+    return fprintf(outFile, "  GXS_VAR_PUSH(%d, %d, %d);\n", index,
+		   code[index + 1], code[index + 2]) >= 0;
+  case OP_NUM_PUSH:
+    return fprintf(outFile, "  GXS_NUM_PUSH(%d);\n", index) >= 0;
+  case OP_BOOL_PUSH:
+    return fprintf(outFile, "  GXS_BOOL_PUSH(%d);\n", code[index + 1]) >= 0;
+  case OP_NULL_PUSH:
+    return fprintf(outFile, "  GXS_NULL_PUSH();\n") >= 0;
+  case OP_POP:
+    return fprintf(outFile, "  GXS_POP(%d);\n", index) >= 0;
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+    return fprintf(outFile, "  GXS_ARITH(%d, %s, %s);\n", index,
+		   aot_operator(code[index]), handler) >= 0;
+  case OP_LT:
+  case OP_GT:
+  case OP_LTE:
+  case OP_GTE:
+    return fprintf(outFile, "  GXS_COMPARE(%d, %s, %s);\n", index,
+		   aot_operator(code[index]), handler) >= 0;
+  case OP_NUM_ADD:
+  case OP_NUM_SUB:
+  case OP_NUM_MUL:
+    return fprintf(outFile, "  GXS_NUM_ARITH(%s);\n",
+		   aot_operator(code[index])) >= 0;
+  case OP_NUM_LT:
+  case OP_NUM_GT:
+  case OP_NUM_LTE:
+  case OP_NUM_GTE:
+  case OP_NUM_EQUALS:
+  case OP_NUM_NOT_EQUALS:
+    return fprintf(outFile, "  GXS_NUM_COMPARE(%s);\n",
+		   aot_operator(code[index])) >= 0;
+  case OP_NUM_STOR:
+    return fprintf(outFile, "  GXS_NUM_STOR(%d, %d);\n", code[index + 1],
+		   code[index + 2]) >= 0;
+  case OP_FOR_STEP:
+    return fprintf(outFile, "  GXS_FOR_STEP(%d, %d, %d, %s, %d, %d, %d, "
+		   "%s);\n", index, code[index + 1], code[index + 2],
+		   aot_operator(code[index + 3]),
+		   code[index + 4 + sizeof(double)],
+		   code[index + 5 + sizeof(double)], target, handler) >= 0;
+  case OP_FOR_STEP_NUM:
+    return fprintf(outFile, "  GXS_FOR_STEP_NUM(%d, %d, %d, %s, %d, %s);\n",
+		   index, code[index + 1], code[index + 2],
+		   aot_operator(code[index + 3]), target, handler) >= 0;
+  case OP_SWITCH_NUM:
+    return aot_write_switch(outFile, code, index, len, handler);
+  case OP_GOTO:
+    return fprintf(outFile, "  goto L%d;\n", target) >= 0;
+  case OP_TCOND_GOTO:
+  case OP_FCOND_GOTO:
+    return fprintf(outFile, "  GXS_COND_GOTO(%d, %d, %d, op_cond_goto(vm, code, "
+		   "codeLen, &index, %s));\n", index,
+		   code[index] == OP_TCOND_GOTO, target,
+		   code[index] == OP_FCOND_GOTO ? "true" : "false") >= 0;
+  case OP_CALL_B:
+    return fprintf(outFile, "  index = %d; if(!op_frame_push(vm, code, codeLen, "
+		   "&index, true) || !%s_f%d(vm)) return false;\n",
+		   index, symbolName, target) >= 0;
+  case OP_FRM_POP:
+    return fprintf(outFile, "  index = %d; if(!op_frame_pop(vm, code, codeLen, "
+		   "&index, false)) return false;\n"
+		   "  if(frmstk_size(vm->frmStk) < base) return true;\n",
+		   index) >= 0;
+  case OP_RETURN:
+    return fprintf(outFile, "  index = %d; return op_frame_pop(vm, code, "
+		   "codeLen, &index, true);\n", index) >= 0;
+  default:
+    if(handler != NULL) {
+      return fprintf(outFile, "  GXS_HANDLER(%d, %s);\n", index,
+		     handler) >= 0;
+    }
+    return fprintf(outFile, "  vm_set_err(vm, VMERR_INVALID_OPCODE); "
+		   "return false;\n") >= 0;
+  }
+}
+
+/**
+ * Finds the instructions of a function and the ones that are jumped to.
+ * Instructions whose jumps or calls don't land where they should are marked
+ * invalid, so that they fail when run. Verified code has none of those, but
+ * the code that the verifier found unreachable is translated too.
+ * code: the program's code.
+ * codeLen: the length of code.
+ * function: the function.
+ * kind: receives the AOT_* flags of each byte of the function.
+ * functions: the function table, sorted by index.
+ * numFunctions: the number of functions.
+ */
+static void aot_find_targets(char * code, size_t codeLen,
+			     GSByteCodeFunc * function, char * kind,
+			     GSByteCodeFunc * functions, int numFunctions) {
+  int start = function->index;
+  int end = function->index + function->codeLen;
+  int i;
+  int len;
+
+  for(i = start; i < end; i += len) {
+    len = verifier_op_len(code, codeLen, i);
+    if(len < 1 || i + len > end) {
+      break;
+    }
+    kind[i - start] |= AOT_INSTRUCTION;
+  }
+
+  for(i = start; i < end; i += len) {
+    int target;
+
+    len = verifier_op_len(code, codeLen, i);
+    if(len < 1 || i + len > end) {
+      break;
+    }
+
+    /* the OP_GOTOs of a switch's table must follow it and jump within the
+     * function.
+     */
+    if(code[i] == OP_SWITCH_NUM) {
+      int count;
+      int j;
+
+      memcpy(&count, code + i + 3 + sizeof(double), sizeof(int));
+      for(j = 0; count >= 0 && j <= count; j++) {
+	int entry = i + len + (j * (1 + sizeof(int)));
+
+	if(entry >= end || !(kind[entry - start] & AOT_INSTRUCTION)
+	   || code[entry] != OP_GOTO) {
+	  break;
+	}
+	memcpy(&target, code + entry + 1, sizeof(int));
+	if(target < start || target >= end
+	   || !(kind[target - start] & AOT_INSTRUCTION)) {
+	  break;
+	}
+      }
+      if(count < 0 || j <= count) {
+	kind[i - start] |= AOT_INVALID;
+      }
+      continue;
+    }
+    if(code[i] != OP_GOTO && code[i] != OP_TCOND_GOTO
+       && code[i] != OP_FCOND_GOTO && code[i] != OP_FOR_STEP
+       && code[i] != OP_FOR_STEP_NUM && code[i] != OP_CALL_B) {
+      continue;
+    }
+
+    memcpy(&target, code + i + len - sizeof(int), sizeof(int));
+    if(code[i] == OP_CALL_B) {
+      if(aot_function_at(functions, numFunctions, target) == NULL) {
+	kind[i - start] |= AOT_INVALID;
+      }
+    } else if(target < start || target >= end
+	      || !(kind[target - start] & AOT_INSTRUCTION)) {
+      kind[i - start] |= AOT_INVALID;
+    } else {
+      kind[target - start] |= AOT_TARGET;
+    }
+  }
+}
+
+/**
+ * Writes one function's C translation.
+ * outFile: the file.
+ * symbolName: the C name of the program.
+ * code: the program's code.
+ * codeLen: the length of code.
+ * maxStack: the deepest stack of any function, from the verifier.
+ * function: the function.
+ * functions: the function table, sorted by index.
+ * numFunctions: the number of functions.
+ * returns: true upon success, and false if the write or allocation fails.
+ */
+static bool aot_write_function(FILE * outFile, char * symbolName, char * code,
+			       size_t codeLen, int maxStack,
+			       GSByteCodeFunc * function,
+			       GSByteCodeFunc * functions, int numFunctions) {
+  char * kind = calloc(function->codeLen, sizeof(char));
+  int end = function->index + function->codeLen;
+  int i;
+  int len;
+  bool success;
+
+  if(kind == NULL) {
+    return false;
+  }
+
+  aot_find_targets(code, codeLen, function, kind, functions, numFunctions);
+
+  /* the function's frame is pushed by its caller. the function ends when
+   * that frame is popped.
+   */
+  success = fprintf(outFile, "\nstatic bool %s_f%d(VM * vm) {\n"
+		    "  char * code = (char*)%s_code;\n"
+		    "  size_t codeLen = sizeof(%s_code);\n"
+		    "  int base = frmstk_size(vm->frmStk);\n"
+		    "  int index;\n\n"
+		    "  /* room for the deepest stack of any function */\n"
+		    "  if(!typestk_reserve(vm->opStk, %d)) {\n"
+		    "    vm_set_err(vm, VMERR_ALLOC_FAILED);\n"
+		    "    return false;\n"
+		    "  }\n\n", symbolName, function->index,
+		    symbolName, symbolName, maxStack) >= 0;
+
+  for(i = function->index; success && i < end; i += len) {
+    len = verifier_op_len(code, codeLen, i);
+    if(len < 1 || i + len > end) {
+      break;
+    }
+    success = aot_write_instruction(outFile, symbolName, code, i, len, kind,
+				    function->index, functions, numFunctions);
+  }
+
+  success = success
+    && fprintf(outFile, "  vm_set_err(vm, VMERR_UNEXPECTED_END_OF_OPCODES);\n"
+	       "  return false;\n}\n") >= 0;
+
+  free(kind);
+  return success;
+}
+
+/**
+ * Writes the C translation of every function of a program, for a file that
+ * already holds the program written by gunderscript_export_c(), and a table
+ * of them named symbolName_compiled in function table order.
+ * vm: the VM that the program's code was verified in.
+ * code: the program's code.
+ * codeLen: the length of code.
+ * outFile: the file.
+ * symbolName: the C name of the program.
+ * functions: the function table, sorted by index.
+ * numFunctions: the number of functions.
+ * returns: true upon success, and false if the write or allocation fails.
+ */
+bool aot_write_functions(VM * vm, char * code, size_t codeLen,
+			 FILE * outFile, char * symbolName,
+			 GSByteCodeFunc * functions, int numFunctions) {
+  int i;
+  bool success;
+
+  assert(vm != NULL);
+  assert(code != NULL);
+  assert(outFile != NULL);
+  assert(functions != NULL);
+
+  /* declarations, since functions may call each other in any order */
+  success = fprintf(outFile, "\n%s\n", aotPrelude) >= 0;
+  for(i = 0; success && i < numFunctions; i++) {
+    success = fprintf(outFile, "static bool %s_f%d(VM * vm);\n", symbolName,
+		      functions[i].index) >= 0;
+  }
+
+  for(i = 0; success && i < numFunctions; i++) {
+    success = aot_write_function(outFile, symbolName, code, codeLen,
+				 vm->maxStack, &functions[i], functions,
+				 numFunctions);
+  }
+
+  /* the table of compiled functions */
+  success = success
+    && fprintf(outFile, "\nstatic const VMCompiledFunc %s_compiled[] = {\n",
+	       symbolName) >= 0;
+  for(i = 0; success && i < numFunctions; i++) {
+    success = fprintf(outFile, "  %s_f%d,\n", symbolName,
+		      functions[i].index) >= 0;
+  }
+  return success && fprintf(outFile, "};\n") >= 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * arena.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * An arena allocator. Allocations are carved from large blocks by bumping an
+ * offset and are never freed one at a time. Instead, the whole arena is reset
+ * or freed at once, which makes memory that lives as long as some task, such
+ * as a build, cheap to allocate and to tear down.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "arena.h"
+
+/* allocations are aligned for any of the types that are stored in them */
+#define ARENA_ALIGN  sizeof(double)
+
+/* rounds a size up to the alignment of allocations */
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/* bytes taken by the header at the start of each block */
+#define ARENA_HEADER ARENA_ROUND(sizeof(ArenaBlock))
+
+/**
+ * Creates a new arena. No memory is allocated for it until the first call to
+ * arena_alloc().
+ * blockSize: the number of bytes in each block of the arena. Allocations
+ * larger than this get a block of their own.
+ * returns: the new arena, or NULL if the allocation fails.
+ */
+Arena * arena_new(size_t blockSize) {
+  Arena * arena;
+
+  assert(blockSize > 0);
+
+  arena = calloc(1, sizeof(Arena));
+  if(arena == NULL) {
+    return NULL;
+  }
+
+  arena->blockSize = blockSize;
+  return arena;
+}
+
+/**
+ * Allocates memory from an arena. The memory is not initialized, and stays
+ * allocated until the arena is reset or freed.
+ * arena: an instance of arena.
+ * size: the number of bytes to allocate.
+ * returns: the memory, aligned for any type, or NULL if the allocation fails.
+ */
+void * arena_alloc(Arena * arena, size_t size) {
+  ArenaBlock * block;
+
+  assert(arena != NULL);
+
+  block = arena->blocks;
+  size = ARENA_ROUND(size);
+
+  /* out of room in the newest block, start a new one */
+  if(block == NULL || block->size - block->used < size) {
+    size_t blockSize = size > arena->blockSize ? size : arena->blockSize;
+
+    block = malloc(ARENA_HEADER + blockSize);
+    if(block == NULL) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    block->size = blockSize;
+    block->used = 0;
+    arena->blocks = block;
+  }
+
+  block->used += size;
+  return (char*)block + ARENA_HEADER + block->used - size;
+}
+
+/**
+ * Resizes memory allocated from an arena. The newest allocation grows in place
+ * when its block has room, anything else is copied to a new allocation and
+ * the old memory is not reused until the arena is reset.
+ * arena: an instance of arena.
+ * memory: memory from arena_alloc(), or NULL to allocate new memory.
+ * size: the number of bytes that were allocated for memory.
+ * newSize: the number of bytes to resize it to, which is at least size.
+ * returns: the resized memory, or NULL if the allocation fails, in which case
+ * memory is unchanged.
+ */
+void * arena_realloc(Arena * arena, void * memory, size_t size,
+		     size_t newSize) {
+  ArenaBlock * block;
+  void * newMemory;
+
+  assert(arena != NULL);
+  assert(newSize >= size);
+
+  block = arena->blocks;
+  size = ARENA_ROUND(size);
+  newSize = ARENA_ROUND(newSize);
+
+  /* the newest allocation is at the end of the newest block */
+  if(memory != NULL
+     && (char*)memory + size == (char*)block + ARENA_HEADER + block->used
+     && block->size - block->used >= newSize - size) {
+    block->used += newSize - size;
+    return memory;
+  }
+
+  newMemory = arena_alloc(arena, newSize);
+  if(newMemory != NULL && memory != NULL) {
+    memcpy(newMemory, memory, size);
+  }
+
+  return newMemory;
+}
+
+/**
+ * Copies a string into an arena.
+ * arena: an instance of arena.
+ * string: the string, which need not be null terminated.
+ * len: the number of chars to copy.
+ * returns: the null terminated copy, or NULL if the allocation fails.
+ */
+char * arena_strndup(Arena * arena, char * string, size_t len) {
+  char * copy = arena_alloc(arena, len + 1);
+
+  if(copy == NULL) {
+    return NULL;
+  }
+
+  memcpy(copy, string, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+/**
+ * Frees every allocation from an arena at once. The first block that was
+ * allocated is kept to be reused by the next allocations.
+ * arena: an instance of arena.
+ */
+void arena_reset(Arena * arena) {
+  assert(arena != NULL);
+
+  while(arena->blocks != NULL && arena->blocks->next != NULL) {
+    ArenaBlock * next = arena->blocks->next;
+
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+
+  if(arena->blocks != NULL) {
+    arena->blocks->used = 0;
+  }
+}
+
+/**
+ * Frees an arena and all memory that was allocated from it.
+ * arena: an instance of arena.
+ */
+void arena_free(Arena * arena) {
+  assert(arena != NULL);
+
+  while(arena->blocks != NULL) {
+    ArenaBlock * next = arena->blocks->next;
+
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+
+  free(arena);
+}
@@ -83,6 +83,20 @@ bool buffer_resize(Buffer * buffer, int newSize) {
   return true;
 }
 
+/**
+ * Throws away the contents of the buffer past the given size.
+ * buffer: an instance of buffer.
+ * size: the new size of the contents in chars. Must not be more than the
+ * current size.
+ */
+void buffer_truncate(Buffer * buffer, int size) {
+  assert(buffer != NULL);
+  assert(size >= 0 && size <= buffer->index);
+
+  buffer->index = size;
+  buffer->buffer[size] = '\0';
+}
+
 /**
  * Appends a char to the end of the end-most character in the buffer.
  * buffer: an instance of buffer.
@@ -0,0 +1,255 @@
+/**
+ * buildcache.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Keys for the on-disk cache of compiled scripts. A key is a hash of
+ * everything that the compiled code depends on: the text of a script and of
+ * every script that it depends on, the runtime that compiles it, its
+ * optimization level and profile, and the native functions that its calls
+ * are bound to.
+ * Any change to any of them gives a different key, so cached builds never
+ * need to be invalidated.
+ * Finding the dependencies only takes a scan of the "depends" statements at
+ * the head of each script, which is much cheaper than compiling them.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "buildcache.h"
+#include "vmregistry.h"
+#include "compiler.h"
+#include "lexer.h"
+#include "langkeywords.h"
+#include "gunderscript.h"
+#include "set.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+/* 64 bit FNV-1a parameters */
+#define BUILDCACHE_FNV_BASIS   UINT64_C(14695981039346656037)
+#define BUILDCACHE_FNV_PRIME   UINT64_C(1099511628211)
+
+/* state of a key computation */
+typedef struct BuildCacheKey {
+  uint64_t hash;
+  Set * visited;                  /* scripts that have been hashed */
+  Buffer * files;                 /* receives the name of each script */
+} BuildCacheKey;
+
+/**
+ * Adds bytes to a hash with FNV-1a.
+ * hash: the hash so far.
+ * data: the bytes.
+ * len: the number of bytes.
+ * returns: the new hash.
+ */
+static uint64_t buildcache_hash(uint64_t hash, void * data, size_t len) {
+  unsigned char * bytes = data;
+  size_t i;
+
+  for(i = 0; i < len; i++) {
+    hash = (hash ^ bytes[i]) * BUILDCACHE_FNV_PRIME;
+  }
+  return hash;
+}
+
+/**
+ * Adds a length prefixed string to a hash, so that the boundaries between
+ * strings are part of the hash.
+ * hash: the hash so far.
+ * string: the string.
+ * len: the length of string.
+ * returns: the new hash.
+ */
+static uint64_t buildcache_hash_string(uint64_t hash, char * string,
+				       size_t len) {
+  hash = buildcache_hash(hash, &len, sizeof(size_t));
+  return buildcache_hash(hash, string, len);
+}
+
+/**
+ * Adds a script and, before its own code, each script that it depends on to
+ * the key. Scripts are hashed once each, in the order that the compiler
+ * would build them.
+ * k: the key.
+ * fileName: the script.
+ * returns: true upon success, and false if a script can't be read or
+ * allocation fails.
+ */
+static bool buildcache_hash_file(BuildCacheKey * k, char * fileName) {
+  Lexer * lexer;
+  LexerType type;
+  char * text;
+  char * token;
+  size_t textLen = 0;
+  size_t len;
+  bool prevExists;
+  bool success = true;
+
+  /* the compiler builds each file once */
+  if(!set_add(k->visited, fileName, strlen(fileName), &prevExists)) {
+    return false;
+  }
+  if(prevExists) {
+    return true;
+  }
+
+  text = compiler_file_to_string(fileName, &textLen);
+  if(text == NULL) {
+    return false;
+  }
+
+  /* hash the script by name, since that is how dependencies refer to it */
+  k->hash = buildcache_hash_string(k->hash, fileName, strlen(fileName));
+  k->hash = buildcache_hash_string(k->hash, text, textLen);
+  if(!buffer_append_string(k->files, fileName, strlen(fileName) + 1)) {
+    free(text);
+    return false;
+  }
+
+  /* follow the depends statements at the head of the script. malformed ones
+   * are left for the compiler to report.
+   */
+  lexer = textLen > 0 ? lexer_new(text, textLen) : NULL;
+  token = lexer != NULL ? lexer_next(lexer, &type, &len) : NULL;
+  while(success && token != NULL
+	&& tokens_equal(token, len, LANG_DEPENDS, LANG_DEPENDS_LEN)) {
+    char * dependency;
+
+    token = lexer_next(lexer, &type, &len);
+    if(token == NULL || type != LEXERTYPE_STRING) {
+      break;
+    }
+
+    dependency = calloc(len + 1, sizeof(char));
+    if(dependency == NULL) {
+      success = false;
+      break;
+    }
+    strncpy(dependency, token, len);
+    success = buildcache_hash_file(k, dependency);
+    free(dependency);
+
+    lexer_next(lexer, &type, &len);
+    token = lexer_next(lexer, &type, &len);
+  }
+
+  if(lexer != NULL) {
+    lexer_free(lexer);
+  }
+  free(text);
+
+  return success;
+}
+
+/**
+ * Adds the native functions that compiled calls are bound to, and their
+ * indices, to the key.
+ * k: the key.
+ * vm: the VM that the scripts are compiled for.
+ */
+static void buildcache_hash_natives(BuildCacheKey * k, VM * vm) {
+  uint64_t overlay = 0;
+  int i;
+
+  /* shared natives, in index order */
+  if(vm->registry != NULL) {
+    for(i = 0; i < vm->registry->numNatives; i++) {
+      k->hash = buildcache_hash_string(k->hash, vm->registry->natives[i].name,
+				       vm->registry->natives[i].nameLen);
+    }
+  }
+
+  /* the instance's own natives, which are kept in no particular order. each
+   * one is hashed on its own and the hashes are summed.
+   */
+  if(vm->callbacksHT != NULL) {
+    HTIter iter;
+
+    ht_iter_get(vm->callbacksHT, &iter);
+    while(ht_iter_has_next(&iter)) {
+      char name[GS_MAX_FUNCTION_NAME_LEN];
+      size_t nameLen;
+      DSValue value;
+      uint64_t hash;
+
+      ht_iter_next(&iter, name, GS_MAX_FUNCTION_NAME_LEN, &value,
+		   &nameLen, false);
+      if(nameLen > GS_MAX_FUNCTION_NAME_LEN) {
+	nameLen = GS_MAX_FUNCTION_NAME_LEN;
+      }
+      hash = buildcache_hash_string(BUILDCACHE_FNV_BASIS, name, nameLen);
+      overlay += buildcache_hash(hash, &value.intVal, sizeof(value.intVal));
+    }
+  }
+  k->hash = buildcache_hash(k->hash, &overlay, sizeof(uint64_t));
+}
+
+/**
+ * Computes the cache key of a build of a script and its dependencies.
+ * vm: the VM that the script is compiled for.
+ * fileName: the script.
+ * optLevel: the optimization level that it is compiled at.
+ * profile: the profile that guides the optimizer, or NULL.
+ * key: receives the key as BUILDCACHE_KEY_LEN hex digits and a NULL
+ * terminator.
+ * files: receives the name of the script and of each of its dependencies,
+ * each NULL terminated.
+ * returns: true upon success, and false if a script can't be read or
+ * allocation fails, in which case the script can't be cached.
+ */
+bool buildcache_key(VM * vm, char * fileName, int optLevel,
+		    Profile * profile, char * key, Buffer * files) {
+  BuildCacheKey k;
+  int version = GS_BYTECODE_VERSION;
+  bool success;
+
+  assert(vm != NULL);
+  assert(fileName != NULL);
+  assert(key != NULL);
+  assert(files != NULL);
+
+  k.hash = BUILDCACHE_FNV_BASIS;
+  k.files = files;
+  k.visited = set_new();
+  if(k.visited == NULL) {
+    return false;
+  }
+
+  /* the runtime that compiles the scripts */
+  k.hash = buildcache_hash_string(k.hash, GUNDERSCRIPT_BUILD_DATE,
+				  strlen(GUNDERSCRIPT_BUILD_DATE));
+  k.hash = buildcache_hash(k.hash, &version, sizeof(int));
+  k.hash = buildcache_hash(k.hash, &optLevel, sizeof(int));
+  if(profile != NULL) {
+    k.hash = buildcache_hash(k.hash, profile->text, profile->textLen);
+  }
+  success = buildcache_hash_file(&k, fileName);
+  buildcache_hash_natives(&k, vm);
+
+  if(success) {
+    unsigned long high = (unsigned long)(k.hash >> 32);
+    unsigned long low = (unsigned long)(k.hash & 0xFFFFFFFFUL);
+    sprintf(key, "%08lx%08lx", high, low);
+  }
+
+  set_free(k.visited);
+  return success;
+}
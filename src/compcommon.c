@@ -26,6 +26,8 @@
 #include "lexer.h"
 #include "langkeywords.h"
 #include <assert.h>
+#include <string.h>
+#include <limits.h>
 
 /**
  * Gets the OP code associated with an operation from its string representation.
@@ -87,26 +89,6 @@ bool tokens_equal(char * token1, size_t num1,
   return false;
 }
 
-/**
- * Gets the top symbol table from the symbol table stack and returns a pointer,
- * without actually removing the table from the stack. This function is useful
- * for getting a reference to the current frame's symbol table so that you can
- * look up its symbols.
- * c: an instance of Compiler.
- * returns: a pointer to the top symbol table hashtable, or NULL if the stack
- * is empty.
- */
-HT * symtblstk_peek(Compiler * c, int offset) {
-  DSValue value;
-
-  /* check that peek was success */
-  if(!stk_peek_offset(c->symTableStk, offset, &value)) {
-    return NULL;
-  }
-
-  return value.pointerVal;
-}
-
 /**
  * Place holder for a function that gets the precedence of an operator.
  * operator: the operator to check for precedence.
@@ -198,47 +180,290 @@ int topstack_type(TypeStk * stk, Stk * lenStk) {
 
 
 /**
- * Pushes a new symbol table onto the stack of symbol tables. The symbol table
- * is a structure that contains records of all variables and their respective
- * locations in the stack in the VM. The symbol table's position in the stack
- * represents the VM stack frame's position in the stack as well.
+ * Grows an array allocated from the compiler's arena to twice its size, or to
+ * COMPILER_INITIAL_SYMBOLS entries if it is empty.
+ * c: an instance of Compiler.
+ * array: the array, or NULL.
+ * size: number of entries in the array, receives the new number.
+ * entrySize: number of bytes in each entry.
+ * returns: the grown array, or NULL if allocation fails.
+ */
+static void * symtbl_grow(Compiler * c, void * array, int * size,
+			  size_t entrySize) {
+  int newSize = *size > 0 ? *size * 2 : COMPILER_INITIAL_SYMBOLS;
+
+  array = arena_realloc(c->arena, array, *size * entrySize,
+			newSize * entrySize);
+  if(array != NULL) {
+    *size = newSize;
+  }
+
+  return array;
+}
+
+/**
+ * Hashes an identifier with FNV-1a.
+ * name: the identifier.
+ * nameLen: its number of chars.
+ * returns: the hash.
+ */
+static unsigned long symtbl_hash(char * name, size_t nameLen) {
+  unsigned long hash = 2166136261UL;
+  size_t i;
+
+  for(i = 0; i < nameLen; i++) {
+    hash = (hash ^ (unsigned char)name[i]) * 16777619UL;
+  }
+
+  return hash;
+}
+
+/**
+ * Finds the slot of an identifier in the index of interned names.
+ * c: an instance of Compiler, with a name index.
+ * name: the identifier.
+ * nameLen: its number of chars.
+ * hash: its hash.
+ * returns: the index of its slot in c->nameIndex, which is -1 if it has not
+ * been interned.
+ */
+static int symtbl_name_slot(Compiler * c, char * name, size_t nameLen,
+			    unsigned long hash) {
+  int mask = c->namesSize * 2 - 1;
+  int i;
+
+  for(i = hash & mask; c->nameIndex[i] != -1; i = (i + 1) & mask) {
+    CompilerName * entry = c->names + c->nameIndex[i];
+
+    if(entry->hash == hash
+       && tokens_equal(entry->text, entry->len, name, nameLen)) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+/**
+ * Gets the id of an interned identifier, optionally interning it first. Ids
+ * index c->names, and each name is copied once per build, into the arena.
+ * c: an instance of Compiler.
+ * name: the identifier.
+ * nameLen: its number of chars.
+ * intern: true to intern the name if it has not been.
+ * returns: the id, or -1 if the name is not interned and intern is false or
+ * allocation fails.
+ */
+static int symtbl_intern(Compiler * c, char * name, size_t nameLen,
+			 bool intern) {
+  unsigned long hash = symtbl_hash(name, nameLen);
+  CompilerName * entry;
+  int slot;
+
+  if(c->numNames > 0) {
+    slot = symtbl_name_slot(c, name, nameLen, hash);
+    if(c->nameIndex[slot] != -1 || !intern) {
+      return c->nameIndex[slot];
+    }
+  } else if(!intern) {
+    return -1;
+  }
+
+  /* grow the names and rebuild the index, which is kept at most half full */
+  if(c->numNames == c->namesSize) {
+    int size = c->namesSize;
+    int * index;
+    int i;
+
+    entry = symtbl_grow(c, c->names, &size, sizeof(CompilerName));
+    index = entry != NULL
+      ? arena_alloc(c->arena, size * 2 * sizeof(int)) : NULL;
+    if(index == NULL) {
+      return -1;
+    }
+    c->names = entry;
+    c->namesSize = size;
+    c->nameIndex = index;
+
+    memset(c->nameIndex, -1, c->namesSize * 2 * sizeof(int));
+    for(i = 0; i < c->numNames; i++) {
+      entry = c->names + i;
+      c->nameIndex[symtbl_name_slot(c, entry->text, entry->len,
+				    entry->hash)] = i;
+    }
+  }
+
+  entry = c->names + c->numNames;
+  entry->text = arena_strndup(c->arena, name, nameLen);
+  if(entry->text == NULL) {
+    return -1;
+  }
+  entry->len = nameLen;
+  entry->hash = hash;
+  entry->binding = -1;
+
+  c->nameIndex[symtbl_name_slot(c, name, nameLen, hash)] = c->numNames;
+  return c->numNames++;
+}
+
+/**
+ * Opens a new scope in the symbol table. The symbol table is a flat array of
+ * records of all variables and their respective locations in the stack in the
+ * VM. Each scope's position in the stack of scopes represents the VM stack
+ * frame's position in the stack as well.
  * c: an instance of Compiler that will receive the new frame.
- * returns: true if success, false if an allocation failure occurs.
+ * returns: true if success, false if an allocation failure occurs or the
+ * scopes are nested too deeply, in which case c->err is set.
+ */
+bool symtbl_push_scope(Compiler * c) {
+
+  assert(c != NULL);
+
+  /* frame depths are written to the byte code as chars */
+  if(c->numScopes > CHAR_MAX) {
+    c->err = COMPILERERR_NESTED_TOO_DEEP;
+    return false;
+  }
+
+  if(c->numScopes == c->scopesSize) {
+    int * scopes = symtbl_grow(c, c->scopes, &c->scopesSize, sizeof(int));
+
+    if(scopes == NULL) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      return false;
+    }
+    c->scopes = scopes;
+  }
+
+  c->scopes[c->numScopes++] = c->numSymbols;
+  return true;
+}
+
+/**
+ * Closes the innermost scope of the symbol table, uncovering the variables
+ * that its variables hid. Closing the outermost scope ends the build, so the
+ * symbol and name tables are emptied and the compiler's arena is reset.
+ * c: an instance of Compiler.
  */
-bool symtblstk_push(Compiler * c) {
+void symtbl_pop_scope(Compiler * c) {
 
   assert(c != NULL);
+  assert(c->numScopes > 0);
+
+  c->numScopes--;
+  while(c->numSymbols > c->scopes[c->numScopes]) {
+    CompilerSymbol * symbol = c->symbols + --c->numSymbols;
+
+    c->names[symbol->name].binding = symbol->shadowed;
+  }
+
+  /* the tables were allocated from the arena */
+  if(c->numScopes == 0) {
+    arena_reset(c->arena);
+    c->symbols = NULL;
+    c->symbolsSize = 0;
+    c->scopes = NULL;
+    c->scopesSize = 0;
+    c->names = NULL;
+    c->numNames = 0;
+    c->namesSize = 0;
+    c->nameIndex = NULL;
+  }
+}
 
-  HT * symTbl = ht_new(COMPILER_INITIAL_HTSIZE, COMPILER_HTBLOCKSIZE, COMPILER_HTLOADFACTOR);
+/**
+ * Declares a variable in the innermost scope of the symbol table, at the next
+ * slot of the scope's VM stack frame.
+ * c: an instance of Compiler.
+ * name: the name of the variable.
+ * nameLen: the number of chars in name.
+ * prevDefined: receives true if the scope already had a variable of this
+ * name, in which case nothing is declared.
+ * returns: true upon success, and false if allocation fails or the scope has
+ * too many variables, in which case c->err is set.
+ */
+bool symtbl_define(Compiler * c, char * name, size_t nameLen,
+		   bool * prevDefined) {
+  CompilerSymbol * symbol;
+  int scopeStart;
+  int id;
 
-  /* check that hashtable was successfully allocated */
-  if(symTbl == NULL) {
+  assert(c != NULL);
+  assert(c->numScopes > 0);
+
+  scopeStart = c->scopes[c->numScopes - 1];
+  id = symtbl_intern(c, name, nameLen, true);
+  if(id == -1) {
+    c->err = COMPILERERR_ALLOC_FAILED;
     return false;
   }
 
-  if(!stk_push_pointer(c->symTableStk, symTbl)) {
+  /* a binding in the innermost scope is a duplicate */
+  *prevDefined = c->names[id].binding >= scopeStart;
+  if(*prevDefined) {
+    return true;
+  }
+
+  /* slots are written to the byte code as chars */
+  if(c->numSymbols - scopeStart >= CHAR_MAX) {
+    c->err = COMPILERERR_TOO_MANY_VARS;
     return false;
   }
 
+  if(c->numSymbols == c->symbolsSize) {
+    symbol = symtbl_grow(c, c->symbols, &c->symbolsSize,
+			 sizeof(CompilerSymbol));
+    if(symbol == NULL) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      return false;
+    }
+    c->symbols = symbol;
+  }
+
+  symbol = c->symbols + c->numSymbols;
+  symbol->name = id;
+  symbol->scope = c->numScopes - 1;
+  symbol->slot = c->numSymbols - scopeStart;
+  symbol->shadowed = c->names[id].binding;
+  c->names[id].binding = c->numSymbols++;
+
   return true;
 }
 
 /**
- * Gets the top symbol table from the symbol table stack and returns a pointer,
- * and removes the table from the stack. This function does NOT free the table.
- * You must free the table manually when finished with symtbl_free(), or the memory
- * will leak.
+ * Looks up a variable in the symbol table, finding the declaration in the
+ * innermost scope that has one.
  * c: an instance of Compiler.
- * returns: a pointer to the symbol table formerly at the top of the stack, or
- * NULL if the stack is empty.
+ * name: the name of the variable.
+ * nameLen: the number of chars in name.
+ * depth: receives the number of scopes, or VM stack frames, between the
+ * innermost scope and the scope that declared the variable.
+ * slot: receives the variable's index in that scope's VM stack frame.
+ * returns: true if the variable was found, and false if it is undefined or
+ * name is NULL.
  */
-HT * symtblstk_pop(Compiler * c) {
-  DSValue value;
+bool symtbl_lookup(Compiler * c, char * name, size_t nameLen,
+		   int * depth, int * slot) {
+  CompilerSymbol * symbol;
+  int id;
 
-  /* check that peek was success */
-  if(!stk_pop(c->symTableStk, &value)) {
-    return NULL;
+  assert(c != NULL);
+
+  /* the lexer returns no token once it has hit an error */
+  if(name == NULL) {
+    return false;
   }
 
-  return value.pointerVal;
+  id = symtbl_intern(c, name, nameLen, false);
+  if(id == -1 || c->names[id].binding == -1) {
+    return false;
+  }
+
+  symbol = c->symbols + c->names[id].binding;
+  *depth = c->numScopes - 1 - symbol->scope;
+  *slot = symbol->slot;
+
+  /* symtbl_push_scope() and symtbl_define() keep both within a char */
+  assert(*depth <= CHAR_MAX && *slot <= CHAR_MAX);
+  return true;
 }
@@ -41,14 +41,15 @@
 #include "gunderscript.h"
 #include "compiler.h"
 #include "parsers.h"
+#include "optimizer.h"
 #include "lexer.h"
 #include "langkeywords.h"
 #include "vm.h"
 #include "vmdefs.h"
 #include "typestk.h"
 
-/* TODO: make symTableStk auto expand and remove this */
-static const int maxFuncDepth = 100;
+/* deepest nesting of && and || operators in an expression */
+static const int maxShortCircuitDepth = 100;
 
 /**
  * Creates a new compiler object that will contain the current state of the
@@ -68,12 +69,15 @@ Compiler * compiler_new(VM * vm) {
 
   /* TODO: make this stack auto expand when full */
   compiler->compiledScripts = set_new();
-  compiler->symTableStk = stk_new(maxFuncDepth);
+  compiler->arena = arena_new(COMPILER_ARENA_BLOCKSIZE);
+  compiler->shortCircuitStk = stk_new(maxShortCircuitDepth);
   compiler->vm = vm;
+  compiler->optLevel = COMPILER_DEFAULT_OPT_LEVEL;
 
   /* check for further malloc errors */
   if(compiler->compiledScripts == NULL
-     || compiler->symTableStk == NULL 
+     || compiler->arena == NULL
+     || compiler->shortCircuitStk == NULL
      || vm_buffer(compiler->vm) == NULL) {
     compiler_free(compiler);
     return NULL;
@@ -82,19 +86,6 @@ Compiler * compiler_new(VM * vm) {
   return compiler;
 }
 
-/**
- * A wrapper function that frees a symbol table. This function should be used
- * after a symbol table is popped from the symbol table stack with
- * symtblstk_pop(). Do NOT free symbol table references obtained with
- * symtblstk_peek(). They are still being used. SEGFAULTS will ensue.
- * symTbl: a hashtable/symbol table to free.
- */
-static void symtbl_free(HT * symTbl) {
-  assert(symTbl != NULL);
-
-  ht_free(symTbl);
-}
-
 /**
  * Checks a string to see if it is a reserved keyword for the scripting language
  * At the moment this function is a place holder for the keyword check
@@ -136,12 +127,10 @@ static int parse_arguments(Compiler * c, Lexer * l) {
    * the tokens and store each KEYVAR type token in the symbol table as a
    * function argument
    */
-  HT * symTbl = symtblstk_peek(c, 0);
   LexerType type;
   size_t len;
   bool prevExisted;
   char * token = lexer_next(l, &type, &len);
-  DSValue value;
   int numArgs = 0;
 
   while(true) {
@@ -161,10 +150,7 @@ static int parse_arguments(Compiler * c, Lexer * l) {
     /* store variable along with index at which its data will be stored in the
      * frame stack in the virtual machine
      */
-    value.intVal = ht_size(symTbl);
-    if(!ht_put_raw_key(symTbl, token, len, 
-		       &value, NULL, &prevExisted)) {
-      c->err = COMPILERERR_ALLOC_FAILED;
+    if(!symtbl_define(c, token, len, &prevExisted)) {
       return -1;
     }
     numArgs++;
@@ -208,9 +194,11 @@ static int parse_arguments(Compiler * c, Lexer * l) {
  * call the function. e.g. print.
  * nameLen: the number of characters to read from name.
  * numArgs: the number of arguments that the function can accept.
+ * inlineHint: true if the function was declared inline.
  */
 static bool function_store_definition(Compiler * c, char * name, size_t nameLen,
-			   int numArgs, int numVars, bool exported) {
+			   int numArgs, int numVars, bool exported,
+			   bool inlineHint) {
 
   /* TODO: might need a lexer_next() call to get correct token */
   bool prevValue;
@@ -224,6 +212,7 @@ static bool function_store_definition(Compiler * c, char * name, size_t nameLen,
     c->err = COMPILERERR_ALLOC_FAILED;
     return false;
   }
+  cp->inlineHint = inlineHint;
 
   value.pointerVal = cp;
   ht_put_raw_key(vm_functions(c->vm), name, nameLen, &value, NULL, &prevValue);
@@ -265,15 +254,17 @@ static bool parse_dependencies(Compiler * compiler, Lexer * lexer) {
       return false;
     }
 
-    scriptFileName = calloc(len + 1, sizeof(char));
-    strncpy(scriptFileName, token, len);
+    /* the name lives in the arena until the build finishes */
+    scriptFileName = arena_strndup(compiler->arena, token, len);
+    if(scriptFileName == NULL) {
+      compiler->err = COMPILERERR_ALLOC_FAILED;
+      return false;
+    }
 
     /* build dependency script */
     if(!compiler_build_file(compiler, scriptFileName)) {
-      free(scriptFileName);
       return false;
     }
-    free(scriptFileName);
 
     /* check for terminating semicolon */
     token = lexer_next(lexer, &type, &len);
@@ -305,7 +296,7 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
   /*
    * A Function definition looks like so:
    *
-   * function [EXPORTED] [NAME] ( [ARG1], [ARG2], ... ) {
+   * function [EXPORTED] [INLINE] [NAME] ( [ARG1], [ARG2], ... ) {
    *   [code]
    * }
    * 
@@ -314,6 +305,7 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
    */
    
   bool exported = false;
+  bool inlineHint = false;
   size_t len;
   LexerType type;
   char * token = lexer_current_token(l, &type, &len);
@@ -321,6 +313,7 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
   size_t nameLen;
   int numArgs;
   int numVars;
+  int start;
 
   /* check that this is a function declaration token */
   if(!tokens_equal(token, len, LANG_FUNCTION, LANG_FUNCTION_LEN)) {
@@ -335,6 +328,12 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
     token = lexer_next(l, &type, &len);
   }
 
+  /* if it is INLINE, calls to it should be inlined where possible */
+  if(tokens_equal(token, len, LANG_INLINE, LANG_INLINE_LEN)) {
+    inlineHint = true;
+    token = lexer_next(l, &type, &len);
+  }
+
   /* this is the name token, store it and check for correct type */
   name = token;
   nameLen = len;
@@ -356,9 +355,8 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
     return true;
   }
 
-  /* we're going down a level. push new symbol table to stack */
-  if(!symtblstk_push(c)) {
-    c->err = COMPILERERR_ALLOC_FAILED;
+  /* we're going down a level. open a new scope in the symbol table */
+  if(!symtbl_push_scope(c)) {
     return true;
   }
 
@@ -386,7 +384,9 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
   token = lexer_current_token(l, &type, &len);
 
   /* store the function name, location in the output, and # of args and vars */
-  if(!function_store_definition(c, name, nameLen, numArgs, numVars, exported)) {
+  start = buffer_size(vm_buffer(c->vm));
+  if(!function_store_definition(c, name, nameLen, numArgs, numVars, exported,
+				inlineHint)) {
     return true;
   }
 
@@ -412,10 +412,15 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
   /* pop function frame and return to calling function */
   buffer_append_char(vm_buffer(c->vm), OP_FRM_POP);
 
+  /* the function is complete, optimize its code */
+  if(!optimizer_optimize(c, start)) {
+    return true;
+  }
+
   token = lexer_next(l, &type, &len);
 
-  /* we're done here! pop the symbol table for this function off the stack. */
-  ht_free(symtblstk_pop(c));
+  /* we're done here! close the function's scope in the symbol table. */
+  symtbl_pop_scope(c);
 
   return true;
 }
@@ -425,8 +430,10 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
  * string.
  * file: string containing file name.
  * size: a size_t* that will recv. the size of the file, in bytes.
+ * returns: the contents, which must be freed, or NULL if the file can't be
+ * read.
  */
-static char * file_to_string(char * file, size_t * size) {
+char * compiler_file_to_string(char * file, size_t * size) {
   FILE * fp;
   long lSize;
   char * buffer;
@@ -493,7 +500,7 @@ bool compiler_build_file(Compiler * compiler, char * fileName) {
   }
 
   /* load entire file into a buffer for compilation */
-  codeFileText = file_to_string(fileName, &codeFileSize);
+  codeFileText = compiler_file_to_string(fileName, &codeFileSize);
 
   /* check that file opened correctly */
   if(codeFileText == NULL) {
@@ -508,6 +515,40 @@ bool compiler_build_file(Compiler * compiler, char * fileName) {
   return result;
 }
 
+/**
+ * Records that a script file has been built into this compiler's VM by other
+ * means, such as by loading a cached build of it, so that it isn't built
+ * again if another script depends on it.
+ * compiler: an instance of compiler.
+ * fileName: the script file.
+ * returns: true upon success, and false if allocation fails.
+ */
+bool compiler_mark_built(Compiler * compiler, char * fileName) {
+  bool prevExists;
+
+  assert(compiler != NULL);
+  assert(fileName != NULL);
+
+  if(!set_add(compiler->compiledScripts, fileName,
+	      strlen(fileName), &prevExists)) {
+    compiler->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Closes the scopes of the symbol table that a failed build left open, so that
+ * the compiler can build again.
+ * compiler: an instance of compiler.
+ * numScopes: the number of scopes that were open when the build started.
+ */
+static void close_scopes(Compiler * compiler, int numScopes) {
+  while(compiler->numScopes > numScopes) {
+    symtbl_pop_scope(compiler);
+  }
+}
+
 /**
  * Builds a script buffer and adds its code to the bytecode output buffer and
  * stores references to its functions and variables in the Compiler object.
@@ -527,20 +568,33 @@ bool compiler_build(Compiler * compiler, char * input, size_t inputLen) {
   Lexer * lexer = lexer_new(input, inputLen);
   LexerType type;
   size_t tokenLen;
+  int numScopes = compiler->numScopes;
 
-  /* check that lexer alloc didn't fail, and push symtbl for global variables */
-  if(lexer == NULL || !symtblstk_push(compiler)) {
+  /* check that lexer alloc didn't fail */
+  if(lexer == NULL) {
     compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
-    lexer_free(lexer);
     return false;
   }
   compiler_set_err(compiler, COMPILERERR_SUCCESS);
 
+  /* tokenize the whole script up front so the parsers index into an array
+   * of tokens. if there isn't memory for it the script is lexed lazily.
+   */
+  lexer_tokenize(lexer);
+
+  /* open the scope of global variables, which sets the error if it fails */
+  if(!symtbl_push_scope(compiler)) {
+    lexer_free(lexer);
+    return false;
+  }
+
   /* get first token */
   lexer_next(lexer, &type, &tokenLen);
 
   /* handle script imports/"depends" */
   if(!parse_dependencies(compiler, lexer)) {
+    close_scopes(compiler, numScopes);
+    lexer_free(lexer);
     return false;
   }
 
@@ -557,18 +611,71 @@ bool compiler_build(Compiler * compiler, char * input, size_t inputLen) {
     if(compiler->err != COMPILERERR_SUCCESS) {
       compiler->lexerErr = lexer_get_err(lexer);
       compiler->errorLineNum = lexer_line_num(lexer);
+      close_scopes(compiler, numScopes);
       lexer_free(lexer);
       return false;
     }
   }
 
-  /* we're done here: pop globals symtable */
-  symtbl_free(symtblstk_pop(compiler));
+  /* we're done here: close the scope of globals */
+  symtbl_pop_scope(compiler);
 
   lexer_free(lexer);
   return true;
 }
 
+/**
+ * Sets how much the compiler optimizes the code that it builds from now on.
+ * compiler: an instance of compiler.
+ * optLevel: 0 to turn the optimizer off, 1 for the passes that are always
+ * worth it, and higher for passes that trade build time for faster code.
+ */
+void compiler_set_opt_level(Compiler * compiler, int optLevel) {
+  assert(compiler != NULL);
+
+  compiler->optLevel = optLevel < 0 ? 0 : optLevel;
+}
+
+/**
+ * Gets the compiler's optimization level.
+ * compiler: an instance of compiler.
+ * returns: the level set with compiler_set_opt_level().
+ */
+int compiler_opt_level(Compiler * compiler) {
+  assert(compiler != NULL);
+
+  return compiler->optLevel;
+}
+
+/**
+ * Sets the profile that guides the optimizer's choices for the code that the
+ * compiler builds from now on, such as which calls to inline and which way
+ * each branch is laid out. The profile is not copied or freed.
+ * compiler: an instance of compiler.
+ * profile: a profile loaded with profile_load(), or NULL for none.
+ */
+void compiler_set_profile(Compiler * compiler, Profile * profile) {
+  assert(compiler != NULL);
+
+  compiler->profile = profile;
+}
+
+/**
+ * Gets the statistics of the optimization passes, summed over every function
+ * that this compiler has built.
+ * compiler: an instance of compiler.
+ * numPasses: receives the number of entries. Entries of passes that didn't
+ * run have a NULL name.
+ * returns: the statistics, which are valid for the life of the compiler.
+ */
+const PassStats * compiler_pass_stats(Compiler * compiler, int * numPasses) {
+  assert(compiler != NULL);
+  assert(numPasses != NULL);
+
+  *numPasses = compiler->numPassStats;
+  return compiler->passStats;
+}
+
 /**
  * Sets the compiler error code.
  * compiler: an instance of compiler to set the err on.
@@ -607,8 +714,12 @@ void compiler_free(Compiler * compiler) {
     set_free(compiler->compiledScripts);
   }
 
-  if(compiler->symTableStk != NULL) {
-    stk_free(compiler->symTableStk);
+  if(compiler->arena != NULL) {
+    arena_free(compiler->arena);
+  }
+
+  if(compiler->shortCircuitStk != NULL) {
+    stk_free(compiler->shortCircuitStk);
   }
 
   free(compiler);
@@ -0,0 +1,149 @@
+/**
+ * gspool.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * A pool of Gunderscript instances that are created and initialized up front
+ * and handed out on request. Applications that run a short script for each
+ * request can acquire an instance, run it, and release it back to the pool,
+ * where it is reset with gunderscript_reset() instead of being freed. The
+ * pool does no locking; multithreaded users must serialize calls to it.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gspool.h"
+
+/**
+ * Creates a pool of instances.
+ * size: the number of instances in the pool.
+ * stackSize: the VM stack size of each instance, in bytes.
+ * callbacksSize: the number of callback slots of each instance.
+ * withCompiler: if true, instances are created with gunderscript_new_full()
+ * and have a compiler. Otherwise, they have a VM only.
+ * init: called once for each new instance to load code into it, or NULL.
+ * initData: passed to init.
+ * returns: a new pool, or NULL if an allocation or init fails.
+ */
+GSAPI GSPool * gspool_new(int size, size_t stackSize, int callbacksSize,
+			  bool withCompiler, GSPoolInitCallback init,
+			  void * initData) {
+  GSPool * pool;
+
+  assert(size > 0);
+
+  pool = calloc(1, sizeof(GSPool));
+  if(pool == NULL) {
+    return NULL;
+  }
+
+  pool->instances = calloc(size, sizeof(Gunderscript));
+  pool->idle = calloc(size, sizeof(Gunderscript*));
+  if(pool->instances == NULL || pool->idle == NULL) {
+    gspool_free(pool);
+    return NULL;
+  }
+
+  /* create and initialize every instance */
+  for(pool->size = 0; pool->size < size; pool->size++) {
+    Gunderscript * instance = &pool->instances[pool->size];
+    bool created = withCompiler
+      ? gunderscript_new_full(instance, stackSize, callbacksSize)
+      : gunderscript_new_vm(instance, stackSize, callbacksSize);
+
+    if(!created) {
+      gspool_free(pool);
+      return NULL;
+    }
+
+    /* count it now so that gspool_free() frees it if init fails */
+    pool->idle[pool->numIdle++] = instance;
+
+    if(init != NULL && !init(instance, initData)) {
+      pool->size++;
+      gspool_free(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+/**
+ * Takes an instance out of the pool.
+ * pool: an instance of GSPool.
+ * returns: an instance ready for use, or NULL if every instance in the pool
+ * is in use.
+ */
+GSAPI Gunderscript * gspool_acquire(GSPool * pool) {
+  assert(pool != NULL);
+
+  if(pool->numIdle == 0) {
+    return NULL;
+  }
+
+  return pool->idle[--pool->numIdle];
+}
+
+/**
+ * Resets an instance and returns it to the pool.
+ * pool: an instance of GSPool.
+ * instance: an instance that came from gspool_acquire() on this pool.
+ */
+GSAPI void gspool_release(GSPool * pool, Gunderscript * instance) {
+  assert(pool != NULL);
+  assert(instance >= pool->instances
+	 && instance < pool->instances + pool->size);
+  assert(pool->numIdle < pool->size);
+
+  gunderscript_reset(instance);
+  pool->idle[pool->numIdle++] = instance;
+}
+
+/**
+ * Gets the number of instances that are available to gspool_acquire().
+ * pool: an instance of GSPool.
+ * returns: the number of idle instances.
+ */
+GSAPI int gspool_num_idle(GSPool * pool) {
+  assert(pool != NULL);
+  return pool->numIdle;
+}
+
+/**
+ * Frees a pool and all of its instances. Instances that are still acquired
+ * are freed as well and must not be used afterwards.
+ * pool: an instance of GSPool.
+ */
+GSAPI void gspool_free(GSPool * pool) {
+  int i;
+
+  assert(pool != NULL);
+
+  if(pool->instances != NULL) {
+    for(i = 0; i < pool->size; i++) {
+      gunderscript_free(&pool->instances[i]);
+    }
+    free(pool->instances);
+  }
+
+  if(pool->idle != NULL) {
+    free(pool->idle);
+  }
+
+  free(pool);
+}
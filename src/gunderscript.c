@@ -29,6 +29,64 @@
 #include "libmath.h"
 #include "libstr.h"
 #include "libarray.h"
+#include "vmregistry.h"
+#include "verifier.h"
+#include "buildcache.h"
+#include "aot.h"
+#include "snapshot.h"
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dlfcn.h>
+#define GS_PROCESS_ID()             getpid()
+#else
+#include <process.h>
+#define GS_PROCESS_ID()             _getpid()
+#endif
+
+/* the number of natives in the standard libraries, with room to grow */
+#define GS_STD_REGISTRY_SIZE        64
+
+/* the standard library natives, shared by every instance */
+static VMRegistry * stdRegistry = NULL;
+
+/**
+ * Gets the registry of standard library native functions that is shared by
+ * every instance, building it on the first call. The first call is not thread
+ * safe, so multithreaded hosts should call this once before creating
+ * instances from more than one thread. The registry is never modified
+ * afterwards and lives until the process exits.
+ * returns: the registry, or NULL if building it failed.
+ */
+GSAPI VMRegistry * gunderscript_std_registry() {
+  VMRegistry * registry;
+
+  if(stdRegistry != NULL) {
+    return stdRegistry;
+  }
+
+  registry = vmregistry_new(GS_STD_REGISTRY_SIZE);
+  if(registry == NULL) {
+    return NULL;
+  }
+
+  /* initialize system libraries */
+  if(!libsys_install(registry)
+     || !libmath_install(registry)
+     || !libstr_install(registry)
+     || !libarray_install(registry)
+     || !vmregistry_freeze(registry)) {
+    vmregistry_free(registry);
+    return NULL;
+  }
+
+  stdRegistry = registry;
+  return stdRegistry;
+}
 
 /**
  * Creates a new instance of Gunderscript object with a Virtual
@@ -38,12 +96,11 @@
  * stackSize: the size for the VM stack in bytes. The VM does not
  * dynamically resize so this value is absolute for this instance.
  * callbacksSize: the number of callbacks slots. This number defines
- * how many native functions can be bound to this instance. Increase
- * this value if vm_reg_callback() fails, or if gunderscript_new()
- * always returns false.
+ * how many native functions can be bound to this instance with
+ * vm_reg_callback(), in addition to the shared standard libraries.
+ * Increase this value if vm_reg_callback() fails.
  * returns: true if creation succeeds, and false if fails. Failure can
- * occur due to malloc failure or if callbacksSize is too small to
- * contain all of the standard libraries.
+ * occur due to malloc failure.
  */
 GSAPI bool gunderscript_new_vm(Gunderscript * instance, size_t stackSize,
 		      int callbacksSize) {
@@ -51,22 +108,29 @@ GSAPI bool gunderscript_new_vm(Gunderscript * instance, size_t stackSize,
   assert(stackSize > 0);
   assert(callbacksSize > 0);
 
-  /* allocate virtual machine */
-  instance->vm = vm_new(stackSize, callbacksSize);
+  VMRegistry * registry = gunderscript_std_registry();
+
   instance->err = GUNDERSCRIPTERR_SUCCESS;
-  if(instance->vm == NULL) {
+  if(registry == NULL) {
     return false;
   }
 
-  /* initialize system libraries */
-  if(!libsys_install(instance)
-     || !libmath_install(instance)
-     || !libstr_install(instance)
-     || !libarray_install(instance)) {
-    vm_free(instance->vm);
+  instance->byteCode = NULL;
+  instance->byteCodeLen = 0;
+  instance->cacheDir = NULL;
+  instance->aotLibrary = NULL;
+  instance->profile = NULL;
+  instance->recorder = NULL;
+
+  /* allocate virtual machine */
+  instance->vm = vm_new(stackSize, callbacksSize);
+  if(instance->vm == NULL) {
     return false;
   }
 
+  /* reference the system libraries */
+  vm_set_registry(instance->vm, registry);
+
   instance->compiler = NULL;
 
   return true;
@@ -80,12 +144,11 @@ GSAPI bool gunderscript_new_vm(Gunderscript * instance, size_t stackSize,
  * stackSize: the size for the VM stack in bytes. The VM does not
  * dynamically resize so this value is absolute for this instance.
  * callbacksSize: the number of callbacks slots. This number defines
- * how many native functions can be bound to this instance. Increase
- * this value if vm_reg_callback() fails, or if gunderscript_new()
- * always returns false.
+ * how many native functions can be bound to this instance with
+ * vm_reg_callback(), in addition to the shared standard libraries.
+ * Increase this value if vm_reg_callback() fails.
  * returns: true if creation succeeds, and false if fails. Failure can
- * occur due to malloc failure or if callbacksSize is too small to
- * contain all of the standard libraries.
+ * occur due to malloc failure.
  */
 GSAPI bool gunderscript_new_full(Gunderscript * instance, size_t stackSize,
 		      int callbacksSize) {
@@ -142,30 +205,25 @@ GSAPI bool gunderscript_build(Gunderscript * instance, char * input, size_t inpu
   assert(instance->compiler != NULL);
   assert(input != NULL);
   assert(inputLen > 0);
-  bool result = compiler_build(instance->compiler, input, inputLen);
 
-  if(!result) {
-    instance->err = GUNDERSCRIPTERR_BUILDERR;
+  /* can't add to code that is running in place from a bytecode file */
+  if(instance->byteCode != NULL) {
+    instance->err = GUNDERSCRIPTERR_ALREADY_LOADED;
+    return false;
   }
-  return result;
-}
 
-/**
- * Same as gunderscript_build, but builds a file.
- * instance: an instance of Gunderscript.
- * fileName: the file to build.
- * returns: true upon success, and false upon failure.
- */
-GSAPI bool gunderscript_build_file(Gunderscript * instance, char * fileName) {
-  assert(instance != NULL);
-  assert(instance->compiler != NULL);
+  bool result = compiler_build(instance->compiler, input, inputLen);
 
-  bool result = compiler_build_file(instance->compiler, fileName);
-  
   if(!result) {
     instance->err = GUNDERSCRIPTERR_BUILDERR;
+    return false;
   }
-  return result;
+
+  /* code that verifies runs without per instruction checks. code that
+   * doesn't still runs, checked.
+   */
+  verifier_verify(instance->vm);
+  return true;
 }
 
 /**
@@ -187,280 +245,1762 @@ GSAPI LexerErr gunderscript_lexer_err(Gunderscript * instance) {
 }
 
 /**
- * Run after gunderscript_build_file() to export the compiled bytecode to an
- * external bytecode file.
- * instance: a Gunderscript object.
- * fileName: The name of the file to export to. Caution: file will be overwritten
- * returns: true upon success, or false if file cannot be opened, 
- * no code has been built, or there was an error building code.
+ * Rounds a bytecode file offset up to the next section boundary.
  */
-GSAPI bool gunderscript_export_bytecode(Gunderscript * instance, char * fileName) {
-  FILE * outFile = fopen(fileName, "w");
-  GSByteCodeHeader header;
-  HTIter functionHTIter;
-  char * byteCodeBuffer;
+#define GS_BYTECODE_ALIGN_UP(x) \
+  (((x) + GS_BYTECODE_ALIGN - 1) & ~(GS_BYTECODE_ALIGN - 1))
 
-  /* check if file open fails */
-  if(outFile == NULL) {
-    instance->err = GUNDERSCRIPTERR_BAD_FILE_OPEN_WRITE;
-    return false;
+/**
+ * Compares two function table entries by their offset in the code, for
+ * qsort().
+ */
+static int gunderscript_func_compare(const void * a, const void * b) {
+  return ((GSByteCodeFunc*)a)->index - ((GSByteCodeFunc*)b)->index;
+}
+
+/**
+ * Writes a section of a bytecode file, followed by zeros up to the next
+ * section boundary.
+ * outFile: the file.
+ * data: the section.
+ * len: the length of data.
+ * returns: true upon success, and false if the write fails.
+ */
+static bool gunderscript_write_section(FILE * outFile, void * data, size_t len) {
+  static const char padding[GS_BYTECODE_ALIGN];
+  size_t padLen = GS_BYTECODE_ALIGN_UP(len) - len;
+
+  return (len == 0 || fwrite(data, len, 1, outFile) == 1)
+    && (padLen == 0 || fwrite(padding, padLen, 1, outFile) == 1);
+}
+
+/**
+ * Finds the function that starts at an address.
+ * functions: the function table, sorted by index.
+ * numFunctions: the number of functions.
+ * addr: the address.
+ * returns: the function's position in the table, or -1 if none starts there.
+ */
+static int gunderscript_func_at(GSByteCodeFunc * functions, int numFunctions,
+				int addr) {
+  int low = 0;
+  int high = numFunctions - 1;
+
+  while(low <= high) {
+    int mid = (low + high) / 2;
+
+    if(functions[mid].index == addr) {
+      return mid;
+    } else if(functions[mid].index < addr) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
   }
+  return -1;
+}
 
-  /* create header */
-  strcpy(header.header, GS_BYTECODE_HEADER);
-  strcpy(header.buildDate, __DATE__);
-  header.byteCodeLen = vm_bytecode_size(instance->vm);
-  header.numFunctions = ht_size(vm_functions(instance->vm));
+/**
+ * Finds the functions that an exported function can call, directly or
+ * through other functions. Scripts only call functions by the address that
+ * was compiled into the call, and the host only calls exported functions, so
+ * no other function can ever run.
+ * code: the compiled code.
+ * functions: the function table, sorted by index, with each function's
+ * length.
+ * numFunctions: the number of functions.
+ * live: receives true for each function that can run.
+ * returns: true upon success, and false if an allocation fails or the code
+ * can't be followed.
+ */
+static bool gunderscript_mark_live(char * code, GSByteCodeFunc * functions,
+				   int numFunctions, bool * live) {
+  int * pending = malloc(numFunctions * sizeof(int));
+  int numPending = 0;
+  int i;
 
-  /* write header to file, return false on failure */
-  if(fwrite(&header, sizeof(GSByteCodeHeader), 1, outFile) != 1) {
-    instance->err = GUNDERSCRIPTERR_BAD_FILE_WRITE;
+  if(pending == NULL) {
     return false;
   }
-  
-  ht_iter_get(vm_functions(instance->vm), &functionHTIter);
 
-  /* write exported functions to file */
-  while(ht_iter_has_next(&functionHTIter)) {
-    DSValue value;
-    char functionName[GS_MAX_FUNCTION_NAME_LEN];
-    size_t functionNameLen;
-    char outLen;
+  for(i = 0; i < numFunctions; i++) {
+    live[i] = functions[i].exported != 0;
+    if(live[i]) {
+      pending[numPending++] = i;
+    }
+  }
 
-    /* get the next item from hashtable */
-    ht_iter_next(&functionHTIter, functionName, GS_MAX_FUNCTION_NAME_LEN,
-		 &value, &functionNameLen, false);
+  while(numPending > 0) {
+    GSByteCodeFunc * function = &functions[pending[--numPending]];
+    int end = function->index + function->codeLen;
+    int len;
 
-    /* check if the function should be exported. if so, write it to the file */
-    if(((VMFunc*)value.pointerVal)->exported) {
-
-      /* TODO: create an error handler case for this */
-      assert(functionNameLen < GS_MAX_FUNCTION_NAME_LEN);
-    
-      /* write it's name and length to the file */
-      outLen = functionNameLen;
-      if(fwrite(&outLen, sizeof(char), 1, outFile) != 1 
-	 || fwrite(functionName, sizeof(char), functionNameLen, outFile) 
-	 != functionNameLen) {
-	instance->err = GUNDERSCRIPTERR_BAD_FILE_WRITE;
+    for(i = function->index; i < end; i += len) {
+      len = verifier_op_len(code, end, i);
+      if(len < 0 || i + len > end) {
+	free(pending);
 	return false;
       }
 
-      /* write its CompilerFunc to the file (stores function call information) */
-      if(fwrite(value.pointerVal, sizeof(VMFunc), 1, outFile) != 1) {
-	instance->err = GUNDERSCRIPTERR_BAD_FILE_WRITE;
-	return false;
+      if(code[i] == OP_CALL_B || code[i] == OP_CALL_LAZY) {
+	int addr;
+	int callee;
+
+	memcpy(&addr, code + i + 3, sizeof(int));
+	callee = gunderscript_func_at(functions, numFunctions, addr);
+	if(callee == -1) {
+	  free(pending);
+	  return false;
+	}
+	if(!live[callee]) {
+	  live[callee] = true;
+	  pending[numPending++] = callee;
+	}
       }
     }
   }
 
-  byteCodeBuffer = vm_bytecode(instance->vm);
-  if(byteCodeBuffer == NULL) {
-    instance->err = GUNDERSCRIPTERR_NO_SUCCESSFUL_BUILD;
+  free(pending);
+  return true;
+}
+
+/**
+ * Copies the functions that can run into a new code buffer, one after
+ * another, and moves the addresses of their jumps and calls to match.
+ * code: the compiled code.
+ * functions: the function table, sorted by index, with each function's
+ * length. Receives the functions that can run, at their new addresses.
+ * numFunctions: the number of functions. Receives the number left.
+ * live: whether each function can run, from gunderscript_mark_live().
+ * out: receives the code.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool gunderscript_copy_live(char * code, GSByteCodeFunc * functions,
+				   int * numFunctions, bool * live,
+				   Buffer * out) {
+  int * newIndex = malloc(*numFunctions * sizeof(int));
+  int size = 0;
+  int i;
+  int j;
+
+  if(newIndex == NULL) {
     return false;
   }
 
-  /* write bytecode */
-  if(fwrite(byteCodeBuffer, 
-	    vm_bytecode_size(instance->vm), 1, outFile) != 1) {
-    instance->err = GUNDERSCRIPTERR_BAD_FILE_WRITE;
-    return false;
+  for(i = 0; i < *numFunctions; i++) {
+    newIndex[i] = size;
+    if(live[i]) {
+      size += functions[i].codeLen;
+    }
   }
 
-  fclose(outFile);
+  for(i = 0; i < *numFunctions; i++) {
+    int start = functions[i].index;
+    int end = start + functions[i].codeLen;
+    int len;
 
-  return true;
-}
+    if(!live[i]) {
+      continue;
+    }
+    if(!buffer_append_string(out, code + start, end - start)) {
+      free(newIndex);
+      return false;
+    }
 
-GSAPI bool gunderscript_import_bytecode(Gunderscript * instance, char * fileName) {
-  DSValue value;
-  FILE * inFile = fopen(fileName, "r");
-  GSByteCodeHeader header;
-  int i = 0;
+    /* jumps within the function move with it, calls go to the callee */
+    for(j = start; j < end; j += len) {
+      char * instr = buffer_get_buffer(out) + newIndex[i] + (j - start);
+      int addr;
 
-  if(inFile == NULL) {
-    instance->err = GUNDERSCRIPTERR_BAD_FILE_OPEN_READ;
-    return false;
+      len = verifier_op_len(code, end, j);
+      switch(code[j]) {
+      case OP_GOTO:
+      case OP_TCOND_GOTO:
+      case OP_FCOND_GOTO:
+      case OP_FOR_STEP:
+      case OP_FOR_STEP_NUM:
+	memcpy(&addr, instr + len - sizeof(int), sizeof(int));
+	addr += newIndex[i] - start;
+	memcpy(instr + len - sizeof(int), &addr, sizeof(int));
+	break;
+      case OP_CALL_B:
+      case OP_CALL_LAZY:
+	memcpy(&addr, instr + 3, sizeof(int));
+	addr = newIndex[gunderscript_func_at(functions, *numFunctions, addr)];
+	memcpy(instr + 3, &addr, sizeof(int));
+	break;
+      }
+    }
   }
 
-  /* read header */
-  if(fread(&header, sizeof(GSByteCodeHeader), 1, inFile) != 1) {
-    instance->err = GUNDERSCRIPTERR_BAD_FILE_READ;
-    fclose(inFile);
-    return false;
+  /* the table of what is left */
+  for(i = 0, j = 0; i < *numFunctions; i++) {
+    if(live[i]) {
+      functions[j] = functions[i];
+      functions[j].index = newIndex[i];
+      j++;
+    }
   }
+  *numFunctions = j;
 
-  /* check for header */
-  if(strcmp(header.header, GS_BYTECODE_HEADER) != 0) {
-    instance->err = GUNDERSCRIPTERR_NOT_BYTECODE_FILE;
-    fclose(inFile);
-    return false;
-  }
+  free(newIndex);
+  return true;
+}
 
-  /* check that this build is the same as the one that created the file */
-  if(strcmp(header.buildDate, GUNDERSCRIPT_BUILD_DATE) != 0) {
-    instance->err = GUNDERSCRIPTERR_INCORRECT_RUNTIME_VERSION;
-    fclose(inFile);
-    return false;
+/**
+ * Builds the function table of the compiled code, and the code, for writing
+ * out. Functions that can never run may be left out, in which case the code
+ * is rearranged. Otherwise every function is included, not just the exported
+ * ones, so that the table describes the whole code. The table is sorted by
+ * offset.
+ * instance: a Gunderscript object.
+ * constants: receives the function names. Table entries refer to offsets in
+ * it.
+ * code: receives the code.
+ * prune: true to leave out the functions that exported functions can't call.
+ * numFunctions: receives the number of functions.
+ * returns: a new table that must be freed, or NULL if no code has been built
+ * or allocation fails. The instance's error is set on failure.
+ */
+static GSByteCodeFunc * gunderscript_function_table(Gunderscript * instance,
+						    Buffer * constants,
+						    Buffer * code, bool prune,
+						    int * numFunctions) {
+  GSByteCodeFunc * functions;
+  HTIter functionHTIter;
+  char * names;
+  bool * live;
+  int i;
+
+  *numFunctions = ht_size(vm_functions(instance->vm));
+  if(vm_bytecode_size(instance->vm) == 0 || *numFunctions < 1) {
+    instance->err = GUNDERSCRIPTERR_NO_SUCCESSFUL_BUILD;
+    return NULL;
   }
 
-  /* check that the number of functions isn't negative or zero */
-  if(header.numFunctions < 1) {
-    instance->err = GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
-    return false;
+  functions = calloc(*numFunctions, sizeof(GSByteCodeFunc));
+  if(functions == NULL) {
+    instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+    return NULL;
   }
 
-  /* import the exported functions definitions (script entry points) */
-  for(i = 0; i < header.numFunctions; i++) {
-    VMFunc * currentFunc = calloc(1, sizeof(VMFunc));
+  ht_iter_get(vm_functions(instance->vm), &functionHTIter);
+
+  /* fill in the function table */
+  for(i = 0; ht_iter_has_next(&functionHTIter); i++) {
+    DSValue value;
     char functionName[GS_MAX_FUNCTION_NAME_LEN];
-    char functionNameLen;
-    bool prevValue = false;
+    size_t functionNameLen;
+    VMFunc * function;
 
-    /* check if VMFunc alloc failed */
-    if(currentFunc == NULL) {
+    /* get the next item from hashtable */
+    ht_iter_next(&functionHTIter, functionName, GS_MAX_FUNCTION_NAME_LEN,
+		 &value, &functionNameLen, false);
+    function = value.pointerVal;
+
+    /* TODO: create an error handler case for this */
+    assert(functionNameLen < GS_MAX_FUNCTION_NAME_LEN);
+
+    /* store the name in the constant pool */
+    functions[i].nameOffset = buffer_size(constants);
+    functions[i].nameLen = functionNameLen;
+    if(!buffer_append_string(constants, functionName, functionNameLen)) {
+      free(functions);
       instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
-      fclose(inFile);
-      return false;
+      return NULL;
     }
 
-    /* read function name length */
-    if(fread(&functionNameLen, sizeof(char), 1, inFile) != 1) {
-      instance->err = GUNDERSCRIPTERR_BAD_FILE_READ;
-      return false;
-    }
+    functions[i].index = function->index;
+    functions[i].numArgs = function->numArgs;
+    functions[i].numVars = function->numVars;
+    functions[i].exported = function->exported;
+  }
 
-    /* check function name length */
-    if(functionNameLen > GS_MAX_FUNCTION_NAME_LEN) {
-      instance->err = GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
-      fclose(inFile);
-      return false;
-    }
+  /* functions are laid out one after another, so each one ends where the
+   * next one begins.
+   */
+  qsort(functions, *numFunctions, sizeof(GSByteCodeFunc),
+	gunderscript_func_compare);
+  for(i = 0; i < *numFunctions; i++) {
+    functions[i].codeLen = (i + 1 < *numFunctions ? functions[i + 1].index
+			    : (int)vm_bytecode_size(instance->vm))
+      - functions[i].index;
+  }
 
-    /* read function name */
-    if(fread(&functionName, sizeof(char), functionNameLen, inFile) 
-       != functionNameLen) {
-      instance->err = GUNDERSCRIPTERR_BAD_FILE_READ;
-      fclose(inFile);
-      return false;
-    }
-    
-    /* read from file into new VMFunc */
-    value.pointerVal = currentFunc;
-    if(fread(currentFunc, sizeof(VMFunc), 1, inFile) != 1) {
-      instance->err = GUNDERSCRIPTERR_BAD_FILE_READ;
-      fclose(inFile);
-      return false;
+  /* code that can't be followed is written as it is. vm_bytecode() can't be
+   * used here since resolving names during the build leaves the VM's error
+   * set.
+   */
+  live = malloc(*numFunctions * sizeof(bool));
+  names = malloc(buffer_size(constants));
+  if(live == NULL || names == NULL) {
+    free(functions);
+    free(live);
+    free(names);
+    instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+    return NULL;
+  }
+  if(!prune || !gunderscript_mark_live(vm_code(instance->vm), functions,
+				       *numFunctions, live)) {
+    for(i = 0; i < *numFunctions; i++) {
+      live[i] = true;
     }
+  }
 
-    /* put functions into VM functions hashtable */
-    if(!ht_put_raw_key(vm_functions(instance->vm), functionName, 
-		       functionNameLen, &value, NULL, &prevValue)) {
-      instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
-      fclose(inFile);
-      return false;
-    }
+  /* and the names of the functions that are left */
+  memcpy(names, buffer_get_buffer(constants), buffer_size(constants));
+  buffer_truncate(constants, 0);
+  if(!gunderscript_copy_live(vm_code(instance->vm), functions, numFunctions,
+			     live, code)) {
+    free(functions);
+    functions = NULL;
+  }
+  for(i = 0; functions != NULL && i < *numFunctions; i++) {
+    int nameOffset = functions[i].nameOffset;
 
-    /* check for duplicate function names */
-    if(prevValue) {
-      instance->err = GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
-      fclose(inFile);
-      return false;
+    functions[i].nameOffset = buffer_size(constants);
+    if(!buffer_append_string(constants, names + nameOffset,
+			     functions[i].nameLen)) {
+      free(functions);
+      functions = NULL;
     }
   }
 
-  /* make space in buffer for the bytecode */
-  if(!buffer_resize(vm_buffer(instance->vm), header.byteCodeLen)) {
+  if(functions == NULL) {
     instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
-    fclose(inFile);
-    return false;
   }
+  free(live);
+  free(names);
+  return functions;
+}
+
+/**
+ * Writes the compiled code to a bytecode file.
+ * instance: a Gunderscript object.
+ * fileName: the file. Caution: file will be overwritten.
+ * prune: true to leave out the functions that exported functions can't call.
+ * returns: true upon success, or false if file cannot be opened,
+ * no code has been built, or there was an error building code.
+ */
+static bool gunderscript_write_bytecode(Gunderscript * instance,
+					char * fileName, bool prune) {
+  FILE * outFile;
+  GSByteCodeHeader header;
+  GSByteCodeFunc * functions;
+  Buffer * constants;
+  Buffer * code;
+  int numFunctions;
+  bool success;
 
-  /* read raw bytecode from end of bytecode file */
-  {
-    int c, i;
-    for(i = 0; (c = fgetc(inFile)) != -1; i++) {
-      buffer_append_char(vm_buffer(instance->vm), (char)c);
+  constants = buffer_new(GS_MAX_FUNCTION_NAME_LEN * 16,
+			 GS_MAX_FUNCTION_NAME_LEN * 16);
+  code = buffer_new(vm_bytecode_size(instance->vm) + 1,
+		    vm_bytecode_size(instance->vm) + 1);
+  if(constants == NULL || code == NULL) {
+    if(constants != NULL) {
+      buffer_free(constants);
     }
+    if(code != NULL) {
+      buffer_free(code);
+    }
+    instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+    return false;
+  }
 
-    if(i != (header.byteCodeLen)) {
-      instance->err = GUNDERSCRIPTERR_BAD_FILE_READ;
-      fclose(inFile);
-      return false;
+  functions = gunderscript_function_table(instance, constants, code, prune,
+					  &numFunctions);
+  if(functions == NULL) {
+    buffer_free(constants);
+    buffer_free(code);
+    return false;
+  }
+
+  /* create header */
+  memset(&header, 0, sizeof(GSByteCodeHeader));
+  strcpy(header.header, GS_BYTECODE_HEADER);
+  strcpy(header.buildDate, GUNDERSCRIPT_BUILD_DATE);
+  header.version = GS_BYTECODE_VERSION;
+  header.headerSize = sizeof(GSByteCodeHeader);
+  header.numFunctions = numFunctions;
+  header.functionsOffset = GS_BYTECODE_ALIGN_UP(sizeof(GSByteCodeHeader));
+  header.constantsOffset = header.functionsOffset
+    + GS_BYTECODE_ALIGN_UP(numFunctions * sizeof(GSByteCodeFunc));
+  header.constantsLen = buffer_size(constants);
+  header.codeOffset = header.constantsOffset
+    + GS_BYTECODE_ALIGN_UP(header.constantsLen);
+  header.byteCodeLen = buffer_size(code);
+
+  /* write the sections */
+  outFile = fopen(fileName, "wb");
+  if(outFile == NULL) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_OPEN_WRITE;
+    success = false;
+  } else {
+    success = gunderscript_write_section(outFile, &header,
+					 sizeof(GSByteCodeHeader))
+      && gunderscript_write_section(outFile, functions,
+				    numFunctions * sizeof(GSByteCodeFunc))
+      && gunderscript_write_section(outFile, buffer_get_buffer(constants),
+				    header.constantsLen)
+      && gunderscript_write_section(outFile, buffer_get_buffer(code),
+				    header.byteCodeLen);
+
+    if(fclose(outFile) != 0) {
+      success = false;
+    }
+    if(!success) {
+      instance->err = GUNDERSCRIPTERR_BAD_FILE_WRITE;
     }
   }
 
-  fclose(inFile);
-  return true;
-}
+  free(functions);
+  buffer_free(constants);
+  buffer_free(code);
 
-GSAPI GunderscriptErr gunderscript_get_err(Gunderscript * instance) {
-  return instance->err;
+  return success;
 }
 
-static const char * err_to_string(GunderscriptErr err) {
-  return gunderscriptErrorMessages[err];
+/**
+ * Run after gunderscript_build_file() to export the compiled bytecode to an
+ * external bytecode file. The file can later be loaded with
+ * gunderscript_import_bytecode(), which maps it and runs it in place. Only
+ * the functions that exported functions can call are written.
+ * instance: a Gunderscript object.
+ * fileName: The name of the file to export to. Caution: file will be overwritten
+ * returns: true upon success, or false if file cannot be opened, 
+ * no code has been built, or there was an error building code.
+ */
+GSAPI bool gunderscript_export_bytecode(Gunderscript * instance, char * fileName) {
+  return gunderscript_write_bytecode(instance, fileName, true);
 }
 
 /**
- * Gets a textual error message representing the last error, if there is one.
- * instance: an instance of Gunderscript.
- * returns: an error message, or NULL if there are no errors.
+ * Writes an array of bytes as the body of a C array initializer.
+ * outFile: the file.
+ * data: the bytes.
+ * len: the length of data.
+ * returns: true upon success, and false if the write fails.
  */
-GSAPI const char * gunderscript_err_message(Gunderscript * instance) {
-  assert(instance != NULL);
+static bool gunderscript_write_c_bytes(FILE * outFile, char * data, size_t len) {
+  size_t i;
 
-  if(gunderscript_get_err(instance) == GUNDERSCRIPTERR_BUILDERR) {
-    assert(instance->compiler != NULL);
-    if(compiler_get_err(instance->compiler) == COMPILERERR_LEXER_ERR) {
-      return lexer_err_to_string(compiler_lex_err(instance->compiler));
-    } else {
-      return compiler_err_to_string(instance->compiler,
-				  compiler_get_err(instance->compiler));
+  for(i = 0; i < len; i++) {
+    if(fprintf(outFile, "%s%d,", i % 16 == 0 ? "\n  " : " ",
+	       (int)data[i]) < 0) {
+      return false;
     }
-  } else if(gunderscript_get_err(instance) == GUNDERSCRIPTERR_EXECERR) {
-    return vm_err_to_string(vm_get_err(instance->vm));
-  } else {
-    return err_to_string(gunderscript_get_err(instance));
   }
+  return fprintf(outFile, "\n") >= 0;
 }
 
 /**
- * Gets the line where the last known compiler error occurred.
- * instance: an instance of Gunderscript.
- * returns: a line number.
+ * Writes a compiled program as C source that defines a const GSStaticProgram
+ * named symbolName.
+ * instance: a Gunderscript object with a successful build.
+ * outFile: the file.
+ * symbolName: the name of the program in C.
+ * functions: the function table, sorted by index.
+ * numFunctions: the number of functions.
+ * constants: the function names.
+ * code: the code of the functions.
+ * returns: true upon success, and false if the write fails.
  */
-GSAPI int gunderscript_err_line(Gunderscript * instance) {
-  assert(instance != NULL);
-  assert(instance->compiler != NULL);
-  return compiler_err_line(instance->compiler);
+static bool gunderscript_write_c(Gunderscript * instance, FILE * outFile,
+				 char * symbolName, GSByteCodeFunc * functions,
+				 int numFunctions, Buffer * constants,
+				 Buffer * code) {
+  int i;
+  bool success;
+
+  /* code and names */
+  success = fprintf(outFile, "/* Gunderscript program %s. Generated by "
+		    "Gunderscript, do not edit. */\n\n"
+		    "#include \"gunderscript.h\"\n\n"
+		    "static const char %s_code[] = {", symbolName,
+		    symbolName) >= 0
+    && gunderscript_write_c_bytes(outFile, buffer_get_buffer(code),
+				  buffer_size(code))
+    && fprintf(outFile, "};\n\nstatic const char %s_constants[] = {",
+	       symbolName) >= 0
+    && gunderscript_write_c_bytes(outFile, buffer_get_buffer(constants),
+				  buffer_size(constants))
+    && fprintf(outFile, "};\n\nstatic const GSByteCodeFunc %s_functions[] = {\n",
+	       symbolName) >= 0;
+
+  /* function table */
+  for(i = 0; success && i < numFunctions; i++) {
+    success = fprintf(outFile, "  { %d, %d, %d, %d, %d, %d, %d, 0 },\n",
+		      functions[i].nameOffset, functions[i].nameLen,
+		      functions[i].index, functions[i].codeLen,
+		      functions[i].numArgs, functions[i].numVars,
+		      functions[i].exported) >= 0;
+  }
+
+  /* the program */
+  return success
+    && fprintf(outFile, "};\n\nconst GSStaticProgram %s = {\n"
+	       "  \"%s\", %d,\n"
+	       "  %s_code, sizeof(%s_code),\n"
+	       "  %s_constants, sizeof(%s_constants),\n"
+	       "  %s_functions, %d,\n"
+	       "  %d\n"
+	       "};\n", symbolName, GUNDERSCRIPT_BUILD_DATE, GS_BYTECODE_VERSION,
+	       symbolName, symbolName, symbolName, symbolName, symbolName,
+	       numFunctions,
+	       vm_verified(instance->vm) ? instance->vm->maxStack : -1) >= 0;
 }
 
 /**
- * Runs the specified Gunderscript "exported" function.
- * instance: an instance of Gunderscript.
- * entryPoint: the name of an entryPoint function to run.
- * entryPointLen: the length of entryPoint in chars.
- * returns: true if a success, and false if an error occurs.
+ * Exports the compiled code as a C source file, optionally with each
+ * function translated to C.
+ * instance: a Gunderscript object.
+ * fileName: the file. Caution: file will be overwritten.
+ * symbolName: the name of the program in C.
+ * aot: if true, the functions are translated to C.
+ * returns: true upon success.
  */
-GSAPI bool gunderscript_function(Gunderscript * instance, char * entryPoint,
-			   size_t entryPointLen) {
-  VMFunc * function;
+static bool gunderscript_export_source(Gunderscript * instance,
+				       char * fileName, char * symbolName,
+				       bool aot) {
+  FILE * outFile;
+  GSByteCodeFunc * functions;
+  Buffer * constants;
+  Buffer * code;
+  int numFunctions;
+  bool success;
 
-  /* get compiler function definitions */
-  function = vm_function(instance->vm, entryPoint, entryPointLen);
-  if(function == NULL) {
+  constants = buffer_new(GS_MAX_FUNCTION_NAME_LEN * 16,
+			 GS_MAX_FUNCTION_NAME_LEN * 16);
+  code = buffer_new(vm_bytecode_size(instance->vm) + 1,
+		    vm_bytecode_size(instance->vm) + 1);
+  if(constants == NULL || code == NULL) {
+    if(constants != NULL) {
+      buffer_free(constants);
+    }
+    if(code != NULL) {
+      buffer_free(code);
+    }
+    instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
     return false;
   }
-  
-  /* execute function in the virtual machine */
-  if(!vm_exec(instance->vm, vm_bytecode(instance->vm), 
-	      vm_bytecode_size(instance->vm), function->index,
-	      function->numArgs + function->numVars)) {
+
+  functions = gunderscript_function_table(instance, constants, code, true,
+					  &numFunctions);
+  if(functions == NULL) {
+    buffer_free(constants);
+    buffer_free(code);
     return false;
   }
 
-  return true;
+  outFile = fopen(fileName, "w");
+  if(outFile == NULL) {
+    free(functions);
+    buffer_free(constants);
+    buffer_free(code);
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_OPEN_WRITE;
+    return false;
+  }
+
+  success = gunderscript_write_c(instance, outFile, symbolName, functions,
+				 numFunctions, constants, code);
+
+  /* the translated functions and the symbol that gunderscript_load_aot()
+   * looks for.
+   */
+  if(aot) {
+    success = success
+      && aot_write_functions(instance->vm, buffer_get_buffer(code),
+			     buffer_size(code), outFile, symbolName, functions,
+			     numFunctions)
+      && fprintf(outFile, "\nconst GSAotProgram %s = { &%s, %s_compiled };\n",
+		 GS_AOT_SYMBOL, symbolName, symbolName) >= 0;
+  }
+
+  if(fclose(outFile) != 0) {
+    success = false;
+  }
+  if(!success) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_WRITE;
+  }
+
+  free(functions);
+  buffer_free(constants);
+  buffer_free(code);
+
+  return success;
+}
+
+/**
+ * Run after gunderscript_build_file() to export the compiled code as a C
+ * source file, so that it can be compiled into the host program and run with
+ * gunderscript_load_static(). The file defines a const GSStaticProgram named
+ * symbolName that holds the code, the function table and their names as
+ * read-only data. Loading it needs no file I/O or header checks, and the
+ * code is shared by every process that runs the same binary. Code that
+ * passed verification is marked as verified so that it is not verified
+ * again when it is loaded.
+ * instance: a Gunderscript object.
+ * fileName: The name of the file to export to. Caution: file will be
+ * overwritten.
+ * symbolName: the name of the program in C. Must be a valid C identifier.
+ * returns: true upon success, or false if file cannot be opened, no code has
+ * been built, or there was an error building code.
+ */
+GSAPI bool gunderscript_export_c(Gunderscript * instance, char * fileName,
+				 char * symbolName) {
+  return gunderscript_export_source(instance, fileName, symbolName, false);
+}
+
+/**
+ * Run after gunderscript_build_file() to compile the code ahead of time. The
+ * code is exported as with gunderscript_export_c(), along with a translation
+ * of each function into C. Compile the file into a shared library that can
+ * see the Gunderscript headers, for example with
+ * "cc -O2 -shared -fPIC -I include out.c -o out.so", and load it with
+ * gunderscript_load_aot(). The host must export the library's functions to
+ * it, by linking with -rdynamic or by linking the library against
+ * libgunderscript.so.
+ * instance: a Gunderscript object.
+ * fileName: The name of the file to export to. Caution: file will be
+ * overwritten.
+ * symbolName: a prefix for names in the C file. Must be a valid C identifier.
+ * returns: true upon success, or false if file cannot be opened, no code has
+ * been built, or the code did not verify.
+ */
+GSAPI bool gunderscript_export_aot(Gunderscript * instance, char * fileName,
+				   char * symbolName) {
+
+  /* translation relies on the verifier having checked the control flow */
+  if(!vm_verified(instance->vm)) {
+    instance->err = vm_bytecode_size(instance->vm) == 0
+      ? GUNDERSCRIPTERR_NO_SUCCESSFUL_BUILD
+      : GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
+    return false;
+  }
+
+  return gunderscript_export_source(instance, fileName, symbolName, true);
+}
+
+/**
+ * Maps a file into memory, read only. Where mapping is not available, the
+ * file is read into an allocated buffer instead.
+ * instance: an instance of Gunderscript, which receives any error.
+ * fileName: the file.
+ * file: receives the file's contents.
+ * fileLen: receives the length of the file.
+ * returns: true upon success, and false if the file cannot be read.
+ */
+static bool gunderscript_map_file(Gunderscript * instance, char * fileName,
+				  char ** file, size_t * fileLen) {
+#if defined(_WIN32)
+  FILE * inFile = fopen(fileName, "rb");
+  long len;
+
+  if(inFile == NULL) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_OPEN_READ;
+    return false;
+  }
+
+  if(fseek(inFile, 0, SEEK_END) != 0
+     || (len = ftell(inFile)) <= 0
+     || fseek(inFile, 0, SEEK_SET) != 0) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_READ;
+    fclose(inFile);
+    return false;
+  }
+
+  *file = malloc(len);
+  if(*file == NULL) {
+    instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+    fclose(inFile);
+    return false;
+  }
+
+  if(fread(*file, len, 1, inFile) != 1) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_READ;
+    free(*file);
+    fclose(inFile);
+    return false;
+  }
+
+  fclose(inFile);
+  *fileLen = len;
+  return true;
+#else
+  struct stat fileStat;
+  void * mapping;
+  int fd = open(fileName, O_RDONLY);
+
+  if(fd == -1) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_OPEN_READ;
+    return false;
+  }
+
+  if(fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_READ;
+    close(fd);
+    return false;
+  }
+
+  /* the mapping is shared with every other process that maps the file */
+  mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_READ;
+    return false;
+  }
+
+  *file = mapping;
+  *fileLen = fileStat.st_size;
+  return true;
+#endif
+}
+
+/**
+ * Releases a file loaded by gunderscript_map_file().
+ * file: the file's contents.
+ * fileLen: the length of the file.
+ */
+static void gunderscript_unmap_file(char * file, size_t fileLen) {
+#if defined(_WIN32)
+  free(file);
+#else
+  munmap(file, fileLen);
+#endif
+}
+
+/**
+ * Checks that a section lies within a bytecode file.
+ * fileLen: the length of the file.
+ * offset: the section's offset.
+ * len: the section's length.
+ * returns: true if the section is aligned and within the file.
+ */
+static bool gunderscript_check_section(size_t fileLen, int offset, int len) {
+  return offset >= 0 && len >= 0
+    && offset % GS_BYTECODE_ALIGN == 0
+    && (size_t)offset <= fileLen
+    && (size_t)len <= fileLen - offset;
+}
+
+/**
+ * Takes back a load that failed part way through: frees every function that
+ * it added to the VM and clears the code image, so that the instance can
+ * load something else.
+ * instance: an instance of Gunderscript.
+ */
+static void gunderscript_unload_functions(Gunderscript * instance) {
+  HTIter iter;
+
+  ht_iter_get(vm_functions(instance->vm), &iter);
+  while(ht_iter_has_next(&iter)) {
+    DSValue value;
+    ht_iter_next(&iter, NULL, 0, &value, NULL, true);
+    free(value.pointerVal);
+  }
+  vm_set_image(instance->vm, NULL, 0);
+}
+
+/**
+ * Checks that every function's name and code are within their sections.
+ * instance: an instance of Gunderscript, which receives any error.
+ * functions: the function table.
+ * numFunctions: the number of functions.
+ * constantsLen: the length of the function names section.
+ * codeLen: the length of the code.
+ * returns: true if every entry is within bounds.
+ */
+static bool gunderscript_check_functions(Gunderscript * instance,
+					 const GSByteCodeFunc * functions,
+					 int numFunctions, int constantsLen,
+					 int codeLen) {
+  int i;
+
+  for(i = 0; i < numFunctions; i++) {
+    const GSByteCodeFunc * function = &functions[i];
+
+    if(function->nameLen < 1
+       || function->nameLen >= GS_MAX_FUNCTION_NAME_LEN
+       || function->nameOffset < 0
+       || function->nameOffset > constantsLen - function->nameLen
+       || function->index < 0
+       || function->index >= codeLen
+       || function->codeLen < 0
+       || function->codeLen > codeLen - function->index
+       || function->numArgs < 0
+       || function->numVars < 0) {
+      instance->err = GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Checks the header and function table of a bytecode file.
+ * instance: an instance of Gunderscript, which receives any error.
+ * file: the file's contents.
+ * fileLen: the length of the file.
+ * returns: true if the file can be run by this build.
+ */
+static bool gunderscript_check_bytecode(Gunderscript * instance, char * file,
+					size_t fileLen) {
+  GSByteCodeHeader * header = (GSByteCodeHeader*)file;
+  GSByteCodeFunc * functions;
+
+  /* check for header */
+  if(fileLen < sizeof(GSByteCodeHeader)
+     || memcmp(header->header, GS_BYTECODE_HEADER,
+	       GS_BYTECODE_HEADER_SIZE) != 0) {
+    instance->err = GUNDERSCRIPTERR_NOT_BYTECODE_FILE;
+    return false;
+  }
+
+  /* check that this build is the same as the one that created the file */
+  if(header->version != GS_BYTECODE_VERSION
+     || strncmp(header->buildDate, GUNDERSCRIPT_BUILD_DATE,
+		GS_BYTECODE_BUILDDATE_SIZE) != 0) {
+    instance->err = GUNDERSCRIPTERR_INCORRECT_RUNTIME_VERSION;
+    return false;
+  }
+
+  /* check that the number of functions isn't negative or zero and that each
+   * section is within the file.
+   */
+  if(header->headerSize != sizeof(GSByteCodeHeader)
+     || header->numFunctions < 1
+     || header->byteCodeLen < 1
+     || header->numFunctions > (int)(fileLen / sizeof(GSByteCodeFunc))
+     || !gunderscript_check_section(fileLen, header->functionsOffset,
+				    header->numFunctions
+				    * sizeof(GSByteCodeFunc))
+     || !gunderscript_check_section(fileLen, header->constantsOffset,
+				    header->constantsLen)
+     || !gunderscript_check_section(fileLen, header->codeOffset,
+				    header->byteCodeLen)) {
+    instance->err = GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
+    return false;
+  }
+
+  functions = (GSByteCodeFunc*)(file + header->functionsOffset);
+  return gunderscript_check_functions(instance, functions,
+				      header->numFunctions,
+				      header->constantsLen, header->byteCodeLen);
+}
+
+/**
+ * Maps a bytecode file and imports its function table. The code is either
+ * verified as a whole and run in place, or loaded into the VM one function
+ * at a time as each is first called.
+ * instance: an instance of Gunderscript.
+ * fileName: the bytecode file.
+ * lazy: if true, functions are loaded on demand.
+ * returns: true upon success.
+ */
+static bool gunderscript_load_bytecode(Gunderscript * instance, char * fileName,
+				       bool lazy) {
+  GSByteCodeHeader * header;
+  GSByteCodeFunc * functions;
+  char * file;
+  size_t fileLen;
+  bool success = true;
+  int i;
+
+  if(instance->byteCode != NULL || vm_bytecode_size(instance->vm) > 0) {
+    instance->err = GUNDERSCRIPTERR_ALREADY_LOADED;
+    return false;
+  }
+
+  if(!gunderscript_map_file(instance, fileName, &file, &fileLen)) {
+    return false;
+  }
+
+  if(!gunderscript_check_bytecode(instance, file, fileLen)) {
+    gunderscript_unmap_file(file, fileLen);
+    return false;
+  }
+
+  /* the code section is run in place, or functions are loaded from it */
+  header = (GSByteCodeHeader*)file;
+  instance->byteCode = file;
+  instance->byteCodeLen = fileLen;
+  if(!lazy) {
+    vm_set_image(instance->vm, file + header->codeOffset, header->byteCodeLen);
+  }
+
+  /* import the function definitions (script entry points) */
+  functions = (GSByteCodeFunc*)(file + header->functionsOffset);
+  for(i = 0; success && i < header->numFunctions; i++) {
+    VMFunc * currentFunc;
+    DSValue value;
+    DSValue oldValue;
+    bool prevValue = false;
+
+    currentFunc = vmfunc_new(functions[i].index, functions[i].numArgs,
+			     functions[i].numVars, functions[i].exported != 0);
+    if(currentFunc == NULL) {
+      instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+      success = false;
+      break;
+    }
+    currentFunc->exported = functions[i].exported != 0;
+    currentFunc->codeLen = functions[i].codeLen;
+    currentFunc->loaded = !lazy;
+
+    /* put functions into VM functions hashtable */
+    value.pointerVal = currentFunc;
+    if(!ht_put_raw_key(vm_functions(instance->vm), 
+		       file + header->constantsOffset + functions[i].nameOffset,
+		       functions[i].nameLen, &value, &oldValue, &prevValue)) {
+      free(currentFunc);
+      instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+      success = false;
+    } else if(prevValue) {
+
+      /* duplicate function names */
+      free(oldValue.pointerVal);
+      instance->err = GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
+      success = false;
+    }
+  }
+
+  /* files can come from anywhere, so they must verify before they can run.
+   * lazily loaded functions are verified as they are loaded.
+   */
+  if(success && (lazy ? !vm_set_lazy_source(instance->vm,
+					    file + header->codeOffset,
+					    header->byteCodeLen)
+		 : !verifier_verify(instance->vm))) {
+    instance->err = vm_get_err(instance->vm) == VMERR_ALLOC_FAILED
+      ? GUNDERSCRIPTERR_ALLOC_FAILED : GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
+    success = false;
+  }
+
+  if(!success) {
+    gunderscript_unload_functions(instance);
+    instance->byteCode = NULL;
+    instance->byteCodeLen = 0;
+    gunderscript_unmap_file(file, fileLen);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Loads a bytecode file written by gunderscript_export_bytecode(). The file
+ * is mapped into memory and its code is run in place, without being copied,
+ * so loading is cheap regardless of the file's size and the pages are shared
+ * by every process that loads the same file. The file must not be modified
+ * while it is loaded. The instance must not have built or imported any other
+ * code.
+ * instance: an instance of Gunderscript.
+ * fileName: the bytecode file.
+ * returns: true upon success, and false if the file cannot be read or was
+ * created by a different build.
+ */
+GSAPI bool gunderscript_import_bytecode(Gunderscript * instance, char * fileName) {
+  return gunderscript_load_bytecode(instance, fileName, false);
+}
+
+/**
+ * Loads a bytecode file written by gunderscript_export_bytecode() without
+ * loading any of its code up front. Only the function table is read. Each
+ * function's code is copied out of the mapped file, verified and linked the
+ * first time it is called, so the time and memory spent scale with the
+ * functions that a script actually uses rather than with the size of the
+ * file. This suits large libraries of which each run uses a few functions.
+ * A function that fails verification fails the call with
+ * VMERR_VERIFY_FAILED. The file must not be modified while it is loaded.
+ * The instance must not have built or imported any other code.
+ * instance: an instance of Gunderscript.
+ * fileName: the bytecode file.
+ * returns: true upon success, and false if the file cannot be read or was
+ * created by a different build.
+ */
+GSAPI bool gunderscript_import_bytecode_lazy(Gunderscript * instance,
+					     char * fileName) {
+  return gunderscript_load_bytecode(instance, fileName, true);
+}
+
+/**
+ * Loads a program that was compiled into the host binary from a C file
+ * written by gunderscript_export_c(). The code is run straight from the
+ * program's read-only data, with no file I/O and no header checks. Code that
+ * was verified when it was exported is trusted and runs unchecked. The
+ * instance must not have built or imported any other code.
+ * instance: an instance of Gunderscript.
+ * program: the program.
+ * returns: true upon success, and false if the program was created by a
+ * different build or allocation fails.
+ */
+GSAPI bool gunderscript_load_static(Gunderscript * instance,
+				    const GSStaticProgram * program) {
+  bool success = true;
+  int i;
+
+  assert(program != NULL);
+
+  if(instance->byteCode != NULL || vm_bytecode_size(instance->vm) > 0) {
+    instance->err = GUNDERSCRIPTERR_ALREADY_LOADED;
+    return false;
+  }
+
+  /* the opcodes must be those of this build */
+  if(program->version != GS_BYTECODE_VERSION
+     || strcmp(program->buildDate, GUNDERSCRIPT_BUILD_DATE) != 0) {
+    instance->err = GUNDERSCRIPTERR_INCORRECT_RUNTIME_VERSION;
+    return false;
+  }
+
+  /* the function table decides where unchecked code is entered, so it is
+   * checked even though the program was built into the binary.
+   */
+  if(program->numFunctions < 1 || program->codeLen < 1
+     || !gunderscript_check_functions(instance, program->functions,
+				      program->numFunctions,
+				      program->constantsLen,
+				      program->codeLen)) {
+    instance->err = GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
+    return false;
+  }
+
+  /* the VM only reads its code image */
+  vm_set_image(instance->vm, (char*)program->code, program->codeLen);
+
+  /* import the function definitions (script entry points) */
+  for(i = 0; success && i < program->numFunctions; i++) {
+    const GSByteCodeFunc * function = &program->functions[i];
+    VMFunc * currentFunc;
+    DSValue value;
+    DSValue oldValue;
+    bool prevValue = false;
+
+    currentFunc = vmfunc_new(function->index, function->numArgs,
+			     function->numVars, function->exported != 0);
+    if(currentFunc == NULL) {
+      instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+      success = false;
+      break;
+    }
+    currentFunc->exported = function->exported != 0;
+    currentFunc->codeLen = function->codeLen;
+
+    /* put functions into VM functions hashtable */
+    value.pointerVal = currentFunc;
+    if(!ht_put_raw_key(vm_functions(instance->vm),
+		       (char*)program->constants + function->nameOffset,
+		       function->nameLen, &value, &oldValue, &prevValue)) {
+      free(currentFunc);
+      instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+      success = false;
+    } else if(prevValue) {
+
+      /* duplicate function names */
+      free(oldValue.pointerVal);
+      instance->err = GUNDERSCRIPTERR_CORRUPTED_BYTECODE;
+      success = false;
+    }
+  }
+
+  if(!success) {
+    gunderscript_unload_functions(instance);
+    return false;
+  }
+
+  if(program->maxStack >= 0) {
+    vm_set_verified(instance->vm, program->maxStack);
+  }
+
+  return true;
+}
+
+/**
+ * Sets a directory in which builds of script files are cached. A build of a
+ * script whose text, dependencies, runtime and native functions match a
+ * cached build is loaded from the cache instead of being compiled, and new
+ * builds are added to it. Only the first build into an instance is cached.
+ * The directory must exist and may be shared by many processes.
+ * instance: an instance of Gunderscript.
+ * dir: the directory, or NULL to stop caching.
+ * returns: true upon success, and false if allocation fails.
+ */
+GSAPI bool gunderscript_set_cache_dir(Gunderscript * instance, char * dir) {
+  char * newDir = NULL;
+
+  assert(instance != NULL);
+
+  if(dir != NULL) {
+    newDir = calloc(strlen(dir) + 1, sizeof(char));
+    if(newDir == NULL) {
+      instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+      return false;
+    }
+    strcpy(newDir, dir);
+  }
+
+  free(instance->cacheDir);
+  instance->cacheDir = newDir;
+  return true;
+}
+
+/**
+ * Loads a profile written by gunderscript_profile_write() to guide the
+ * optimizer in the builds that follow. Calls that ran often are inlined more
+ * eagerly, calls that never ran are left alone, and the branch that was
+ * taken most is laid out to fall through, with the other moved out of the
+ * way. The profile is part of the key of cached builds.
+ * instance: an instance of Gunderscript.
+ * fileName: the profile, or NULL to build without one.
+ * returns: true upon success, and false if the file can't be read or is not
+ * a profile.
+ */
+GSAPI bool gunderscript_set_profile(Gunderscript * instance, char * fileName) {
+  Profile * profile = NULL;
+
+  assert(instance != NULL);
+  assert(instance->compiler != NULL);
+
+  if(fileName != NULL && (profile = profile_load(fileName)) == NULL) {
+    instance->err = GUNDERSCRIPTERR_BAD_PROFILE;
+    return false;
+  }
+
+  if(instance->profile != NULL) {
+    profile_free(instance->profile);
+  }
+  instance->profile = profile;
+  compiler_set_profile(instance->compiler, profile);
+  return true;
+}
+
+/**
+ * Starts counting what the instance's calls run, to be written to a profile
+ * with gunderscript_profile_write(). Profiled calls are much slower: every
+ * instruction is counted, and functions compiled ahead of time are
+ * interpreted. The scripts should be built with an optimization level of 0,
+ * since the profile names instructions by where they are before they are
+ * optimized.
+ * instance: an instance of Gunderscript.
+ * returns: true upon success, and false if allocation fails.
+ */
+GSAPI bool gunderscript_profile_start(Gunderscript * instance) {
+  assert(instance != NULL);
+
+  if(instance->recorder == NULL
+     && (instance->recorder = profile_recorder_new()) == NULL) {
+    instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+    return false;
+  }
+
+  vm_set_profile(instance->vm, instance->recorder);
+  return true;
+}
+
+/**
+ * Writes what was counted since gunderscript_profile_start() to a profile
+ * file, to be loaded with gunderscript_set_profile() when the scripts are
+ * built for production. Counting continues.
+ * instance: an instance of Gunderscript.
+ * fileName: the file, which is replaced.
+ * returns: true upon success, and false if profiling wasn't started, an
+ * allocation failed while counting, or the file can't be written.
+ */
+GSAPI bool gunderscript_profile_write(Gunderscript * instance,
+				      char * fileName) {
+  assert(instance != NULL);
+  assert(fileName != NULL);
+
+  if(instance->recorder == NULL
+     || !profile_write(instance->recorder, instance->vm, fileName)) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_WRITE;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Gets the path of the cached build of a script file.
+ * instance: an instance of Gunderscript, with a cache directory.
+ * fileName: the script file.
+ * files: receives the names of the script and its dependencies.
+ * returns: the path, which must be freed, or NULL if the build can't be
+ * cached.
+ */
+static char * gunderscript_cache_path(Gunderscript * instance, char * fileName,
+				      Buffer * files) {
+  char key[BUILDCACHE_KEY_LEN + 1];
+  char * path;
+
+  if(!buildcache_key(instance->vm, fileName,
+		     compiler_opt_level(instance->compiler), instance->profile,
+		     key, files)) {
+    return NULL;
+  }
+
+  path = calloc(strlen(instance->cacheDir) + BUILDCACHE_KEY_LEN + 6,
+		sizeof(char));
+  if(path != NULL) {
+    sprintf(path, "%s/%s.gxb", instance->cacheDir, key);
+  }
+  return path;
+}
+
+/**
+ * Loads a cached build into an instance that has no code yet, as if the
+ * scripts had been compiled into it. The code is copied into the VM's
+ * bytecode buffer, so more scripts can be built after it, and it is
+ * verified since the file could have been changed.
+ * instance: an instance of Gunderscript.
+ * path: the cached build.
+ * files: the names of the scripts that the build contains.
+ * returns: true if the build was loaded, and false if there is no usable
+ * build, in which case the instance is left as it was.
+ */
+static bool gunderscript_load_cached(Gunderscript * instance, char * path,
+				     Buffer * files) {
+  GSByteCodeHeader * header;
+  GSByteCodeFunc * functions;
+  char * file;
+  char * fileName;
+  size_t fileLen;
+  bool success;
+  int i;
+
+  if(!gunderscript_map_file(instance, path, &file, &fileLen)) {
+    instance->err = GUNDERSCRIPTERR_SUCCESS;
+    return false;
+  }
+
+  header = (GSByteCodeHeader*)file;
+  success = gunderscript_check_bytecode(instance, file, fileLen)
+    && buffer_append_string(vm_buffer(instance->vm),
+			    file + header->codeOffset, header->byteCodeLen);
+  functions = (GSByteCodeFunc*)(file + (success ? header->functionsOffset : 0));
+
+  /* add the function definitions */
+  for(i = 0; success && i < header->numFunctions; i++) {
+    VMFunc * currentFunc;
+    DSValue value;
+    DSValue oldValue;
+    bool prevValue = false;
+
+    currentFunc = vmfunc_new(functions[i].index, functions[i].numArgs,
+			     functions[i].numVars, functions[i].exported != 0);
+    if(currentFunc == NULL) {
+      success = false;
+      break;
+    }
+    currentFunc->exported = functions[i].exported != 0;
+
+    value.pointerVal = currentFunc;
+    if(!ht_put_raw_key(vm_functions(instance->vm),
+		       file + header->constantsOffset + functions[i].nameOffset,
+		       functions[i].nameLen, &value, &oldValue, &prevValue)) {
+      free(currentFunc);
+      success = false;
+    } else if(prevValue) {
+
+      /* duplicate function names */
+      free(oldValue.pointerVal);
+      success = false;
+    }
+  }
+
+  /* files can be changed by anyone, so the code must verify */
+  success = success && verifier_verify(instance->vm);
+  gunderscript_unmap_file(file, fileLen);
+
+  if(!success) {
+    gunderscript_unload_functions(instance);
+    buffer_truncate(vm_buffer(instance->vm), 0);
+    vm_set_err(instance->vm, VMERR_SUCCESS);
+    instance->err = GUNDERSCRIPTERR_SUCCESS;
+    return false;
+  }
+
+  /* scripts that depend on these ones shouldn't build them again */
+  for(i = 0; i < buffer_size(files); i += strlen(fileName) + 1) {
+    fileName = buffer_get_buffer(files) + i;
+    compiler_mark_built(instance->compiler, fileName);
+  }
+
+  return true;
+}
+
+/**
+ * Adds a build to the cache. The build is written to a file of its own and
+ * then renamed into place, so that processes sharing the cache never see a
+ * partly written build. Failures are ignored since the cache is only an
+ * optimization.
+ * instance: an instance of Gunderscript with a successful build.
+ * path: the path of the cached build.
+ */
+static void gunderscript_store_cached(Gunderscript * instance, char * path) {
+  char * tempPath = calloc(strlen(path) + 24, sizeof(char));
+
+  if(tempPath == NULL) {
+    return;
+  }
+
+  sprintf(tempPath, "%s.%lu", path, (unsigned long)GS_PROCESS_ID());
+  /* scripts built on top of the cached ones may call any of their functions */
+  if(!gunderscript_write_bytecode(instance, tempPath, false)
+     || rename(tempPath, path) != 0) {
+    remove(tempPath);
+  }
+
+  free(tempPath);
+  instance->err = GUNDERSCRIPTERR_SUCCESS;
+}
+
+/**
+ * Same as gunderscript_build, but builds a file. If a cache directory is set
+ * with gunderscript_set_cache_dir(), a cached build is loaded instead of
+ * compiling when there is one.
+ * instance: an instance of Gunderscript.
+ * fileName: the file to build.
+ * returns: true upon success, and false upon failure.
+ */
+GSAPI bool gunderscript_build_file(Gunderscript * instance, char * fileName) {
+  Buffer * files = NULL;
+  char * cachePath = NULL;
+  bool result;
+
+  assert(instance != NULL);
+  assert(instance->compiler != NULL);
+
+  /* can't add to code that is running in place from a bytecode file */
+  if(instance->byteCode != NULL) {
+    instance->err = GUNDERSCRIPTERR_ALREADY_LOADED;
+    return false;
+  }
+
+  /* look for a cached build of the scripts */
+  if(instance->cacheDir != NULL && vm_bytecode_size(instance->vm) == 0) {
+    files = buffer_new(GS_MAX_FUNCTION_NAME_LEN * 4,
+		       GS_MAX_FUNCTION_NAME_LEN * 4);
+    cachePath = files != NULL
+      ? gunderscript_cache_path(instance, fileName, files) : NULL;
+    if(cachePath != NULL && gunderscript_load_cached(instance, cachePath,
+						     files)) {
+      free(cachePath);
+      buffer_free(files);
+      return true;
+    }
+  }
+
+  result = compiler_build_file(instance->compiler, fileName);
+  
+  if(!result) {
+    instance->err = GUNDERSCRIPTERR_BUILDERR;
+  } else {
+
+    /* code that verifies runs without per instruction checks. code that
+     * doesn't still runs, checked.
+     */
+    verifier_verify(instance->vm);
+    if(cachePath != NULL) {
+      gunderscript_store_cached(instance, cachePath);
+    }
+  }
+
+  free(cachePath);
+  if(files != NULL) {
+    buffer_free(files);
+  }
+  return result;
+}
+
+/**
+ * Loads a program compiled ahead of time by gunderscript_export_aot() from a
+ * shared library. Calls into the program run its C translation instead of
+ * being interpreted, except while an execution budget is set, since the
+ * translation can't be suspended. The library stays loaded until the
+ * instance is freed. The instance must not have built or imported any other
+ * code.
+ * instance: an instance of Gunderscript.
+ * libraryName: the path of the shared library.
+ * returns: true upon success, and false if the library can't be loaded, is
+ * not a compiled program, or was created by a different build.
+ */
+GSAPI bool gunderscript_load_aot(Gunderscript * instance, char * libraryName) {
+#if !defined(_WIN32)
+  const GSAotProgram * aotProgram;
+  void * library;
+  int i;
+
+  if(instance->byteCode != NULL || vm_bytecode_size(instance->vm) > 0) {
+    instance->err = GUNDERSCRIPTERR_ALREADY_LOADED;
+    return false;
+  }
+
+  library = dlopen(libraryName, RTLD_NOW | RTLD_LOCAL);
+  if(library == NULL) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_OPEN_READ;
+    return false;
+  }
+
+  aotProgram = dlsym(library, GS_AOT_SYMBOL);
+  if(aotProgram == NULL) {
+    dlclose(library);
+    instance->err = GUNDERSCRIPTERR_NOT_BYTECODE_FILE;
+    return false;
+  }
+
+  if(!gunderscript_load_static(instance, aotProgram->program)) {
+    dlclose(library);
+    return false;
+  }
+  instance->aotLibrary = library;
+
+  /* attach the translation of each function, exported or not */
+  for(i = 0; i < aotProgram->program->numFunctions; i++) {
+    const GSByteCodeFunc * function = &aotProgram->program->functions[i];
+    DSValue value;
+
+    if(ht_get_raw_key(vm_functions(instance->vm),
+		      (char*)aotProgram->program->constants
+		      + function->nameOffset, function->nameLen, &value)) {
+      ((VMFunc*)value.pointerVal)->compiled = aotProgram->compiled[i];
+    }
+  }
+
+  return true;
+#else
+  instance->err = GUNDERSCRIPTERR_BAD_FILE_OPEN_READ;
+  return false;
+#endif /* !defined(_WIN32) */
+}
+
+GSAPI GunderscriptErr gunderscript_get_err(Gunderscript * instance) {
+  return instance->err;
+}
+
+static const char * err_to_string(GunderscriptErr err) {
+  return gunderscriptErrorMessages[err];
+}
+
+/**
+ * Gets a textual error message representing the last error, if there is one.
+ * instance: an instance of Gunderscript.
+ * returns: an error message, or NULL if there are no errors.
+ */
+GSAPI const char * gunderscript_err_message(Gunderscript * instance) {
+  assert(instance != NULL);
+
+  if(gunderscript_get_err(instance) == GUNDERSCRIPTERR_BUILDERR) {
+    assert(instance->compiler != NULL);
+    if(compiler_get_err(instance->compiler) == COMPILERERR_LEXER_ERR) {
+      return lexer_err_to_string(compiler_lex_err(instance->compiler));
+    } else {
+      return compiler_err_to_string(instance->compiler,
+				  compiler_get_err(instance->compiler));
+    }
+  } else if(gunderscript_get_err(instance) == GUNDERSCRIPTERR_EXECERR) {
+    return vm_err_to_string(vm_get_err(instance->vm));
+  } else {
+    return err_to_string(gunderscript_get_err(instance));
+  }
+}
+
+/**
+ * Gets the line where the last known compiler error occurred.
+ * instance: an instance of Gunderscript.
+ * returns: a line number.
+ */
+GSAPI int gunderscript_err_line(Gunderscript * instance) {
+  assert(instance != NULL);
+  assert(instance->compiler != NULL);
+  return compiler_err_line(instance->compiler);
+}
+
+/**
+ * Runs the specified Gunderscript "exported" function. The return value of
+ * the function is discarded. To pass arguments or get the return value, use
+ * gunderscript_prepare() and gunderscript_call() instead.
+ * instance: an instance of Gunderscript.
+ * entryPoint: the name of an entryPoint function to run.
+ * entryPointLen: the length of entryPoint in chars.
+ * returns: true if a success, and false if an error occurs.
+ */
+GSAPI bool gunderscript_function(Gunderscript * instance, char * entryPoint,
+			   size_t entryPointLen) {
+  VMFunc * function;
+
+  /* get compiler function definitions */
+  function = gunderscript_prepare(instance, entryPoint, entryPointLen);
+  if(function == NULL) {
+    return false;
+  }
+  
+  /* execute function in the virtual machine. functions without arguments
+   * are entered the same way as prepared calls so that verified code runs
+   * unchecked. for the others, the arguments are left null. vm_code() is used
+   * since vm_bytecode() reports NULL while the VM holds an error, such as the
+   * one left behind by a preempted call.
+   */
+  if(function->numArgs == 0) {
+    if(!vm_call(instance->vm, function, NULL, 0, NULL)) {
+      instance->err = GUNDERSCRIPTERR_EXECERR;
+      return false;
+    }
+    return true;
+  }
+
+  if(!vm_load_function(instance->vm, function)
+     || !vm_exec(instance->vm, vm_code(instance->vm), 
+	      vm_bytecode_size(instance->vm), function->index,
+	      function->numArgs + function->numVars)) {
+    instance->err = GUNDERSCRIPTERR_EXECERR;
+    return false;
+  }
+
+  /* discard the return value */
+  vm_take_result(instance->vm, NULL);
+  return true;
+}
+
+/**
+ * Looks up an "exported" function once so that it can be called any number
+ * of times with gunderscript_call() without a lookup by name.
+ * instance: an instance of Gunderscript.
+ * entryPoint: the name of the function.
+ * entryPointLen: the length of entryPoint in chars.
+ * returns: a handle to the function that remains valid for the life of the
+ * instance, or NULL if there is no such exported function.
+ */
+GSAPI VMFunc * gunderscript_prepare(Gunderscript * instance, char * entryPoint,
+				    size_t entryPointLen) {
+  VMFunc * function;
+
+  assert(instance != NULL);
+  assert(entryPoint != NULL);
+
+  function = vm_function(instance->vm, entryPoint, entryPointLen);
+  if(function == NULL) {
+    instance->err = GUNDERSCRIPTERR_NO_SUCH_FUNCTION;
+    return NULL;
+  }
+
+  return function;
+}
+
+/**
+ * Calls a function prepared with gunderscript_prepare().
+ * instance: an instance of Gunderscript.
+ * function: the function handle.
+ * args: an array of numArgs arguments, created with vmarg_set_*().
+ * numArgs: the number of arguments, which must match the declaration.
+ * result: receives the return value, or NULL to discard it. Strings and other
+ * objects returned this way must be released with vmarg_release().
+ * returns: true if a success, and false if an error occurs.
+ */
+GSAPI bool gunderscript_call(Gunderscript * instance, VMFunc * function,
+			     VMArg * args, int numArgs, VMArg * result) {
+  assert(instance != NULL);
+  assert(function != NULL);
+
+  if(!vm_call(instance->vm, function, args, numArgs, result)) {
+    instance->err = GUNDERSCRIPTERR_EXECERR;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Calls a function prepared with gunderscript_prepare() once for every record
+ * in an array of argument tuples.
+ * instance: an instance of Gunderscript.
+ * function: the function handle.
+ * args: numRecords tuples of arguments, one after another. Each tuple has as
+ * many arguments as the function declares.
+ * numRecords: the number of records.
+ * results: an array of numRecords values that receive the return values, or
+ * NULL to discard them. Objects must be released with vmarg_release().
+ * errors: an array of numRecords VMErr that receive each record's error, or
+ * NULL. Records skipped after a failure receive VMERR_NOT_RUN.
+ * continueOnError: if true, keep going after a record fails.
+ * returns: true if all records succeeded, and false if any failed.
+ */
+GSAPI bool gunderscript_call_batch(Gunderscript * instance, VMFunc * function,
+				   VMArg * args, int numRecords, VMArg * results,
+				   VMErr * errors, bool continueOnError) {
+  assert(instance != NULL);
+  assert(function != NULL);
+
+  if(!vm_call_batch(instance->vm, function, args, numRecords,
+		    results, errors, continueOnError)) {
+    instance->err = GUNDERSCRIPTERR_EXECERR;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Converts a snapshot error to a Gunderscript error.
+ * err: the snapshot error.
+ * returns: the Gunderscript error.
+ */
+static GunderscriptErr gunderscript_snapshot_err(SnapshotErr err) {
+  switch(err) {
+  case SNAPSHOTERR_UNSUPPORTED_TYPE:
+    return GUNDERSCRIPTERR_SNAPSHOT_UNSUPPORTED;
+  case SNAPSHOTERR_CORRUPTED:
+    return GUNDERSCRIPTERR_BAD_SNAPSHOT;
+  default:
+    return GUNDERSCRIPTERR_ALLOC_FAILED;
+  }
+}
+
+/**
+ * Runs an init function that takes no arguments, and saves the value that it
+ * returns, along with every string and array reachable from it, to a
+ * snapshot file. Restoring the snapshot with gunderscript_restore() gives a
+ * new instance the same state without running init again.
+ * instance: an instance of Gunderscript.
+ * entryPoint: the name of the exported init function.
+ * entryPointLen: the length of entryPoint in chars.
+ * fileName: the snapshot file.
+ * state: receives the value, or NULL to discard it. Objects must be released
+ * with vmarg_release().
+ * returns: true if a success, and false if init fails, if its value holds an
+ * object other than strings and arrays, or if the file can't be written.
+ */
+GSAPI bool gunderscript_snapshot(Gunderscript * instance, char * entryPoint,
+				 size_t entryPointLen, char * fileName,
+				 VMArg * state) {
+  VMFunc * function;
+  VMArg value;
+  SnapshotErr err;
+  Buffer * image;
+  FILE * outFile;
+  bool success;
+
+  assert(instance != NULL);
+  assert(fileName != NULL);
+
+  function = gunderscript_prepare(instance, entryPoint, entryPointLen);
+  if(function == NULL || !gunderscript_call(instance, function, NULL, 0,
+					    &value)) {
+    return false;
+  }
+
+  image = buffer_new(sizeof(SnapshotHeader) * 16, sizeof(SnapshotHeader) * 16);
+  if(image == NULL) {
+    instance->err = GUNDERSCRIPTERR_ALLOC_FAILED;
+    vmarg_release(instance->vm, &value);
+    return false;
+  }
+
+  success = snapshot_write(instance->vm, &value, image, &err);
+  if(!success) {
+    instance->err = gunderscript_snapshot_err(err);
+  } else if((outFile = fopen(fileName, "wb")) == NULL) {
+    instance->err = GUNDERSCRIPTERR_BAD_FILE_OPEN_WRITE;
+    success = false;
+  } else {
+    success = fwrite(buffer_get_buffer(image), buffer_size(image), 1,
+		     outFile) == 1;
+    if(fclose(outFile) != 0) {
+      success = false;
+    }
+    if(!success) {
+      instance->err = GUNDERSCRIPTERR_BAD_FILE_WRITE;
+    }
+  }
+  buffer_free(image);
+
+  if(success && state != NULL) {
+    *state = value;
+  } else {
+    vmarg_release(instance->vm, &value);
+  }
+  return success;
+}
+
+/**
+ * Restores the state saved by gunderscript_snapshot(). The instance doesn't
+ * need to hold any code, but the state is meant to be passed as an argument
+ * to functions of the same script with gunderscript_call().
+ * instance: an instance of Gunderscript.
+ * fileName: the snapshot file.
+ * state: receives the value. Objects must be released with vmarg_release().
+ * returns: true if a success, and false if the file can't be read or isn't a
+ * valid snapshot.
+ */
+GSAPI bool gunderscript_restore(Gunderscript * instance, char * fileName,
+				VMArg * state) {
+  SnapshotErr err;
+  char * image;
+  size_t imageLen;
+  bool success;
+
+  assert(instance != NULL);
+  assert(fileName != NULL);
+  assert(state != NULL);
+
+  if(!gunderscript_map_file(instance, fileName, &image, &imageLen)) {
+    return false;
+  }
+
+  success = snapshot_read(instance->vm, image, imageLen, state, &err);
+  if(!success) {
+    instance->err = gunderscript_snapshot_err(err);
+  }
+
+  gunderscript_unmap_file(image, imageLen);
+  return success;
+}
+
+/**
+ * Limits how long each call to gunderscript_function() or
+ * gunderscript_resume() may run before it is preempted. A preempted call
+ * returns false with gunderscript_function_err() returning
+ * VMERR_BUDGET_EXHAUSTED and can be continued later with gunderscript_resume().
+ * instance: an instance of Gunderscript.
+ * maxInstructions: instructions per call, or 0 for no limit.
+ * maxMicros: microseconds per call, or 0 for no limit.
+ */
+GSAPI void gunderscript_set_budget(Gunderscript * instance, long maxInstructions,
+				   long maxMicros) {
+  assert(instance != NULL);
+  vm_set_budget(instance->vm, maxInstructions, maxMicros);
+}
+
+/**
+ * Continues a call that was preempted because its budget ran out.
+ * instance: an instance of Gunderscript.
+ * result: receives the return value once the function completes, or NULL to
+ * discard it. Objects must be released with vmarg_release().
+ * returns: true if the function ran to completion, and false if an error
+ * occurred or the budget ran out again.
+ */
+GSAPI bool gunderscript_resume(Gunderscript * instance, VMArg * result) {
+  assert(instance != NULL);
+  assert(gunderscript_suspended(instance));
+
+  if(!vm_resume(instance->vm)) {
+    instance->err = GUNDERSCRIPTERR_EXECERR;
+    return false;
+  }
+
+  vm_take_result(instance->vm, result);
+  return true;
+}
+
+/**
+ * Checks if the last call was preempted and can be continued with
+ * gunderscript_resume().
+ * instance: an instance of Gunderscript.
+ * returns: true if there is a suspended call.
+ */
+GSAPI bool gunderscript_suspended(Gunderscript * instance) {
+  assert(instance != NULL);
+  return vm_suspended(instance->vm);
 }
 
 /**
@@ -473,6 +2013,19 @@ GSAPI VMErr gunderscript_function_err(Gunderscript * instance) {
   return vm_get_err(instance->vm);
 }
 
+/**
+ * Resets an instance to the state it was in after its scripts were built or
+ * its bytecode was imported, keeping all of its allocations. This is much
+ * cheaper than freeing the instance and creating a new one.
+ * instance: an instance of Gunderscript.
+ */
+GSAPI void gunderscript_reset(Gunderscript * instance) {
+  assert(instance != NULL);
+
+  vm_reset(instance->vm);
+  instance->err = GUNDERSCRIPTERR_SUCCESS;
+}
+
 /**
  * Frees a Gunderscript object.
  * instance: an instance of Gunderscript.
@@ -487,6 +2040,28 @@ GSAPI void gunderscript_free(Gunderscript * instance) {
   if(instance->vm != NULL) {
     vm_free(instance->vm);
   }
+
+  /* the VM may have been running an imported file in place */
+  if(instance->byteCode != NULL) {
+    gunderscript_unmap_file(instance->byteCode, instance->byteCodeLen);
+  }
+
+  free(instance->cacheDir);
+
+  /* the profiles that the compiler and the VM used */
+  if(instance->profile != NULL) {
+    profile_free(instance->profile);
+  }
+  if(instance->recorder != NULL) {
+    profile_recorder_free(instance->recorder);
+  }
+
+#if !defined(_WIN32)
+  /* the compiled functions that the VM used */
+  if(instance->aotLibrary != NULL) {
+    dlclose(instance->aotLibrary);
+  }
+#endif /* !defined(_WIN32) */
 }
 
 /**
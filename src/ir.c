@@ -0,0 +1,575 @@
+/**
+ * ir.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * The compiler's intermediate representation. The parsers write each
+ * function's bytecode in a single pass, which leaves no room to improve it,
+ * so once a function is complete its code is lifted into a list of
+ * instructions whose jumps refer to other instructions rather than to
+ * addresses. The optimization passes rewrite that list, and it is lowered
+ * back into bytecode at the same address, with jump addresses recomputed.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ir.h"
+#include "verifier.h"
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Checks if an opcode is a jump.
+ * op: the opcode.
+ * returns: true if the instruction's operand is a jump address.
+ */
+static bool ir_is_jump(char op) {
+  return op == OP_GOTO || op == OP_TCOND_GOTO || op == OP_FCOND_GOTO
+    || op == OP_FOR_STEP || op == OP_FOR_STEP_NUM;
+}
+
+/**
+ * Gets the number of entries of the table of OP_GOTOs that follows an
+ * OP_SWITCH_NUM, other than the first, which it falls through to.
+ * instr: the instruction.
+ * returns: the number of entries.
+ */
+static int ir_switch_entries(IRInstr * instr) {
+  int count;
+
+  memcpy(&count, instr->args + 2 + sizeof(double), sizeof(int));
+  return count;
+}
+
+/**
+ * Gets the length of an instruction's bytecode.
+ * func: the function.
+ * instr: the instruction.
+ * returns: the length in bytes, which is 0 for IR_NOP.
+ */
+static int ir_instr_len(IRFunc * func, IRInstr * instr) {
+  if(instr->op == IR_NOP) {
+    return 0;
+  } else if(ir_is_jump(instr->op)) {
+    return 1 + instr->argsLen + sizeof(int);
+  } else if(instr->op == OP_STR_PUSH) {
+    return 2 + instr->args[0];
+  }
+  return 1 + instr->argsLen;
+}
+
+/**
+ * Frees a function in the intermediate representation.
+ * func: the function.
+ */
+void ir_free(IRFunc * func) {
+  assert(func != NULL);
+
+  free(func->code);
+  free(func->source);
+  free(func);
+}
+
+/**
+ * Lifts a function's bytecode into the intermediate representation.
+ * byteCode: the bytecode buffer.
+ * start: the address of the function.
+ * end: the address after its last instruction.
+ * returns: the function, to be freed with ir_free(), or NULL if an
+ * allocation fails or the code is malformed.
+ */
+IRFunc * ir_lift(char * byteCode, int start, int end) {
+  IRFunc * func;
+  IRInstr * instr;
+  int * instrAt;
+  int index;
+  int len;
+  int i;
+
+  assert(byteCode != NULL);
+  assert(start < end);
+
+  /* every instruction is at least a byte long */
+  func = calloc(1, sizeof(IRFunc));
+  instrAt = malloc((end - start + 1) * sizeof(int));
+  if(func == NULL || instrAt == NULL
+     || (func->code = malloc((end - start) * sizeof(IRInstr))) == NULL
+     || (func->source = malloc(end - start)) == NULL) {
+    if(func != NULL) {
+      ir_free(func);
+    }
+    free(instrAt);
+    return NULL;
+  }
+  func->capacity = end - start;
+  func->start = start;
+  func->sourceLen = end - start;
+  memcpy(func->source, byteCode + start, end - start);
+
+  /* instruction at each address, or -1 within an instruction */
+  for(i = 0; i <= end - start; i++) {
+    instrAt[i] = -1;
+  }
+
+  for(index = start; index < end; index += len) {
+    len = verifier_op_len(byteCode, end, index);
+    if(len < 1 || len > end - index) {
+      free(instrAt);
+      ir_free(func);
+      return NULL;
+    }
+
+    instr = &func->code[func->size];
+    instrAt[index - start] = func->size;
+    instr->op = byteCode[index];
+    instr->target = -1;
+    instr->string = -1;
+    instr->origin = index - start + 1;
+
+    if(ir_is_jump(instr->op)) {
+      /* the address, until every instruction's index is known */
+      memcpy(&instr->target, byteCode + index + len - sizeof(int),
+	     sizeof(int));
+      instr->argsLen = len - 1 - sizeof(int);
+      memcpy(instr->args, byteCode + index + 1, instr->argsLen);
+    } else if(instr->op == OP_STR_PUSH) {
+      instr->args[0] = byteCode[index + 1];
+      instr->argsLen = 1;
+      instr->string = index + 2 - start;
+    } else {
+      instr->argsLen = len - 1;
+      memcpy(instr->args, byteCode + index + 1, len - 1);
+    }
+    func->size++;
+  }
+  instrAt[end - start] = func->size;
+
+  /* jumps refer to instructions, or to the end of the function */
+  for(i = 0; i < func->size; i++) {
+    instr = &func->code[i];
+    if(!ir_is_jump(instr->op)) {
+      continue;
+    }
+    if(instr->target < start || instr->target > end
+       || instrAt[instr->target - start] == -1) {
+      free(instrAt);
+      ir_free(func);
+      return NULL;
+    }
+    instr->target = instrAt[instr->target - start];
+  }
+
+  free(instrAt);
+  return func;
+}
+
+/**
+ * Lowers a function in the intermediate representation to bytecode.
+ * func: the function.
+ * out: the bytecode buffer, which must end at the function's address.
+ * returns: true upon success, and false if an allocation fails.
+ */
+bool ir_lower(IRFunc * func, Buffer * out) {
+  IRInstr * instr;
+  int * address;
+  int i;
+  bool success = true;
+
+  assert(func != NULL);
+  assert(out != NULL);
+  assert(buffer_size(out) == func->start);
+
+  address = malloc((func->size + 1) * sizeof(int));
+  if(address == NULL) {
+    return false;
+  }
+
+  /* a removed instruction has the address of the one after it */
+  address[0] = func->start;
+  for(i = 0; i < func->size; i++) {
+    address[i + 1] = address[i] + ir_instr_len(func, &func->code[i]);
+  }
+
+  for(i = 0; success && i < func->size; i++) {
+    instr = &func->code[i];
+    if(instr->op == IR_NOP) {
+      continue;
+    }
+
+    success = buffer_append_char(out, instr->op)
+      && buffer_append_string(out, instr->args, instr->argsLen);
+    if(ir_is_jump(instr->op)) {
+      success = success
+	&& buffer_append_string(out, (char*)&address[instr->target],
+				sizeof(int));
+    } else if(instr->op == OP_STR_PUSH) {
+      success = success
+	&& buffer_append_string(out, func->source + instr->string,
+				instr->args[0]);
+    }
+  }
+
+  free(address);
+  return success;
+}
+
+/**
+ * Adds text to a function's source, so that an OP_STR_PUSH can refer to it.
+ * func: the function.
+ * string: the text.
+ * len: the length of the text.
+ * returns: the text's offset in func->source, or -1 if an allocation fails.
+ */
+int ir_add_string(IRFunc * func, char * string, int len) {
+  char * source;
+  int offset;
+
+  assert(func != NULL);
+  assert(string != NULL || len == 0);
+
+  source = realloc(func->source, func->sourceLen + len);
+  if(source == NULL) {
+    return -1;
+  }
+
+  offset = func->sourceLen;
+  memcpy(source + offset, string, len);
+  func->source = source;
+  func->sourceLen += len;
+  return offset;
+}
+
+/**
+ * Adds an instruction to the end of a function.
+ * func: the function.
+ * instr: the instruction, which is copied.
+ * returns: true upon success, and false if an allocation fails.
+ */
+bool ir_append(IRFunc * func, IRInstr * instr) {
+  assert(func != NULL);
+  assert(instr != NULL);
+
+  if(func->size == func->capacity) {
+    int capacity = func->capacity > 0 ? func->capacity * 2 : 16;
+    IRInstr * code = realloc(func->code, capacity * sizeof(IRInstr));
+
+    if(code == NULL) {
+      return false;
+    }
+    func->code = code;
+    func->capacity = capacity;
+  }
+
+  func->code[func->size++] = *instr;
+  return true;
+}
+
+/**
+ * Replaces zero or one instructions of a function with the code of another.
+ * Jumps within the inserted code to its end go to the instruction after it.
+ * func: the function.
+ * index: the instruction to replace or insert before.
+ * removed: the number of instructions replaced, 0 or 1.
+ * insert: the code to insert, which is left unchanged.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool ir_replace(IRFunc * func, int index, int removed,
+		       IRFunc * insert) {
+  int size = func->size - removed + insert->size;
+  int offset = 0;
+  int i;
+
+  assert(func != NULL);
+  assert(insert != NULL);
+  assert(index >= 0 && index + removed <= func->size);
+
+  if(size > func->capacity) {
+    IRInstr * code = realloc(func->code, size * sizeof(IRInstr));
+
+    if(code == NULL) {
+      return false;
+    }
+    func->code = code;
+    func->capacity = size;
+  }
+
+  /* the inserted code's strings */
+  if(insert->sourceLen > 0
+     && (offset = ir_add_string(func, insert->source,
+				insert->sourceLen)) == -1) {
+    return false;
+  }
+
+  for(i = 0; i < func->size; i++) {
+    if(ir_is_jump(func->code[i].op)
+       && func->code[i].target >= index + removed) {
+      func->code[i].target += insert->size - removed;
+    }
+  }
+
+  memmove(func->code + index + insert->size, func->code + index + removed,
+	  (func->size - index - removed) * sizeof(IRInstr));
+  for(i = 0; i < insert->size; i++) {
+    IRInstr * instr = &func->code[index + i];
+
+    *instr = insert->code[i];
+    if(ir_is_jump(instr->op)) {
+      instr->target += index;
+    } else if(instr->op == OP_STR_PUSH) {
+      instr->string += offset;
+    }
+  }
+  func->size = size;
+  return true;
+}
+
+/**
+ * Replaces an instruction of a function with the code of another. Jumps to
+ * the instruction go to the first instruction inserted, and jumps within the
+ * inserted code to its end go to the instruction after it.
+ * func: the function.
+ * index: the instruction to replace.
+ * insert: the code to insert in its place, which is left unchanged.
+ * returns: true upon success, and false if an allocation fails.
+ */
+bool ir_splice(IRFunc * func, int index, IRFunc * insert) {
+  assert(index < func->size);
+
+  return ir_replace(func, index, 1, insert);
+}
+
+/**
+ * Inserts the code of another function before an instruction. Jumps to the
+ * instruction still go to it, after the inserted code.
+ * func: the function.
+ * index: the instruction to insert before, or the size to append.
+ * insert: the code to insert, which is left unchanged.
+ * returns: true upon success, and false if an allocation fails.
+ */
+bool ir_insert(IRFunc * func, int index, IRFunc * insert) {
+  return ir_replace(func, index, 0, insert);
+}
+
+/**
+ * Drops the instructions that passes replaced with IR_NOP. Jumps to them go
+ * to the instruction after them.
+ * func: the function.
+ * returns: true upon success, and false if an allocation fails.
+ */
+bool ir_compact(IRFunc * func) {
+  int * newIndex;
+  int i;
+  int size = 0;
+
+  assert(func != NULL);
+
+  newIndex = malloc((func->size + 1) * sizeof(int));
+  if(newIndex == NULL) {
+    return false;
+  }
+
+  for(i = 0; i < func->size; i++) {
+    newIndex[i] = size;
+    if(func->code[i].op != IR_NOP) {
+      func->code[size++] = func->code[i];
+    }
+  }
+  newIndex[func->size] = size;
+  func->size = size;
+
+  for(i = 0; i < func->size; i++) {
+    if(ir_is_jump(func->code[i].op)) {
+      func->code[i].target = newIndex[func->code[i].target];
+    }
+  }
+
+  free(newIndex);
+  return true;
+}
+
+/**
+ * Moves instructions to the end of a function. Jumps to them still go to
+ * them, but the code only runs the same if the instruction before them and
+ * the last of them don't fall through, and nothing falls through to the end
+ * of the function.
+ * func: the function.
+ * from: the first instruction to move.
+ * to: the instruction after the last one to move.
+ * returns: true upon success, and false if an allocation fails.
+ */
+bool ir_move(IRFunc * func, int from, int to) {
+  IRInstr * moved;
+  int * newIndex;
+  int count = to - from;
+  int i;
+
+  assert(func != NULL);
+  assert(from >= 0 && from <= to && to <= func->size);
+
+  moved = malloc((count + 1) * sizeof(IRInstr));
+  newIndex = malloc((func->size + 1) * sizeof(int));
+  if(moved == NULL || newIndex == NULL) {
+    free(moved);
+    free(newIndex);
+    return false;
+  }
+
+  for(i = 0; i <= func->size; i++) {
+    if(i < from || i == func->size) {
+      newIndex[i] = i;
+    } else if(i < to) {
+      newIndex[i] = func->size - count + i - from;
+    } else {
+      newIndex[i] = i - count;
+    }
+  }
+
+  memcpy(moved, func->code + from, count * sizeof(IRInstr));
+  memmove(func->code + from, func->code + to,
+	  (func->size - to) * sizeof(IRInstr));
+  memcpy(func->code + func->size - count, moved, count * sizeof(IRInstr));
+
+  for(i = 0; i < func->size; i++) {
+    if(ir_is_jump(func->code[i].op)) {
+      func->code[i].target = newIndex[func->code[i].target];
+    }
+  }
+
+  free(moved);
+  free(newIndex);
+  return true;
+}
+
+/**
+ * Finds the frame that is live before each instruction of a function, by
+ * following its control flow. The function's own frame is frame 0, and the
+ * frame pushed by the OP_FRM_PUSH at instruction i is frame i + 1.
+ * func: the function.
+ * frame: receives the live frame before each of the func->size
+ * instructions, or -1 if the instruction cannot be reached.
+ * parent: receives the frame that encloses each of the func->size + 1
+ * frames, or -1 for frame 0 and frames that are never pushed.
+ * returns: true upon success, and false if an allocation fails.
+ */
+bool ir_frames(IRFunc * func, int * frame, int * parent) {
+  int * pending;
+  int numPending = 0;
+  int i;
+
+  assert(func != NULL);
+  assert(frame != NULL);
+  assert(parent != NULL);
+
+  pending = malloc((func->size + 1) * sizeof(int));
+  if(pending == NULL) {
+    return false;
+  }
+
+  for(i = 0; i < func->size; i++) {
+    frame[i] = -1;
+    parent[i + 1] = -1;
+  }
+  parent[0] = -1;
+
+  if(func->size > 0) {
+    frame[0] = 0;
+    pending[numPending++] = 0;
+  }
+
+  while(numPending > 0) {
+    IRInstr * instr;
+    int next;
+
+    i = pending[--numPending];
+    instr = &func->code[i];
+    next = frame[i];
+
+    if(instr->op == OP_FRM_PUSH) {
+      parent[i + 1] = frame[i];
+      next = i + 1;
+    } else if(instr->op == OP_FRM_POP) {
+      /* popping the function's frame returns from it */
+      next = parent[frame[i]];
+    } else if(instr->op == OP_RETURN) {
+      next = -1;
+    }
+    if(next == -1) {
+      continue;
+    }
+
+    /* the verifier checks that every path to an instruction agrees */
+    if(instr->op != OP_GOTO && i + 1 < func->size && frame[i + 1] == -1) {
+      frame[i + 1] = next;
+      pending[numPending++] = i + 1;
+    }
+    if(ir_is_jump(instr->op) && instr->target < func->size
+       && frame[instr->target] == -1) {
+      frame[instr->target] = next;
+      pending[numPending++] = instr->target;
+    }
+
+    /* a switch goes to any entry of its table */
+    if(instr->op == OP_SWITCH_NUM) {
+      int entries = ir_switch_entries(instr);
+      int j;
+
+      for(j = i + 2; j <= i + 1 + entries && j < func->size; j++) {
+	if(frame[j] == -1) {
+	  frame[j] = next;
+	  pending[numPending++] = j;
+	}
+      }
+    }
+  }
+
+  free(pending);
+  return true;
+}
+
+/**
+ * Counts the jumps to each instruction of a function. An instruction that
+ * is jumped to can be reached other than from the instruction before it.
+ * func: the function.
+ * returns: an array of func->size + 1 counts, the last of which is the jumps
+ * to the end of the function, to be freed with free(), or NULL if the
+ * allocation fails.
+ */
+int * ir_jump_counts(IRFunc * func) {
+  int * counts;
+  int i;
+
+  assert(func != NULL);
+
+  counts = calloc(func->size + 1, sizeof(int));
+  if(counts == NULL) {
+    return NULL;
+  }
+
+  for(i = 0; i < func->size; i++) {
+    if(func->code[i].op != IR_NOP && ir_is_jump(func->code[i].op)) {
+      counts[func->code[i].target]++;
+    } else if(func->code[i].op == OP_SWITCH_NUM) {
+      int entries = ir_switch_entries(&func->code[i]);
+      int j;
+
+      for(j = i + 2; j <= i + 1 + entries && j <= func->size; j++) {
+	counts[j]++;
+      }
+    }
+  }
+  return counts;
+}
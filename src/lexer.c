@@ -15,6 +15,8 @@
  * This object acts to unify the interface for acquiring new tokens. The object
  * can be initialized using either a file, or String. Each time next is called,
  * the method peruses the selected input source until it finds the next token.
+ * Alternatively, lexer_tokenize() scans the whole input up front into an array
+ * of tokens and a table of line offsets, which next then indexes into.
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU Lesser General Public License as published by
@@ -84,73 +86,70 @@ Lexer * lexer_new(char * input, size_t inputLen) {
 void lexer_free(Lexer * l) {
   assert(l != NULL);
 
+  free(l->tokens);
+  free(l->lines);
   free(l->input);
   free(l);
 }
 
-/**
- * Checks to see if character is a whitespace character, such as end line,
- * return carriage, tab, or space.
- * c: a char value to check.
- * returns: true if c is a whitespace char, and false if not.
- */
-static bool is_white_space(char c) {
-
-  switch(c) {
-  case ' ':
-  case '\t':
-  case '\r':
-  case '\n':
-    return true;
-  }
-
-  return false;
-}
-
-/**
- * Returns the next char in the input string. This wrapper is for convenience.
- * Warning: this method does not do bounds checking.
- * l: an instance of lexer.
- * returns: the next char from the input.
- */
-static char next_char(Lexer * l) {
-  return l->input[l->index];
-}
-
-/**
- * Advances the next_char index to the next char in the input string.
- * Warning: this method does no bounds checking.
- * l: an instance of lexer.
- */
-static void advance_char(Lexer * l) {
-
-  /* if new line, increment line number */
-  if(next_char(l) == '\n') {
-    l->lineNum++;
-  }
-
-  l->index++;
-}
-
-/**
- * Gets the previous character in the input string.
- * Warning: this method does not do bounds checking.
- * l: an instance of lexer.
- * returns: the previous character.
- */
-static char prev_char(Lexer * l) {
-  assert(l->index > 0);
-  return l->input[l->index - 1];
-}
-
-/**
- * Returns the next character in the input string without advancing current char
- * iterator.
- * l: an instance of lexer.
- * returns: the char in the sequence after the current char.
- */
-static char peek_char(Lexer * l) {
-  return l->input[l->index + 1];
+/* classes of characters, bits of the entries of charClasses */
+#define CLASS_SPACE       1       /* whitespace, skipped between tokens */
+#define CLASS_IDENT       2       /* continues a keyword or variable */
+#define CLASS_IDENT_START 4       /* begins a keyword or variable */
+#define CLASS_DIGIT       8       /* continues a number */
+#define CLASS_OPERATOR    16      /* continues an operator */
+#define CLASS_SINGLE      32      /* a token by itself: brackets, parens, ;
+				   * and , */
+
+#define LS (CLASS_SPACE)
+#define LL (CLASS_IDENT | CLASS_IDENT_START)
+#define LU (CLASS_IDENT | CLASS_IDENT_START | CLASS_OPERATOR)
+#define LD (CLASS_IDENT | CLASS_DIGIT)
+#define LP (CLASS_SINGLE)
+#define LC (CLASS_SINGLE | CLASS_OPERATOR)
+#define LO (CLASS_OPERATOR)
+#define LN 0
+
+/* class of each char. Anything that is not a digit, letter, whitespace, quote,
+ * bracket, parenthesis or ; is an operator char, which includes '_', ',', the
+ * single quote and the null that terminates the input. The null stops every
+ * run but operators, so those scans need no bounds checks.
+ */
+static const unsigned char charClasses[256] = {
+  /* 00 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LS, LS, LO, LO, LS, LO, LO,
+  /* 10 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO,
+  /* 20 */ LS, LO, LN, LO, LO, LO, LO, LO, LP, LP, LO, LO, LC, LO, LO, LO,
+  /* 30 */ LD, LD, LD, LD, LD, LD, LD, LD, LD, LD, LO, LP, LO, LO, LO, LO,
+  /* 40 */ LO, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL,
+  /* 50 */ LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LP, LO, LP, LO, LU,
+  /* 60 */ LO, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL,
+  /* 70 */ LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LL, LP, LO, LP, LO, LO,
+  /* 80 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO,
+  /* 90 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO,
+  /* a0 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO,
+  /* b0 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO,
+  /* c0 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO,
+  /* d0 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO,
+  /* e0 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO,
+  /* f0 */ LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO, LO
+};
+
+#undef LS
+#undef LL
+#undef LU
+#undef LD
+#undef LP
+#undef LC
+#undef LO
+#undef LN
+
+/**
+ * Gets the class of a character.
+ * c: the char.
+ * returns: its CLASS_* bits.
+ */
+static int char_class(char c) {
+  return charClasses[(unsigned char)c];
 }
 
 /**
@@ -175,462 +174,271 @@ static void set_type(LexerType * outType, LexerType newType) {
 }
 
 /**
- * lexer_next() whitespace subparser.
- * Advances current character index until current contiguous block of whitespace
- * has been passed completed.
- * l: an instance of lexer object.
- * returns: true if current character was a whitespace char when subparser was
- * first called, or false if the current character was not a whitespace
- * character.
+ * Counts the new lines in a block of the input. memchr() is used so that the
+ * C library's vectorized search does the scanning of long comments.
+ * start: the first char of the block.
+ * end: the char after the block.
+ * returns: the number of '\n' chars in the block.
  */
-static bool next_parse_whitespace(Lexer * l) {
-
-  if(is_white_space(next_char(l))) {
+static int count_lines(char * start, char * end) {
+  int lines = 0;
 
-    /* skip all whitespace characters */
-    while(remaining_chars(l) > 0 && is_white_space(next_char(l))) {
-      advance_char(l);
-    }
-
-    return true;
+  while(start < end
+	&& (start = memchr(start, '\n', end - start)) != NULL) {
+    lines++;
+    start++;
   }
 
-  return false;
+  return lines;
 }
 
 /**
- * lexer_next() comments subparser.
- * Whenever a comment start operator is encountered, advances current char index
- * until the matching comment terminator is encountered. If a multiline comment
- * is encountered, but it does not have a matching terminator, the l->err flag
- * is set to LEXERERR_UNTERMINATED_COMMENT, the next l->nextToken is set to NULL
- * but method still returns true.
- * l: a lexer object.
- * returns: true if this subparser was called when first chars were a start
- * comment operator, and returns false if current character was not comment
- * related and nothing was done.
+ * Stores the token the lexer will return next and moves the index past it.
+ * l: an instance of lexer.
+ * start: the first char of the token.
+ * end: the char after the token.
+ * type: the type of the token.
  */
-static bool next_parse_comments(Lexer * l) {
-
-  /* if there is another character after this one, check this one and the next
-   * one to see if they are single line comment characters: "//". If so, skip the
-   * comment characters.
-   */
-  if(remaining_chars(l) > 0
-     && next_char(l) == '/'
-     && peek_char(l) == '/') {
-
-    while(remaining_chars(l) > 0 && next_char(l) != '\n') {
-      advance_char(l);
-    }
-
-    return true;
-  }
-
-  /* if there is another character after the current one, check it to see if they
-   * are single line line comment characters. If so, skip the comment chars
-   */
-  if(remaining_chars(l) > 0
-     && next_char(l) == '/'
-     && peek_char(l) == '*') {
-
-    while(remaining_chars(l) > 0) {
-      if(l->index > 0 && prev_char(l) == '*' && next_char(l) == '/') {
-
-	/* prevent the closing / from being re-evaluated next iteration */
-	advance_char(l);
-	return true;
-      }
-      advance_char(l);
-    }
-
-    l->err = LEXERERR_UNTERMINATED_COMMENT;
-    finalize_lexer(l);
-  }
-
-  return false;
+static void set_next_token(Lexer * l, char * start, char * end,
+			   LexerType type) {
+  l->nextToken = start;
+  l->nextTokenLen = end - start;
+  l->nextTokenType = type;
+  l->err = LEXERERR_SUCCESS;
+  l->index = end - l->input;
 }
 
 /**
- * lexer_next() strings subparser.
- * If current character is a quotation mark, ", this function begins parsing to
- * find the matching end quotation mark. Upon finding it, the l->nextToken
- * pointer is set to point to the beginning of the string, and l->nextTokenLen is
- * set to the length of the string. If no end quotation mark is encountered,
- * l->err is set to LEXERERR_UNTERMINATED_STRING and l->nextToken is set to NULL,
- * but function returns true;
- * l: an instance of lexer.
- * returns: true if the first character the lexer encountered was a quotation
- * mark, and false if not.
+ * lexer_next() whitespace scanner.
+ * Advances current character index past the current contiguous block of
+ * whitespace, counting the new lines in it.
+ * l: an instance of lexer object.
  */
-static bool next_parse_strings(Lexer * l) {
-
-  /* this is the beginning of a string */
-  if(next_char(l) == '"') {
-    int beginStrIndex = l->index + 1;
-
-    /* add characters to the string */
-    l->index++;
-    for(; remaining_chars(l) > 0; advance_char(l)) {
-
-      /* handle escaping of quotes */
-      if(next_char(l) == '\\'){
-        advance_char(l);
-      } else if(next_char(l) == '"') {
-	/* encountered end of string, return it */
-	l->nextTokenLen = (l->index - beginStrIndex);
-	l->nextToken = l->input + beginStrIndex;
-	l->err = LEXERERR_SUCCESS;
-
-	l->nextTokenType = LEXERTYPE_STRING;
-
-	/* increment index again to prevent the end quote from being evaluated
-	 * next iteration.
-	 */
-	advance_char(l);
-	return true;
-      }
+static void skip_whitespace(Lexer * l) {
+  char * c = l->input + l->index;
 
-      /* prevent newlines from being put in strings */
-      if(next_char(l) == '\n') {
-	l->err = LEXERERR_NEWLINE_IN_STRING_UNTERMINATED_ESCAPE;
-	finalize_lexer(l);
-	return true;
-      }
-    
+  /* the null at the end of the input is not whitespace and stops the scan */
+  while(char_class(*c) & CLASS_SPACE) {
+    if(*c == '\n') {
+      l->lineNum++;
     }
-
-    /* error occurred, set token to null and quit */
-    l->nextToken = NULL;
-    l->err = LEXERERR_UNTERMINATED_STRING;
-    finalize_lexer(l);
-    return true;
+    c++;
   }
-  return false;
+
+  l->index = c - l->input;
 }
 
 /**
- * lexer_next() char subparser.
- * If current character is a single quote, ', this function begins parsing to
- * find the matching end quote. Upon finding it, the l->nextToken
- * pointer is set to point to the beginning of the contained string, and 
- * l->nextTokenLen is set to the length of the string. If no end quote 
- * is encountered, l->err is set to LEXERERR_UNTERMINATED_STRING and 
- * l->nextToken is set to NULL, but function returns true;
- * l: an instance of lexer.
- * returns: true if the first character the lexer encountered was a single quote
- * and false if not.
+ * lexer_next() comments scanner. Must be called with the index at a "//" or a
+ * slash star. Advances current char index past the comment. A single line
+ * comment ends before its new line. If a multiline comment does not have a
+ * matching terminator, the l->err flag is set to LEXERERR_UNTERMINATED_COMMENT
+ * and the lexer is finalized.
+ * l: a lexer object.
+ * returns: true if the comment was skipped, and false if it is unterminated.
  */
-static bool next_parse_chars(Lexer * l) {
-
-  /* this is the beginning of a char */
-  if(next_char(l) == '\'') {
-    int beginStrIndex = l->index + 1;
-
-    /* add characters to the char string */
-    l->index++;
-    for(; remaining_chars(l) > 0; advance_char(l)) {
+static bool skip_comment(Lexer * l) {
+  char * start = l->input + l->index;
+  char * end = l->input + l->inputLen;
+  char * c;
 
-      /* handle escaping of quotes */
-      if(next_char(l) == '\\'){
-        advance_char(l);
-      } else if(next_char(l) == '\'') {
-	/* encountered end of string, return it */
-	l->nextTokenLen = (l->index - beginStrIndex);
-	l->nextToken = l->input + beginStrIndex;
-
-	l->err = LEXERERR_SUCCESS;
-
-	l->nextTokenType = LEXERTYPE_CHAR;
-
-	/* increment index again to prevent the end quote from being evaluated
-	 * next iteration.
-	 */
-	advance_char(l);
-	return true;
-      }
-
-      /* prevent newlines from being put in strings */
-      if(next_char(l) == '\n') {
-	l->err = LEXERERR_NEWLINE_IN_STRING_UNTERMINATED_ESCAPE;
-	finalize_lexer(l);
-	return true;
-      }
-    
-    }
-
-    /* error occurred, set token to null and quit */
-    l->nextToken = NULL;
-    l->err = LEXERERR_UNTERMINATED_STRING;
-    finalize_lexer(l);
+  /* single line comments run until the next new line */
+  if(start[1] == '/') {
+    c = memchr(start, '\n', end - start);
+    l->index = (c != NULL ? c : end) - l->input;
     return true;
   }
-  return false;
-}
 
-/**
- * Checks to determine if the character is a letter.
- * c: the letter to check.
- * returns: true if a letter, and false if not.
- */
-static bool is_letter(char c) {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
-}
+  /* find the star slash, starting at the star that opens the comment so that
+   * a slash star slash also closes it.
+   */
+  for(c = start + 1;
+      (c = memchr(c, '*', end - c)) != NULL && c + 1 < end; c++) {
+    if(c[1] == '/') {
+      l->lineNum += count_lines(start, c);
+      l->index = (c + 2) - l->input;
+      return true;
+    }
+  }
 
-/**
- * Checks if is digit.
- * c: digit to check.
- * returns: true if is digit, false if not.
- */
-static bool is_digit(char c) {
-  return (c >= '0' && c <= '9');
+  l->lineNum += count_lines(start, end);
+  l->err = LEXERERR_UNTERMINATED_COMMENT;
+  finalize_lexer(l);
+  return false;
 }
 
 /**
- * lexer_next() keyvars subparser.
- * If current character is a letter, this method parses to the end of the
- * contiguous body of letters and numbers and then sets l->nextToken to the
- * start of the keyword or variable, and l->nextTokenLen to the the length
- * of the keyword or variable.
+ * lexer_next() strings and chars scanner. Must be called with the index at the
+ * opening quote. Finds the matching end quote, skipping escaped chars, and then
+ * sets l->nextToken to the beginning of the contained string and
+ * l->nextTokenLen to its length. If no end quote is encountered, l->err is set
+ * to LEXERERR_UNTERMINATED_STRING and l->nextToken is set to NULL. New lines
+ * are not allowed in strings.
  * l: an instance of lexer.
- * returns: true if the first char was a letter, and false if not.
+ * quote: the quote that ends the string: " for strings or ' for chars.
+ * type: the type of the token: LEXERTYPE_STRING or LEXERTYPE_CHAR.
  */
-static bool next_parse_keyvars(Lexer * l) {
+static void lex_quoted(Lexer * l, char quote, LexerType type) {
+  char * start = l->input + l->index + 1;
+  char * end = l->input + l->inputLen;
+  char stops[4];
+  char * c;
+
+  /* the chars that stop the scan. strcspn() is vectorized by most C libraries
+   * so long strings are scanned many bytes at a time.
+   */
+  stops[0] = quote;
+  stops[1] = '\\';
+  stops[2] = '\n';
+  stops[3] = '\0';
 
-  if(is_letter(next_char(l)) || next_char(l) == '_') {
-    int beginStrIndex = l->index;
+  for(c = start; (c += strcspn(c, stops)) < end; c++) {
 
-    /* extract entire word */
-    while(remaining_chars(l) > 0 
-	  && (is_letter(next_char(l)) 
-	      || is_digit(next_char(l)) 
-	      || next_char(l) == '_')) {
-      advance_char(l);
+    /* found the end of the string, the end quote is not evaluated again */
+    if(*c == quote) {
+      set_next_token(l, start, c, type);
+      l->index++;
+      return;
     }
 
-    l->nextTokenLen = (l->index - beginStrIndex);
-    l->nextToken = l->input + beginStrIndex;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_KEYVAR;
+    /* skip escaped chars, but an escape may not escape a new line */
+    if(*c == '\\') {
+      c++;
+      if(c >= end) {
+	break;
+      }
+    }
 
-    return true;
+    /* prevent newlines from being put in strings */
+    if(*c == '\n') {
+      l->err = LEXERERR_NEWLINE_IN_STRING_UNTERMINATED_ESCAPE;
+      finalize_lexer(l);
+      return;
+    }
   }
 
-  return false;
+  /* error occurred, set token to null and quit */
+  l->nextToken = NULL;
+  l->err = LEXERERR_UNTERMINATED_STRING;
+  finalize_lexer(l);
 }
 
 /**
- * lexer_next() numbers subparser.
- * If current character is a digit, begins parsing until end of digits is reached
- * making note of decimal points along the way. If more than one decimal point is
- * encountered, l->err is set to LEXERERR_DUPLICATE_DECIMAL_PT, l->nextToken is
- * set to NULL, and the function returns true. Otherwise, the function sets
- * l->nextToken to the pointer to the first digit in the number, and l->tokenLen
- * to the number of digits in the number (plus one if there is a decimal pt).
+ * lexer_next() numbers scanner. Must be called with the index at a digit, or at
+ * the '-' of a negative number. Scans to the end of the digits, making note of
+ * decimal points along the way. If more than one decimal point is encountered,
+ * l->err is set to LEXERERR_DUPLICATE_DECIMAL_PT and l->nextToken is set to
+ * NULL. Otherwise, l->nextToken is set to the first char of the number, and
+ * l->nextTokenLen to its length.
  * l: an instance of lexer.
- * returns: true if the first character encountered is a digit, and false if not.
  */
-static bool next_parse_numbers(Lexer * l) {
-  int beginStrIndex = l->index;
+static void lex_number(Lexer * l) {
+  char * start = l->input + l->index;
+  char * c = start;
+  bool decimalDetected = false;
 
   /* start of negative number */
-  if(((prev_char(l) == ' ' || prev_char(l) == '(') 
-      && next_char(l) == '-' && is_digit(peek_char(l)))) {
-    advance_char(l);
+  if(*c == '-') {
+    c++;
   }
 
-  /* parse normal number */
-  if(is_digit(next_char(l))) {
-    bool decimalDetected = false;
+  /* move to end of number, which the null at the end of the input stops */
+  for(; (char_class(*c) & CLASS_DIGIT) || *c == '.'; c++) {
 
-    /* move index to end of number */
-    while(remaining_chars(l) > 0 
-	  && (is_digit(next_char(l)) || next_char(l) == '.')) {
+    /* prevent multiple decimal points in one number */
+    if(*c == '.') {
 
-      /* prevent multiple decimal points in one number */
-      if(next_char(l) == '.') {
-
-	if(decimalDetected) {
-	  l->err = LEXERERR_DUPLICATE_DECIMAL_PT;
-	  finalize_lexer(l);
-	  l->nextToken = NULL;
-	  l->nextTokenLen = 0;
-	  return true;
-	}
-
-	decimalDetected = true;
+      if(decimalDetected) {
+	l->err = LEXERERR_DUPLICATE_DECIMAL_PT;
+	finalize_lexer(l);
+	l->nextToken = NULL;
+	l->nextTokenLen = 0;
+	return;
       }
 
-      advance_char(l);
+      decimalDetected = true;
     }
-
-    /* if last character in digit grouping is a '.' throw a fit.
-     * Numbers must start and end with digits.
-     */
-    if(prev_char(l) == '.') {
-      l->err = LEXERERR_TRAILING_DECIMAL_PT;
-      finalize_lexer(l);
-      l->nextToken = NULL;
-      l->nextTokenLen = 0;
-      return true;
-    }
-
-    /* success, save number to currentToken pointer */
-    l->nextTokenLen = (l->index - beginStrIndex);
-    l->nextToken = l->input + beginStrIndex;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_NUMBER;
-
-    return true;
   }
 
-  return false;
-}
-
-/**
- * Checks if a character is a bracket or curly brace.
- * c: the char to check.
- * returns: true if c is a bracket, false if not.
- */
-static bool is_bracket(char c) {
-  return c == '{' || c == '}' || c == '[' || c == ']';
-}
-
-/**
- * Checks if a character is a parenthesis.
- * c: the char to check.
- * returns: true if c is a parenthesis, false if not.
- */
-static bool is_parenthesis(char c) {
-  return c == '(' || c == ')';
-}
+  /* if last character in digit grouping is a '.' throw a fit.
+   * Numbers must start and end with digits.
+   */
+  if(c[-1] == '.') {
+    l->err = LEXERERR_TRAILING_DECIMAL_PT;
+    finalize_lexer(l);
+    l->nextToken = NULL;
+    l->nextTokenLen = 0;
+    return;
+  }
 
-/**
- * Superficially decides if character is an operator character (not a letter,
- * digit, or whitespace).
- * c: the char to check.
- * returns: true if c is an operator, false if not.
- */
-static bool is_operator(char c) {
-  return (!is_digit(c) && !is_letter(c) && !is_white_space(c)
-	  && c != '"' && c != ';' && !is_bracket(c) && !is_parenthesis(c));
+  set_next_token(l, start, c, LEXERTYPE_NUMBER);
 }
 
 /**
- * lexer_next() operators subparser.
- * If current character is an operator char (see is_operator()), function copies
- * current character and all characters following operator that are operators
- * to the l->nextToken pointer, and sets l->nextTokenLen to the length of this
- * multicharacter operator.
+ * Checks if the lexer is at a negative number: a '-' that follows a space or
+ * an open parenthesis and is followed by a digit.
  * l: an instance of lexer.
- * returns: true if the first character is an operator, and false if not.
+ * returns: true if the next token is a negative number.
  */
-static bool next_parse_operators(Lexer * l) {
-
-  if(is_operator(next_char(l))) {
-    int beginStrIndex = l->index;
-    char * token;
-    size_t tokenLen;
+static bool at_negative_number(Lexer * l) {
+  char * c = l->input + l->index;
 
-    /* move index to end of symbols */
-    while(remaining_chars(l) > 0 
-	  && is_operator(next_char(l))) {
-      advance_char(l);
-    }
-
-    tokenLen = (l->index - beginStrIndex);
-    token  = l->input + beginStrIndex;
-
-    l->nextToken = token;
-    l->nextTokenLen = tokenLen;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_OPERATOR;
-
-    return true;
-  }
-  return false;
+  return l->index > 0 && (c[-1] == ' ' || c[-1] == '(')
+    && c[0] == '-' && (char_class(c[1]) & CLASS_DIGIT);
 }
 
 /**
- * lexer_next() brackets subparser.
- * If current character is a bracket or curly brace), the current character
- * will be set to the l->nextToken pointer, and
- * l->nextTokenLen will be set to the length of the symbol (always 1).
- * l: an instance of lexer.
- * returns: true if the current character is a logiparenth and false if not.
+ * Gets the type of a token that is a single char: brackets, parenthesis, ;
+ * and ,.
+ * c: the char.
+ * returns: the type of its token.
  */
-static bool next_parse_brackets(Lexer * l) {
-
-  if(is_bracket(next_char(l))) {
-    l->nextToken = l->input + l->index;
-    l->nextTokenLen = 1;
-    l->nextTokenType = LEXERTYPE_BRACKETS;
-    l->err = LEXERERR_SUCCESS;
-    advance_char(l);
-
-    return true;
+static LexerType single_type(char c) {
+  switch(c) {
+  case '(':
+  case ')':
+    return LEXERTYPE_PARENTHESIS;
+  case ';':
+    return LEXERTYPE_ENDSTATEMENT;
+  case ',':
+    return LEXERTYPE_ARGDELIM;
+  default:
+    return LEXERTYPE_BRACKETS;
   }
-
-  return false;
 }
 
 /**
- * lexer_next() parenthesis subparser.
- * If current character is a parenthesis, the current character
- * will be set to the l->nextToken pointer, and
- * l->nextTokenLen will be set to the length of the symbol (always 1).
- * l: an instance of lexer.
- * returns: true if the current character is a logiparenth and false if not.
+ * Moves nextToken to the next token in the tokens array. After the last token,
+ * the error, line number and type that lexing ended with are restored.
+ * l: an instance of lexer, that has been tokenized.
  */
-static bool next_parse_parenthesis(Lexer * l) {
-
-  if(is_parenthesis(next_char(l))) {
-    l->nextToken = l->input + l->index;
-    l->nextTokenLen = 1;
-    l->nextTokenType = LEXERTYPE_PARENTHESIS;
-    l->err = LEXERERR_SUCCESS;
-    advance_char(l);
+static void next_from_tokens(Lexer * l) {
 
-    return true;
+  if(l->tokenIndex < l->numTokens) {
+    l->tokenIndex++;
   }
 
-  return false;
-}
+  if(l->tokenIndex < l->numTokens) {
+    LexerToken * token = l->tokens + l->tokenIndex;
 
-/**
- * lexer_next() end statement subparser. If current character is an endstatement
- * character, function returns true and sets l->nextToken to the current character.
- * l: an instance of lexer.
- * returns: true if current character is an endstatement.
- */
-static bool next_parse_endstatement(Lexer * l) {
-  if(next_char(l) == ';') {
-    l->nextToken = l->input + l->index;
-    l->nextTokenLen = 1;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_ENDSTATEMENT;
-    advance_char(l);
-    return true;
-  }
-  return false;
-}
+    l->nextToken = l->input + token->offset;
+    l->nextTokenLen = token->len;
+    l->nextTokenType = token->type;
+    l->index = token->offset + token->len;
 
-/**
- * lexer_next() comma subparser. If current character is a comma
- * character, function returns true and sets l->nextToken to the current character.
- * l: an instance of lexer.
- * returns: true if current character is a comma.
- */
-static bool next_parse_argdelim(Lexer * l) {
-  if(next_char(l) == ',') {
-    l->nextToken = l->input + l->index;
-    l->nextTokenLen = 1;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_ARGDELIM;
-    advance_char(l);
-    return true;
+    /* tokens are replayed in order, so lineNum only has to move forward past
+     * the lines that start at or before the end of this token
+     */
+    while(l->lineNum < l->numLines && l->lines[l->lineNum] <= l->index) {
+      l->lineNum++;
+    }
+  } else {
+    l->nextToken = NULL;
+    l->nextTokenType = l->endType;
+    l->err = l->endErr;
+    l->index = l->inputLen;
+    l->lineNum = l->endLineNum;
   }
-  return false;
 }
 
 /**
@@ -646,69 +454,156 @@ static void update_next_token(Lexer * l) {
   l->currTokenLen = l->nextTokenLen;
   l->currTokenType = l->nextTokenType;
 
-  /* Recursive Descent Parsing Loop:
-   * Each iteration, the lexer attempts to handle the current set of characters
-   * by feeding the current, previous, and next characters into a sub parser.
-   * The sub parser will then look at the current character and decide whether
-   * or not it can handle the current situation. For example, if the whitespace
-   * parser sees a whitespace character, it will move the iterator index forward
-   * until no more remain. It then returns true to signify that it could handle
-   * the current situation, and the if/else chain restarts from the top. Lets say
-   * the next symbol is a digit. The whitespace parser will be called again. Since
-   * it doesn't know how to handle digits, it returns false and the digit is passed
-   * down the chain until it reaches the number parser that can handle it.
+  if(l->tokens != NULL) {
+    next_from_tokens(l);
+    return;
+  }
+
+  /* Dispatch Loop:
+   * Each iteration, the class of the current char selects the scanner that
+   * handles it, instead of offering the char to each sub parser in turn.
+   * Whitespace and comments are skipped and the loop restarts. Every other
+   * scanner consumes one token and returns. The scanners run over the class
+   * table in tight loops, and find string and comment terminators with the C
+   * library's memchr() and strcspn(), so long scripts lex at close to the
+   * speed memory can be read.
    */
   while(remaining_chars(l) > 0) {
+    char * c = l->input + l->index;
+    int charClass = char_class(*c);
 
     l->nextTokenType = LEXERTYPE_UNKNOWN;
 
-    /* Recursive Descent Chain:
-     * I know the McCabe's complexity is CRAZY high, but in this I case, I
-     * believe that it is excusible because it greatly simplifies the rest of
-     * the code document and makes the code much more understandable...the 
-     * primary goal of good computer science.
-     *
-     * Basically, control just cascades down until it finds a method that
-     * can handle the data.
-     */
-    if(next_parse_whitespace(l)) {
-
-      /* do nothing, but restart if/else chain when whitespace is detected */
-
-    } else if(next_parse_comments(l)) {
-      if(l->err != LEXERERR_SUCCESS) {
+    if(charClass & CLASS_SPACE) {
+      skip_whitespace(l);
+    } else if(*c == '/' && (c[1] == '/' || c[1] == '*')) {
+      if(!skip_comment(l)) {
 	break;
       }
-    } else if(next_parse_strings(l)) {
-      return;
-    } else if(next_parse_chars(l)) {
+    } else if(*c == '"') {
+      lex_quoted(l, '"', LEXERTYPE_STRING);
       return;
-    } else if(next_parse_keyvars(l)){
+    } else if(*c == '\'') {
+      lex_quoted(l, '\'', LEXERTYPE_CHAR);
       return;
-    } else if(next_parse_numbers(l)){
-      return;
-    } else if(next_parse_brackets(l)) {
-      return;
-    } else if(next_parse_argdelim(l)) {
-      return;
-    } else if(next_parse_parenthesis(l)) {
+    } else if(charClass & CLASS_IDENT_START) {
+      char * end = c + 1;
+
+      /* extract entire word, the null at the end of the input stops it */
+      while(char_class(*end) & CLASS_IDENT) {
+	end++;
+      }
+      set_next_token(l, c, end, LEXERTYPE_KEYVAR);
       return;
-    } else if(next_parse_operators(l)) {
+    } else if((charClass & CLASS_DIGIT) || at_negative_number(l)) {
+      lex_number(l);
       return;
-    } else if(next_parse_endstatement(l)) {
+    } else if(charClass & CLASS_SINGLE) {
+      set_next_token(l, c, c + 1, single_type(*c));
       return;
     } else {
-
-      /* none of the parsers can handle the current situation */
-      /* temporary warning that helps with debugging */
-      printf("WARNING: Control reached end of Recursive Parse Loop\n");
-      break;
+      char * inputEnd = l->input + l->inputLen;
+      char * end = c + 1;
+
+      /* operators are the remaining chars. Nulls are operator chars, so this
+       * scan checks for the end of the input.
+       */
+      while(end < inputEnd && (char_class(*end) & CLASS_OPERATOR)) {
+	end++;
+      }
+      set_next_token(l, c, end, LEXERTYPE_OPERATOR);
+      return;
     }
   }
 
   l->nextToken = NULL;
 }
 
+/**
+ * Moves the lexer back to the start of its input, as it was before the first
+ * token was lexed.
+ * l: an instance of lexer.
+ */
+static void rewind_input(Lexer * l) {
+  l->err = LEXERERR_SUCCESS;
+  l->index = 0;
+  l->lineNum = 1;
+  l->currToken = l->nextToken = NULL;
+  l->currTokenLen = l->nextTokenLen = 0;
+  l->currTokenType = l->nextTokenType = LEXERTYPE_UNKNOWN;
+}
+
+/**
+ * Tokenizes the whole input up front into a contiguous array of tokens and a
+ * table of the offsets at which lines start. lexer_next() and lexer_peek()
+ * then index into the array. Must be called before the first lexer_next().
+ * A lexer error
+ * is saved and reported when lexer_next() reaches it, just as it is when
+ * lexing lazily.
+ * l: an instance of lexer.
+ * returns: true upon success, and false if allocation fails, in which case
+ * the lexer goes on lexing lazily.
+ */
+bool lexer_tokenize(Lexer * l) {
+  int size = 16 + l->inputLen / 8;
+  LexerToken * tokens = malloc(size * sizeof(LexerToken));
+  int * lines;
+  char * c;
+  int i;
+
+  assert(l != NULL);
+  assert(l->index == 0 && l->tokens == NULL);
+
+  /* the line table, the first line starts at the first char */
+  l->numLines = 1 + count_lines(l->input, l->input + l->inputLen);
+  lines = malloc(l->numLines * sizeof(int));
+  if(tokens == NULL || lines == NULL) {
+    free(tokens);
+    free(lines);
+    return false;
+  }
+  lines[0] = 0;
+  for(c = l->input, i = 1; i < l->numLines; c++, i++) {
+    c = memchr(c, '\n', l->input + l->inputLen - c);
+    lines[i] = (c + 1) - l->input;
+  }
+
+  /* lex every token, stopping at the end of the input or an error */
+  for(update_next_token(l); l->err == LEXERERR_SUCCESS && l->nextToken != NULL;
+      update_next_token(l)) {
+
+    if(l->numTokens == size) {
+      LexerToken * newTokens = realloc(tokens, size * 2 * sizeof(LexerToken));
+
+      if(newTokens == NULL) {
+	free(tokens);
+	free(lines);
+	l->numTokens = 0;
+	rewind_input(l);
+	return false;
+      }
+      tokens = newTokens;
+      size *= 2;
+    }
+
+    tokens[l->numTokens].offset = l->nextToken - l->input;
+    tokens[l->numTokens].len = l->nextTokenLen;
+    tokens[l->numTokens].type = l->nextTokenType;
+    l->numTokens++;
+  }
+
+  /* save how lexing ended and rewind to the start */
+  l->endErr = l->err;
+  l->endLineNum = l->lineNum;
+  l->endType = l->nextTokenType;
+  rewind_input(l);
+  l->tokens = tokens;
+  l->lines = lines;
+  l->tokenIndex = -1;
+
+  return true;
+}
+
 /**
  * Gets the token returned by the previous call to lexer_next.
  * l: an instance of lexer.
@@ -372,20 +372,20 @@ static bool vmn_array_get(VM * vm, VMArg * arg, int argc) {
 }
 
 /**
- * Installs the Libdatastruct library in the given instance of Gunderscript.
- * gunderscript: the instance to receive the library.
+ * Installs the Libdatastruct library in the given registry of native functions.
+ * registry: the registry to receive the library. It must not be frozen yet.
  * returns: true upon success, and false upon failure. If failure occurs,
- * you probably did not allocate enough callbacks space in the call to 
- * gunderscript_new().
+ * you probably did not allocate enough space in the call to
+ * vmregistry_new().
  */
-bool libarray_install(Gunderscript * gunderscript) {
-  if(!vm_reg_callback(gunderscript_vm(gunderscript), 
+bool libarray_install(VMRegistry * registry) {
+  if(!vmregistry_add(registry, 
 		      "array", 5, vmn_array)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add(registry, 
 			 "array_size", 10, vmn_array_size)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add(registry, 
 			 "array_set", 9, vmn_array_set)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add(registry, 
 			 "array_get", 9, vmn_array_get)) {
     return false;
   }
@@ -325,35 +325,35 @@ static bool vmn_math_atan2(VM * vm, VMArg * arg, int argc) {
 }
 
 /**
- * Installs the Libmath library in the given instance of Gunderscript.
- * gunderscript: the instance to receive the library.
+ * Installs the Libmath library in the given registry of native functions.
+ * registry: the registry to receive the library. It must not be frozen yet.
  * returns: true upon success, and false upon failure. If failure occurs,
- * you probably did not allocate enough callbacks space in the call to 
- * gunderscript_new().
+ * you probably did not allocate enough space in the call to
+ * vmregistry_new().
  */
-bool libmath_install(Gunderscript * gunderscript) {
+bool libmath_install(VMRegistry * registry) {
 
-  if(!vm_reg_callback(gunderscript_vm(gunderscript), 
+  if(!vmregistry_add_pure(registry, 
 		      "math_abs", 8, vmn_math_abs)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_sqrt", 9, vmn_math_sqrt)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_pow", 8, vmn_math_pow)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_round", 10, vmn_math_round)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_sin", 8, vmn_math_sin)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_cos", 8, vmn_math_cos)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_tan", 8, vmn_math_tan)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_asin", 9, vmn_math_asin)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_acos", 9, vmn_math_acos)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_atan", 9, vmn_math_atan)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "math_atan2", 10, vmn_math_atan2)) {
     return false;
   }
@@ -551,30 +551,30 @@ static bool vmn_str_substring(VM * vm, VMArg * arg, int argc) {
 }
 
 /**
- * Installs the Libstr library in the given instance of Gunderscript.
- * gunderscript: the instance to receive the library.
+ * Installs the Libstr library in the given registry of native functions.
+ * registry: the registry to receive the library. It must not be frozen yet.
  * returns: true upon success, and false upon failure. If failure occurs,
- * you probably did not allocate enough callbacks space in the call to 
- * gunderscript_new().
+ * you probably did not allocate enough space in the call to
+ * vmregistry_new().
  */
-bool libstr_install(Gunderscript * gunderscript) {
-  if(!vm_reg_callback(gunderscript_vm(gunderscript), 
+bool libstr_install(VMRegistry * registry) {
+  if(!vmregistry_add_pure(registry, 
 		      "string_equals", 13, vmn_str_equals)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add(registry, 
 		      "string", 6, vmn_str)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 		      "string_length", 13, vmn_str_length)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add(registry, 
 		      "string_prealloc", 15, vmn_str_prealloc)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add(registry, 
 			 "string_append", 13, vmn_str_append)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add_pure(registry, 
 			 "string_char_at", 14, vmn_str_char_at)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add(registry, 
 			 "char_to_string", 14, vmn_char_to_str)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add(registry, 
 			 "string_set_char_at", 18, vmn_str_set_char_at)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+     || !vmregistry_add(registry, 
 			 "string_substring", 16, vmn_str_substring)) {
     return false;
   }
@@ -913,38 +913,38 @@ static bool vmn_to_boolean(VM * vm, VMArg * arg, int argc) {
 
 
 /**
- * Installs the Libsys library in the given instance of Gunderscript.
- * gunderscript: the instance to receive the library.
+ * Installs the Libsys library in the given registry of native functions.
+ * registry: the registry to receive the library. It must not be frozen yet.
  * returns: true upon success, and false upon failure. If failure occurs,
- * you probably did not allocate enough callbacks space in the call to 
- * gunderscript_new().
+ * you probably did not allocate enough space in the call to
+ * vmregistry_new().
  */
-bool libsys_install(Gunderscript * gunderscript) {
-  if(!vm_reg_callback(gunderscript_vm(gunderscript), "sys_print", 9, vmn_print)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "sys_shell", 9, vmn_shell)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "sys_getline", 11, vmn_getline)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "sys_getchar", 11, vmn_getchar)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "type", 4, vmn_type)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_delete", 11, vmn_file_delete)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_exists", 11, vmn_file_exists)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_open", 9, vmn_file_open)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_open_read", 14, vmn_file_open_read)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_open_write", 15, vmn_file_open_write)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_close", 10, vmn_file_close)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_read_char", 14, vmn_file_read_char)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_write_char", 15, vmn_file_write_char)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_size", 9, vmn_file_size)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_get_cursor", 15, vmn_file_get_cursor)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_set_cursor", 15, vmn_file_set_cursor)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_set_cursor_begin", 21, vmn_file_set_cursor_begin)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "file_set_cursor_end", 19, vmn_file_set_cursor_end)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "is_boolean", 10, vmn_is_boolean)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "is_number", 9, vmn_is_number)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "is_null", 7, vmn_is_null)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "is_string", 9, vmn_is_string)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "to_string", 9, vmn_to_string)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "to_number", 9, vmn_to_number)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "to_boolean", 10, vmn_to_boolean)) {
+bool libsys_install(VMRegistry * registry) {
+  if(!vmregistry_add(registry, "sys_print", 9, vmn_print)
+     || !vmregistry_add(registry, "sys_shell", 9, vmn_shell)
+     || !vmregistry_add(registry, "sys_getline", 11, vmn_getline)
+     || !vmregistry_add(registry, "sys_getchar", 11, vmn_getchar)
+     || !vmregistry_add(registry, "type", 4, vmn_type)
+     || !vmregistry_add(registry, "file_delete", 11, vmn_file_delete)
+     || !vmregistry_add(registry, "file_exists", 11, vmn_file_exists)
+     || !vmregistry_add(registry, "file_open", 9, vmn_file_open)
+     || !vmregistry_add(registry, "file_open_read", 14, vmn_file_open_read)
+     || !vmregistry_add(registry, "file_open_write", 15, vmn_file_open_write)
+     || !vmregistry_add(registry, "file_close", 10, vmn_file_close)
+     || !vmregistry_add(registry, "file_read_char", 14, vmn_file_read_char)
+     || !vmregistry_add(registry, "file_write_char", 15, vmn_file_write_char)
+     || !vmregistry_add(registry, "file_size", 9, vmn_file_size)
+     || !vmregistry_add(registry, "file_get_cursor", 15, vmn_file_get_cursor)
+     || !vmregistry_add(registry, "file_set_cursor", 15, vmn_file_set_cursor)
+     || !vmregistry_add(registry, "file_set_cursor_begin", 21, vmn_file_set_cursor_begin)
+     || !vmregistry_add(registry, "file_set_cursor_end", 19, vmn_file_set_cursor_end)
+     || !vmregistry_add_pure(registry, "is_boolean", 10, vmn_is_boolean)
+     || !vmregistry_add_pure(registry, "is_number", 9, vmn_is_number)
+     || !vmregistry_add_pure(registry, "is_null", 7, vmn_is_null)
+     || !vmregistry_add_pure(registry, "is_string", 9, vmn_is_string)
+     || !vmregistry_add(registry, "to_string", 9, vmn_to_string)
+     || !vmregistry_add_pure(registry, "to_number", 9, vmn_to_number)
+     || !vmregistry_add_pure(registry, "to_boolean", 10, vmn_to_boolean)) {
     return false;
   }
 
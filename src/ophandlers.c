@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 
 /* define boolean values used in the op_bool_push function */
 #define OP_TRUE             1
@@ -66,14 +67,24 @@ static bool opstk_push(VM * vm, void * data, size_t dataSize, VarType type) {
  * returns: true if success, and false if typestk error occurs. See typestk.c.
  */
 static bool opstk_pop(VM * vm, void * data, size_t dataSize, VarType * type) {
-  bool result = typestk_pop(vm->opStk, data, dataSize, type);
-  
+  char value[VM_VAR_SIZE];
+  bool result;
+
+  /* pop the whole value, a handler that expects a bool can be given an
+   * object whose pointer doesn't fit in its buffer
+   */
+  result = typestk_pop(vm->opStk, value, VM_VAR_SIZE, type);
+  if(!result) {
+    return false;
+  }
+  memcpy(data, value, dataSize);
+
   /* decrement ref count for this object */
   if(*type == TYPE_LIBDATA) {
-    vmlibdata_dec_refcount( *((VMLibData**)data) );
+    vmlibdata_dec_refcount( *((VMLibData**)value) );
   }
 
-  return result;
+  return true;
 }
 
 /**
@@ -347,6 +358,14 @@ bool op_frame_pop(VM * vm,  char * byteCode,
       return false;
     }
 
+    /* the entry frame pushed by the host returns control to the host by
+     * running off the end of the bytecode.
+     */
+    if(returnAddr == VM_HOST_RETURN) {
+      (*index) = byteCodeLen;
+      return true;
+    }
+
     /* if there is a return address, goto it to end the function */
     if(returnAddr != OP_NO_RETURN) {
 
@@ -460,6 +479,7 @@ bool op_add(VM * vm,  char * byteCode,
 /**
  * Pops previous two values on the OP stack, performs the requested math
  * operation and pushes the result.
+ * OP_SUB, OP_MUL, OP_DIV, OP_MOD, and the OP_NUM_* forms of these and OP_ADD
  */
 bool op_dual_operand_math(VM * vm,  char * byteCode, 
 			  size_t byteCodeLen, int * index, OpCode code) {
@@ -485,13 +505,19 @@ bool op_dual_operand_math(VM * vm,  char * byteCode,
   }
 
   switch(code) {
+  case OP_NUM_ADD:
+    value1 += value2;
+    break;
   case OP_SUB:
+  case OP_NUM_SUB:
     value1 -= value2;
     break;
   case OP_MUL:
+  case OP_NUM_MUL:
     value1 *= value2;
     break;
   case OP_DIV:
+  case OP_NUM_DIV:
     /* check for divide by zero errors */
     if(value2 == 0) {
       vm_set_err(vm, VMERR_DIVIDE_BY_ZERO);
@@ -500,6 +526,7 @@ bool op_dual_operand_math(VM * vm,  char * byteCode,
     value1 /= value2;
     break;
   case OP_MOD:
+  case OP_NUM_MOD:
     value1 = fmod(value1, value2);
     break;
   default:
@@ -517,7 +544,7 @@ bool op_dual_operand_math(VM * vm,  char * byteCode,
 /**
  * Pops top two values from OP stack and compares them. If first is less than
  * second, pushes true. Otherwise, pushes false.
- * OP_LT
+ * OP_LT, the other comparisons, and their OP_NUM_* forms
  */
 bool op_dual_comparison(VM * vm,  char * byteCode, 
 			size_t byteCodeLen, int * index, OpCode code) {
@@ -540,6 +567,7 @@ bool op_dual_comparison(VM * vm,  char * byteCode,
   /* TODO: implement comparisons between types, and object to object comparisons */
   switch(code) {
   case OP_LT:
+  case OP_NUM_LT:
     if(type1 == TYPE_NUMBER && type2 == TYPE_NUMBER) {
       result = value1 < value2;
     } else {
@@ -548,6 +576,7 @@ bool op_dual_comparison(VM * vm,  char * byteCode,
     }
     break;
   case OP_LTE:
+  case OP_NUM_LTE:
     if(type1 == TYPE_NUMBER && type2 == TYPE_NUMBER) {
       result = value1 <= value2;
     } else {
@@ -556,6 +585,7 @@ bool op_dual_comparison(VM * vm,  char * byteCode,
     }
     break;
   case OP_GTE:
+  case OP_NUM_GTE:
     if(type1 == TYPE_NUMBER && type2 == TYPE_NUMBER) {
       result = value1 >= value2;
     } else {
@@ -564,6 +594,7 @@ bool op_dual_comparison(VM * vm,  char * byteCode,
     }
     break;
   case OP_GT:
+  case OP_NUM_GT:
     if(type1 == TYPE_NUMBER && type2 == TYPE_NUMBER) {
       result = value1 > value2;
     } else {
@@ -571,6 +602,15 @@ bool op_dual_comparison(VM * vm,  char * byteCode,
       return false;
     }
     break;
+  case OP_NUM_EQUALS:
+  case OP_NUM_NOT_EQUALS:
+    if(type1 == TYPE_NUMBER && type2 == TYPE_NUMBER) {
+      result = (value1 == value2) == (code == OP_NUM_EQUALS);
+    } else {
+      vm_set_err(vm, VMERR_INVALID_TYPE_IN_OPERATION);
+      return false;
+    }
+    break;
   case OP_EQUALS:
     if((type1 == TYPE_NUMBER && type2 == TYPE_NUMBER) ||
        (type1 == TYPE_BOOLEAN && type2 == TYPE_BOOLEAN)) {
@@ -930,6 +970,172 @@ bool op_goto(VM * vm, char * byteCode,
   return true;
 }
 
+/**
+ * Steps the variable of a counted loop and goes back to the loop's body while
+ * it is within the limit. The variable and the limit must be numbers. The
+ * limit is read after the step.
+ * numLimit: true if the limit is a number in the bytecode, rather than a
+ * variable.
+ * OP_FOR_STEP [stack_depth:1] [arg_index:1] [comparison:1]
+ *   [step:sizeof(double)] [limit_depth:1] [limit_index:1]
+ *   [goto_address:sizeof(int)]
+ * OP_FOR_STEP_NUM [stack_depth:1] [arg_index:1] [comparison:1]
+ *   [step:sizeof(double)] [limit:sizeof(double)] [goto_address:sizeof(int)]
+ * comparison: OP_LT, OP_GT, OP_LTE or OP_GTE, as in variable < limit.
+ */
+bool op_for_step(VM * vm, char * byteCode, 
+		 size_t byteCodeLen, int * index, bool numLimit) {
+  size_t len = 4 + sizeof(double) + (numLimit ? sizeof(double) : 2)
+    + sizeof(int);
+  char * operands = byteCode + *index + 1;
+  char * limitOperands = operands + 3 + sizeof(double);
+  double value;
+  double step;
+  double limit;
+  bool result;
+  VarType type;
+  int addr;
+
+  /* check that there are enough bytes for the operands */
+  if((byteCodeLen - *index) < len) {
+    vm_set_err(vm, VMERR_UNEXPECTED_END_OF_OPCODES);
+    return false;
+  }
+
+  /* handle empty frame stack error case */
+  if(!(frmstk_size(vm->frmStk) > 0)) {
+    vm_set_err(vm, VMERR_FRMSTK_EMPTY);
+    return false;
+  }
+
+  /* step the variable */
+  if(!frmstk_var_read(vm->frmStk, operands[0], operands[1],
+		      &value, sizeof(double), &type)) {
+    vm_set_err(vm, VMERR_FRMSTK_VAR_ACCESS_FAILED);
+    return false;
+  }
+  if(type != TYPE_NUMBER) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_IN_OPERATION);
+    return false;
+  }
+  memcpy(&step, operands + 3, sizeof(double));
+  value += step;
+  frmstk_var_write(vm->frmStk, operands[0], operands[1],
+		   &value, sizeof(double), TYPE_NUMBER);
+
+  /* get the limit */
+  if(numLimit) {
+    memcpy(&limit, limitOperands, sizeof(double));
+  } else if(!frmstk_var_read(vm->frmStk, limitOperands[0], limitOperands[1],
+			     &limit, sizeof(double), &type)) {
+    vm_set_err(vm, VMERR_FRMSTK_VAR_ACCESS_FAILED);
+    return false;
+  } else if(type != TYPE_NUMBER) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_IN_OPERATION);
+    return false;
+  }
+
+  switch(operands[2]) {
+  case OP_LT:
+    result = value < limit;
+    break;
+  case OP_GT:
+    result = value > limit;
+    break;
+  case OP_LTE:
+    result = value <= limit;
+    break;
+  case OP_GTE:
+    result = value >= limit;
+    break;
+  default:
+    vm_set_err(vm, VMERR_INVALID_OPCODE);
+    return false;
+  }
+
+  /* leave the loop */
+  if(!result) {
+    *index += len;
+    return true;
+  }
+
+  memcpy(&addr, byteCode + *index + len - sizeof(int), sizeof(int));
+
+  if(addr < 0 || addr >= byteCodeLen) {
+    vm_set_err(vm, VMERR_INVALID_ADDR);
+    return false;
+  }
+
+  /* change address */
+  *index = addr;
+
+  return true;
+}
+
+/**
+ * Goes to one of the OP_GOTOs that follow the instruction, by the value of a
+ * variable. A number that is an integer within [min, min + count) goes to
+ * the OP_GOTO at that offset from min. Any other number, or a NULL, goes to
+ * the last OP_GOTO, at offset count. Other types are an error, as they are
+ * when compared with a number.
+ * OP_SWITCH_NUM [stack_depth:1] [arg_index:1] [min:sizeof(double)]
+ *   [count:sizeof(int)]
+ */
+bool op_switch_num(VM * vm, char * byteCode, 
+		   size_t byteCodeLen, int * index) {
+  size_t len = 3 + sizeof(double) + sizeof(int);
+  char * operands = byteCode + *index + 1;
+  double value;
+  double min;
+  VarType type;
+  int count;
+  int entry;
+  int addr;
+
+  /* check that there are enough bytes for the operands */
+  if((byteCodeLen - *index) < len) {
+    vm_set_err(vm, VMERR_UNEXPECTED_END_OF_OPCODES);
+    return false;
+  }
+
+  /* handle empty frame stack error case */
+  if(!(frmstk_size(vm->frmStk) > 0)) {
+    vm_set_err(vm, VMERR_FRMSTK_EMPTY);
+    return false;
+  }
+
+  if(!frmstk_var_read(vm->frmStk, operands[0], operands[1],
+		      &value, sizeof(double), &type)) {
+    vm_set_err(vm, VMERR_FRMSTK_VAR_ACCESS_FAILED);
+    return false;
+  }
+  if(type != TYPE_NUMBER && type != TYPE_NULL) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_IN_OPERATION);
+    return false;
+  }
+  memcpy(&min, operands + 2, sizeof(double));
+  memcpy(&count, operands + 2 + sizeof(double), sizeof(int));
+
+  /* find the table entry */
+  entry = count;
+  if(type == TYPE_NUMBER && value == floor(value)
+     && value - min >= 0 && value - min < count) {
+    entry = (int)(value - min);
+  }
+  addr = *index + len + (entry * (1 + sizeof(int)));
+
+  if(count < 0 || addr < 0 || addr >= byteCodeLen
+     || byteCode[addr] != OP_GOTO) {
+    vm_set_err(vm, VMERR_INVALID_ADDR);
+    return false;
+  }
+
+  /* change address */
+  *index = addr;
+
+  return true;
+}
+
 /**
  * Calls the specified native function, using the specified number of values
  * from the top of the stack as arguments. callback_index is the index where
@@ -0,0 +1,3080 @@
+/**
+ * optimizer.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * The optimization pipeline. Each function is lifted into the intermediate
+ * representation once it has been parsed, and every pass in the pass table
+ * whose level is at most the compiler's optimization level runs over it, in
+ * order, before it is lowered back to bytecode. The time each pass takes and
+ * the instructions it removes are recorded in the compiler's statistics.
+ * Level 0 turns the optimizer off, level 1 runs the passes that are always
+ * worth it, and higher levels add passes that cost more build time.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "optimizer.h"
+#include "ir.h"
+#include "gunderscript.h"
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+
+/* functions of at most this many instructions are inlined at their calls */
+#define OPT_INLINE_MAX_INSTRS        16
+/* ...or this many, if they are declared inline */
+#define OPT_INLINE_HINT_MAX_INSTRS   256
+/* functions stop growing from inlining at this many instructions */
+#define OPT_INLINE_MAX_CALLER_INSTRS 4096
+/* with a profile, calls that ran at least this many times are hot, and
+ * functions of at most this many instructions are inlined at them.
+ */
+#define OPT_PROFILE_HOT_CALLS        64
+#define OPT_INLINE_PROFILE_MAX_INSTRS 64
+/* branches that ran at least this many times are laid out by the profile */
+#define OPT_LAYOUT_MIN_RUNS          16
+/* loop conditions of at most this many instructions are copied to the end */
+#define OPT_LOOP_MAX_HEADER_INSTRS   32
+/* the most times that the loops of a function are changed */
+#define OPT_LOOP_MAX_ROUNDS          256
+/* induction variables only step by, and are only offset by, integers of at
+ * most this size, so that their values are exact.
+ */
+#define OPT_LOOP_MAX_INT             65536.0
+/* the types that a value may have, as a set of these bits */
+#define OPT_TYPE_NULL                1
+#define OPT_TYPE_BOOLEAN             2
+#define OPT_TYPE_NUMBER              4
+#define OPT_TYPE_OBJECT              8
+#define OPT_TYPE_ANY                 15
+/* the types of the operand stack are followed up to this depth */
+#define OPT_TYPE_MAX_STACK           64
+/* chains of at least this many comparisons of a variable with numbers
+ * become a switch...
+ */
+#define OPT_SWITCH_MIN_CASES         3
+/* ...if its table has at most this many entries for each case... */
+#define OPT_SWITCH_DENSITY           2
+/* ...and at most this many entries */
+#define OPT_SWITCH_MAX_ENTRIES       1024
+
+/**
+ * The function prototype for an optimization pass. Passes remove an
+ * instruction by making it an IR_NOP.
+ * c: an instance of Compiler.
+ * func: the function being optimized.
+ * returns: true upon success, and false if an error occurs, with c->err set.
+ */
+typedef bool (*OptPassFunc) (Compiler * c, IRFunc * func);
+
+/* an entry in the pass table */
+typedef struct OptPass {
+  const char * name;              /* name shown in statistics */
+  int level;                      /* lowest optimization level that runs it */
+  OptPassFunc run;
+} OptPass;
+
+/**
+ * Checks if an instruction only pushes a value, with no other effect.
+ * instr: the instruction.
+ * returns: true if it is a push of a constant or a variable.
+ */
+static bool opt_is_push(IRInstr * instr) {
+  switch(instr->op) {
+  case OP_VAR_PUSH:
+  case OP_NUM_PUSH:
+  case OP_STR_PUSH:
+  case OP_BOOL_PUSH:
+  case OP_NULL_PUSH:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Gets the opcode that works on operands of any type, for the number form of
+ * an opcode.
+ * op: the opcode.
+ * returns: the generic opcode, or op if it is not a number form.
+ */
+static char opt_generic_op(char op) {
+  switch(op) {
+  case OP_NUM_ADD:
+    return OP_ADD;
+  case OP_NUM_SUB:
+    return OP_SUB;
+  case OP_NUM_MUL:
+    return OP_MUL;
+  case OP_NUM_DIV:
+    return OP_DIV;
+  case OP_NUM_MOD:
+    return OP_MOD;
+  case OP_NUM_LT:
+    return OP_LT;
+  case OP_NUM_GT:
+    return OP_GT;
+  case OP_NUM_LTE:
+    return OP_LTE;
+  case OP_NUM_GTE:
+    return OP_GTE;
+  case OP_NUM_EQUALS:
+    return OP_EQUALS;
+  case OP_NUM_NOT_EQUALS:
+    return OP_NOT_EQUALS;
+  case OP_NUM_STOR:
+    return OP_VAR_STOR;
+  default:
+    return op;
+  }
+}
+
+/**
+ * Replaces an OP_FOR_STEP or OP_FOR_STEP_NUM with the instructions that it
+ * stands for, a store of the variable plus the step and a conditional jump on
+ * its comparison with the limit.
+ * func: the function.
+ * i: the instruction.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_expand_step(IRFunc * func, int i) {
+  IRInstr * step = &func->code[i];
+  IRInstr instr;
+  IRFunc * insert;
+  bool success;
+
+  insert = calloc(1, sizeof(IRFunc));
+  if(insert == NULL) {
+    return false;
+  }
+  memset(&instr, 0, sizeof(IRInstr));
+  instr.target = -1;
+  instr.string = -1;
+
+  /* var = var + step; */
+  instr.op = OP_VAR_PUSH;
+  instr.argsLen = 2;
+  memcpy(instr.args, step->args, 2);
+  success = ir_append(insert, &instr);
+  instr.op = OP_NUM_PUSH;
+  instr.argsLen = sizeof(double);
+  memcpy(instr.args, step->args + 3, sizeof(double));
+  success = success && ir_append(insert, &instr);
+  instr.op = OP_ADD;
+  instr.argsLen = 0;
+  success = success && ir_append(insert, &instr);
+  instr.op = OP_VAR_STOR;
+  instr.argsLen = 2;
+  memcpy(instr.args, step->args, 2);
+  success = success && ir_append(insert, &instr);
+  instr.op = OP_POP;
+  instr.argsLen = 0;
+  success = success && ir_append(insert, &instr);
+
+  /* var op limit */
+  instr.op = OP_VAR_PUSH;
+  instr.argsLen = 2;
+  memcpy(instr.args, step->args, 2);
+  success = success && ir_append(insert, &instr);
+  if(step->op == OP_FOR_STEP) {
+    instr.op = OP_VAR_PUSH;
+    instr.argsLen = 2;
+    memcpy(instr.args, step->args + 3 + sizeof(double), 2);
+  } else {
+    instr.op = OP_NUM_PUSH;
+    instr.argsLen = sizeof(double);
+    memcpy(instr.args, step->args + 3 + sizeof(double), sizeof(double));
+  }
+  success = success && ir_append(insert, &instr);
+  instr.op = step->args[2];
+  instr.argsLen = 0;
+  success = success && ir_append(insert, &instr);
+
+  /* the target is relative to the inserted code, once it is in place */
+  instr.op = OP_TCOND_GOTO;
+  instr.target = (step->target > i
+		  ? step->target + insert->size : step->target) - i;
+  success = success && ir_append(insert, &instr)
+    && ir_splice(func, i, insert);
+
+  ir_free(insert);
+  return success;
+}
+
+/**
+ * Replaces an OP_SWITCH_NUM and its table with a comparison of the variable
+ * with each number of the table and a conditional jump to its entry's target,
+ * followed by a jump to the target of the last entry.
+ * func: the function.
+ * i: the instruction.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_expand_switch(IRFunc * func, int i) {
+  IRInstr * code = func->code;
+  IRInstr instr;
+  IRFunc * insert;
+  bool success = true;
+  double min;
+  double value;
+  int count;
+  int size;
+  int j;
+
+  memcpy(&min, code[i].args + 2, sizeof(double));
+  memcpy(&count, code[i].args + 2 + sizeof(double), sizeof(int));
+  size = (4 * count) + 1;
+
+  insert = calloc(1, sizeof(IRFunc));
+  if(insert == NULL) {
+    return false;
+  }
+  memset(&instr, 0, sizeof(IRInstr));
+  instr.string = -1;
+
+  /* targets are relative to the inserted code, once it is in place */
+  for(j = 0; success && j <= count; j++) {
+    int target = code[i + 1 + j].target;
+
+    target = (target > i ? target + size - 1 : target) - i;
+    if(j < count) {
+      instr.op = OP_VAR_PUSH;
+      instr.argsLen = 2;
+      instr.target = -1;
+      memcpy(instr.args, code[i].args, 2);
+      success = ir_append(insert, &instr);
+      instr.op = OP_NUM_PUSH;
+      instr.argsLen = sizeof(double);
+      value = min + j;
+      memcpy(instr.args, &value, sizeof(double));
+      success = success && ir_append(insert, &instr);
+      instr.op = OP_EQUALS;
+      instr.argsLen = 0;
+      success = success && ir_append(insert, &instr);
+      instr.op = OP_TCOND_GOTO;
+    } else {
+      instr.op = OP_GOTO;
+    }
+    instr.argsLen = 0;
+    instr.target = target;
+    success = success && ir_append(insert, &instr);
+  }
+
+  success = success && ir_splice(func, i, insert);
+  ir_free(insert);
+  if(!success) {
+    return false;
+  }
+
+  /* nothing else goes to the table */
+  for(j = 0; j <= count; j++) {
+    func->code[i + size + j].op = IR_NOP;
+    func->code[i + size + j].target = -1;
+  }
+  return true;
+}
+
+/**
+ * Replaces the fused instructions of a function, OP_FOR_STEP,
+ * OP_FOR_STEP_NUM and OP_SWITCH_NUM, with the instructions that they stand
+ * for, so that passes need not know about them. The fuse and switch passes
+ * put them back.
+ * func: the function.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_expand_fused(IRFunc * func) {
+  bool switches = false;
+  int i;
+
+  for(i = func->size - 1; i >= 0; i--) {
+    char op = func->code[i].op;
+
+    if(op == OP_FOR_STEP || op == OP_FOR_STEP_NUM) {
+      if(!opt_expand_step(func, i)) {
+	return false;
+      }
+    } else if(op == OP_SWITCH_NUM) {
+      if(!opt_expand_switch(func, i)) {
+	return false;
+      }
+      switches = true;
+    }
+  }
+
+  /* drop the tables */
+  return !switches || ir_compact(func);
+}
+
+/**
+ * Optimization pass: removes instructions that cancel out with their
+ * neighbours. A jump to the next instruction, a value that is pushed and
+ * popped right away, and the pop and reload of a variable that was just
+ * stored, which the parsers write for consecutive statements.
+ */
+static bool opt_peephole(Compiler * c, IRFunc * func) {
+  IRInstr * code = func->code;
+  int * jumps;
+  int i;
+
+  jumps = ir_jump_counts(func);
+  if(jumps == NULL) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
+
+  for(i = 0; i < func->size; i++) {
+    if(code[i].op == OP_GOTO && code[i].target == i + 1) {
+      jumps[i + 1]--;
+      code[i].op = IR_NOP;
+    } else if(opt_is_push(&code[i]) && i + 1 < func->size
+	      && code[i + 1].op == OP_POP && jumps[i + 1] == 0) {
+      code[i].op = IR_NOP;
+      code[i + 1].op = IR_NOP;
+      i++;
+    } else if(code[i].op == OP_VAR_STOR && i + 2 < func->size
+	      && code[i + 1].op == OP_POP && jumps[i + 1] == 0
+	      && code[i + 2].op == OP_VAR_PUSH && jumps[i + 2] == 0
+	      && memcmp(code[i].args, code[i + 2].args, 2) == 0) {
+      /* the stored value is still on the stack */
+      code[i + 1].op = IR_NOP;
+      code[i + 2].op = IR_NOP;
+      i += 2;
+    }
+  }
+
+  free(jumps);
+  return true;
+}
+
+/**
+ * Finds the script function that starts at an address, and where it ends.
+ * c: an instance of Compiler.
+ * addr: the address.
+ * end: receives the address after the function's last instruction.
+ * returns: the function, or NULL if no function starts at addr.
+ */
+static VMFunc * opt_function_at(Compiler * c, int addr, int * end) {
+  VMFunc * found = NULL;
+  HTIter iter;
+
+  *end = buffer_size(vm_buffer(c->vm));
+
+  /* each function ends where the one after it starts */
+  ht_iter_get(vm_functions(c->vm), &iter);
+  while(ht_iter_has_next(&iter)) {
+    DSValue value;
+    VMFunc * function;
+
+    ht_iter_next(&iter, NULL, 0, &value, NULL, false);
+    function = value.pointerVal;
+    if(function->index == addr) {
+      found = function;
+    } else if(function->index > addr && function->index < *end) {
+      *end = function->index;
+    }
+  }
+  return found;
+}
+
+/**
+ * Looks up what the compiler's profile recorded for the function at an
+ * address.
+ * c: an instance of Compiler.
+ * addr: the address.
+ * returns: the function's profile, or NULL if there is no profile or the
+ * function isn't in it.
+ */
+static ProfileFunc * opt_profile(Compiler * c, int addr) {
+  HTIter iter;
+
+  if(c->profile == NULL) {
+    return NULL;
+  }
+
+  ht_iter_get(vm_functions(c->vm), &iter);
+  while(ht_iter_has_next(&iter)) {
+    char name[GS_MAX_FUNCTION_NAME_LEN];
+    size_t nameLen;
+    DSValue value;
+
+    ht_iter_next(&iter, name, GS_MAX_FUNCTION_NAME_LEN, &value, &nameLen,
+		 false);
+    if(((VMFunc*)value.pointerVal)->index == addr) {
+      return nameLen <= GS_MAX_FUNCTION_NAME_LEN
+	? profile_function(c->profile, name, nameLen) : NULL;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Looks up what a profile recorded for an instruction.
+ * profile: the profile of the instruction's function, or NULL.
+ * instr: the instruction.
+ * returns: the instruction's profile, or NULL if there is none, the
+ * instruction is new, or it never ran.
+ */
+static ProfileSite * opt_profile_site(ProfileFunc * profile, IRInstr * instr) {
+  if(profile == NULL || instr->origin == 0) {
+    return NULL;
+  }
+  return profile_site(profile, instr->origin - 1);
+}
+
+/**
+ * Finds the frame that holds the variable of an OP_VAR_PUSH or OP_VAR_STOR.
+ * instr: the instruction.
+ * frame: the frame that is live before it, from ir_frames().
+ * parent: the enclosing frame of each frame, from ir_frames().
+ * returns: the frame, or -1 if it is not known.
+ */
+static int opt_var_frame(IRInstr * instr, int frame, int * parent) {
+  int i;
+
+  for(i = 0; i < instr->args[0] && frame != -1; i++) {
+    frame = parent[frame];
+  }
+  return frame;
+}
+
+/**
+ * Rewrites a function's code to run in place of a call to it, without a
+ * frame of its own. Its variables are kept in the frame that is live at the
+ * call, starting at a given slot. The code starts by storing the arguments,
+ * and clearing the variables that may be read before they are set, and
+ * returns jump to the end, after popping the frames of the blocks that they
+ * are within.
+ * callee: the function.
+ * numArgs: the number of arguments.
+ * numVarArgs: the number of arguments and variables.
+ * base: the slot of the first argument in the frame of the call.
+ * returns: the code to inline, to be freed with ir_free(), or NULL if an
+ * allocation fails. Its strings are the callee's, which is left without any.
+ */
+static IRFunc * opt_inline_body(IRFunc * callee, int numArgs, int numVarArgs,
+				int base) {
+  IRFunc * body = calloc(1, sizeof(IRFunc));
+  int * newIndex = malloc((callee->size + 1) * sizeof(int));
+  int * frame = malloc(callee->size * sizeof(int));
+  int * parent = malloc((callee->size + 1) * sizeof(int));
+  int * jumps = ir_jump_counts(callee);
+  bool * set = calloc(numVarArgs + 1, sizeof(bool));
+  IRInstr instr;
+  bool success = true;
+  int i;
+  int j;
+
+  if(body == NULL || newIndex == NULL || frame == NULL || parent == NULL
+     || jumps == NULL || set == NULL || !ir_frames(callee, frame, parent)) {
+    free(body);
+    free(newIndex);
+    free(frame);
+    free(parent);
+    free(jumps);
+    free(set);
+    return NULL;
+  }
+  body->source = callee->source;
+  body->sourceLen = callee->sourceLen;
+  callee->source = NULL;
+  callee->sourceLen = 0;
+
+  /* variables that are set before any branch, and before they are read,
+   * need not be cleared.
+   */
+  for(i = 0; i < numArgs; i++) {
+    set[i] = true;
+  }
+  for(i = 0; i < callee->size && (i == 0 || jumps[i] == 0)
+	&& callee->code[i].target == -1; i++) {
+    IRInstr * code = &callee->code[i];
+
+    if((code->op != OP_VAR_PUSH && code->op != OP_VAR_STOR)
+       || opt_var_frame(code, frame[i], parent) != 0
+       || code->args[1] < 0 || code->args[1] >= numVarArgs) {
+      continue;
+    }
+    if(code->op == OP_VAR_STOR) {
+      set[(int)code->args[1]] = true;
+    } else if(!set[(int)code->args[1]]) {
+      break;
+    }
+  }
+
+  memset(&instr, 0, sizeof(IRInstr));
+  instr.target = -1;
+  instr.string = -1;
+
+  /* pop the arguments into their slots, last first, and clear the rest */
+  for(i = 0; success && i < numVarArgs; i++) {
+    int slot = i < numArgs ? numArgs - 1 - i : i;
+
+    if(slot >= numArgs && set[slot]) {
+      continue;
+    }
+    if(slot >= numArgs) {
+      instr.op = OP_NULL_PUSH;
+      instr.argsLen = 0;
+      success = ir_append(body, &instr);
+    }
+
+    instr.op = OP_VAR_STOR;
+    instr.args[0] = 0;
+    instr.args[1] = base + slot;
+    instr.argsLen = 2;
+    success = success && ir_append(body, &instr);
+
+    instr.op = OP_POP;
+    instr.argsLen = 0;
+    success = success && ir_append(body, &instr);
+  }
+
+  for(i = 0; success && i < callee->size; i++) {
+    IRInstr * code = &callee->code[i];
+    int pops = 0;
+
+    newIndex[i] = body->size;
+    if(code->op == OP_RETURN) {
+      /* the frames of the blocks that it is within */
+      for(j = frame[i]; j > 0; j = parent[j]) {
+	pops++;
+      }
+    } else if(code->op != OP_FRM_POP || frame[i] != 0) {
+      success = ir_append(body, code);
+      if((code->op == OP_VAR_PUSH || code->op == OP_VAR_STOR)
+	 && opt_var_frame(code, frame[i], parent) == 0) {
+	body->code[body->size - 1].args[1] += base;
+      }
+      continue;
+    }
+
+    /* leave the function's frames and jump past its end */
+    instr.op = OP_FRM_POP;
+    instr.argsLen = 0;
+    for(j = 0; success && j < pops; j++) {
+      success = ir_append(body, &instr);
+    }
+    instr.op = OP_GOTO;
+    instr.target = -2;
+    success = success && ir_append(body, &instr);
+    instr.target = -1;
+  }
+  newIndex[callee->size] = body->size;
+
+  for(i = 0; success && i < body->size; i++) {
+    if(body->code[i].target == -2) {
+      body->code[i].target = body->size;
+    } else if(body->code[i].target >= 0) {
+      body->code[i].target = newIndex[body->code[i].target];
+    }
+  }
+
+  free(newIndex);
+  free(frame);
+  free(parent);
+  free(jumps);
+  free(set);
+  if(!success) {
+    ir_free(body);
+    return NULL;
+  }
+  return body;
+}
+
+/**
+ * Makes room for new variables, such as an inlined function's, in a frame of
+ * a function.
+ * c: an instance of Compiler.
+ * func: the function.
+ * site: the frame, which is the function's own frame, or one pushed by an
+ * OP_FRM_PUSH of func, from ir_frames().
+ * numVarArgs: the number of slots to add.
+ * commit: false to only find the slot, and true to also add the slots.
+ * returns: the first of the new slots, or -1 if the frame would be too big.
+ */
+static int opt_add_slots(Compiler * c, IRFunc * func, int site,
+			 int numVarArgs, bool commit) {
+  VMFunc * caller;
+  int base;
+  int end;
+  int i;
+
+  if(site > 0) {
+    base = func->code[site - 1].args[0];
+    if(base + numVarArgs > CHAR_MAX) {
+      return -1;
+    }
+    if(commit) {
+      func->code[site - 1].args[0] = base + numVarArgs;
+    }
+    return base;
+  }
+
+  /* the function's own frame is sized by its definition, and by every call
+   * to it, of which only its own calls to itself are compiled yet.
+   */
+  caller = opt_function_at(c, func->start, &end);
+  if(caller == NULL) {
+    return -1;
+  }
+  base = caller->numArgs + caller->numVars;
+  if(base + numVarArgs > CHAR_MAX) {
+    return -1;
+  }
+  if(commit) {
+    caller->numVars += numVarArgs;
+    for(i = 0; i < func->size; i++) {
+      if(func->code[i].op == OP_CALL_B
+	 && memcmp(func->code[i].args + 2, &func->start, sizeof(int)) == 0) {
+	func->code[i].args[0] = base + numVarArgs;
+      }
+    }
+  }
+  return base;
+}
+
+/**
+ * Gets the most instructions that a function may have to be inlined at a
+ * call. Without a profile, that depends on whether it was declared inline.
+ * With one, a call that never ran is only inlined if the function was
+ * declared inline, since it would only grow the caller. A call that ran
+ * often may inline a larger function, and one as large as those declared
+ * inline if the function's operators only ever saw numbers, since the types
+ * pass can then prove them to be number forms within the caller.
+ * c: an instance of Compiler.
+ * func: the caller.
+ * call: the call.
+ * function: the function that it calls.
+ * returns: the limit, which is 0 for none.
+ */
+static int opt_inline_limit(Compiler * c, IRFunc * func, IRInstr * call,
+			    VMFunc * function) {
+  int limit = function->inlineHint
+    ? OPT_INLINE_HINT_MAX_INSTRS : OPT_INLINE_MAX_INSTRS;
+  ProfileFunc * caller;
+  ProfileFunc * callee;
+  ProfileSite * site;
+
+  if(call->origin == 0 || (caller = opt_profile(c, func->start)) == NULL) {
+    return limit;
+  } else if((site = opt_profile_site(caller, call)) == NULL) {
+    return function->inlineHint ? limit : 0;
+  } else if(site->count < OPT_PROFILE_HOT_CALLS) {
+    return limit;
+  }
+
+  callee = opt_profile(c, function->index);
+  if(callee != NULL && callee->types == PROFILE_TYPE_NUMBER) {
+    return OPT_INLINE_HINT_MAX_INSTRS;
+  }
+  return limit > OPT_INLINE_PROFILE_MAX_INSTRS
+    ? limit : OPT_INLINE_PROFILE_MAX_INSTRS;
+}
+
+/**
+ * Optimization pass: replaces calls to small script functions, to those
+ * declared inline, and to those that a profile shows to be hot, with the
+ * code of the function, saving the cost of the call, its frame, and the
+ * return. Functions are compiled before the calls
+ * to them, so they already have their own calls inlined, and a function that
+ * calls itself is never inlined.
+ */
+static bool opt_inline(Compiler * c, IRFunc * func) {
+  int * frame = NULL;
+  int * parent = NULL;
+  bool success = true;
+  int i;
+
+  for(i = 0; success && i < func->size; i++) {
+    IRInstr * call = &func->code[i];
+    IRFunc * callee;
+    IRFunc * body;
+    VMFunc * function;
+    int numVarArgs = call->args[0];
+    int numArgs = call->args[1];
+    int base;
+    int addr;
+    int end;
+    int j;
+
+    if(call->op != OP_CALL_B) {
+      continue;
+    }
+
+    memcpy(&addr, call->args + 2, sizeof(int));
+    function = opt_function_at(c, addr, &end);
+    if(function == NULL || !function->loaded || addr == func->start
+       || end > func->start || numArgs != function->numArgs) {
+      continue;
+    }
+
+    /* the frames, as of the last call that was inlined */
+    if(frame == NULL) {
+      frame = malloc(func->size * sizeof(int));
+      parent = malloc((func->size + 1) * sizeof(int));
+      if(frame == NULL || parent == NULL || !ir_frames(func, frame, parent)) {
+	success = false;
+	break;
+      }
+    }
+    if(frame[i] == -1
+       || (base = opt_add_slots(c, func, frame[i], numVarArgs,
+				false)) == -1) {
+      continue;
+    }
+
+    callee = ir_lift(buffer_get_buffer(vm_buffer(c->vm)), addr, end);
+    if(callee == NULL) {
+      continue;
+    }
+
+    /* the types of the callee's number forms were proven for its own frame,
+     * and are proven again for the caller's. its profile is of its own
+     * calls, not of this one.
+     */
+    for(j = 0; j < callee->size; j++) {
+      callee->code[j].op = opt_generic_op(callee->code[j].op);
+      callee->code[j].origin = 0;
+    }
+    if(!opt_expand_fused(callee)) {
+      ir_free(callee);
+      success = false;
+      break;
+    }
+
+    /* small enough, and not recursive */
+    j = opt_inline_limit(c, func, call, function);
+    if(callee->size > j
+       || func->size + callee->size > OPT_INLINE_MAX_CALLER_INSTRS) {
+      ir_free(callee);
+      continue;
+    }
+    for(j = 0; j < callee->size; j++) {
+      if(callee->code[j].op == OP_CALL_B
+	 && memcmp(callee->code[j].args + 2, &addr, sizeof(int)) == 0) {
+	break;
+      }
+    }
+    if(j < callee->size) {
+      ir_free(callee);
+      continue;
+    }
+
+    body = opt_inline_body(callee, numArgs, numVarArgs, base);
+    ir_free(callee);
+    if(body == NULL || !ir_splice(func, i, body)) {
+      if(body != NULL) {
+	ir_free(body);
+      }
+      success = false;
+      break;
+    }
+    opt_add_slots(c, func, frame[i], numVarArgs, true);
+
+    /* the inlined code's own calls were considered when it was compiled */
+    i += body->size - 1;
+    ir_free(body);
+    free(frame);
+    free(parent);
+    frame = NULL;
+    parent = NULL;
+  }
+
+  free(frame);
+  free(parent);
+  if(!success) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+  }
+  return success;
+}
+
+/**
+ * Optimization pass: jump threading. A jump to a GOTO goes straight to where
+ * the GOTO goes, and a jump to a push of a boolean that a conditional jump
+ * then tests goes straight to where the test sends it. The short circuit
+ * code of && and || within conditions is mostly made of these.
+ */
+static bool opt_jumps(Compiler * c, IRFunc * func) {
+  IRInstr * code = func->code;
+  int i;
+  int hops;
+
+  for(i = 0; i < func->size; i++) {
+    IRInstr * jump = &code[i];
+
+    if(jump->target < 0) {
+      continue;
+    }
+
+    /* a bounded number of hops, since GOTOs may form a cycle */
+    for(hops = 0; hops < func->size && jump->target < func->size; hops++) {
+      IRInstr * target = &code[jump->target];
+
+      if(target->op == OP_GOTO && target->target != jump->target) {
+	jump->target = target->target;
+      } else if(target->op == OP_BOOL_PUSH && jump->target + 1 < func->size
+		&& (code[jump->target + 1].op == OP_TCOND_GOTO
+		    || code[jump->target + 1].op == OP_FCOND_GOTO)) {
+	IRInstr * test = &code[jump->target + 1];
+	bool taken = (target->args[0] != 0) == (test->op == OP_TCOND_GOTO);
+
+	jump->target = taken ? test->target : jump->target + 2;
+      } else {
+	break;
+      }
+    }
+  }
+  return true;
+}
+
+/* a value that is known when the function is compiled */
+typedef struct OptConst {
+  VarType type;                   /* TYPE_NUMBER, TYPE_BOOLEAN, TYPE_NULL, or
+				     TYPE_LIBDATA for a string */
+  double number;
+  bool boolean;
+  char * string;                  /* text within the function's source */
+  int stringLen;
+} OptConst;
+
+/**
+ * Gets the value that an instruction pushes, if it pushes a constant.
+ * func: the function.
+ * instr: the instruction.
+ * value: receives the value.
+ * returns: true if the instruction is a push of a constant.
+ */
+static bool opt_const_get(IRFunc * func, IRInstr * instr, OptConst * value) {
+  switch(instr->op) {
+  case OP_NUM_PUSH:
+    value->type = TYPE_NUMBER;
+    memcpy(&value->number, instr->args, sizeof(double));
+    return true;
+  case OP_BOOL_PUSH:
+    value->type = TYPE_BOOLEAN;
+    value->boolean = instr->args[0] != 0;
+    return true;
+  case OP_NULL_PUSH:
+    value->type = TYPE_NULL;
+    return true;
+  case OP_STR_PUSH:
+    value->type = TYPE_LIBDATA;
+    value->string = func->source + instr->string;
+    value->stringLen = instr->args[0];
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Makes an instruction push a constant.
+ * func: the function.
+ * instr: the instruction to replace.
+ * value: the value. A string must be shorter than CHAR_MAX.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_const_set(IRFunc * func, IRInstr * instr, OptConst * value) {
+  instr->target = -1;
+  instr->string = -1;
+
+  switch(value->type) {
+  case TYPE_NUMBER:
+    instr->op = OP_NUM_PUSH;
+    instr->argsLen = sizeof(double);
+    memcpy(instr->args, &value->number, sizeof(double));
+    break;
+  case TYPE_BOOLEAN:
+    instr->op = OP_BOOL_PUSH;
+    instr->argsLen = 1;
+    instr->args[0] = value->boolean;
+    break;
+  case TYPE_LIBDATA:
+    instr->op = OP_STR_PUSH;
+    instr->argsLen = 1;
+    instr->args[0] = value->stringLen;
+    instr->string = ir_add_string(func, value->string, value->stringLen);
+    if(instr->string == -1) {
+      return false;
+    }
+    break;
+  default:
+    instr->op = OP_NULL_PUSH;
+    instr->argsLen = 0;
+    break;
+  }
+  return true;
+}
+
+/**
+ * Evaluates an operator upon two constants, the way that the VM would.
+ * op: the operator.
+ * a: the first operand, which receives the result.
+ * b: the second operand.
+ * text: a buffer of at least CHAR_MAX bytes for a string result.
+ * returns: true if the operation was evaluated, and false if the VM would
+ * raise an error, which is left for it to raise when the code runs.
+ */
+static bool opt_const_eval(char op, OptConst * a, OptConst * b, char * text) {
+  bool numbers = a->type == TYPE_NUMBER && b->type == TYPE_NUMBER;
+  bool booleans = a->type == TYPE_BOOLEAN && b->type == TYPE_BOOLEAN;
+  bool nulls = a->type == TYPE_NULL || b->type == TYPE_NULL;
+  bool result;
+
+  switch(op) {
+  case OP_ADD:
+    if(a->type == TYPE_LIBDATA && b->type == TYPE_LIBDATA) {
+      if(a->stringLen + b->stringLen >= CHAR_MAX) {
+	return false;
+      }
+      memcpy(text, a->string, a->stringLen);
+      memcpy(text + a->stringLen, b->string, b->stringLen);
+      a->string = text;
+      a->stringLen += b->stringLen;
+      return true;
+    } else if(!numbers) {
+      return false;
+    }
+    a->number += b->number;
+    return true;
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_MOD:
+    if(!numbers || (op == OP_DIV && b->number == 0)) {
+      return false;
+    }
+    if(op == OP_SUB) {
+      a->number -= b->number;
+    } else if(op == OP_MUL) {
+      a->number *= b->number;
+    } else if(op == OP_DIV) {
+      a->number /= b->number;
+    } else {
+      a->number = fmod(a->number, b->number);
+    }
+    return true;
+  case OP_LT:
+  case OP_GT:
+  case OP_LTE:
+  case OP_GTE:
+    if(!numbers) {
+      return false;
+    }
+    result = (op == OP_LT && a->number < b->number)
+      || (op == OP_GT && a->number > b->number)
+      || (op == OP_LTE && a->number <= b->number)
+      || (op == OP_GTE && a->number >= b->number);
+    break;
+  case OP_EQUALS:
+  case OP_NOT_EQUALS:
+    if(numbers) {
+      result = a->number == b->number;
+    } else if(booleans) {
+      result = a->boolean == b->boolean;
+    } else if(nulls) {
+      result = a->type == b->type;
+    } else {
+      return false;
+    }
+    if(op == OP_NOT_EQUALS) {
+      result = !result;
+    }
+    break;
+  case OP_AND:
+  case OP_OR:
+    if(!booleans) {
+      return false;
+    }
+    result = op == OP_AND ? (a->boolean && b->boolean)
+      : (a->boolean || b->boolean);
+    break;
+  default:
+    return false;
+  }
+
+  a->type = TYPE_BOOLEAN;
+  a->boolean = result;
+  return true;
+}
+
+/**
+ * Folds operators whose operands are constants into a push of the result.
+ * func: the function, which must be compacted.
+ * changed: set to true if anything was folded.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_fold(IRFunc * func, bool * changed) {
+  IRInstr * code = func->code;
+  char text[CHAR_MAX];
+  OptConst a;
+  OptConst b;
+  int * jumps;
+  int i;
+
+  jumps = ir_jump_counts(func);
+  if(jumps == NULL) {
+    return false;
+  }
+
+  for(i = 0; i + 1 < func->size; i++) {
+    if(!opt_const_get(func, &code[i], &a) || jumps[i + 1] != 0) {
+      continue;
+    }
+
+    if(code[i + 1].op == OP_NOT && a.type == TYPE_BOOLEAN) {
+      /* the result replaces the operand */
+      a.boolean = !a.boolean;
+      opt_const_set(func, &code[i], &a);
+      code[i + 1].op = IR_NOP;
+      *changed = true;
+    } else if(i + 2 < func->size && jumps[i + 2] == 0
+	      && opt_const_get(func, &code[i + 1], &b)
+	      && opt_const_eval(code[i + 2].op, &a, &b, text)) {
+      if(!opt_const_set(func, &code[i], &a)) {
+	free(jumps);
+	return false;
+      }
+      code[i + 1].op = IR_NOP;
+      code[i + 2].op = IR_NOP;
+      *changed = true;
+      i += 2;
+    }
+  }
+
+  free(jumps);
+  return true;
+}
+
+/**
+ * Finds the instructions that can run before a given instruction has run.
+ * func: the function.
+ * avoid: the instruction.
+ * reached: receives true for each instruction that can be reached from the
+ * start of the function without running avoid.
+ * pending: space for func->size instructions.
+ */
+static void opt_reach(IRFunc * func, int avoid, bool * reached,
+		      int * pending) {
+  IRInstr * instr;
+  int numPending = 0;
+  int i;
+
+  for(i = 0; i < func->size; i++) {
+    reached[i] = false;
+  }
+
+  if(avoid != 0) {
+    reached[0] = true;
+    pending[numPending++] = 0;
+  }
+
+  while(numPending > 0) {
+    i = pending[--numPending];
+    instr = &func->code[i];
+
+    /* an instruction continues to the next unless it always jumps or
+     * returns. any jump may be taken.
+     */
+    if(instr->op != OP_GOTO && instr->op != OP_RETURN && i + 1 < func->size
+       && i + 1 != avoid && !reached[i + 1]) {
+      reached[i + 1] = true;
+      pending[numPending++] = i + 1;
+    }
+    if(instr->target >= 0 && instr->target < func->size
+       && instr->target != avoid && !reached[instr->target]) {
+      reached[instr->target] = true;
+      pending[numPending++] = instr->target;
+    }
+  }
+}
+
+/**
+ * Replaces reads of variables that are stored to only once, with a number or
+ * boolean constant, by the constant, where the store is certain to have run. Each variable is
+ * identified by the frame that holds it and by its slot.
+ * func: the function, which must be compacted.
+ * changed: set to true if any read was replaced.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_propagate(IRFunc * func, bool * changed) {
+  IRInstr * code = func->code;
+  int * jumps = ir_jump_counts(func);
+  int * frame = malloc(func->size * sizeof(int));
+  int * parent = malloc((func->size + 1) * sizeof(int));
+  int * block = malloc(func->size * sizeof(int));
+  int * stores = malloc(func->size * sizeof(int));
+  int * pending = malloc(func->size * sizeof(int));
+  bool * reached = malloc(func->size * sizeof(bool));
+  int i;
+  int j;
+  OptConst value;
+
+  if(jumps == NULL || frame == NULL || parent == NULL || block == NULL
+     || stores == NULL || pending == NULL || reached == NULL
+     || !ir_frames(func, frame, parent)) {
+    free(jumps);
+    free(frame);
+    free(parent);
+    free(block);
+    free(stores);
+    free(pending);
+    free(reached);
+    return false;
+  }
+
+  /* the frame whose variable each VAR_PUSH or VAR_STOR accesses */
+  for(i = 0; i < func->size; i++) {
+    block[i] = -1;
+    if(code[i].op == OP_VAR_PUSH || code[i].op == OP_VAR_STOR) {
+      block[i] = opt_var_frame(&code[i], frame[i], parent);
+    }
+  }
+
+  /* the number of stores to the variable of each store */
+  for(i = 0; i < func->size; i++) {
+    stores[i] = 0;
+    if(code[i].op != OP_VAR_STOR) {
+      continue;
+    }
+    for(j = 0; j < func->size; j++) {
+      if(code[j].op == OP_VAR_STOR && block[j] == block[i]
+	 && code[j].args[1] == code[i].args[1]) {
+	stores[i]++;
+      }
+    }
+  }
+
+  for(i = 1; i < func->size; i++) {
+    /* only stores of a constant that are the variable's only store. strings
+     * are mutable objects, so each read must see the one that was stored
+     * rather than a fresh copy.
+     */
+    if(code[i].op != OP_VAR_STOR || stores[i] != 1 || block[i] == -1
+       || jumps[i] != 0 || !opt_const_get(func, &code[i - 1], &value)
+       || value.type == TYPE_NULL || value.type == TYPE_LIBDATA) {
+      continue;
+    }
+
+    /* reads that can run before the store may see a different value */
+    opt_reach(func, i, reached, pending);
+    for(j = 0; j < func->size; j++) {
+      if(code[j].op == OP_VAR_PUSH && !reached[j] && block[j] == block[i]
+	 && code[j].args[1] == code[i].args[1]) {
+	code[j] = code[i - 1];
+	*changed = true;
+      }
+    }
+  }
+
+  free(jumps);
+  free(frame);
+  free(parent);
+  free(block);
+  free(stores);
+  free(pending);
+  free(reached);
+  return true;
+}
+
+/**
+ * Optimization pass: evaluates operators on constants when the function is
+ * compiled, and replaces reads of variables that are only ever set to one
+ * constant with the constant. Each of these may make more of the other
+ * possible, so they alternate until neither changes anything.
+ */
+static bool opt_constants(Compiler * c, IRFunc * func) {
+  bool changed = true;
+
+  while(changed) {
+    changed = false;
+    if(!opt_fold(func, &changed) || !ir_compact(func)
+       || !opt_propagate(func, &changed) || !ir_compact(func)) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Optimization pass: removes dead code. A conditional jump on a constant
+ * either always jumps, and becomes a GOTO, or never does, and is removed,
+ * and a GOTO that takes a constant to a conditional jump goes where it goes.
+ * Then code that no path through the function reaches, such as the branch
+ * that such a jump never takes, or what jump threading and inlining leave
+ * behind, is removed.
+ */
+static bool opt_dead_code(Compiler * c, IRFunc * func) {
+  IRInstr * code = func->code;
+  int * jumps = ir_jump_counts(func);
+  int * frame;
+  int * parent;
+  bool success = true;
+  int i;
+
+  if(jumps == NULL) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
+
+  /* jumps to the push still reach the jump, which now has a known outcome,
+   * but jumps straight to the jump may bring another value. the push may
+   * also be stored to a variable on its way to the jump. from the end, so
+   * that adding an instruction leaves the ones still to look at in place.
+   */
+  for(i = func->size - 1; success && i > 0; i--) {
+    int push = i - 1;
+    bool taken;
+
+    /* a GOTO that carries the push to the jump goes where the jump would */
+    if(code[i].op == OP_GOTO && jumps[i] == 0 && code[push].op == OP_BOOL_PUSH
+       && code[i].target < func->size
+       && (code[code[i].target].op == OP_TCOND_GOTO
+	   || code[code[i].target].op == OP_FCOND_GOTO)) {
+      IRInstr * test = &code[code[i].target];
+
+      taken = (code[push].args[0] != 0) == (test->op == OP_TCOND_GOTO);
+      code[push].op = IR_NOP;
+      code[i].target = taken ? test->target : code[i].target + 1;
+      continue;
+    }
+
+    if(code[push].op == OP_VAR_STOR && jumps[push] == 0) {
+      push--;
+    }
+    if((code[i].op != OP_TCOND_GOTO && code[i].op != OP_FCOND_GOTO)
+       || jumps[i] != 0 || push < 0 || code[push].op != OP_BOOL_PUSH) {
+      continue;
+    }
+    taken = (code[push].args[0] != 0) == (code[i].op == OP_TCOND_GOTO);
+
+    if(push == i - 1) {
+      code[push].op = IR_NOP;
+      code[i].op = taken ? OP_GOTO : IR_NOP;
+    } else if(!taken) {
+      code[i].op = OP_POP;
+    } else {
+      /* the stored value is still on the stack */
+      IRFunc * insert = calloc(1, sizeof(IRFunc));
+      IRInstr instr = code[i];
+
+      instr.op = OP_GOTO;
+      instr.target = (instr.target > i ? instr.target + 1 : instr.target) - i;
+      code[i].op = OP_POP;
+      code[i].target = -1;
+      success = insert != NULL && ir_append(insert, &code[i])
+	&& ir_append(insert, &instr) && ir_splice(func, i, insert);
+      code = func->code;
+      if(insert != NULL) {
+	ir_free(insert);
+      }
+      continue;
+    }
+    if(code[i].op != OP_GOTO) {
+      code[i].target = -1;
+    }
+  }
+  free(jumps);
+
+  frame = malloc(func->size * sizeof(int));
+  parent = malloc((func->size + 1) * sizeof(int));
+  if(!success || frame == NULL || parent == NULL || !ir_compact(func)
+     || !ir_frames(func, frame, parent)) {
+    free(frame);
+    free(parent);
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
+
+  /* ir_frames() only gives a frame to the instructions that it reaches */
+  for(i = 0; i < func->size; i++) {
+    if(frame[i] == -1) {
+      func->code[i].op = IR_NOP;
+      func->code[i].target = -1;
+    }
+  }
+
+  free(frame);
+  free(parent);
+  return true;
+}
+
+/* a loop, which is entered only at its head */
+typedef struct OptLoop {
+  int head;                       /* the first instruction */
+  int latch;                      /* the last instruction, which jumps back */
+  int frame;                      /* the frame that is live at the head */
+} OptLoop;
+
+/* the frames of a function, from ir_frames(), and what refers to them */
+typedef struct OptFrames {
+  int * frame;                    /* the frame that is live at each instr */
+  int * parent;                   /* the enclosing frame of each frame */
+  int * block;                    /* the frame of each variable access */
+  int * jumps;                    /* the number of jumps to each instr */
+} OptFrames;
+
+/**
+ * Finds how many frames out one frame is from another that encloses it.
+ * from: the inner frame.
+ * to: the outer frame.
+ * parent: the enclosing frame of each frame, from ir_frames().
+ * returns: the number of frames, or -1 if to does not enclose from.
+ */
+static int opt_frame_dist(int from, int to, int * parent) {
+  int dist = 0;
+
+  while(from != to) {
+    if(from == -1) {
+      return -1;
+    }
+    from = parent[from];
+    dist++;
+  }
+  return dist;
+}
+
+/**
+ * Checks if an instruction is an operator, which replaces its operands with
+ * its result.
+ * instr: the instruction.
+ * returns: true for the arithmetic, comparison, and logical operators.
+ */
+static bool opt_is_operator(IRInstr * instr) {
+  switch(instr->op) {
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_LT:
+  case OP_GT:
+  case OP_LTE:
+  case OP_GTE:
+  case OP_EQUALS:
+  case OP_NOT_EQUALS:
+  case OP_AND:
+  case OP_OR:
+  case OP_NOT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Checks if an instruction is a call to a pure native.
+ * c: an instance of Compiler.
+ * instr: the instruction.
+ * returns: true if it calls a native that has no side effects.
+ */
+static bool opt_is_pure_call(Compiler * c, IRInstr * instr) {
+  int index;
+
+  if(instr->op != OP_CALL_PTR_N) {
+    return false;
+  }
+  memcpy(&index, instr->args + 1, sizeof(int));
+  return vm_callback_pure(c->vm, index);
+}
+
+/**
+ * Checks if an instruction is a call that may change the contents of
+ * strings and other objects.
+ * c: an instance of Compiler.
+ * instr: the instruction.
+ * returns: true for calls to script functions and to natives that are not
+ * pure.
+ */
+static bool opt_may_mutate(Compiler * c, IRInstr * instr) {
+  return instr->op == OP_CALL_B || instr->op == OP_CALL_LAZY
+    || (instr->op == OP_CALL_PTR_N && !opt_is_pure_call(c, instr));
+}
+
+/**
+ * Finds the loop that starts at an instruction, if it is the target of a
+ * jump back, and checks that it is only entered there and that its blocks
+ * are all within the frame that is live at the head.
+ * func: the function.
+ * head: the instruction.
+ * flow: the function's frames.
+ * loop: receives the loop.
+ * returns: true if there is such a loop.
+ */
+static bool opt_loop_find(IRFunc * func, int head, OptFrames * flow,
+			  OptLoop * loop) {
+  IRInstr * code = func->code;
+  int i;
+
+  loop->head = head;
+  loop->latch = -1;
+  loop->frame = flow->frame[head];
+  for(i = head + 1; i < func->size; i++) {
+    if(code[i].target == head) {
+      loop->latch = i;
+    }
+  }
+  if(loop->latch == -1 || loop->frame == -1
+     || flow->frame[loop->latch] != loop->frame) {
+    return false;
+  }
+
+  for(i = 0; i < func->size; i++) {
+    if(i >= head && i <= loop->latch) {
+      if(flow->frame[i] != -1
+	 && opt_frame_dist(flow->frame[i], loop->frame, flow->parent) == -1) {
+	return false;
+      }
+    } else if(code[i].target > head && code[i].target <= loop->latch) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Checks if a loop stores to the variable that an instruction accesses.
+ * func: the function.
+ * loop: the loop.
+ * flow: the function's frames.
+ * var: the OP_VAR_PUSH or OP_VAR_STOR.
+ * returns: the number of stores to the variable within the loop.
+ */
+static int opt_loop_stores(IRFunc * func, OptLoop * loop, OptFrames * flow,
+			   int var) {
+  int stores = 0;
+  int i;
+
+  for(i = loop->head; i <= loop->latch; i++) {
+    if(func->code[i].op == OP_VAR_STOR && flow->block[i] == flow->block[var]
+       && func->code[i].args[1] == func->code[var].args[1]) {
+      stores++;
+    }
+  }
+  return stores;
+}
+
+/**
+ * Checks if a variable that an instruction accesses lives outside of a loop,
+ * in a frame that the loop's blocks are within.
+ * loop: the loop.
+ * flow: the function's frames.
+ * var: the OP_VAR_PUSH or OP_VAR_STOR.
+ * returns: true if it keeps its value from one iteration to the next.
+ */
+static bool opt_loop_outer_var(OptLoop * loop, OptFrames * flow, int var) {
+  return flow->block[var] != -1
+    && opt_frame_dist(loop->frame, flow->block[var], flow->parent) != -1;
+}
+
+/**
+ * Checks if an instruction within a loop runs exactly once in each
+ * iteration that reaches the end of the loop.
+ * func: the function.
+ * loop: the loop.
+ * index: the instruction.
+ * returns: true if no jump skips it or repeats it.
+ */
+static bool opt_loop_once(IRFunc * func, OptLoop * loop, int index) {
+  int i;
+
+  for(i = loop->head; i < loop->latch; i++) {
+    int target = func->code[i].target;
+
+    if(target < 0) {
+      continue;
+    }
+    if((i < index && target > index && target <= loop->latch)
+       || (target <= i && target <= index && i >= index)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Initializes an instruction that is not a jump.
+ * instr: the instruction.
+ * op: its opcode.
+ * argsLen: the number of bytes of operands, which are zeroed.
+ */
+static void opt_loop_instr(IRInstr * instr, char op, int argsLen) {
+  memset(instr, 0, sizeof(IRInstr));
+  instr->op = op;
+  instr->argsLen = argsLen;
+  instr->target = -1;
+  instr->string = -1;
+}
+
+/**
+ * Inserts code to run once before a loop, each time that it is entered.
+ * func: the function.
+ * loop: the loop.
+ * pre: the code, which has no jumps.
+ * changed: set to true if there was any code to insert.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_loop_enter(IRFunc * func, OptLoop * loop, IRFunc * pre,
+			   bool * changed) {
+  int head = loop->head + pre->size;
+  int i;
+
+  if(pre->size == 0) {
+    return true;
+  }
+  if(!ir_insert(func, loop->head, pre)) {
+    return false;
+  }
+
+  /* jumps into the loop from outside of it run the code too */
+  for(i = 0; i < func->size; i++) {
+    if(func->code[i].target == head
+       && (i < loop->head || i > loop->latch + pre->size)) {
+      func->code[i].target = loop->head;
+    }
+  }
+  *changed = true;
+  return true;
+}
+
+/**
+ * Optimization pass helper: turns a while loop, which tests its condition at
+ * the head and jumps back to it at the end, into a loop that tests a copy of
+ * its condition at the end, saving a jump in each iteration. The original
+ * test now only guards the first iteration, so code can be hoisted out of the
+ * loop, to before its new head, without running when the loop does not.
+ * func: the function.
+ * loop: the loop, which ends with an OP_GOTO.
+ * changed: set to true if the loop was inverted.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_loop_invert(IRFunc * func, OptLoop * loop, bool * changed) {
+  IRInstr * code = func->code;
+  int exit = loop->latch + 1;
+  IRFunc * copy;
+  int test;
+  int i;
+
+  /* the last exit test before the body such that the code up to it is only
+   * entered at the head, has no frames, and jumps only within itself, to the
+   * body, or out of the loop.
+   */
+  for(test = loop->head + OPT_LOOP_MAX_HEADER_INSTRS - 1;
+      test >= loop->head; test--) {
+    if(test >= loop->latch
+       || (code[test].op != OP_FCOND_GOTO && code[test].op != OP_TCOND_GOTO)
+       || code[test].target != exit) {
+      continue;
+    }
+    for(i = 0; i < func->size; i++) {
+      if(i >= loop->head && i <= test) {
+	if(code[i].op == OP_FRM_PUSH || code[i].op == OP_FRM_POP
+	   || code[i].op == OP_RETURN
+	   || (code[i].target >= 0 && code[i].target != exit
+	       && (code[i].target <= i || code[i].target > test + 1))) {
+	  break;
+	}
+      } else if(code[i].target > loop->head && code[i].target <= test) {
+	break;
+      }
+    }
+    if(i == func->size) {
+      break;
+    }
+  }
+  if(test < loop->head) {
+    return true;
+  }
+
+  /* the copy of the condition at the end jumps back to the body */
+  copy = calloc(1, sizeof(IRFunc));
+  if(copy == NULL) {
+    return false;
+  }
+  for(i = loop->head; i <= test; i++) {
+    if(!ir_append(copy, &code[i])) {
+      ir_free(copy);
+      return false;
+    }
+  }
+  for(i = 0; i < copy->size; i++) {
+    IRInstr * instr = &copy->code[i];
+
+    if(instr->target == exit) {
+      instr->target = copy->size;
+    } else if(instr->target == test + 1) {
+      instr->target = test + 1 - loop->latch;
+    } else if(instr->target >= 0) {
+      instr->target -= loop->head;
+    }
+  }
+  copy->code[copy->size - 1].op = code[test].op == OP_FCOND_GOTO
+    ? OP_TCOND_GOTO : OP_FCOND_GOTO;
+  copy->code[copy->size - 1].target = test + 1 - loop->latch;
+
+  /* the body's other jumps back test the copy */
+  for(i = test + 1; i < loop->latch; i++) {
+    if(code[i].target == loop->head) {
+      code[i].target = loop->latch;
+    }
+  }
+
+  if(!ir_splice(func, loop->latch, copy)) {
+    ir_free(copy);
+    return false;
+  }
+  ir_free(copy);
+  *changed = true;
+  return true;
+}
+
+/**
+ * Checks if a tree of pure instructions can be hoisted out of a loop without
+ * changing what it computes, and that its value is a number or a boolean, so
+ * that the loop can share one value between its iterations. When the loop
+ * calls functions that may change strings, the tree may not read the
+ * contents of any string or object.
+ * func: the function.
+ * a: the tree's first instruction.
+ * b: the tree's last instruction.
+ * mutates: whether the loop may change strings or objects.
+ * simple: space for b - a + 1 values.
+ * returns: true if it may be hoisted.
+ */
+static bool opt_loop_tree_safe(IRFunc * func, int a, int b, bool mutates,
+			       bool * simple) {
+  int depth = 0;
+  int i;
+  int j;
+
+  /* whether each value on the stack is certain to be a number or boolean */
+  for(i = a; i <= b; i++) {
+    IRInstr * instr = &func->code[i];
+
+    switch(instr->op) {
+    case OP_NUM_PUSH:
+    case OP_BOOL_PUSH:
+    case OP_NULL_PUSH:
+      simple[depth++] = true;
+      break;
+    case OP_STR_PUSH:
+    case OP_VAR_PUSH:
+      simple[depth++] = false;
+      break;
+    case OP_NOT:
+      simple[depth - 1] = true;
+      break;
+    case OP_ADD:
+      /* strings may only be added to strings */
+      depth--;
+      if(mutates && !simple[depth - 1] && !simple[depth]) {
+	return false;
+      }
+      simple[depth - 1] = simple[depth - 1] || simple[depth];
+      break;
+    case OP_CALL_PTR_N:
+      for(j = 0; j < instr->args[0]; j++) {
+	if(mutates && !simple[depth - 1 - j]) {
+	  return false;
+	}
+      }
+      depth -= instr->args[0];
+      simple[depth++] = true;
+      break;
+    default:
+      depth--;
+      simple[depth - 1] = true;
+      break;
+    }
+  }
+  return simple[0];
+}
+
+/**
+ * Optimization pass helper: hoists loop invariant code. Trees of pushes,
+ * operators, and calls to pure natives, that only read variables that the
+ * loop never stores to, are computed once before the loop, into a new
+ * variable that the loop reads instead. Only trees that are certain to run
+ * in the first iteration, before the loop has any side effect, are hoisted,
+ * so that an error that they raise is raised at the same point.
+ * c: an instance of Compiler.
+ * func: the function.
+ * loop: the loop.
+ * flow: the function's frames.
+ * changed: set to true if any code was hoisted.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_loop_hoist(Compiler * c, IRFunc * func, OptLoop * loop,
+			   OptFrames * flow, bool * changed) {
+  IRInstr * code = func->code;
+  int size = loop->latch - loop->head + 1;
+  IRFunc * pre = calloc(1, sizeof(IRFunc));
+  IRFunc * tree = calloc(1, sizeof(IRFunc));
+  bool * certain = malloc(size * sizeof(bool));
+  bool * simple = malloc(size * sizeof(bool));
+  IRInstr var;
+  IRInstr pop;
+  bool mutates = false;
+  bool success = true;
+  int furthest = loop->head;
+  int end;
+  int a;
+  int b;
+  int i;
+
+  if(pre == NULL || tree == NULL || certain == NULL || simple == NULL) {
+    free(pre);
+    free(tree);
+    free(certain);
+    free(simple);
+    return false;
+  }
+  opt_loop_instr(&var, OP_VAR_STOR, 2);
+  opt_loop_instr(&pop, OP_POP, 0);
+
+  for(i = loop->head; i <= loop->latch; i++) {
+    mutates = mutates || opt_may_mutate(c, &code[i]);
+  }
+
+  /* instructions that run in the first iteration, before any side effect,
+   * are those after the loop head that no earlier jump skips.
+   */
+  for(end = loop->head; end <= loop->latch; end++) {
+    IRInstr * instr = &code[end];
+
+    if(opt_may_mutate(c, instr) || instr->op == OP_RETURN
+       || instr->op == OP_EXIT
+       || (instr->op == OP_FRM_POP && flow->frame[end] == 0)
+       || (instr->target >= 0
+	   && (instr->target <= end || instr->target > loop->latch))) {
+      break;
+    }
+    certain[end - loop->head] = end >= furthest;
+    if(instr->target > furthest) {
+      furthest = instr->target;
+    }
+  }
+
+  /* the largest trees first, which are found from their last instruction */
+  for(b = end - 1; success && b >= loop->head; b--) {
+    int depth = 0;
+    int slot;
+
+    if(!opt_is_operator(&code[b]) && !opt_is_pure_call(c, &code[b])) {
+      continue;
+    }
+    for(a = b; a >= loop->head; a--) {
+      IRInstr * instr = &code[a];
+
+      if((a < b && flow->jumps[a + 1] != 0)
+	 || (instr->op == OP_VAR_PUSH
+	     && (!opt_loop_outer_var(loop, flow, a)
+		 || opt_loop_stores(func, loop, flow, a) != 0))
+	 || (!opt_is_push(instr) && !opt_is_operator(instr)
+	     && !opt_is_pure_call(c, instr))) {
+	a = loop->head - 1;
+	break;
+      }
+
+      if(opt_is_push(instr)) {
+	depth++;
+      } else if(instr->op == OP_CALL_PTR_N) {
+	depth += 1 - instr->args[0];
+      } else if(instr->op != OP_NOT) {
+	depth--;
+      }
+      if(depth == 1) {
+	break;
+      }
+    }
+    if(a < loop->head || !certain[a - loop->head]
+       || !opt_loop_tree_safe(func, a, b, mutates, simple)
+       || (slot = opt_add_slots(c, func, loop->frame, 1, true)) == -1) {
+      continue;
+    }
+
+    /* compute it before the loop, from the frame that is live there, ahead
+     * of the trees that come after it.
+     */
+    tree->size = 0;
+    for(i = a; success && i <= b; i++) {
+      IRInstr instr = code[i];
+
+      if(instr.op == OP_VAR_PUSH) {
+	instr.args[0] = opt_frame_dist(loop->frame, flow->block[i],
+				       flow->parent);
+      }
+      success = ir_append(tree, &instr);
+    }
+    var.op = OP_VAR_STOR;
+    var.args[0] = 0;
+    var.args[1] = slot;
+    success = success && ir_append(tree, &var)
+      && ir_append(tree, &pop) && ir_insert(pre, 0, tree);
+
+    /* and read it within the loop */
+    var.op = OP_VAR_PUSH;
+    var.args[0] = opt_frame_dist(flow->frame[a], loop->frame, flow->parent);
+    code[a] = var;
+    flow->block[a] = loop->frame;
+    for(i = a + 1; i <= b; i++) {
+      code[i].op = IR_NOP;
+    }
+    b = a;
+  }
+
+  success = success && opt_loop_enter(func, loop, pre, changed);
+  ir_free(pre);
+  ir_free(tree);
+  free(certain);
+  free(simple);
+  return success;
+}
+
+/**
+ * Gets the value that an instruction pushes, if it is an integer that is
+ * small enough for induction variables.
+ * instr: the instruction.
+ * value: receives the value.
+ * returns: true if it pushes such an integer.
+ */
+static bool opt_loop_int(IRInstr * instr, double * value) {
+  if(instr->op != OP_NUM_PUSH) {
+    return false;
+  }
+  memcpy(value, instr->args, sizeof(double));
+  return *value == floor(*value) && fabs(*value) <= OPT_LOOP_MAX_INT;
+}
+
+/**
+ * Checks if a variable is a basic induction variable of a loop, one that
+ * the loop adds the same integer to in each iteration, and that only ever
+ * holds integers, so that arithmetic on it is exact.
+ * func: the function.
+ * loop: the loop.
+ * flow: the function's frames.
+ * var: an OP_VAR_PUSH of the variable.
+ * update: receives the loop's store to the variable.
+ * step: receives the integer added in each iteration.
+ * returns: true upon success, and false if it is not, or an allocation fails.
+ */
+static bool opt_loop_basic(IRFunc * func, OptLoop * loop, OptFrames * flow,
+			   int var, int * update, double * step) {
+  IRInstr * code = func->code;
+  bool * reached;
+  int * pending;
+  bool dominated = false;
+  double value;
+  int i;
+
+  if(!opt_loop_outer_var(loop, flow, var)
+     || opt_loop_stores(func, loop, flow, var) != 1) {
+    return false;
+  }
+
+  /* the loop stores the variable plus or minus an integer */
+  for(*update = loop->head; code[*update].op != OP_VAR_STOR
+	|| flow->block[*update] != flow->block[var]
+	|| code[*update].args[1] != code[var].args[1]; (*update)++) {
+  }
+  i = *update;
+  if(i - 3 < loop->head || code[i - 3].op != OP_VAR_PUSH
+     || flow->block[i - 3] != flow->block[var]
+     || code[i - 3].args[1] != code[var].args[1]
+     || !opt_loop_int(&code[i - 2], step)
+     || (code[i - 1].op != OP_ADD && code[i - 1].op != OP_SUB)
+     || flow->jumps[i - 2] != 0 || flow->jumps[i - 1] != 0
+     || flow->jumps[i] != 0 || !opt_loop_once(func, loop, i)) {
+    return false;
+  }
+  if(code[i - 1].op == OP_SUB) {
+    *step = -*step;
+  }
+
+  /* every other store is of an integer, and one of them always runs before
+   * the loop.
+   */
+  reached = malloc(func->size * sizeof(bool));
+  pending = malloc(func->size * sizeof(int));
+  if(reached == NULL || pending == NULL) {
+    free(reached);
+    free(pending);
+    return false;
+  }
+  for(i = 1; i < func->size; i++) {
+    if(i == *update || code[i].op != OP_VAR_STOR
+       || flow->block[i] != flow->block[var]
+       || code[i].args[1] != code[var].args[1]) {
+      continue;
+    }
+    if(flow->jumps[i] != 0 || !opt_loop_int(&code[i - 1], &value)) {
+      dominated = false;
+      break;
+    }
+    if(!dominated) {
+      opt_reach(func, i, reached, pending);
+      dominated = !reached[loop->head];
+    }
+  }
+  free(reached);
+  free(pending);
+  return dominated;
+}
+
+/**
+ * Optimization pass helper: strength reduction. A variable that a loop sets
+ * to a multiple of a basic induction variable, plus a constant, once in each
+ * iteration, is set to its previous value plus a constant instead, which is
+ * two instructions fewer. The variable is computed once before the loop to
+ * start it off, so the loop must run at least once each time that it is
+ * entered, as it does once it has been inverted, and the variable may not
+ * be read, or the loop left, before it is set in the first iteration.
+ * Everything is an integer that a double holds exactly, so the values are
+ * the same as those that the multiplication gives.
+ * c: an instance of Compiler.
+ * func: the function.
+ * loop: the loop.
+ * flow: the function's frames.
+ * changed: set to true if any variable was reduced.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_loop_reduce(Compiler * c, IRFunc * func, OptLoop * loop,
+			    OptFrames * flow, bool * changed) {
+  IRInstr * code = func->code;
+  IRFunc * pre;
+  IRInstr instr;
+  bool success = true;
+  int store;
+
+  if(code[loop->latch].op != OP_TCOND_GOTO
+     && code[loop->latch].op != OP_FCOND_GOTO) {
+    return true;
+  }
+  pre = calloc(1, sizeof(IRFunc));
+  if(pre == NULL) {
+    return false;
+  }
+
+  for(store = loop->head + 5; success && store < loop->latch; store++) {
+    int w = store - 5;
+    int mul;
+    int var;
+    int update;
+    double k;
+    double b;
+    double step;
+    int i;
+
+    if(code[store].op != OP_VAR_STOR || !opt_loop_outer_var(loop, flow, store)
+       || opt_loop_stores(func, loop, flow, store) != 1
+       || !opt_loop_once(func, loop, store)) {
+      continue;
+    }
+
+    /* i * k + b, i * k - b, b + i * k, or b - i * k, in either order of i
+     * and k.
+     */
+    mul = code[w + 2].op == OP_MUL ? w : w + 1;
+    if(code[mul + 2].op != OP_MUL
+       || (code[w + 4].op != OP_ADD && code[w + 4].op != OP_SUB)
+       || !opt_loop_int(&code[mul == w ? w + 3 : w], &b)) {
+      continue;
+    }
+    for(i = w + 1; i <= store && flow->jumps[i] == 0; i++) {
+    }
+    var = code[mul].op == OP_VAR_PUSH ? mul : mul + 1;
+    if(i <= store || code[var].op != OP_VAR_PUSH
+       || !opt_loop_int(&code[var == mul ? mul + 1 : mul], &k)
+       || (flow->block[var] == flow->block[store]
+	   && code[var].args[1] == code[store].args[1])) {
+      continue;
+    }
+
+    /* nothing sees the value that it is started off with */
+    for(i = loop->head; i < store; i++) {
+      if((code[i].op == OP_VAR_PUSH && flow->block[i] == flow->block[store]
+	  && code[i].args[1] == code[store].args[1])
+	 || (code[i].target >= 0
+	     && (code[i].target < loop->head
+		 || code[i].target > loop->latch))) {
+	break;
+      }
+    }
+    if(i < store) {
+      continue;
+    }
+
+    if(!opt_loop_basic(func, loop, flow, var, &update, &step)) {
+      continue;
+    }
+    step *= k;
+    if(mul != w && code[w + 4].op == OP_SUB) {
+      step = -step;
+    }
+
+    /* the value that the first iteration adds step to */
+    for(i = w; success && i < store; i++) {
+      instr = code[i];
+      if(i == var) {
+	instr.args[0] = opt_frame_dist(loop->frame, flow->block[var],
+				       flow->parent);
+      }
+      success = ir_append(pre, &instr);
+    }
+    if(store < update) {
+      opt_loop_instr(&instr, OP_NUM_PUSH, sizeof(double));
+      memcpy(instr.args, &step, sizeof(double));
+      success = success && ir_append(pre, &instr);
+      opt_loop_instr(&instr, OP_SUB, 0);
+      success = success && ir_append(pre, &instr);
+    }
+    opt_loop_instr(&instr, OP_VAR_STOR, 2);
+    instr.args[0] = opt_frame_dist(loop->frame, flow->block[store],
+				   flow->parent);
+    instr.args[1] = code[store].args[1];
+    success = success && ir_append(pre, &instr);
+    opt_loop_instr(&instr, OP_POP, 0);
+    success = success && ir_append(pre, &instr);
+
+    /* the loop adds step to it */
+    opt_loop_instr(&code[w], OP_VAR_PUSH, 2);
+    code[w].args[0] = opt_frame_dist(flow->frame[w], flow->block[store],
+				     flow->parent);
+    code[w].args[1] = code[store].args[1];
+    flow->block[w] = flow->block[store];
+    opt_loop_instr(&code[w + 1], OP_NUM_PUSH, sizeof(double));
+    memcpy(code[w + 1].args, &step, sizeof(double));
+    opt_loop_instr(&code[w + 2], OP_ADD, 0);
+    code[w + 3].op = IR_NOP;
+    code[w + 4].op = IR_NOP;
+  }
+
+  success = success && opt_loop_enter(func, loop, pre, changed);
+  ir_free(pre);
+  if(!success) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+  }
+  return success;
+}
+
+/**
+ * Optimizes the loops of a function, innermost first, until one of them is
+ * changed.
+ * c: an instance of Compiler.
+ * func: the function, which must be compacted.
+ * changed: set to true if a loop was changed.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_loop_round(Compiler * c, IRFunc * func, bool * changed) {
+  OptFrames flow;
+  OptLoop * loops = malloc(func->size * sizeof(OptLoop));
+  int numLoops = 0;
+  bool success = true;
+  int i;
+  int j;
+
+  flow.frame = malloc(func->size * sizeof(int));
+  flow.parent = malloc((func->size + 1) * sizeof(int));
+  flow.block = malloc(func->size * sizeof(int));
+  flow.jumps = ir_jump_counts(func);
+  if(loops == NULL || flow.frame == NULL || flow.parent == NULL
+     || flow.block == NULL || flow.jumps == NULL
+     || !ir_frames(func, flow.frame, flow.parent)) {
+    success = false;
+  }
+
+  for(i = 0; success && i < func->size; i++) {
+    flow.block[i] = -1;
+    if(func->code[i].op == OP_VAR_PUSH || func->code[i].op == OP_VAR_STOR) {
+      flow.block[i] = opt_var_frame(&func->code[i], flow.frame[i],
+				    flow.parent);
+    }
+  }
+
+  /* the loops, shortest first, so that inner loops come first */
+  for(i = 0; success && i < func->size; i++) {
+    OptLoop loop;
+
+    if(!opt_loop_find(func, i, &flow, &loop)) {
+      continue;
+    }
+    for(j = numLoops; j > 0 && loops[j - 1].latch - loops[j - 1].head
+	  > loop.latch - loop.head; j--) {
+      loops[j] = loops[j - 1];
+    }
+    loops[j] = loop;
+    numLoops++;
+  }
+
+  for(i = 0; success && !*changed && i < numLoops; i++) {
+    if(func->code[loops[i].latch].op == OP_GOTO) {
+      success = opt_loop_invert(func, &loops[i], changed);
+    }
+    if(success && !*changed) {
+      success = opt_loop_hoist(c, func, &loops[i], &flow, changed);
+    }
+    if(success && !*changed) {
+      success = opt_loop_reduce(c, func, &loops[i], &flow, changed);
+    }
+  }
+
+  free(loops);
+  free(flow.frame);
+  free(flow.parent);
+  free(flow.block);
+  free(flow.jumps);
+  return success;
+}
+
+/**
+ * Optimization pass: optimizes loops. While loops are inverted so that they
+ * test their condition at the end, code that computes the same value in
+ * every iteration is hoisted out of them, and variables that follow a basic
+ * induction variable are stepped along with it rather than recomputed.
+ */
+static bool opt_loops(Compiler * c, IRFunc * func) {
+  bool changed = true;
+  int rounds;
+
+  for(rounds = 0; changed && rounds < OPT_LOOP_MAX_ROUNDS; rounds++) {
+    changed = false;
+    if(!ir_compact(func) || !opt_loop_round(c, func, &changed)) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Gets the number form of an operator.
+ * op: the opcode.
+ * returns: the number form, or op if it has none.
+ */
+static char opt_number_op(char op) {
+  switch(op) {
+  case OP_ADD:
+    return OP_NUM_ADD;
+  case OP_SUB:
+    return OP_NUM_SUB;
+  case OP_MUL:
+    return OP_NUM_MUL;
+  case OP_DIV:
+    return OP_NUM_DIV;
+  case OP_MOD:
+    return OP_NUM_MOD;
+  case OP_LT:
+    return OP_NUM_LT;
+  case OP_GT:
+    return OP_NUM_GT;
+  case OP_LTE:
+    return OP_NUM_LTE;
+  case OP_GTE:
+    return OP_NUM_GTE;
+  case OP_EQUALS:
+    return OP_NUM_EQUALS;
+  case OP_NOT_EQUALS:
+    return OP_NUM_NOT_EQUALS;
+  default:
+    return op;
+  }
+}
+
+/**
+ * Finds the types after an instruction, from the types before it.
+ * instr: the instruction.
+ * index: the instruction's index.
+ * frame: the frame that is live before it, from ir_frames().
+ * var: the variable that it accesses, or -1.
+ * varFrame: the frame of each variable.
+ * numVars: the number of variables.
+ * types: the types of the variables, followed by those of the operand stack,
+ * which are changed to the types after the instruction.
+ * depth: the depth of the operand stack, which is changed likewise.
+ * leaves: set to true if the instruction leaves the function.
+ * returns: true upon success, and false if its types can't be followed.
+ */
+static bool opt_types_step(IRInstr * instr, int index, int frame, int var,
+			   int * varFrame, int numVars, char * types,
+			   int * depth, bool * leaves) {
+  char * stack = types + numVars;
+  int pops = 0;
+  int i;
+
+  *leaves = false;
+
+  /* the operands that it takes */
+  switch(opt_generic_op(instr->op)) {
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_LT:
+  case OP_GT:
+  case OP_LTE:
+  case OP_GTE:
+  case OP_EQUALS:
+  case OP_NOT_EQUALS:
+  case OP_AND:
+  case OP_OR:
+    pops = 2;
+    break;
+  case OP_VAR_STOR:
+  case OP_NOT:
+  case OP_POP:
+  case OP_TCOND_GOTO:
+  case OP_FCOND_GOTO:
+    pops = 1;
+    break;
+  case OP_CALL_B:
+  case OP_CALL_LAZY:
+    pops = instr->args[1];
+    break;
+  case OP_CALL_PTR_N:
+    pops = instr->args[0];
+    break;
+  case OP_VAR_PUSH:
+  case OP_NUM_PUSH:
+  case OP_BOOL_PUSH:
+  case OP_NULL_PUSH:
+  case OP_STR_PUSH:
+  case OP_FRM_PUSH:
+  case OP_FRM_POP:
+  case OP_RETURN:
+  case OP_GOTO:
+    break;
+  default:
+    return false;
+  }
+  if(pops < 0 || pops > *depth || *depth - pops + 1 > OPT_TYPE_MAX_STACK) {
+    return false;
+  }
+
+  switch(opt_generic_op(instr->op)) {
+  case OP_ADD:
+    /* numbers add to a number, and strings to a string */
+    stack[*depth - 2] &= stack[*depth - 1]
+      & (OPT_TYPE_NUMBER | OPT_TYPE_OBJECT);
+    break;
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_MOD:
+    stack[*depth - 2] = OPT_TYPE_NUMBER;
+    break;
+  case OP_LT:
+  case OP_GT:
+  case OP_LTE:
+  case OP_GTE:
+  case OP_EQUALS:
+  case OP_NOT_EQUALS:
+  case OP_AND:
+  case OP_OR:
+  case OP_NOT:
+    stack[*depth - pops] = OPT_TYPE_BOOLEAN;
+    break;
+  case OP_VAR_STOR:
+    /* the value stays on the stack */
+    if(var != -1) {
+      types[var] = stack[*depth - 1];
+    }
+    pops = 0;
+    break;
+  case OP_VAR_PUSH:
+    stack[*depth] = var != -1 ? types[var] : OPT_TYPE_ANY;
+    break;
+  case OP_NUM_PUSH:
+    stack[*depth] = OPT_TYPE_NUMBER;
+    break;
+  case OP_BOOL_PUSH:
+    stack[*depth] = OPT_TYPE_BOOLEAN;
+    break;
+  case OP_NULL_PUSH:
+    stack[*depth] = OPT_TYPE_NULL;
+    break;
+  case OP_STR_PUSH:
+    stack[*depth] = OPT_TYPE_OBJECT;
+    break;
+  case OP_CALL_B:
+  case OP_CALL_LAZY:
+  case OP_CALL_PTR_N:
+    stack[*depth - pops] = OPT_TYPE_ANY;
+    break;
+  case OP_FRM_PUSH:
+    /* a block's variables start out null */
+    for(i = 0; i < numVars; i++) {
+      if(varFrame[i] == index + 1) {
+	types[i] = OPT_TYPE_NULL;
+      }
+    }
+    break;
+  case OP_FRM_POP:
+    /* popping the function's frame returns from it */
+    *leaves = frame == 0;
+    return true;
+  case OP_RETURN:
+    *leaves = true;
+    return true;
+  }
+
+  switch(opt_generic_op(instr->op)) {
+  case OP_VAR_PUSH:
+  case OP_NUM_PUSH:
+  case OP_BOOL_PUSH:
+  case OP_NULL_PUSH:
+  case OP_STR_PUSH:
+    (*depth)++;
+    break;
+  case OP_CALL_B:
+  case OP_CALL_LAZY:
+  case OP_CALL_PTR_N:
+  case OP_NOT:
+    *depth -= pops - 1;
+    break;
+  case OP_POP:
+  case OP_TCOND_GOTO:
+  case OP_FCOND_GOTO:
+    (*depth)--;
+    break;
+  default:
+    /* binary operators leave their result */
+    *depth -= pops > 0 ? pops - 1 : 0;
+    break;
+  }
+  return true;
+}
+
+/**
+ * Optimization pass: type inference. Follows the types that each variable
+ * and operand may have through the function, and where an operator's
+ * operands can only be numbers, replaces it with its number form, which the
+ * VM runs without checking their types. A store of a number to a variable
+ * that can't hold an object, and so has no reference to release, becomes an
+ * OP_NUM_STOR. A function's variables start out null, and its arguments may
+ * be of any type, as may the results of calls. Functions whose operand stack
+ * can't be followed are left as they are.
+ */
+static bool opt_types(Compiler * c, IRFunc * func) {
+  IRInstr * code = func->code;
+  VMFunc * function;
+  int * frame = malloc(func->size * sizeof(int));
+  int * parent = malloc((func->size + 1) * sizeof(int));
+  int * var = malloc(func->size * sizeof(int));
+  int * varFrame = malloc(func->size * sizeof(int));
+  int * varSlot = malloc(func->size * sizeof(int));
+  int * depth = malloc(func->size * sizeof(int));
+  int * pending = malloc(func->size * sizeof(int));
+  bool * isPending = calloc(func->size + 1, sizeof(bool));
+  char * types = NULL;
+  char * row = NULL;
+  bool success = true;
+  bool known = true;
+  int numVars = 0;
+  int numPending = 0;
+  int width;
+  int end;
+  int i;
+  int j;
+
+  if(frame == NULL || parent == NULL || var == NULL || varFrame == NULL
+     || varSlot == NULL || depth == NULL || pending == NULL
+     || isPending == NULL || !ir_frames(func, frame, parent)) {
+    success = known = false;
+  }
+
+  /* each variable is identified by the frame that holds it and its slot */
+  for(i = 0; known && i < func->size; i++) {
+    int block;
+
+    var[i] = -1;
+    depth[i] = -1;
+    if(opt_generic_op(code[i].op) != OP_VAR_PUSH
+       && opt_generic_op(code[i].op) != OP_VAR_STOR) {
+      continue;
+    }
+    block = opt_var_frame(&code[i], frame[i], parent);
+    if(block == -1) {
+      continue;
+    }
+    for(j = 0; j < numVars; j++) {
+      if(varFrame[j] == block && varSlot[j] == code[i].args[1]) {
+	break;
+      }
+    }
+    if(j == numVars) {
+      varFrame[numVars] = block;
+      varSlot[numVars++] = code[i].args[1];
+    }
+    var[i] = j;
+  }
+
+  width = numVars + OPT_TYPE_MAX_STACK;
+  if(known && func->size > 0) {
+    types = malloc(func->size * width);
+    row = malloc(width);
+    if(types == NULL || row == NULL) {
+      success = known = false;
+    }
+  }
+
+  /* the function's arguments may be anything, and its variables are null */
+  if(known && func->size > 0) {
+    function = opt_function_at(c, func->start, &end);
+    for(i = 0; i < numVars; i++) {
+      types[i] = OPT_TYPE_NULL;
+      if(varFrame[i] == 0
+	 && (function == NULL || varSlot[i] < function->numArgs)) {
+	types[i] = OPT_TYPE_ANY;
+      }
+    }
+    depth[0] = 0;
+    pending[numPending++] = 0;
+    isPending[0] = true;
+  }
+
+  /* until the types before every instruction stop growing */
+  while(known && numPending > 0) {
+    bool leaves;
+    int next[2];
+    int d;
+
+    i = pending[--numPending];
+    isPending[i] = false;
+    d = depth[i];
+    memcpy(row, types + i * width, width);
+    known = opt_types_step(&code[i], i, frame[i], var[i], varFrame,
+			   numVars, row, &d, &leaves);
+    if(!known || leaves) {
+      continue;
+    }
+
+    next[0] = code[i].op != OP_GOTO ? i + 1 : func->size;
+    next[1] = code[i].target >= 0 ? code[i].target : func->size;
+    for(j = 0; known && j < 2; j++) {
+      char * to = types + next[j] * width;
+      bool grew = false;
+      int k;
+
+      if(next[j] >= func->size) {
+	continue;
+      } else if(depth[next[j]] == -1) {
+	memcpy(to, row, width);
+	depth[next[j]] = d;
+	grew = true;
+      } else if(depth[next[j]] != d) {
+	known = false;
+	break;
+      }
+      for(k = 0; k < numVars + d; k++) {
+	grew = grew || (to[k] | row[k]) != to[k];
+	to[k] |= row[k];
+      }
+      if(grew && !isPending[next[j]]) {
+	isPending[next[j]] = true;
+	pending[numPending++] = next[j];
+      }
+    }
+  }
+
+  /* the number forms of what only ever sees numbers */
+  for(i = 0; known && i < func->size; i++) {
+    char * stack = types + i * width + numVars;
+    int d = depth[i];
+
+    if(opt_number_op(code[i].op) != code[i].op && d >= 2
+       && stack[d - 1] == OPT_TYPE_NUMBER
+       && stack[d - 2] == OPT_TYPE_NUMBER) {
+      code[i].op = opt_number_op(code[i].op);
+    } else if(code[i].op == OP_VAR_STOR && d >= 1 && var[i] != -1
+	      && stack[d - 1] == OPT_TYPE_NUMBER
+	      && (types[i * width + var[i]] & OPT_TYPE_OBJECT) == 0) {
+      code[i].op = OP_NUM_STOR;
+    }
+  }
+
+  free(frame);
+  free(parent);
+  free(var);
+  free(varFrame);
+  free(varSlot);
+  free(depth);
+  free(pending);
+  free(isPending);
+  free(types);
+  free(row);
+  if(!success) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+  }
+  return success;
+}
+
+/**
+ * Optimization pass: fuses the step at the end of a counted loop, a variable
+ * plus or minus a number, stored back, then compared with a variable or a
+ * number by a conditional jump back, into an OP_FOR_STEP or OP_FOR_STEP_NUM.
+ * These are the steps that opt_expand_fused() makes, and those of while
+ * loops, once the loops pass has moved their tests to the end.
+ */
+static bool opt_fuse_steps(Compiler * c, IRFunc * func) {
+  IRInstr * code = func->code;
+  int * jumps = ir_jump_counts(func);
+  int i;
+  int j;
+
+  if(jumps == NULL) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
+
+  for(i = 0; i + 6 < func->size; i++) {
+    IRInstr * var = &code[i];
+    int limit = i + 4;
+    int popFrame = 0;
+    char op = opt_generic_op(code[i + 2].op);
+    char compare;
+    double step;
+
+    if(var->op != OP_VAR_PUSH || code[i + 1].op != OP_NUM_PUSH
+       || (op != OP_ADD && op != OP_SUB)
+       || opt_generic_op(code[i + 3].op) != OP_VAR_STOR
+       || memcmp(code[i + 3].args, var->args, 2) != 0) {
+      continue;
+    }
+
+    /* the stored value may be popped and read again, after the frame of a
+     * loop body is popped, in which case the step can follow the pop
+     */
+    if(code[limit].op == OP_POP) {
+      popFrame = code[i + 5].op == OP_FRM_POP;
+      limit = popFrame ? i + 6 : i + 5;
+      if(limit + 3 >= func->size || code[limit].op != OP_VAR_PUSH
+	 || code[limit].args[0] != var->args[0] - popFrame
+	 || code[limit].args[1] != var->args[1]
+	 || (popFrame && var->args[0] == 0)) {
+	continue;
+      }
+      limit++;
+    }
+    if(limit + 2 >= func->size
+       || (code[limit].op != OP_VAR_PUSH && code[limit].op != OP_NUM_PUSH)
+       || code[limit + 2].op != OP_TCOND_GOTO) {
+      continue;
+    }
+    compare = opt_generic_op(code[limit + 1].op);
+    if(compare != OP_LT && compare != OP_GT && compare != OP_LTE
+       && compare != OP_GTE) {
+      continue;
+    }
+
+    /* only the first instruction may be jumped to */
+    for(j = i + 1; j <= limit + 2 && jumps[j] == 0; j++);
+    if(j <= limit + 2) {
+      continue;
+    }
+
+    /* subtracting a number is adding its negation */
+    memcpy(&step, code[i + 1].args, sizeof(double));
+    if(op == OP_SUB) {
+      step = -step;
+    }
+
+    if(popFrame) {
+      var->op = OP_FRM_POP;
+      var->argsLen = 0;
+      var = &code[i + 1];
+      var->args[0] = code[i].args[0] - 1;
+      var->args[1] = code[i].args[1];
+    }
+    var->op = code[limit].op == OP_VAR_PUSH ? OP_FOR_STEP : OP_FOR_STEP_NUM;
+    var->args[2] = compare;
+    memcpy(var->args + 3, &step, sizeof(double));
+    memcpy(var->args + 3 + sizeof(double), code[limit].args,
+	   code[limit].argsLen);
+    var->argsLen = 3 + sizeof(double) + code[limit].argsLen;
+    var->target = code[limit + 2].target;
+    for(j = i + 1 + popFrame; j <= limit + 2; j++) {
+      code[j].op = IR_NOP;
+      code[j].target = -1;
+    }
+    i = limit + 2;
+  }
+
+  free(jumps);
+  return true;
+}
+
+/**
+ * Checks whether the four instructions at an index compare a variable with an
+ * integer, and jump on the result.
+ * code: the code.
+ * size: the number of instructions.
+ * i: the first instruction.
+ * var: the variable's operands, or NULL for any variable.
+ * value: receives the integer.
+ * returns: true if they do.
+ */
+static bool opt_switch_test(IRInstr * code, int size, int i, char * var,
+			    double * value) {
+  if(i + 3 >= size || code[i].op != OP_VAR_PUSH
+     || (var != NULL && memcmp(code[i].args, var, 2) != 0)
+     || code[i + 1].op != OP_NUM_PUSH
+     || opt_generic_op(code[i + 2].op) != OP_EQUALS
+     || (code[i + 3].op != OP_TCOND_GOTO && code[i + 3].op != OP_FCOND_GOTO)) {
+    return false;
+  }
+
+  memcpy(value, code[i + 1].args, sizeof(double));
+  return *value == floor(*value) && fabs(*value) <= INT_MAX / 2;
+}
+
+/**
+ * Replaces a chain of tests at an index, that compare one variable with
+ * integers and go to a case for each, with an OP_SWITCH_NUM and its table.
+ * A test either jumps to its case if equal, or jumps to the next test if not.
+ * The chain ends at the first instruction that is not such a test, or that
+ * is jumped to from elsewhere, which is where the switch's table goes when
+ * nothing matches.
+ * c: an instance of Compiler.
+ * func: the function.
+ * i: the first test.
+ * jumps: the jump counts of the function.
+ * frame: the frames of the function.
+ * tests: a buffer of func->size ints.
+ * returns: the number of instructions of the switch and its table, zero if
+ * the tests do not make a switch, or -1 if an allocation fails.
+ */
+static int opt_switch_chain(Compiler * c, IRFunc * func, int i, int * jumps,
+			    int * frame, int * tests) {
+  IRInstr * code = func->code;
+  IRInstr instr;
+  IRFunc * insert;
+  bool success = true;
+  double value;
+  double min = 0;
+  double max = 0;
+  int numTests = 0;
+  int pos = i;
+  int links = 0;
+  int fallback;
+  int count;
+  int j;
+
+  /* follow the chain while its tests are only reached from the one before */
+  while(opt_switch_test(code, func->size, pos, code[i].args, &value)
+	&& frame[pos] == frame[i] && (pos == i || jumps[pos] == links)
+	&& jumps[pos + 1] == 0 && jumps[pos + 2] == 0 && jumps[pos + 3] == 0) {
+    int next = code[pos + 3].op == OP_FCOND_GOTO
+      ? code[pos + 3].target : pos + 4;
+
+    if(numTests == 0 || value < min) {
+      min = value;
+    }
+    if(numTests == 0 || value > max) {
+      max = value;
+    }
+    if(max - min >= OPT_SWITCH_MAX_ENTRIES || next <= pos) {
+      break;
+    }
+    tests[numTests++] = pos;
+    links = code[pos + 3].op == OP_FCOND_GOTO ? 1 : 0;
+    pos = next;
+  }
+
+  /* drop the last tests until the table is dense enough */
+  for(; numTests >= OPT_SWITCH_MIN_CASES; numTests--) {
+    for(j = 0; j < numTests; j++) {
+      memcpy(&value, code[tests[j] + 1].args, sizeof(double));
+      if(j == 0 || value < min) {
+	min = value;
+      }
+      if(j == 0 || value > max) {
+	max = value;
+      }
+    }
+    if(max - min < OPT_SWITCH_DENSITY * numTests) {
+      break;
+    }
+  }
+  if(numTests < OPT_SWITCH_MIN_CASES) {
+    return 0;
+  }
+  fallback = tests[numTests - 1];
+  fallback = code[fallback + 3].op == OP_FCOND_GOTO
+    ? code[fallback + 3].target : fallback + 4;
+  count = (int)(max - min) + 1;
+
+  insert = calloc(1, sizeof(IRFunc));
+  if(insert == NULL) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return -1;
+  }
+  memset(&instr, 0, sizeof(IRInstr));
+  instr.string = -1;
+
+  instr.op = OP_SWITCH_NUM;
+  instr.argsLen = 2 + sizeof(double) + sizeof(int);
+  instr.target = -1;
+  memcpy(instr.args, code[i].args, 2);
+  memcpy(instr.args + 2, &min, sizeof(double));
+  memcpy(instr.args + 2 + sizeof(double), &count, sizeof(int));
+  success = ir_append(insert, &instr);
+
+  /* each entry goes to the case of the first test of its integer */
+  instr.op = OP_GOTO;
+  instr.argsLen = 0;
+  for(j = 0; success && j <= count; j++) {
+    int k;
+
+    instr.target = fallback;
+    for(k = 0; j < count && k < numTests; k++) {
+      memcpy(&value, code[tests[k] + 1].args, sizeof(double));
+      if(value == min + j) {
+	instr.target = code[tests[k] + 3].op == OP_TCOND_GOTO
+	  ? code[tests[k] + 3].target : tests[k] + 4;
+	break;
+      }
+    }
+
+    /* relative to the inserted code, once it is in place */
+    instr.target = (instr.target > i
+		    ? instr.target + count + 1 : instr.target) - i;
+    success = ir_append(insert, &instr);
+  }
+
+  /* the tests are replaced */
+  for(j = 0; success && j < numTests; j++) {
+    for(pos = tests[j] + (j == 0 ? 1 : 0); pos < tests[j] + 4; pos++) {
+      code[pos].op = IR_NOP;
+      code[pos].target = -1;
+    }
+  }
+
+  success = success && ir_splice(func, i, insert);
+  ir_free(insert);
+  if(!success) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return -1;
+  }
+  return count + 2;
+}
+
+/**
+ * Optimization pass: turns chains of if and else if statements, that compare
+ * one variable with integers, into an OP_SWITCH_NUM. This jumps through a
+ * table by the variable's value, rather than testing each case in turn.
+ */
+static bool opt_switches(Compiler * c, IRFunc * func) {
+  int * jumps = NULL;
+  int * frame = NULL;
+  int * parent = NULL;
+  int * tests = NULL;
+  bool success = true;
+  double value;
+  int i;
+
+  for(i = 0; success && i < func->size; i++) {
+    int size;
+
+    if(!opt_switch_test(func->code, func->size, i, NULL, &value)) {
+      continue;
+    }
+
+    /* the function changes with each switch */
+    if(jumps == NULL) {
+      free(frame);
+      free(parent);
+      free(tests);
+      jumps = ir_jump_counts(func);
+      frame = malloc(func->size * sizeof(int));
+      parent = malloc((func->size + 1) * sizeof(int));
+      tests = malloc(func->size * sizeof(int));
+      if(jumps == NULL || frame == NULL || parent == NULL || tests == NULL
+	 || !ir_frames(func, frame, parent)) {
+	c->err = COMPILERERR_ALLOC_FAILED;
+	success = false;
+	break;
+      }
+    }
+    if(frame[i] == -1) {
+      continue;
+    }
+
+    size = opt_switch_chain(c, func, i, jumps, frame, tests);
+    if(size == -1) {
+      success = false;
+    } else if(size > 0) {
+      free(jumps);
+      jumps = NULL;
+      i += size - 1;
+    }
+  }
+
+  free(jumps);
+  free(frame);
+  free(parent);
+  free(tests);
+  return success;
+}
+
+/**
+ * Marks the instructions of a function that are entries of a switch table,
+ * which must stay right after their OP_SWITCH_NUM.
+ * func: the function.
+ * inTable: receives whether each of the func->size + 1 instructions, and
+ * the end of the function, is an entry.
+ */
+static void opt_layout_tables(IRFunc * func, bool * inTable) {
+  int count;
+  int i;
+  int j;
+
+  memset(inTable, 0, (func->size + 1) * sizeof(bool));
+  for(i = 0; i < func->size; i++) {
+    if(func->code[i].op == OP_SWITCH_NUM) {
+      memcpy(&count, func->code[i].args + 2 + sizeof(double), sizeof(int));
+      for(j = i + 1; j <= i + 1 + count && j <= func->size; j++) {
+	inTable[j] = true;
+      }
+    }
+  }
+}
+
+/**
+ * Moves a block of a function to its end, out of the way of the code
+ * around it. A jump to the instruction after the block is added after it, if
+ * it would fall through.
+ * func: the function.
+ * from: the first instruction of the block.
+ * to: the instruction after its last one.
+ * returns: true upon success, and false if an allocation fails.
+ */
+static bool opt_layout_move(IRFunc * func, int from, int to) {
+  char last = func->code[to - 1].op;
+  IRInstr instr;
+
+  if(!ir_move(func, from, to)) {
+    return false;
+  }
+
+  if(last != OP_GOTO && last != OP_RETURN) {
+    memset(&instr, 0, sizeof(IRInstr));
+    instr.op = OP_GOTO;
+    instr.target = from;
+    if(!ir_append(func, &instr)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Optimization pass: profile guided code layout. An if statement whose then
+ * branch ran most of the time has its else branch moved to the end of the
+ * function, so that the then branch falls through to the code after the
+ * statement instead of jumping over the else branch. One whose then branch
+ * ran less than half of the time has the then branch moved there instead,
+ * with the test inverted, so that the code that runs is contiguous. Only
+ * branches whose function has a profile, and that ran often enough for it
+ * to mean something, are moved.
+ */
+static bool opt_layout(Compiler * c, IRFunc * func) {
+  ProfileFunc * profile = opt_profile(c, func->start);
+  bool * inTable;
+  int * frame;
+  int * parent;
+  char last;
+  int moved;
+  int limit;
+  int i;
+
+  if(profile == NULL || func->size == 0) {
+    return true;
+  }
+
+  inTable = malloc((func->size + 1) * sizeof(bool));
+  frame = malloc(func->size * sizeof(int));
+  parent = malloc((func->size + 1) * sizeof(int));
+  if(inTable == NULL || frame == NULL || parent == NULL
+     || !ir_frames(func, frame, parent)) {
+    free(inTable);
+    free(frame);
+    free(parent);
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
+
+  /* blocks go after the last instruction, which must not fall through */
+  last = func->code[func->size - 1].op;
+  if(frame[func->size - 1] != -1 && last != OP_GOTO && last != OP_RETURN
+     && (last != OP_FRM_POP || frame[func->size - 1] != 0)) {
+    limit = 0;
+  } else {
+    limit = func->size;
+  }
+  free(frame);
+  free(parent);
+
+  /* blocks that were moved are not looked at again */
+  for(i = 0; i < limit; i++) {
+    IRInstr * test = &func->code[i];
+    ProfileSite * site = opt_profile_site(profile, test);
+    int from;
+    int to;
+
+    if(test->op != OP_FCOND_GOTO || site == NULL
+       || site->count < OPT_LAYOUT_MIN_RUNS
+       || test->target <= i + 1 || test->target >= func->size) {
+      continue;
+    }
+    opt_layout_tables(func, inTable);
+
+    if(site->taken * 2 < site->count) {
+
+      /* the then branch is hot. move the else branch, if there is one */
+      IRInstr * skip = &func->code[test->target - 1];
+
+      from = test->target;
+      to = skip->target;
+      if(skip->op != OP_GOTO || to <= from || to > limit
+	 || inTable[from - 1] || inTable[from] || inTable[to]) {
+	continue;
+      }
+      skip->op = IR_NOP;
+    } else if(site->taken * 2 > site->count) {
+
+      /* the then branch is cold. move it, and jump to it when it runs */
+      from = i + 1;
+      to = test->target;
+      if(to > limit || inTable[from] || inTable[to]) {
+	continue;
+      }
+      test->op = OP_TCOND_GOTO;
+    } else {
+      continue;
+    }
+
+    moved = func->size - (to - from);
+    if(!opt_layout_move(func, from, to)) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      free(inTable);
+      return false;
+    }
+    if(func->code[i].op == OP_TCOND_GOTO) {
+      func->code[i].target = moved;
+    }
+    limit -= to - from;
+
+    /* the table is for the function's old size */
+    free(inTable);
+    inTable = malloc((func->size + 1) * sizeof(bool));
+    if(inTable == NULL) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      return false;
+    }
+  }
+
+  free(inTable);
+  return true;
+}
+
+/* the passes, in the order that they run */
+static const OptPass optPasses[] = {
+  { "inline", 1, opt_inline },
+  { "jumps", 1, opt_jumps },
+  { "peephole", 1, opt_peephole },
+  { "constants", 1, opt_constants },
+  { "deadcode", 1, opt_dead_code },
+  { "loops", 1, opt_loops },
+  { "types", 1, opt_types },
+  { "fuse", 1, opt_fuse_steps },
+  { "switch", 1, opt_switches },
+  { "layout", 1, opt_layout },
+};
+
+/**
+ * Optimizes the last function that was written to the compiler's bytecode
+ * buffer, by running every pass up to the compiler's optimization level.
+ * c: an instance of Compiler.
+ * start: the address of the function, which ends at the end of the buffer.
+ * returns: true upon success, and false if an error occurs, with c->err set.
+ */
+bool optimizer_optimize(Compiler * c, int start) {
+  Buffer * buffer = vm_buffer(c->vm);
+  int numPasses = sizeof(optPasses) / sizeof(OptPass);
+  PassStats * stats;
+  IRFunc * func;
+  clock_t begin;
+  bool success = true;
+  int i;
+
+  assert(numPasses <= COMPILER_MAX_PASSES);
+
+  if(c->optLevel <= 0) {
+    return true;
+  }
+
+  func = ir_lift(buffer_get_buffer(buffer), start, buffer_size(buffer));
+  if(func == NULL) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
+  if(!opt_expand_fused(func)) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    ir_free(func);
+    return false;
+  }
+
+  for(i = 0; success && i < numPasses; i++) {
+    if(optPasses[i].level > c->optLevel) {
+      continue;
+    }
+
+    stats = &c->passStats[i];
+    stats->name = optPasses[i].name;
+    stats->runs++;
+    stats->instrsIn += func->size;
+
+    begin = clock();
+    success = optPasses[i].run(c, func);
+    if(success && !ir_compact(func)) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      success = false;
+    }
+    stats->seconds += (double)(clock() - begin) / CLOCKS_PER_SEC;
+    stats->instrsOut += func->size;
+
+    if(i >= c->numPassStats) {
+      c->numPassStats = i + 1;
+    }
+  }
+
+  /* replace the function's code */
+  if(success) {
+    buffer_truncate(buffer, start);
+    if(!ir_lower(func, buffer)) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      success = false;
+    }
+  }
+
+  ir_free(func);
+  return success;
+}
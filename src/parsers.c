@@ -24,6 +24,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <string.h>
 #include "parsers.h"
 #include "langkeywords.h"
 #include "lexer.h"
@@ -59,6 +60,9 @@ bool parse_body_statement(Compiler * c, Lexer * l);
 static bool write_operator(Compiler * c,  char * token,
 				   size_t len, LexerType type) {
   OpCode opCode = operator_to_opcode(token, len);
+  Buffer * buffer = vm_buffer(c->vm);
+  DSValue value;
+  int address;
 
   /* check for invalid operators */
   if(opCode == -1) {
@@ -66,6 +70,39 @@ static bool write_operator(Compiler * c,  char * token,
     return false;
   }
 
+  /* && and || short circuit. the left operand was followed by a jump past the
+   * right operand, to code that pushes the result that it decided. the right
+   * operand is tested by the same kind of jump, so that it must be a boolean
+   * too, and the result is always pushed as one.
+   */
+  if(opCode == OP_AND || opCode == OP_OR) {
+    int decided;
+
+    if(!stk_pop(c->shortCircuitStk, &value)) {
+      c->err = COMPILERERR_UNKNOWN_OPERATOR;
+      return false;
+    }
+
+    /* the right operand jumps to the decided result, or pushes the other */
+    decided = buffer_size(buffer) + (2 * (1 + sizeof(int))) + 2;
+    buffer_append_char(buffer, opCode == OP_AND ? OP_FCOND_GOTO
+		       : OP_TCOND_GOTO);
+    buffer_append_string(buffer, (char*)&decided, sizeof(int));
+    buffer_append_char(buffer, OP_BOOL_PUSH);
+    buffer_append_char(buffer, opCode == OP_AND);
+
+    /* jump past the decided result */
+    address = decided + 2;
+    buffer_append_char(buffer, OP_GOTO);
+    buffer_append_string(buffer, (char*)&address, sizeof(int));
+
+    /* the left operand jumps to the decided result */
+    buffer_set_string(buffer, (char*)&decided, sizeof(int), value.longVal);
+    buffer_append_char(buffer, OP_BOOL_PUSH);
+    buffer_append_char(buffer, opCode == OP_OR);
+    return true;
+  }
+
   /* write operator OP code to output buffer */
   buffer_append_char(vm_buffer(c->vm), opCode);
    
@@ -444,6 +481,9 @@ static bool parse_operator(Compiler * c, TypeStk * opStk, Stk * opLenStk,
    * empty. By doing this, we modify the order of evaluation of operators based
    * on their precedence, a.k.a. order of operations.
    */
+  OpCode opCode;
+  int address = 0;
+
   assert(token != NULL);
 
   /* if current token has a higher precedence than top of stack, push it */
@@ -465,6 +505,21 @@ static bool parse_operator(Compiler * c, TypeStk * opStk, Stk * opLenStk,
     stk_push_long(opLenStk, len);
   }
 
+  /* the left operand of && and || is complete. write the jump that skips the
+   * right operand when the left decides the result. write_operator() fills in
+   * its address once the right operand is written.
+   */
+  opCode = operator_to_opcode(token, len);
+  if(opCode == OP_AND || opCode == OP_OR) {
+    buffer_append_char(vm_buffer(c->vm),
+		       opCode == OP_AND ? OP_FCOND_GOTO : OP_TCOND_GOTO);
+    if(!stk_push_long(c->shortCircuitStk, buffer_size(vm_buffer(c->vm)))) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      return false;
+    }
+    buffer_append_string(vm_buffer(c->vm), (char*)&address, sizeof(int));
+  }
+
   /* check for invalid types: */
   if(prevTokenType != LEXERTYPE_STRING
      && prevTokenType != LEXERTYPE_CHAR
@@ -1101,31 +1156,21 @@ static bool parse_function_call(Compiler * c, Lexer * l) {
 static bool assignment(Compiler * c, Lexer * l, char * variable, 
 		       size_t variableLen) {
 
-  DSValue value;
-  char i = 0;
-  HT * ht = symtblstk_peek(c, i);
+  int depth;
+  int slot;
 
   /* get variable depth */
-  for(i = 0; true; i++, ht = symtblstk_peek(c, i)) {
-
-    /* reached bottom of stack, variable not found */
-    if(ht == NULL) {
-      c->err = COMPILERERR_UNDEFINED_VARIABLE;
-      return false;
-    }
-
-    /* found variable in this stack, stop iterating */
-    if(ht_get_raw_key(ht, variable, variableLen, &value)) {
-      break;
-    }
+  if(!symtbl_lookup(c, variable, variableLen, &depth, &slot)) {
+    c->err = COMPILERERR_UNDEFINED_VARIABLE;
+    return false;
   }
 
   /* write the variable data OPCodes
    * Moves the last value from the OP stack in the VM to the variable
    * storage slot in the frame stack. */
   buffer_append_char(vm_buffer(c->vm), OP_VAR_STOR);
-  buffer_append_char(vm_buffer(c->vm), i);
-  buffer_append_char(vm_buffer(c->vm), value.intVal);
+  buffer_append_char(vm_buffer(c->vm), depth);
+  buffer_append_char(vm_buffer(c->vm), slot);
 
   return true;
 }
@@ -1191,36 +1236,22 @@ static bool parse_assignment_statement(Compiler * c, Lexer * l) {
 static bool reference(Compiler * c, Lexer * l, 
 		      char * variable, size_t variableLen) {
 
-  DSValue value;
-  char i = 0;
-  char varSlot;
-  HT * ht = symtblstk_peek(c, i);
+  int depth;
+  int slot;
 
   /* get variable depth */
-  for(i = 0; true; i++, ht = symtblstk_peek(c, i)) {
-
-    /* reached bottom of stack, variable not found */
-    if(ht == NULL) {
-      c->err = COMPILERERR_UNDEFINED_VARIABLE;
-      return false;
-    }
-
-    /* found variable in this stack, stop iterating */
-    if(ht_get_raw_key(ht, variable, variableLen, &value)) {
-      break;
-    }
+  if(!symtbl_lookup(c, variable, variableLen, &depth, &slot)) {
+    c->err = COMPILERERR_UNDEFINED_VARIABLE;
+    return false;
   }
 
   /* write the variable data read OPCodes
    * Moves the last value from the specified depth and slot of the frame
    * stack in the VM to the VM OP stack.
    */
-  /* TODO: need to add ability to search LOWER frames for variables */
-  varSlot = value.intVal;
-
   buffer_append_char(vm_buffer(c->vm), OP_VAR_PUSH);
-  buffer_append_char(vm_buffer(c->vm), i);
-  buffer_append_char(vm_buffer(c->vm), varSlot);
+  buffer_append_char(vm_buffer(c->vm), depth);
+  buffer_append_char(vm_buffer(c->vm), slot);
 
   return true;
 }
@@ -1340,6 +1371,234 @@ static bool parse_line(Compiler * c, Lexer * l) {
   return true;
 }
 
+/**
+ * Checks whether the condition and step of a for loop are a variable compared
+ * with a variable or a number, and the same variable plus or minus a number,
+ * and if so, writes the OP_FOR_STEP or OP_FOR_STEP_NUM instruction that does
+ * both, without its jump address.
+ * cond: the condition bytecode.
+ * condLen: the length of the condition bytecode in bytes.
+ * step: the step bytecode.
+ * stepLen: the length of the step bytecode in bytes.
+ * fused: a buffer of at least 4 + (2 * sizeof(double)) bytes that recv's the
+ * instruction.
+ * returns: the length of the instruction written to fused, or zero if the
+ * condition and step cannot be fused.
+ */
+static int for_step_fuse(char * cond, int condLen, char * step, int stepLen,
+			 char * fused) {
+  int limitLen = condLen - 5;
+  char op = cond[condLen - 1];
+  double stepVal;
+
+  /* step must be: var = var + number, or var = var - number */
+  if(stepLen != 8 + sizeof(double) || step[0] != OP_VAR_PUSH
+     || step[3] != OP_NUM_PUSH
+     || (step[4 + sizeof(double)] != OP_ADD
+	 && step[4 + sizeof(double)] != OP_SUB)
+     || step[5 + sizeof(double)] != OP_VAR_STOR
+     || memcmp(step + 1, step + 6 + sizeof(double), 2) != 0) {
+    return 0;
+  }
+
+  /* condition must be: var compared with a variable or a number */
+  if((limitLen != 2 && limitLen != sizeof(double))
+     || cond[0] != OP_VAR_PUSH || memcmp(cond + 1, step + 1, 2) != 0
+     || cond[3] != (limitLen == 2 ? OP_VAR_PUSH : OP_NUM_PUSH)
+     || (op != OP_LT && op != OP_GT && op != OP_LTE && op != OP_GTE)) {
+    return 0;
+  }
+
+  /* subtracting a number is adding its negation */
+  memcpy(&stepVal, step + 4, sizeof(double));
+  if(step[4 + sizeof(double)] == OP_SUB) {
+    stepVal = -stepVal;
+  }
+
+  fused[0] = limitLen == 2 ? OP_FOR_STEP : OP_FOR_STEP_NUM;
+  fused[1] = cond[1];
+  fused[2] = cond[2];
+  fused[3] = op;
+  memcpy(fused + 4, &stepVal, sizeof(double));
+  memcpy(fused + 4 + sizeof(double), cond + 4, limitLen);
+  return 4 + sizeof(double) + limitLen;
+}
+
+/**
+ * Parses for statements in script code, starting at the initial "for" token
+ * and dispatches subparsers as needed until done. For loops take the form:
+ *   for([initialization]; condition; [step]) statement
+ * A loop that counts a variable up or down to a limit has its step and
+ * condition compiled into a single OP_FOR_STEP or OP_FOR_STEP_NUM at the end
+ * of its body. Other loops test the condition at the top and jump back to the
+ * step after each iteration.
+ * c: an instance of compiler.
+ * l: an instance of lexer.
+ * returns: true if this is a for statement, regardless of error. If error,
+ * c->err is set.
+ */
+static bool parse_for_statement(Compiler * c, Lexer * l) {
+  Buffer * buffer = vm_buffer(c->vm);
+  char * token;
+  size_t len;
+  LexerType type;
+  char * varToken;
+  size_t varTokenLen;
+  bool parenthEncountered = false;
+  char fused[4 + (2 * sizeof(double))];
+  int fusedLen;
+  int condAddr;
+  int condEndAddr;
+  int condJumpAddr;
+  int bodyJumpAddr;
+  int stepAddr;
+  int stepEndAddr;
+  int bodyAddr;
+  int address = 0;
+
+  token = lexer_current_token(l, &type, &len);
+
+  /* check if this is a for statement */
+  if(!tokens_equal(token, len, LANG_FOR, LANG_FOR_LEN)) {
+    return false;
+  }
+
+  token = lexer_next(l, &type, &len);
+
+  /* check for an open parenthesis token */
+  if(!tokens_equal(token, len, LANG_OPARENTH, LANG_OPARENTH_LEN)) {
+    c->err = COMPILERERR_MALFORMED_IFORLOOP;
+    return true;
+  }
+
+  token = lexer_next(l, &type, &len);
+
+  /* compile the initialization, if there is one, and discard its value */
+  if(type != LEXERTYPE_ENDSTATEMENT) {
+    if(!parse_line(c, l)) {
+      return true;
+    }
+    buffer_append_char(buffer, OP_POP);
+
+    token = lexer_current_token(l, &type, &len);
+    if(type != LEXERTYPE_ENDSTATEMENT) {
+      c->err = COMPILERERR_EXPECTED_ENDSTATEMENT;
+      return true;
+    }
+  }
+
+  token = lexer_next(l, &type, &len);
+
+  /* compile the condition, which is tested before the first iteration */
+  condAddr = buffer_size(buffer);
+  if(type == LEXERTYPE_ENDSTATEMENT) {
+    c->err = COMPILERERR_MALFORMED_IFORLOOP;
+    return true;
+  }
+  if(!parse_straight_code(c, l, false, NULL)) {
+    return true;
+  }
+
+  token = lexer_current_token(l, &type, &len);
+  if(type != LEXERTYPE_ENDSTATEMENT) {
+    c->err = COMPILERERR_EXPECTED_ENDSTATEMENT;
+    return true;
+  }
+  condEndAddr = buffer_size(buffer);
+
+  /* fill jump instructions with placeholder bytes since we don't know the
+   * body or end of loop addresses yet
+   */
+  buffer_append_char(buffer, OP_FCOND_GOTO);
+  condJumpAddr = buffer_size(buffer);
+  buffer_append_string(buffer, (char*)(&address), sizeof(int));
+  buffer_append_char(buffer, OP_GOTO);
+  bodyJumpAddr = buffer_size(buffer);
+  buffer_append_string(buffer, (char*)(&address), sizeof(int));
+
+  token = lexer_next(l, &type, &len);
+
+  /* compile the step, if there is one */
+  stepAddr = buffer_size(buffer);
+  if(!tokens_equal(token, len, LANG_CPARENTH, LANG_CPARENTH_LEN)) {
+
+    /* the step may be an assignment or any other straight code */
+    varToken = token;
+    varTokenLen = len;
+    if(type == LEXERTYPE_KEYVAR) {
+      token = lexer_peek(l, NULL, &len);
+      if(tokens_equal(token, len, LANG_OP_ASSIGN, LANG_OP_ASSIGN_LEN)) {
+	token = lexer_next(l, &type, &len);
+	token = lexer_next(l, &type, &len);
+      } else {
+	varToken = NULL;
+      }
+    } else {
+      varToken = NULL;
+    }
+
+    if(!parse_straight_code(c, l, true, &parenthEncountered)) {
+      return true;
+    }
+    if(!parenthEncountered) {
+      c->err = COMPILERERR_MALFORMED_IFORLOOP;
+      return true;
+    }
+    if(varToken != NULL && !assignment(c, l, varToken, varTokenLen)) {
+      return true;
+    }
+  }
+  stepEndAddr = buffer_size(buffer);
+
+  /* skip the closing parenthesis */
+  token = lexer_next(l, &type, &len);
+
+  fusedLen = for_step_fuse(buffer_get_buffer(buffer) + condAddr,
+			   condEndAddr - condAddr,
+			   buffer_get_buffer(buffer) + stepAddr,
+			   stepEndAddr - stepAddr, fused);
+  if(fusedLen > 0) {
+
+    /* the fused step follows the body, drop the separate step code */
+    buffer_truncate(buffer, bodyJumpAddr - 1);
+  } else {
+
+    /* pop the step's value, if any, and jump back to the condition */
+    if(stepEndAddr > stepAddr) {
+      buffer_append_char(buffer, OP_POP);
+    }
+    buffer_append_char(buffer, OP_GOTO);
+    buffer_append_string(buffer, (char*)(&condAddr), sizeof(int));
+  }
+
+  bodyAddr = buffer_size(buffer);
+  if(fusedLen == 0) {
+    buffer_set_string(buffer, (char*)&bodyAddr, sizeof(int), bodyJumpAddr);
+  }
+
+  if(!parse_body_statement(c, l)) {
+    return true;
+  }
+
+  if(fusedLen > 0) {
+
+    /* step and jump back to the body while the condition holds */
+    buffer_append_string(buffer, fused, fusedLen);
+    buffer_append_string(buffer, (char*)(&bodyAddr), sizeof(int));
+  } else {
+
+    /* jump to the step */
+    buffer_append_char(buffer, OP_GOTO);
+    buffer_append_string(buffer, (char*)(&stepAddr), sizeof(int));
+  }
+
+  /* write jump to end of loop address for the condition */
+  address = buffer_size(buffer);
+  buffer_set_string(buffer, (char*)&address, sizeof(int), condJumpAddr);
+
+  return true;
+}
+
 /**
  * Subparser for define_variables(). Performs definition of variables.
  * Looks at the current token. If it is 'var', the parser takes over and starts
@@ -1362,14 +1621,12 @@ static bool define_variable(Compiler * c, Lexer * l) {
    *
    * var [variable_name];
    */
-  HT * symTbl = symtblstk_peek(c, 0);
   LexerType type;
   char * token;
   size_t len;
   char * varName;
   size_t varNameLen;
   bool prevExisted;
-  DSValue newValue;
 
   /* get current token cached in the lexer */
   token = lexer_current_token(l, &type, &len);
@@ -1389,10 +1646,7 @@ static bool define_variable(Compiler * c, Lexer * l) {
   /* store variable along with index at which its data will be stored in the
    * frame stack in the virtual machine
    */
-  newValue.intVal = ht_size(symTbl);
-  if(!ht_put_raw_key(symTbl, varName, varNameLen,
-		     &newValue, NULL, &prevExisted)) {
-    c->err = COMPILERERR_ALLOC_FAILED;
+  if(!symtbl_define(c, varName, varNameLen, &prevExisted)) {
     return true;
   }
 
@@ -1488,6 +1742,10 @@ bool parse_body_statement(Compiler * c, Lexer * l) {
     if(c->err != COMPILERERR_SUCCESS) {
       return false;
     }
+  } else if(parse_for_statement(c, l)) {
+    if(c->err != COMPILERERR_SUCCESS) {
+      return false;
+    }
   } else {
 
     /* not a logical structure, evaluate as normal line of code */
@@ -1565,9 +1823,8 @@ bool parse_block(Compiler * c, Lexer * l) {
   /* get next token */
   token = lexer_next(l, &type, &len);
 
-  /* we're going down a level. push new symbol table to stack */
-  if(!symtblstk_push(c)) {
-    c->err = COMPILERERR_ALLOC_FAILED;
+  /* we're going down a level. open a new scope in the symbol table */
+  if(!symtbl_push_scope(c)) {
     return true;
   }
 
@@ -1604,8 +1861,8 @@ bool parse_block(Compiler * c, Lexer * l) {
   /* pop block frame */
   buffer_append_char(vm_buffer(c->vm), OP_FRM_POP);
 
-  /* we're done here! pop the symbol table for this block off the stack. */
-  ht_free(symtblstk_pop(c));
+  /* we're done here! close the block's scope in the symbol table. */
+  symtbl_pop_scope(c);
 
   lexer_next(l, &type, &len);
   return true;
@@ -0,0 +1,653 @@
+/**
+ * profile.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Execution profiles, for profile guided optimization. While a recorder is
+ * set, the VM counts the calls of each function, the runs of each call,
+ * conditional jump and operator, the direction that each conditional jump
+ * went, the types of the operands that each operator saw, and the calls of
+ * each native function. The counts are written to a text file in which each
+ * instruction is named by its function and its offset within the function,
+ * so that the file still applies after the script is rebuilt:
+ *
+ *   gxsprofile 1
+ *   function [name] [calls]
+ *   branch [offset] [runs] [times jumped]
+ *   call [offset] [runs]
+ *   types [offset] [runs] [PROFILE_TYPE_* bits]
+ *   native [name] [calls]
+ *
+ * Offsets are those of the code before it is optimized, so profiled runs
+ * must be built with the optimizer off. The compiler loads the file and
+ * looks up each instruction that it lifts by the same offset.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profile.h"
+#include "vmregistry.h"
+#include "compiler.h"
+#include "compcommon.h"
+#include "gunderscript.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+/* version of the profile file format */
+#define PROFILE_VERSION        1
+/* the longest line of a profile file */
+#define PROFILE_MAX_LINE       (GS_MAX_FUNCTION_NAME_LEN + 64)
+
+/* a function of the code that was profiled */
+typedef struct ProfileEntry {
+  char name[GS_MAX_FUNCTION_NAME_LEN + 1];
+  int index;
+} ProfileEntry;
+
+/**
+ * Creates a recorder, to be set with vm_set_profile() before the code that
+ * it profiles runs.
+ * returns: the recorder, to be freed with profile_recorder_free(), or NULL
+ * if the allocation fails.
+ */
+ProfileRecorder * profile_recorder_new() {
+  return calloc(1, sizeof(ProfileRecorder));
+}
+
+/**
+ * Grows an array of counters, clearing the new ones.
+ * array: the array.
+ * oldSize: the number of counters that it has.
+ * newSize: the number of counters that it needs.
+ * size: the size of a counter.
+ * returns: the new array, or NULL if the allocation fails.
+ */
+static void * profile_grow(void * array, int oldSize, int newSize,
+			   size_t size) {
+  char * grown = realloc(array, newSize * size);
+
+  if(grown != NULL) {
+    memset(grown + oldSize * size, 0, (newSize - oldSize) * size);
+  }
+  return grown;
+}
+
+/**
+ * Makes room for the counters of every address of the code.
+ * recorder: the recorder.
+ * byteCodeLen: the length of the code.
+ * returns: true if there is room, and false if an allocation failed.
+ */
+static bool profile_reserve(ProfileRecorder * recorder, size_t byteCodeLen) {
+  void * grown;
+
+  if(recorder->failed) {
+    return false;
+  } else if(byteCodeLen <= recorder->size) {
+    return true;
+  }
+
+  /* each array is replaced as soon as it has grown, so that a failure
+   * leaves none of them freed.
+   */
+  if((grown = profile_grow(recorder->counts, recorder->size, byteCodeLen,
+			   sizeof(long))) != NULL) {
+    recorder->counts = grown;
+  }
+  if(grown != NULL && (grown = profile_grow(recorder->taken, recorder->size,
+					    byteCodeLen,
+					    sizeof(long))) != NULL) {
+    recorder->taken = grown;
+  }
+  if(grown != NULL && (grown = profile_grow(recorder->types, recorder->size,
+					    byteCodeLen,
+					    sizeof(char))) != NULL) {
+    recorder->types = grown;
+  }
+  if(grown != NULL && (grown = profile_grow(recorder->calls, recorder->size,
+					    byteCodeLen,
+					    sizeof(long))) != NULL) {
+    recorder->calls = grown;
+  }
+  if(grown == NULL) {
+    recorder->failed = true;
+    return false;
+  }
+
+  recorder->size = byteCodeLen;
+  return true;
+}
+
+/**
+ * Counts a call of a native function.
+ * recorder: the recorder.
+ * vm: the VM that calls it.
+ * index: the callback index of the function.
+ */
+static void profile_native(ProfileRecorder * recorder, VM * vm, int index) {
+  if(index < 0) {
+    return;
+  }
+
+  if(index >= recorder->numNatives) {
+    int numNatives = vm_num_callbacks(vm);
+    long * grown;
+
+    if(index >= numNatives
+       || (grown = profile_grow(recorder->natives, recorder->numNatives,
+				numNatives, sizeof(long))) == NULL) {
+      return;
+    }
+    recorder->natives = grown;
+    recorder->numNatives = numNatives;
+  }
+  recorder->natives[index]++;
+}
+
+/**
+ * Counts the instruction that the VM is about to run. This is called for
+ * every instruction while a recorder is set, before the instruction's
+ * operands are checked, so nothing is assumed about them.
+ * recorder: the recorder.
+ * vm: the VM.
+ * byteCode: the code that it runs.
+ * byteCodeLen: the length of byteCode.
+ * index: the address of the instruction.
+ */
+void profile_record(ProfileRecorder * recorder, VM * vm, char * byteCode,
+		    size_t byteCodeLen, int index) {
+  TypeStkData * top = vm->opStk->stack + vm->opStk->size;
+  int address;
+  bool result;
+
+  if(!profile_reserve(recorder, byteCodeLen)) {
+    return;
+  }
+
+  switch(byteCode[index]) {
+  case OP_CALL_B:
+    recorder->counts[index]++;
+    if(byteCodeLen - index >= 3 + sizeof(int)) {
+      memcpy(&address, byteCode + index + 3, sizeof(int));
+      profile_enter(recorder, byteCodeLen, address);
+    }
+    break;
+  case OP_CALL_PTR_N:
+    recorder->counts[index]++;
+    if(byteCodeLen - index >= 2 + sizeof(int)) {
+      memcpy(&address, byteCode + index + 2, sizeof(int));
+      profile_native(recorder, vm, address);
+    }
+    break;
+  case OP_TCOND_GOTO:
+  case OP_FCOND_GOTO:
+    recorder->counts[index]++;
+    if(vm->opStk->size > 0 && top[-1].type == TYPE_BOOLEAN) {
+      memcpy(&result, top[-1].data, sizeof(bool));
+      if((result != 0) == (byteCode[index] == OP_TCOND_GOTO)) {
+	recorder->taken[index]++;
+      }
+    }
+    break;
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_LT:
+  case OP_GT:
+  case OP_LTE:
+  case OP_GTE:
+  case OP_EQUALS:
+  case OP_NOT_EQUALS:
+  case OP_NUM_ADD:
+  case OP_NUM_SUB:
+  case OP_NUM_MUL:
+  case OP_NUM_DIV:
+  case OP_NUM_MOD:
+  case OP_NUM_LT:
+  case OP_NUM_GT:
+  case OP_NUM_LTE:
+  case OP_NUM_GTE:
+  case OP_NUM_EQUALS:
+  case OP_NUM_NOT_EQUALS:
+  case OP_AND:
+  case OP_OR:
+    recorder->counts[index]++;
+    if(vm->opStk->size >= 2) {
+      recorder->types[index] |= (1 << top[-1].type) | (1 << top[-2].type);
+    }
+    break;
+  }
+}
+
+/**
+ * Counts a call of the function at an address, including calls made by the
+ * host.
+ * recorder: the recorder.
+ * byteCodeLen: the length of the code.
+ * index: the address of the function.
+ */
+void profile_enter(ProfileRecorder * recorder, size_t byteCodeLen,
+		   int index) {
+  if(index >= 0 && index < byteCodeLen
+     && profile_reserve(recorder, byteCodeLen)) {
+    recorder->calls[index]++;
+  }
+}
+
+/**
+ * Compares the addresses of two functions, for qsort().
+ */
+static int profile_entry_compare(const void * a, const void * b) {
+  return ((ProfileEntry*)a)->index - ((ProfileEntry*)b)->index;
+}
+
+/**
+ * Gets the name of a native function.
+ * vm: the VM.
+ * index: the callback index of the function.
+ * name: receives the name, NULL terminated.
+ * returns: true if the function was found.
+ */
+static bool profile_native_name(VM * vm, int index, char * name) {
+  HTIter iter;
+
+  /* shared natives first, then the VM's own */
+  if(vm->registry != NULL && index < vm->registry->numNatives) {
+    size_t len = vm->registry->natives[index].nameLen;
+
+    if(len > GS_MAX_FUNCTION_NAME_LEN) {
+      return false;
+    }
+    memcpy(name, vm->registry->natives[index].name, len);
+    name[len] = '\0';
+    return true;
+  }
+  if(vm->callbacksHT == NULL) {
+    return false;
+  }
+
+  ht_iter_get(vm->callbacksHT, &iter);
+  while(ht_iter_has_next(&iter)) {
+    DSValue value;
+    size_t len;
+
+    ht_iter_next(&iter, name, GS_MAX_FUNCTION_NAME_LEN, &value, &len,
+		 false);
+    if(value.intVal == index && len <= GS_MAX_FUNCTION_NAME_LEN) {
+      name[len] = '\0';
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Writes the counts of the instructions of a function to a profile file.
+ * recorder: the recorder.
+ * code: the code that was profiled.
+ * start: the address of the function.
+ * end: the address after its last instruction.
+ * file: the profile file.
+ */
+static void profile_write_function(ProfileRecorder * recorder, char * code,
+				   int start, int end, FILE * file) {
+  int i;
+
+  /* only the addresses of instructions are ever counted */
+  for(i = start; i < end && i < recorder->size; i++) {
+    if(recorder->counts[i] == 0) {
+      continue;
+    }
+
+    switch(code[i]) {
+    case OP_TCOND_GOTO:
+    case OP_FCOND_GOTO:
+      fprintf(file, "branch %d %ld %ld\n", i - start, recorder->counts[i],
+	      recorder->taken[i]);
+      break;
+    case OP_CALL_B:
+    case OP_CALL_PTR_N:
+      fprintf(file, "call %d %ld\n", i - start, recorder->counts[i]);
+      break;
+    default:
+      fprintf(file, "types %d %ld %d\n", i - start, recorder->counts[i],
+	      recorder->types[i]);
+      break;
+    }
+  }
+}
+
+/**
+ * Writes what a recorder counted to a profile file.
+ * recorder: the recorder.
+ * vm: the VM that it was set on.
+ * fileName: the file, which is replaced.
+ * returns: true upon success, and false if an allocation failed while
+ * counting or the file can't be written.
+ */
+bool profile_write(ProfileRecorder * recorder, VM * vm, char * fileName) {
+  ProfileEntry * entries;
+  int numEntries = 0;
+  size_t codeLen = vm_bytecode_size(vm);
+  char name[GS_MAX_FUNCTION_NAME_LEN + 1];
+  HTIter iter;
+  FILE * file;
+  bool success;
+  int i;
+
+  assert(recorder != NULL);
+  assert(vm != NULL);
+  assert(fileName != NULL);
+
+  if(recorder->failed) {
+    return false;
+  }
+
+  entries = malloc((ht_size(vm_functions(vm)) + 1) * sizeof(ProfileEntry));
+  if(entries == NULL) {
+    return false;
+  }
+
+  /* functions are laid out one after another, so each one ends where the
+   * next one begins.
+   */
+  ht_iter_get(vm_functions(vm), &iter);
+  while(ht_iter_has_next(&iter)) {
+    DSValue value;
+    size_t len;
+
+    ht_iter_next(&iter, entries[numEntries].name, GS_MAX_FUNCTION_NAME_LEN,
+		 &value, &len, false);
+    if(len <= GS_MAX_FUNCTION_NAME_LEN) {
+      entries[numEntries].name[len] = '\0';
+      entries[numEntries].index = ((VMFunc*)value.pointerVal)->index;
+      numEntries++;
+    }
+  }
+  qsort(entries, numEntries, sizeof(ProfileEntry), profile_entry_compare);
+
+  file = fopen(fileName, "w");
+  if(file == NULL) {
+    free(entries);
+    return false;
+  }
+
+  fprintf(file, "gxsprofile %d\n", PROFILE_VERSION);
+  for(i = 0; i < numEntries; i++) {
+    int start = entries[i].index;
+    int end = i + 1 < numEntries ? entries[i + 1].index : codeLen;
+
+    fprintf(file, "function %s %ld\n", entries[i].name,
+	    start < recorder->size ? recorder->calls[start] : 0);
+    profile_write_function(recorder, vm_code(vm), start, end, file);
+  }
+  for(i = 0; i < recorder->numNatives; i++) {
+    if(recorder->natives[i] > 0 && profile_native_name(vm, i, name)) {
+      fprintf(file, "native %s %ld\n", name, recorder->natives[i]);
+    }
+  }
+
+  success = !ferror(file);
+  success = fclose(file) == 0 && success;
+  free(entries);
+  return success;
+}
+
+/**
+ * Frees a recorder. It must not be set on a VM anymore.
+ * recorder: the recorder.
+ */
+void profile_recorder_free(ProfileRecorder * recorder) {
+  assert(recorder != NULL);
+
+  free(recorder->counts);
+  free(recorder->taken);
+  free(recorder->types);
+  free(recorder->calls);
+  free(recorder->natives);
+  free(recorder);
+}
+
+/**
+ * Gets the site of an offset in a function, adding it if it is new. Sites
+ * are added in the order of the file, which is the order of their offsets.
+ * func: the function.
+ * offset: the offset.
+ * returns: the site, or NULL if the allocation fails.
+ */
+static ProfileSite * profile_add_site(ProfileFunc * func, int offset) {
+  ProfileSite * site;
+
+  if(func->numSites > 0 && func->sites[func->numSites - 1].offset == offset) {
+    return &func->sites[func->numSites - 1];
+  }
+
+  if(func->numSites == func->sitesSize) {
+    int sitesSize = func->sitesSize > 0 ? func->sitesSize * 2 : 16;
+    ProfileSite * sites = realloc(func->sites,
+				  sitesSize * sizeof(ProfileSite));
+
+    if(sites == NULL) {
+      return NULL;
+    }
+    func->sites = sites;
+    func->sitesSize = sitesSize;
+  }
+
+  site = &func->sites[func->numSites++];
+  memset(site, 0, sizeof(ProfileSite));
+  site->offset = offset;
+  return site;
+}
+
+/**
+ * Compares the offsets of two sites, for qsort() and bsearch().
+ */
+static int profile_site_compare(const void * a, const void * b) {
+  return ((ProfileSite*)a)->offset - ((ProfileSite*)b)->offset;
+}
+
+/**
+ * Reads a line of a profile file into the loaded profile.
+ * profile: the profile.
+ * line: the line, NULL terminated.
+ * func: the function that the line belongs to, which receives the function
+ * that the next line belongs to.
+ * returns: true upon success, and false if the line is malformed or an
+ * allocation fails.
+ */
+static bool profile_parse_line(Profile * profile, char * line,
+			       ProfileFunc ** func) {
+  char name[GS_MAX_FUNCTION_NAME_LEN + 1];
+  ProfileSite * site;
+  int offset;
+  long count;
+  long taken;
+  int types;
+  int version;
+
+  if(line[0] == '\0' || line[0] == '#') {
+    return true;
+  } else if(sscanf(line, "gxsprofile %d", &version) == 1) {
+    return version == PROFILE_VERSION;
+  } else if(sscanf(line, "function %80s %ld", name, &count) == 2) {
+    DSValue value;
+    DSValue old;
+    bool existed = false;
+
+    *func = calloc(1, sizeof(ProfileFunc));
+    if(*func == NULL) {
+      return false;
+    }
+    (*func)->calls = count;
+    value.pointerVal = *func;
+    if(!ht_put_raw_key(profile->functions, name, strlen(name), &value,
+		       &old, &existed)) {
+      free(*func);
+      *func = NULL;
+      return false;
+    }
+
+    /* a function named twice keeps its last counts */
+    if(existed) {
+      free(((ProfileFunc*)old.pointerVal)->sites);
+      free(old.pointerVal);
+    }
+    return true;
+  } else if(sscanf(line, "native %80s %ld", name, &count) == 2) {
+    /* natives aren't compiled, so only the host needs their counts */
+    return true;
+  } else if(*func == NULL || sscanf(line, "%*s %d %ld", &offset,
+				    &count) != 2) {
+    return false;
+  } else if((site = profile_add_site(*func, offset)) == NULL) {
+    return false;
+  }
+
+  site->count = count;
+  if(sscanf(line, "branch %d %ld %ld", &offset, &count, &taken) == 3) {
+    site->taken = taken;
+  } else if(sscanf(line, "types %d %ld %d", &offset, &count, &types) == 3) {
+    site->types = types;
+    (*func)->types |= types;
+  }
+  return true;
+}
+
+/**
+ * Loads a profile file written by profile_write(), for the compiler.
+ * fileName: the file.
+ * returns: the profile, to be freed with profile_free(), or NULL if the file
+ * can't be read, is not a profile, or an allocation fails.
+ */
+Profile * profile_load(char * fileName) {
+  char line[PROFILE_MAX_LINE + 1];
+  ProfileFunc * func = NULL;
+  Profile * profile;
+  HTIter iter;
+  size_t i = 0;
+  bool success = true;
+
+  assert(fileName != NULL);
+
+  profile = calloc(1, sizeof(Profile));
+  if(profile == NULL) {
+    return NULL;
+  }
+  profile->text = compiler_file_to_string(fileName, &profile->textLen);
+  profile->functions = ht_new(COMPILER_INITIAL_HTSIZE, COMPILER_HTBLOCKSIZE,
+			      COMPILER_HTLOADFACTOR);
+  if(profile->text == NULL || profile->functions == NULL
+     || strncmp(profile->text, "gxsprofile", 10) != 0) {
+    profile_free(profile);
+    return NULL;
+  }
+
+  while(success && i < profile->textLen) {
+    size_t len = strcspn(profile->text + i, "\r\n");
+
+    if(len > PROFILE_MAX_LINE) {
+      success = false;
+      break;
+    }
+    memcpy(line, profile->text + i, len);
+    line[len] = '\0';
+    success = profile_parse_line(profile, line, &func);
+    i += len + 1;
+  }
+
+  /* written in order, but the file could have been edited */
+  ht_iter_get(profile->functions, &iter);
+  while(ht_iter_has_next(&iter)) {
+    DSValue value;
+
+    ht_iter_next(&iter, NULL, 0, &value, NULL, false);
+    func = value.pointerVal;
+    qsort(func->sites, func->numSites, sizeof(ProfileSite),
+	  profile_site_compare);
+  }
+
+  if(!success) {
+    profile_free(profile);
+    return NULL;
+  }
+  return profile;
+}
+
+/**
+ * Looks up what was recorded for a function.
+ * profile: the profile.
+ * name: the name of the function.
+ * nameLen: the length of name.
+ * returns: the function, or NULL if it wasn't profiled.
+ */
+ProfileFunc * profile_function(Profile * profile, char * name,
+			       size_t nameLen) {
+  DSValue value;
+
+  assert(profile != NULL);
+  assert(name != NULL);
+
+  if(!ht_get_raw_key(profile->functions, name, nameLen, &value)) {
+    return NULL;
+  }
+  return value.pointerVal;
+}
+
+/**
+ * Looks up what was recorded for an instruction of a function.
+ * func: the function.
+ * offset: the instruction's offset in the unoptimized function.
+ * returns: the site, or NULL if the instruction never ran or is not one
+ * that is profiled.
+ */
+ProfileSite * profile_site(ProfileFunc * func, int offset) {
+  ProfileSite key;
+
+  assert(func != NULL);
+
+  key.offset = offset;
+  return bsearch(&key, func->sites, func->numSites, sizeof(ProfileSite),
+		 profile_site_compare);
+}
+
+/**
+ * Frees a profile.
+ * profile: the profile.
+ */
+void profile_free(Profile * profile) {
+  assert(profile != NULL);
+
+  if(profile->functions != NULL) {
+    HTIter iter;
+
+    ht_iter_get(profile->functions, &iter);
+    while(ht_iter_has_next(&iter)) {
+      DSValue value;
+
+      ht_iter_next(&iter, NULL, 0, &value, NULL, true);
+      free(((ProfileFunc*)value.pointerVal)->sites);
+      free(value.pointerVal);
+    }
+    ht_free(profile->functions);
+  }
+  free(profile->text);
+  free(profile);
+}
@@ -0,0 +1,448 @@
+/**
+ * snapshot.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Snapshots of script state. Scripts have no globals, so whatever an init
+ * function builds lives on in the value that it returns. A snapshot image
+ * holds that value and every string and array reachable from it, so that a
+ * new instance can restore the state without running init again. Objects
+ * that are reachable more than once, including through cycles, are saved
+ * once and are shared again when restored.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "snapshot.h"
+#include "libstr.h"
+#include "libarray.h"
+#include <string.h>
+#include <assert.h>
+
+#define SNAPSHOT_HT_SIZE         64
+#define SNAPSHOT_HT_BLOCKSIZE    64
+#define SNAPSHOT_HT_LOADFACTOR   0.75
+
+/* state of a snapshot being written */
+typedef struct SnapshotWriter {
+  HT * ids;                       /* id of each object, keyed by address */
+  Buffer * objects;               /* the objects, in order of id */
+  int numObjects;
+  SnapshotErr err;
+} SnapshotWriter;
+
+/**
+ * Gets the kind of object that a VMLibData is in a snapshot.
+ * data: the object.
+ * returns: SNAPSHOT_STRING, SNAPSHOT_ARRAY, or 0 if it can't be saved.
+ */
+static int snapshot_kind(VMLibData * data) {
+  if(vmlibdata_is_type(data, LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN)) {
+    return SNAPSHOT_STRING;
+  } else if(vmlibdata_is_type(data, LIBARRAY_ARRAY_TYPE,
+			      LIBARRAY_ARRAY_TYPE_LEN)) {
+    return SNAPSHOT_ARRAY;
+  }
+  return 0;
+}
+
+/**
+ * Converts a value to its snapshot form. Objects that haven't been seen yet
+ * get the next id and are queued to be written.
+ * writer: the snapshot writer.
+ * type: the value's type.
+ * data: the value's VM_VAR_SIZE bytes of data.
+ * value: receives SNAPSHOT_VALUE_SIZE bytes.
+ * returns: true upon success, and false if the value can't be saved or an
+ * allocation fails.
+ */
+static bool snapshot_write_value(SnapshotWriter * writer, char type,
+				 char * data, char * value) {
+  VMLibData * object;
+  DSValue id;
+
+  memset(value, 0, SNAPSHOT_VALUE_SIZE);
+  value[0] = type;
+
+  switch(type) {
+  case TYPE_NULL:
+    return true;
+  case TYPE_BOOLEAN:
+    memcpy(value + 1, data, sizeof(bool));
+    return true;
+  case TYPE_NUMBER:
+    memcpy(value + 1, data, sizeof(double));
+    return true;
+  case TYPE_LIBDATA:
+    memcpy(&object, data, sizeof(VMLibData*));
+    if(snapshot_kind(object) == 0) {
+      writer->err = SNAPSHOTERR_UNSUPPORTED_TYPE;
+      return false;
+    }
+
+    /* first time that the object is seen, give it an id */
+    if(!ht_get_raw_key(writer->ids, (char*)&object, sizeof(VMLibData*), &id)) {
+      id.intVal = writer->numObjects;
+      if(!ht_put_raw_key(writer->ids, (char*)&object, sizeof(VMLibData*),
+			 &id, NULL, NULL)
+	 || !buffer_append_string(writer->objects, (char*)&object,
+				  sizeof(VMLibData*))) {
+	writer->err = SNAPSHOTERR_ALLOC_FAILED;
+	return false;
+      }
+      writer->numObjects++;
+    }
+    memcpy(value + 1, &id.intVal, sizeof(int));
+    return true;
+  default:
+    writer->err = SNAPSHOTERR_UNSUPPORTED_TYPE;
+    return false;
+  }
+}
+
+/**
+ * Writes an object and its contents to a snapshot image.
+ * writer: the snapshot writer.
+ * object: the object.
+ * image: the image.
+ * returns: true upon success, and false if it contains a value that can't be
+ * saved or an allocation fails.
+ */
+static bool snapshot_write_object(SnapshotWriter * writer, VMLibData * object,
+				  Buffer * image) {
+  SnapshotObject header;
+  char value[SNAPSHOT_VALUE_SIZE];
+  char * entries;
+  int i;
+
+  header.kind = snapshot_kind(object);
+  if(header.kind == SNAPSHOT_STRING) {
+    header.length = libstr_string_length(object);
+  } else {
+    header.length = libarray_array_size(object);
+  }
+
+  if(!buffer_append_string(image, (char*)&header, sizeof(SnapshotObject))) {
+    writer->err = SNAPSHOTERR_ALLOC_FAILED;
+    return false;
+  }
+
+  if(header.kind == SNAPSHOT_STRING) {
+    if(!buffer_append_string(image, libstr_string(object), header.length)) {
+      writer->err = SNAPSHOTERR_ALLOC_FAILED;
+      return false;
+    }
+    return true;
+  }
+
+  /* array entries are the data followed by the type */
+  for(i = 0; i < header.length; i++) {
+    entries = buffer_get_buffer(vmlibdata_data(object));
+    if(!snapshot_write_value(writer, entries[i * LIBARRAY_ENTRY_SIZE
+					     + VM_VAR_SIZE],
+			     entries + i * LIBARRAY_ENTRY_SIZE, value)) {
+      return false;
+    }
+    if(!buffer_append_string(image, value, SNAPSHOT_VALUE_SIZE)) {
+      writer->err = SNAPSHOTERR_ALLOC_FAILED;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Writes a snapshot image of a value and every object reachable from it.
+ * vm: an instance of VM.
+ * value: the value.
+ * image: an empty buffer that receives the image.
+ * err: receives the error upon failure.
+ * returns: true upon success, and false if an object can't be saved
+ * (SNAPSHOTERR_UNSUPPORTED_TYPE) or an allocation fails.
+ */
+bool snapshot_write(VM * vm, VMArg * value, Buffer * image,
+		    SnapshotErr * err) {
+  SnapshotWriter writer;
+  SnapshotHeader header;
+  VMLibData * object;
+  bool success;
+  int i;
+
+  assert(vm != NULL);
+  assert(value != NULL);
+  assert(image != NULL);
+
+  writer.ids = ht_new(SNAPSHOT_HT_SIZE, SNAPSHOT_HT_BLOCKSIZE,
+		      SNAPSHOT_HT_LOADFACTOR);
+  writer.objects = buffer_new(SNAPSHOT_HT_SIZE * sizeof(VMLibData*),
+			      SNAPSHOT_HT_BLOCKSIZE * sizeof(VMLibData*));
+  writer.numObjects = 0;
+  writer.err = SNAPSHOTERR_SUCCESS;
+  if(writer.ids == NULL || writer.objects == NULL) {
+    if(writer.ids != NULL) {
+      ht_free(writer.ids);
+    }
+    if(writer.objects != NULL) {
+      buffer_free(writer.objects);
+    }
+    *err = SNAPSHOTERR_ALLOC_FAILED;
+    return false;
+  }
+
+  /* the header is rewritten once the number of objects is known */
+  memset(&header, 0, sizeof(SnapshotHeader));
+  memcpy(header.header, SNAPSHOT_HEADER, SNAPSHOT_HEADER_SIZE);
+  header.version = SNAPSHOT_VERSION;
+  success = snapshot_write_value(&writer, value->type, value->data,
+				 header.root)
+    && buffer_append_string(image, (char*)&header, sizeof(SnapshotHeader));
+  if(!success && writer.err == SNAPSHOTERR_SUCCESS) {
+    writer.err = SNAPSHOTERR_ALLOC_FAILED;
+  }
+
+  /* writing an object queues the objects that it refers to */
+  for(i = 0; success && i < writer.numObjects; i++) {
+    memcpy(&object, buffer_get_buffer(writer.objects) + i * sizeof(VMLibData*),
+	   sizeof(VMLibData*));
+    success = snapshot_write_object(&writer, object, image);
+  }
+
+  if(success) {
+    header.numObjects = writer.numObjects;
+    memcpy(buffer_get_buffer(image), &header, sizeof(SnapshotHeader));
+  }
+
+  ht_free(writer.ids);
+  buffer_free(writer.objects);
+  *err = writer.err;
+  return success;
+}
+
+/**
+ * Converts a value from its snapshot form.
+ * objects: the restored objects.
+ * numObjects: the number of objects.
+ * value: SNAPSHOT_VALUE_SIZE bytes of the snapshot.
+ * type: receives the value's type.
+ * data: receives the value's VM_VAR_SIZE bytes of data.
+ * returns: true upon success, and false if the value is invalid.
+ */
+static bool snapshot_read_value(VMLibData ** objects, int numObjects,
+				char * value, VarType * type, char * data) {
+  int id;
+
+  *type = value[0];
+  memcpy(data, value + 1, VM_VAR_SIZE);
+
+  switch(*type) {
+  case TYPE_NULL:
+  case TYPE_BOOLEAN:
+  case TYPE_NUMBER:
+    return true;
+  case TYPE_LIBDATA:
+    memcpy(&id, value + 1, sizeof(int));
+    if(id < 0 || id >= numObjects) {
+      return false;
+    }
+    memset(data, 0, VM_VAR_SIZE);
+    memcpy(data, &objects[id], sizeof(VMLibData*));
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Creates the objects of a snapshot image. Each object holds a reference
+ * that is released by snapshot_release().
+ * image: the image.
+ * imageLen: the length of the image.
+ * objects: the array that receives the objects.
+ * contents: the array that receives the offset of each object's contents.
+ * numObjects: the number of objects.
+ * returns: SNAPSHOTERR_SUCCESS, or the error.
+ */
+static SnapshotErr snapshot_read_objects(char * image, size_t imageLen,
+					 VMLibData ** objects, size_t * contents,
+					 int numObjects) {
+  SnapshotObject object;
+  size_t offset = sizeof(SnapshotHeader);
+  size_t len;
+  int i;
+
+  for(i = 0; i < numObjects; i++) {
+    if(imageLen - offset < sizeof(SnapshotObject)) {
+      return SNAPSHOTERR_CORRUPTED;
+    }
+    memcpy(&object, image + offset, sizeof(SnapshotObject));
+    offset += sizeof(SnapshotObject);
+
+    /* check that the contents are within the image before allocating */
+    if(object.length < 0) {
+      return SNAPSHOTERR_CORRUPTED;
+    } else if(object.kind == SNAPSHOT_STRING) {
+      len = object.length;
+    } else if(object.kind == SNAPSHOT_ARRAY && object.length > 0
+	      && object.length <= (imageLen - offset) / SNAPSHOT_VALUE_SIZE) {
+      len = (size_t)object.length * SNAPSHOT_VALUE_SIZE;
+    } else {
+      return SNAPSHOTERR_CORRUPTED;
+    }
+    if(len > imageLen - offset) {
+      return SNAPSHOTERR_CORRUPTED;
+    }
+
+    if(object.kind == SNAPSHOT_STRING) {
+      objects[i] = vmarg_new_string(image + offset, object.length);
+    } else {
+      objects[i] = libarray_array_new(object.length);
+    }
+    if(objects[i] == NULL) {
+      return SNAPSHOTERR_ALLOC_FAILED;
+    }
+    vmlibdata_inc_refcount(objects[i]);
+    contents[i] = offset;
+    offset += len;
+  }
+
+  return offset == imageLen ? SNAPSHOTERR_SUCCESS : SNAPSHOTERR_CORRUPTED;
+}
+
+/**
+ * Fills the arrays of a snapshot image with their values.
+ * vm: an instance of VM.
+ * image: the image.
+ * objects: the restored objects.
+ * contents: the offset of each object's contents.
+ * numObjects: the number of objects.
+ * returns: SNAPSHOTERR_SUCCESS, or the error.
+ */
+static SnapshotErr snapshot_link_objects(VM * vm, char * image,
+					 VMLibData ** objects, size_t * contents,
+					 int numObjects) {
+  char data[VM_VAR_SIZE];
+  VarType type;
+  int size;
+  int i;
+  int j;
+
+  for(i = 0; i < numObjects; i++) {
+    if(snapshot_kind(objects[i]) != SNAPSHOT_ARRAY) {
+      continue;
+    }
+
+    size = libarray_array_size(objects[i]);
+    for(j = 0; j < size; j++) {
+      if(!snapshot_read_value(objects, numObjects,
+			      image + contents[i] + j * SNAPSHOT_VALUE_SIZE,
+			      &type, data)) {
+	return SNAPSHOTERR_CORRUPTED;
+      }
+      if(type != TYPE_NULL
+	 && !libarray_array_set(vm, objects[i], j, data, VM_VAR_SIZE, type)) {
+	return SNAPSHOTERR_ALLOC_FAILED;
+      }
+    }
+  }
+
+  return SNAPSHOTERR_SUCCESS;
+}
+
+/**
+ * Releases the references that snapshot_read_objects() gave the objects.
+ * Objects that nothing else refers to are freed.
+ * vm: an instance of VM.
+ * objects: the restored objects, NULL where an object wasn't created.
+ * numObjects: the number of objects.
+ */
+static void snapshot_release(VM * vm, VMLibData ** objects, int numObjects) {
+  int i;
+
+  for(i = 0; i < numObjects && objects[i] != NULL; i++) {
+    vmlibdata_dec_refcount(objects[i]);
+    vmlibdata_check_cleanup(vm, objects[i]);
+  }
+}
+
+/**
+ * Restores the value of a snapshot image written by snapshot_write(), and
+ * every object reachable from it.
+ * vm: an instance of VM.
+ * image: the image.
+ * imageLen: the length of the image.
+ * value: receives the value. An object must be released with vmarg_release().
+ * err: receives the error upon failure.
+ * returns: true upon success, and false if the image is invalid
+ * (SNAPSHOTERR_CORRUPTED) or an allocation fails.
+ */
+bool snapshot_read(VM * vm, char * image, size_t imageLen, VMArg * value,
+		   SnapshotErr * err) {
+  SnapshotHeader header;
+  VMLibData ** objects;
+  size_t * contents;
+
+  assert(vm != NULL);
+  assert(image != NULL);
+  assert(value != NULL);
+
+  if(imageLen < sizeof(SnapshotHeader)) {
+    *err = SNAPSHOTERR_CORRUPTED;
+    return false;
+  }
+
+  /* an image can't hold more objects than it has room for */
+  memcpy(&header, image, sizeof(SnapshotHeader));
+  if(strncmp(header.header, SNAPSHOT_HEADER, SNAPSHOT_HEADER_SIZE) != 0
+     || header.version != SNAPSHOT_VERSION
+     || header.numObjects < 0
+     || header.numObjects > imageLen / sizeof(SnapshotObject)) {
+    *err = SNAPSHOTERR_CORRUPTED;
+    return false;
+  }
+
+  objects = calloc(header.numObjects + 1, sizeof(VMLibData*));
+  contents = calloc(header.numObjects + 1, sizeof(size_t));
+  if(objects == NULL || contents == NULL) {
+    free(objects);
+    free(contents);
+    *err = SNAPSHOTERR_ALLOC_FAILED;
+    return false;
+  }
+
+  *err = snapshot_read_objects(image, imageLen, objects, contents,
+			       header.numObjects);
+  if(*err == SNAPSHOTERR_SUCCESS) {
+    *err = snapshot_link_objects(vm, image, objects, contents,
+				 header.numObjects);
+  }
+  if(*err == SNAPSHOTERR_SUCCESS
+     && !snapshot_read_value(objects, header.numObjects, header.root,
+			     &value->type, value->data)) {
+    *err = SNAPSHOTERR_CORRUPTED;
+  }
+
+  /* the value keeps its own reference */
+  if(*err == SNAPSHOTERR_SUCCESS && value->type == TYPE_LIBDATA) {
+    vmlibdata_inc_refcount(vmarg_libdata(*value));
+  }
+
+  snapshot_release(vm, objects, header.numObjects);
+  free(objects);
+  free(contents);
+  return *err == SNAPSHOTERR_SUCCESS;
+}
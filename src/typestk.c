@@ -231,3 +231,26 @@ int typestk_size(TypeStk * stack) {
 
   return stack->size;
 }
+
+/**
+ * Makes sure that the given number of items can be pushed without the stack
+ * having to grow, so that they may be written straight to the top.
+ * stack: an instance of stack.
+ * count: the number of items.
+ * returns: true if the space is available, and false if allocation fails or
+ * the stack can't grow.
+ */
+bool typestk_reserve(TypeStk * stack, int count) {
+  assert(stack != NULL);
+  assert(count >= 0);
+
+  if(stack->depth - stack->size >= count) {
+    return true;
+  }
+
+  if(stack->blockSize == 0) {
+    return false;
+  }
+
+  return resize_stack(stack, stack->size + count + stack->blockSize);
+}
@@ -0,0 +1,654 @@
+/**
+ * verifier.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * The bytecode verifier. Walks every path through every function once, at
+ * build or import time or when a lazily loaded function is first called, and
+ * proves that the code can't go wrong in any of the ways that the op handlers
+ * otherwise check for on every instruction:
+ * every instruction and its operands are within the code, every jump lands on
+ * the start of an instruction, every call targets a function entry with the
+ * right number of arguments, every variable access is within the frame that
+ * it names, the operand stack never runs dry, and each instruction is always
+ * reached with the same operand stack depth and frame nesting. It also
+ * computes the deepest that each function takes the operand stack, so that
+ * the VM can reserve it up front. Code that passes is run by the VM without
+ * those checks.
+ *
+ * Types are not checked since they are only known at run time.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "verifier.h"
+#include "vmdefs.h"
+#include <string.h>
+#include <assert.h>
+
+/* what the verifier knows about each byte of code */
+#define VERIFIER_UNSEEN       0   /* not reached yet */
+#define VERIFIER_OPCODE       1   /* first byte of a reached instruction */
+#define VERIFIER_OPERAND      2   /* operand byte of a reached instruction */
+
+/* a frame that is live at some point in a function. the function's own frame
+ * has no parent, and each OP_FRM_PUSH creates a child of the frame that is
+ * live where it runs.
+ */
+typedef struct VerifierFrame {
+  int parent;                     /* index of the enclosing frame, or -1 */
+  int numVarArgs;                 /* number of variable slots */
+} VerifierFrame;
+
+/* state of a verification */
+typedef struct Verifier {
+  VM * vm;
+  char * byteCode;
+  size_t byteCodeLen;
+  VMFunc ** functions;            /* every function, sorted by index */
+  int numFunctions;
+  int start;                      /* first byte of the function's code */
+  int end;                        /* byte after the function's code */
+  char * kind;                    /* VERIFIER_* for each byte of function */
+  int * depth;                    /* stack depth before each instruction */
+  int * frame;                    /* live frame before each instruction */
+  int * pending;                  /* instructions reached but not checked */
+  int numPending;
+  VerifierFrame * frames;         /* every frame seen so far */
+  int numFrames;
+  int framesSize;
+} Verifier;
+
+/**
+ * Gets the length of the instruction at the given index, including its
+ * operands. This does not check that the operands are within the code.
+ * byteCode: the code.
+ * byteCodeLen: the length of byteCode.
+ * index: the index of the instruction's opcode.
+ * returns: the length in bytes, or -1 if the opcode is not valid.
+ */
+int verifier_op_len(char * byteCode, size_t byteCodeLen, int index) {
+
+  assert(byteCode != NULL);
+  assert(index >= 0 && index < byteCodeLen);
+
+  switch(byteCode[index]) {
+  case OP_FRM_POP:
+  case OP_RETURN:
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_LT:
+  case OP_GT:
+  case OP_LTE:
+  case OP_GTE:
+  case OP_EQUALS:
+  case OP_NOT_EQUALS:
+  case OP_AND:
+  case OP_OR:
+  case OP_NOT:
+  case OP_POP:
+  case OP_NULL_PUSH:
+  case OP_NUM_ADD:
+  case OP_NUM_SUB:
+  case OP_NUM_MUL:
+  case OP_NUM_DIV:
+  case OP_NUM_MOD:
+  case OP_NUM_LT:
+  case OP_NUM_GT:
+  case OP_NUM_LTE:
+  case OP_NUM_GTE:
+  case OP_NUM_EQUALS:
+  case OP_NUM_NOT_EQUALS:
+    return 1;
+  case OP_FRM_PUSH:
+  case OP_BOOL_PUSH:
+    return 2;
+  case OP_VAR_PUSH:
+  case OP_VAR_STOR:
+  case OP_NUM_STOR:
+    return 3;
+  case OP_GOTO:
+  case OP_TCOND_GOTO:
+  case OP_FCOND_GOTO:
+    return 1 + sizeof(int);
+  case OP_CALL_PTR_N:
+    return 2 + sizeof(int);
+  case OP_CALL_B:
+  case OP_CALL_LAZY:
+    return 3 + sizeof(int);
+  case OP_NUM_PUSH:
+    return 1 + sizeof(double);
+  case OP_FOR_STEP:
+    return 6 + sizeof(double) + sizeof(int);
+  case OP_FOR_STEP_NUM:
+    return 4 + (2 * sizeof(double)) + sizeof(int);
+  case OP_SWITCH_NUM:
+    return 3 + sizeof(double) + sizeof(int);
+  case OP_STR_PUSH:
+    if(index + 1 >= byteCodeLen || byteCode[index + 1] < 0) {
+      return -1;
+    }
+    return 2 + byteCode[index + 1];
+  default:
+    return -1;
+  }
+}
+
+/**
+ * Compares two functions by index, for qsort().
+ */
+static int verifier_func_compare(const void * a, const void * b) {
+  return (*(VMFunc**)a)->index - (*(VMFunc**)b)->index;
+}
+
+/**
+ * Finds the function that starts at the given index.
+ * v: the verifier.
+ * index: the index.
+ * returns: the function, or NULL if no function starts there.
+ */
+static VMFunc * verifier_function_at(Verifier * v, int index) {
+  int low = 0;
+  int high = v->numFunctions - 1;
+
+  while(low <= high) {
+    int mid = (low + high) / 2;
+
+    if(v->functions[mid]->index == index) {
+      return v->functions[mid];
+    } else if(v->functions[mid]->index < index) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Adds a frame that is live somewhere in the code.
+ * v: the verifier.
+ * parent: the enclosing frame, or -1 for a function's own frame.
+ * numVarArgs: the number of variable slots in the frame.
+ * returns: the index of the new frame, or -1 if allocation fails.
+ */
+static int verifier_add_frame(Verifier * v, int parent, int numVarArgs) {
+
+  if(v->numFrames >= v->framesSize) {
+    int newSize = v->framesSize * 2 + 16;
+    VerifierFrame * newFrames = realloc(v->frames,
+					newSize * sizeof(VerifierFrame));
+    if(newFrames == NULL) {
+      return -1;
+    }
+    v->frames = newFrames;
+    v->framesSize = newSize;
+  }
+
+  v->frames[v->numFrames].parent = parent;
+  v->frames[v->numFrames].numVarArgs = numVarArgs;
+  return v->numFrames++;
+}
+
+/**
+ * Records that an instruction can be reached with the given state. The first
+ * time an instruction is reached it is queued to be checked. After that, it
+ * must always be reached with the same state.
+ * v: the verifier.
+ * index: the instruction.
+ * depth: the operand stack depth, relative to the start of the function.
+ * frame: the live frame.
+ * returns: true if the state is consistent.
+ */
+static bool verifier_reach(Verifier * v, int index, int depth, int frame) {
+
+  /* jumps and fall through must land on the start of an instruction in the
+   * same function.
+   */
+  if(index < v->start || index >= v->end
+     || v->kind[index - v->start] == VERIFIER_OPERAND) {
+    return false;
+  }
+
+  index -= v->start;
+  if(v->kind[index] == VERIFIER_OPCODE) {
+    return v->depth[index] == depth && v->frame[index] == frame;
+  }
+
+  v->kind[index] = VERIFIER_OPCODE;
+  v->depth[index] = depth;
+  v->frame[index] = frame;
+  v->pending[v->numPending++] = index;
+  return true;
+}
+
+/**
+ * Checks that a variable operand names a slot in a live frame.
+ * v: the verifier.
+ * frame: the live frame.
+ * stackDepth: the number of frames to go up.
+ * varArgsIndex: the slot.
+ * returns: true if the slot exists.
+ */
+static bool verifier_check_var(Verifier * v, int frame, int stackDepth,
+			       int varArgsIndex) {
+  int i;
+
+  if(stackDepth < 0 || varArgsIndex < 0) {
+    return false;
+  }
+
+  /* variables can't be read from the caller's frames */
+  for(i = 0; i < stackDepth; i++) {
+    frame = v->frames[frame].parent;
+    if(frame == -1) {
+      return false;
+    }
+  }
+
+  return varArgsIndex < v->frames[frame].numVarArgs;
+}
+
+/**
+ * Checks one instruction and reaches its successors.
+ * v: the verifier.
+ * function: the function being verified.
+ * index: the instruction.
+ * returns: true if the instruction is valid.
+ */
+static bool verifier_check_op(Verifier * v, VMFunc * function, int index) {
+  char * byteCode = v->byteCode;
+  int depth = v->depth[index - v->start];
+  int frame = v->frame[index - v->start];
+  int len = verifier_op_len(byteCode, v->byteCodeLen, index);
+  int next = index + len;
+  int i;
+
+  /* the whole instruction must be within the function and must not overlap
+   * another instruction.
+   */
+  if(len < 1 || next > v->end) {
+    return false;
+  }
+  for(i = index + 1; i < next; i++) {
+    if(v->kind[i - v->start] == VERIFIER_OPCODE) {
+      return false;
+    }
+    v->kind[i - v->start] = VERIFIER_OPERAND;
+  }
+
+  switch(byteCode[index]) {
+  case OP_VAR_PUSH:
+    depth++;
+    if(!verifier_check_var(v, frame, byteCode[index + 1],
+			   byteCode[index + 2])) {
+      return false;
+    }
+    break;
+  case OP_VAR_STOR:
+  case OP_NUM_STOR:
+    if(depth < 1
+       || !verifier_check_var(v, frame, byteCode[index + 1],
+			      byteCode[index + 2])) {
+      return false;
+    }
+    break;
+  case OP_FRM_PUSH:
+    if(byteCode[index + 1] < 0) {
+      return false;
+    }
+    frame = verifier_add_frame(v, frame, byteCode[index + 1]);
+    if(frame == -1) {
+      vm_set_err(v->vm, VMERR_ALLOC_FAILED);
+      return false;
+    }
+    break;
+  case OP_FRM_POP:
+
+    /* popping the function's own frame returns from it with exactly the
+     * return value on the stack.
+     */
+    if(v->frames[frame].parent == -1) {
+      return depth == 1;
+    }
+    frame = v->frames[frame].parent;
+    break;
+  case OP_RETURN:
+    return depth == 1;
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_LT:
+  case OP_GT:
+  case OP_LTE:
+  case OP_GTE:
+  case OP_EQUALS:
+  case OP_NOT_EQUALS:
+  case OP_AND:
+  case OP_OR:
+  case OP_NUM_ADD:
+  case OP_NUM_SUB:
+  case OP_NUM_MUL:
+  case OP_NUM_DIV:
+  case OP_NUM_MOD:
+  case OP_NUM_LT:
+  case OP_NUM_GT:
+  case OP_NUM_LTE:
+  case OP_NUM_GTE:
+  case OP_NUM_EQUALS:
+  case OP_NUM_NOT_EQUALS:
+    if(depth < 2) {
+      return false;
+    }
+    depth--;
+    break;
+  case OP_NOT:
+    if(depth < 1) {
+      return false;
+    }
+    break;
+  case OP_POP:
+    if(depth < 1) {
+      return false;
+    }
+    depth--;
+    break;
+  case OP_BOOL_PUSH:
+    if(byteCode[index + 1] != true && byteCode[index + 1] != false) {
+      return false;
+    }
+    depth++;
+    break;
+  case OP_NUM_PUSH:
+  case OP_STR_PUSH:
+  case OP_NULL_PUSH:
+    depth++;
+    break;
+  case OP_GOTO: {
+    int addr;
+    memcpy(&addr, byteCode + index + 1, sizeof(int));
+    return verifier_reach(v, addr, depth, frame);
+  }
+  case OP_TCOND_GOTO:
+  case OP_FCOND_GOTO: {
+    int addr;
+    memcpy(&addr, byteCode + index + 1, sizeof(int));
+    if(depth < 1 || !verifier_reach(v, addr, depth - 1, frame)) {
+      return false;
+    }
+    depth--;
+    break;
+  }
+  case OP_FOR_STEP:
+  case OP_FOR_STEP_NUM: {
+    char * limit = byteCode + index + 4 + sizeof(double);
+    int addr;
+
+    memcpy(&addr, byteCode + next - sizeof(int), sizeof(int));
+    if(!verifier_check_var(v, frame, byteCode[index + 1], byteCode[index + 2])
+       || (byteCode[index] == OP_FOR_STEP
+	   && !verifier_check_var(v, frame, limit[0], limit[1]))
+       || (byteCode[index + 3] != OP_LT && byteCode[index + 3] != OP_GT
+	   && byteCode[index + 3] != OP_LTE && byteCode[index + 3] != OP_GTE)
+       || !verifier_reach(v, addr, depth, frame)) {
+      return false;
+    }
+    break;
+  }
+  case OP_SWITCH_NUM: {
+    int count;
+
+    /* the table is count + 1 OP_GOTOs after the instruction */
+    memcpy(&count, byteCode + index + 3 + sizeof(double), sizeof(int));
+    if(count < 0 || count > v->end - next
+       || !verifier_check_var(v, frame, byteCode[index + 1],
+			      byteCode[index + 2])) {
+      return false;
+    }
+    for(i = 0; i <= count; i++) {
+      int entry = next + (i * (1 + sizeof(int)));
+
+      if(entry >= v->end || byteCode[entry] != OP_GOTO
+	 || !verifier_reach(v, entry, depth, frame)) {
+	return false;
+      }
+    }
+    return true;
+  }
+  case OP_CALL_PTR_N: {
+    int numArgs = byteCode[index + 1];
+    int callbackIndex;
+
+    memcpy(&callbackIndex, byteCode + index + 2, sizeof(int));
+    if(numArgs < 0 || numArgs > VM_MAX_NARGS || numArgs > depth
+       || callbackIndex < 0 || callbackIndex >= vm_num_callbacks(v->vm)) {
+      return false;
+    }
+
+    /* the arguments are replaced by the return value */
+    depth = depth - numArgs + 1;
+    break;
+  }
+  case OP_CALL_B:
+  case OP_CALL_LAZY: {
+    int numVarArgs = byteCode[index + 1];
+    int numArgs = byteCode[index + 2];
+    int addr;
+    VMFunc * callee;
+
+    memcpy(&addr, byteCode + index + 3, sizeof(int));
+    callee = verifier_function_at(v, addr);
+    if(callee == NULL
+       || numArgs != callee->numArgs
+       || numVarArgs != callee->numArgs + callee->numVars
+       || numArgs > depth) {
+      return false;
+    }
+
+    /* calls to functions that are not loaded yet load them first */
+    if(!callee->loaded) {
+      byteCode[index] = OP_CALL_LAZY;
+    }
+
+    /* the arguments are replaced by the return value */
+    depth = depth - numArgs + 1;
+    break;
+  }
+  default:
+    return false;
+  }
+
+  if(depth > function->maxStack) {
+    function->maxStack = depth;
+  }
+
+  return verifier_reach(v, next, depth, frame);
+}
+
+/**
+ * Verifies every path through a function. The function's code must not
+ * reach outside of [function->index, function->index + function->codeLen).
+ * v: the verifier, with the code and functions set.
+ * function: the function.
+ * returns: true if the function is valid.
+ */
+static bool verifier_check_function(Verifier * v, VMFunc * function) {
+  size_t len = function->codeLen;
+  bool success = true;
+  int frame;
+
+  v->start = function->index;
+  v->end = function->index + function->codeLen;
+  v->numPending = 0;
+  v->numFrames = 0;
+
+  if(function->index < 0 || function->codeLen < 1
+     || v->end > v->byteCodeLen) {
+    vm_set_err(v->vm, VMERR_VERIFY_FAILED);
+    return false;
+  }
+
+  v->kind = calloc(len, sizeof(char));
+  v->depth = calloc(len, sizeof(int));
+  v->frame = calloc(len, sizeof(int));
+  v->pending = calloc(len, sizeof(int));
+  frame = verifier_add_frame(v, -1, function->numArgs + function->numVars);
+  if(v->kind == NULL || v->depth == NULL || v->frame == NULL
+     || v->pending == NULL || frame == -1) {
+    vm_set_err(v->vm, VMERR_ALLOC_FAILED);
+    success = false;
+  }
+
+  /* check each instruction as it is reached */
+  function->maxStack = 0;
+  if(success && !verifier_reach(v, function->index, 0, frame)) {
+    success = false;
+  }
+  while(success && v->numPending > 0) {
+    success = verifier_check_op(v, function,
+				v->start + v->pending[--v->numPending]);
+  }
+
+  if(!success && vm_get_err(v->vm) == VMERR_SUCCESS) {
+    vm_set_err(v->vm, VMERR_VERIFY_FAILED);
+  }
+
+  free(v->kind);
+  free(v->depth);
+  free(v->frame);
+  free(v->pending);
+  v->kind = NULL;
+  v->depth = NULL;
+  v->frame = NULL;
+  v->pending = NULL;
+
+  return success;
+}
+
+/**
+ * Verifies one function in the VM's code, such as a function that is being
+ * loaded on demand. Calls to functions that are not loaded yet are rewritten
+ * to OP_CALL_LAZY, so that the callee is loaded when the call first runs.
+ * vm: an instance of VM.
+ * function: the function. Its codeLen must be set.
+ * functions: every function that the code may call, sorted by index.
+ * numFunctions: the number of functions.
+ * returns: true if the function is valid. If false, the VM's error is set to
+ * VMERR_VERIFY_FAILED, or to VMERR_ALLOC_FAILED.
+ */
+bool verifier_verify_function(VM * vm, VMFunc * function,
+			      VMFunc ** functions, int numFunctions) {
+  Verifier v;
+  bool success;
+
+  assert(vm != NULL);
+  assert(function != NULL);
+  assert(functions != NULL);
+
+  memset(&v, 0, sizeof(Verifier));
+  v.vm = vm;
+  v.byteCode = vm_code(vm);
+  v.byteCodeLen = vm_bytecode_size(vm);
+  v.functions = functions;
+  v.numFunctions = numFunctions;
+
+  vm_set_err(vm, VMERR_SUCCESS);
+  success = verifier_check_function(&v, function);
+  free(v.frames);
+
+  return success;
+}
+
+/**
+ * Verifies all of the VM's code, starting from every function in it. Each
+ * function's code runs up to the start of the next one. On success, the VM
+ * runs calls into this code without checking each instruction, until the
+ * code changes. Code must be verified again after each build.
+ * vm: an instance of VM.
+ * returns: true if the code is valid. If false, the VM's error is set to
+ * VMERR_VERIFY_FAILED, or to VMERR_ALLOC_FAILED.
+ */
+bool verifier_verify(VM * vm) {
+  Verifier v;
+  HTIter iter;
+  bool success = true;
+  int i;
+
+  assert(vm != NULL);
+
+  memset(&v, 0, sizeof(Verifier));
+  v.vm = vm;
+  v.byteCode = vm_code(vm);
+  v.byteCodeLen = vm_bytecode_size(vm);
+  v.numFunctions = ht_size(vm_functions(vm));
+
+  vm->verifiedCode = NULL;
+  vm->verifiedCodeLen = 0;
+  vm_set_err(vm, VMERR_SUCCESS);
+
+  if(v.byteCodeLen == 0 || v.numFunctions == 0) {
+    vm_set_err(vm, VMERR_VERIFY_FAILED);
+    return false;
+  }
+
+  v.functions = calloc(v.numFunctions, sizeof(VMFunc*));
+  if(v.functions == NULL) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  /* sort the functions so that call targets can be looked up */
+  ht_iter_get(vm_functions(vm), &iter);
+  for(i = 0; ht_iter_has_next(&iter); i++) {
+    DSValue value;
+    ht_iter_next(&iter, NULL, 0, &value, NULL, false);
+    v.functions[i] = value.pointerVal;
+  }
+  qsort(v.functions, v.numFunctions, sizeof(VMFunc*),
+	verifier_func_compare);
+
+  /* check each function and find the deepest stack of any of them */
+  vm->maxStack = 0;
+  for(i = 0; success && i < v.numFunctions; i++) {
+    VMFunc * function = v.functions[i];
+
+    function->codeLen = (i + 1 < v.numFunctions
+			 ? v.functions[i + 1]->index : (int)v.byteCodeLen)
+      - function->index;
+    if(!verifier_check_function(&v, function)) {
+      success = false;
+    } else if(function->maxStack > vm->maxStack) {
+      vm->maxStack = function->maxStack;
+    }
+  }
+
+  if(success) {
+    vm->verifiedCode = v.byteCode;
+    vm->verifiedCodeLen = v.byteCodeLen;
+  }
+
+  free(v.functions);
+  free(v.frames);
+
+  return success;
+}
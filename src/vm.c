@@ -37,15 +37,26 @@
  */
 
 #include "vm.h"
+#include "vmregistry.h"
 #include "vmdefs.h"
 #include "gsbool.h"
 #include "libstr.h"
 #include "ophandlers.h"
+#include "verifier.h"
+#include "profile.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <limits.h>
+#include <time.h>
+#if !defined(_WIN32)
+#include <sys/time.h>
+#include <sys/mman.h>
+#endif /* !defined(_WIN32) */
 
 /* the initial size of the op stack */
 static const int opStkInitSize = 60;
@@ -53,12 +64,31 @@ static const int opStkInitSize = 60;
 static const int opStkBlockSize = 60;
 /* number of bytes in each additional block of the buffer */
 static const int bufferBlockSize = 1000;
+/* number of instructions between clock reads when a time budget is set */
+#define VM_BUDGET_CLOCK_INTERVAL  1024
+
+/* the records of a vm_call_batch() that the interpreter runs back to back */
+typedef struct VMBatch {
+  VMFunc * function;              /* the function called for each record */
+  VMArg * args;                   /* the argument tuples of every record */
+  int numRecords;                 /* the number of records */
+  VMArg * results;                /* receives return values, or NULL */
+  VMErr * errors;                 /* receives errors, or NULL */
+  int record;                     /* the record being run */
+  bool enterFailed;               /* the next record couldn't be entered */
+} VMBatch;
+
+/* private function declarations */
+static bool vm_enter(VM * vm, VMFunc * function, VMArg * args);
 
 /**
  * Initializes a VM with a preallocated maximum frame stack that is stackSize
- * bytes in size and can have up to callbacksSize callbacks registered to it.
+ * bytes in size and can have up to callbacksSize callbacks of its own
+ * registered to it. Callbacks shared with other VMs should be put in a
+ * VMRegistry and attached with vm_set_registry() instead.
  * stackSize: size of the frame stack in bytes.
- * callbacksSize: the maximum number of callbacks that may be registered.
+ * callbacksSize: the maximum number of callbacks that may be registered with
+ * vm_reg_callback(). The space is only allocated on the first registration.
  * returns: a new VM instance, or NULL if allocation fails.
  */
 VM * vm_new(size_t stackSize, int callbacksSize) {
@@ -86,24 +116,12 @@ VM * vm_new(size_t stackSize, int callbacksSize) {
 
   vm->callbacksSize = callbacksSize;
 
-  vm->callbacks = calloc(vm->callbacksSize, sizeof(VMCallback));
-  if(vm->callbacks == NULL) {
-    vm_free(vm);
-    return NULL;
-  }
-
   vm->buffer = buffer_new(bufferBlockSize, bufferBlockSize);
   if(vm->buffer == NULL) {
     vm_free(vm);
     return false;
   }
 
-  vm->callbacksHT = ht_new(vm->callbacksSize, 10, 1.0);
-  if(vm->callbacksHT == NULL) {
-    vm_free(vm);
-    return NULL;
-  }
-
   vm->functionHT = ht_new(COMPILER_INITIAL_HTSIZE, 
 			  COMPILER_HTBLOCKSIZE, COMPILER_HTLOADFACTOR);
 
@@ -116,7 +134,33 @@ VM * vm_new(size_t stackSize, int callbacksSize) {
 }
 
 /**
- * Registers a callback function to this VM instance.
+ * Attaches a shared registry of native functions to the VM. The registry is
+ * not copied or freed by the VM, and must outlive it. Its natives take the
+ * callback indices before any registered with vm_reg_callback(), so it must be
+ * set before any callbacks are registered or code is compiled.
+ * vm: an instance of VM.
+ * registry: a frozen VMRegistry, or NULL to detach it.
+ */
+void vm_set_registry(VM * vm, VMRegistry * registry) {
+  assert(vm != NULL);
+  assert(vm->numCallbacks == 0);
+  assert(registry == NULL || registry->frozen);
+
+  vm->registry = registry;
+}
+
+/**
+ * Gets the number of callbacks that come from the shared registry.
+ * vm: an instance of VM.
+ * returns: the number of shared callbacks.
+ */
+static int vm_registry_size(VM * vm) {
+  return vm->registry == NULL ? 0 : vmregistry_size(vm->registry);
+}
+
+/**
+ * Registers a callback function to this VM instance only. Callbacks that
+ * every VM needs should go in a shared VMRegistry instead.
  * vm: an instance of a VM.
  * name: the text representation of the VM.
  * nameLen: the length of the name, in characters.
@@ -141,7 +185,34 @@ bool vm_reg_callback(VM * vm, char * name, size_t nameLen, VMCallback callback)
     return false;
   }
 
-  newValue.intVal = vm->numCallbacks;
+  /* can't hide a shared callback */
+  if(vm->registry != NULL
+     && vmregistry_index(vm->registry, name, nameLen) != -1) {
+    vm_set_err(vm, VMERR_CALLBACK_EXISTS);
+    return false;
+  }
+
+  /* allocate the instance's callbacks on first use */
+  if(vm->callbacks == NULL) {
+    vm->callbacks = calloc(vm->callbacksSize, sizeof(VMCallback));
+    if(vm->callbacks == NULL) {
+      vm_set_err(vm, VMERR_ALLOC_FAILED);
+      return false;
+    }
+
+    /* without its table, the next call would find callbacks allocated and
+     * never create one
+     */
+    vm->callbacksHT = ht_new(vm->callbacksSize, 10, 1.0);
+    if(vm->callbacksHT == NULL) {
+      free(vm->callbacks);
+      vm->callbacks = NULL;
+      vm_set_err(vm, VMERR_ALLOC_FAILED);
+      return false;
+    }
+  }
+
+  newValue.intVal = vm_registry_size(vm) + vm->numCallbacks;
   vm->callbacks[vm->numCallbacks] = callback;
 
   if(!ht_put_raw_key(vm->callbacksHT, name, nameLen, 
@@ -174,16 +245,38 @@ bool vm_reg_callback(VM * vm, char * name, size_t nameLen, VMCallback callback)
  * not exist.
  */
 VMCallback vm_callback_from_index(VM * vm, int index) {
+  int registrySize;
+
   assert(vm != NULL);
   assert(index >= 0);
 
+  registrySize = vm_registry_size(vm);
+  if(index < registrySize) {
+    return vmregistry_callback(vm->registry, index);
+  }
+
   /* handle index is out of range error case */
-  if(index >= vm->numCallbacks) {
+  if(index - registrySize >= vm->numCallbacks) {
     vm_set_err(vm, VMERR_CALLBACK_NOT_EXIST);
     return NULL;
   }
 
-  return vm->callbacks[index];
+  return vm->callbacks[index - registrySize];
+}
+
+/**
+ * Gets whether a callback function is pure, meaning that it has no side
+ * effects and returns a number or boolean that depends only on its arguments.
+ * Only registry natives can be pure; instance callbacks never are.
+ * vm: an instance of VM.
+ * index: the index of the function.
+ * returns: true if the function is pure.
+ */
+bool vm_callback_pure(VM * vm, int index) {
+  assert(vm != NULL);
+
+  return index >= 0 && index < vm_registry_size(vm)
+    && vmregistry_pure(vm->registry, index);
 }
 
 /**
@@ -203,7 +296,16 @@ int vm_callback_index(VM * vm, char * name, size_t nameLen) {
 
   vm_set_err(vm, VMERR_SUCCESS);
 
-  if(!ht_get_raw_key(vm->callbacksHT, name, nameLen, &value)) {
+  /* shared callbacks first */
+  if(vm->registry != NULL) {
+    int index = vmregistry_index(vm->registry, name, nameLen);
+    if(index != -1) {
+      return index;
+    }
+  }
+
+  if(vm->callbacksHT == NULL
+     || !ht_get_raw_key(vm->callbacksHT, name, nameLen, &value)) {
     vm_set_err(vm, VMERR_CALLBACK_NOT_EXIST);
     return -1;
   }
@@ -212,46 +314,573 @@ int vm_callback_index(VM * vm, char * name, size_t nameLen) {
 }
 
 /**
- * Gets the number of callbacks registered with the VM.
+ * Gets the number of callbacks available to the VM, both shared and its own.
  * vm: an instance of VM.
- * returns: the number of callbacks registered.
+ * returns: the number of callbacks.
  */
 int vm_num_callbacks(VM * vm) {
   assert(vm != NULL);
 
   vm_set_err(vm, VMERR_SUCCESS);
 
-  return vm->numCallbacks;
+  return vm_registry_size(vm) + vm->numCallbacks;
 }
 
 /**
- * Executes a VM bytecode. For more info on the bytecode format, see
- * ophandlers.c where the opcodes are described and implemented.
+ * Gets the current time for measuring execution time slices.
+ * returns: a timestamp in seconds.
+ */
+static double vm_clock() {
+#if defined(_WIN32)
+  return (double)clock() / CLOCKS_PER_SEC;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + (tv.tv_usec / 1000000.0);
+#endif /* defined(_WIN32) */
+}
+
+/**
+ * Sets the execution budget of each call to vm_exec() or vm_resume(). When
+ * either limit is reached, execution stops at the next backwards jump,
+ * conditional jump or script function call with VMERR_BUDGET_EXHAUSTED and the
+ * VM is left suspended so that it can be continued with vm_resume().
  * vm: an instance of VM.
- * byteCode: an array of chars that contain VM byte code.
- * byteCodeLen: the number of bytes to read from byteCode array.
- * startIndex: the index to start executing from. The entry point.
- * numArgs: the number of items to pop off of stack to use as arguments.
+ * maxInstructions: the number of instructions per slice, or 0 for no limit.
+ * maxMicros: the number of microseconds per slice, or 0 for no limit.
  */
-bool vm_exec(VM * vm, char * byteCode, 
-	     size_t byteCodeLen, int startIndex, int numVarArgs) {
+void vm_set_budget(VM * vm, long maxInstructions, long maxMicros) {
+  assert(vm != NULL);
+  assert(maxInstructions >= 0);
+  assert(maxMicros >= 0);
+
+  vm->budgetInstructions = maxInstructions;
+  vm->budgetMicros = maxMicros;
+}
 
+/**
+ * Sets a recorder that counts what the VM runs, for profile guided
+ * optimization. While it is set, every instruction runs through the checked
+ * handlers and functions compiled ahead of time are interpreted instead, so
+ * that all of them are counted.
+ * vm: an instance of VM.
+ * recorder: the recorder, which must outlive its use, or NULL to stop.
+ */
+void vm_set_profile(VM * vm, ProfileRecorder * recorder) {
   assert(vm != NULL);
-  assert(startIndex >= 0);
-  assert(startIndex < byteCodeLen);
-  assert(numVarArgs >= 0);
 
-  vm->index = startIndex;
+  vm->profile = recorder;
+}
 
-  /* push new frame with selected number of arguments and vars. */
-  if(!frmstk_push(vm->frmStk, -1, numVarArgs)) {
-     vm_set_err(vm, VMERR_STACK_OVERFLOW);
-     return false;
+/**
+ * Calculates the instruction count at which the budget should next be looked
+ * at. Reading the clock is comparatively slow, so a time budget is only
+ * checked every VM_BUDGET_CLOCK_INTERVAL instructions.
+ * vm: an instance of VM.
+ * executed: the number of instructions executed so far in this slice.
+ * returns: the instruction count of the next budget check.
+ */
+static long vm_budget_next_check(VM * vm, long executed) {
+  long next = LONG_MAX;
+
+  if(vm->budgetMicros > 0) {
+    next = executed + VM_BUDGET_CLOCK_INTERVAL;
+  }
+
+  if(vm->budgetInstructions > 0 && vm->budgetInstructions < next) {
+    next = vm->budgetInstructions;
+  }
+
+  return next;
+}
+
+/**
+ * Called at preemption points once the instruction count reaches the next
+ * check. Decides whether the current slice is over.
+ * vm: an instance of VM.
+ * executed: the number of instructions executed in this slice.
+ * checkAt: pointer to the instruction count of the next check. Receives the
+ * count for the following check if the slice continues.
+ * returns: true if the budget is spent and execution should be suspended.
+ */
+static bool vm_budget_spent(VM * vm, long executed, long * checkAt) {
+
+  /* out of instructions */
+  if(vm->budgetInstructions > 0 && executed >= vm->budgetInstructions) {
+    return true;
+  }
+
+  /* out of time */
+  if(vm->budgetMicros > 0
+     && (vm_clock() - vm->sliceStart) * 1000000.0 >= vm->budgetMicros) {
+    return true;
+  }
+
+  *checkAt = vm_budget_next_check(vm, executed);
+  return false;
+}
+
+/**
+ * Stops execution at the current instruction, leaving the frame and operand
+ * stacks intact so that vm_resume() can continue from vm->index.
+ * vm: an instance of VM.
+ * byteCode: the bytecode being executed.
+ * byteCodeLen: the length of byteCode.
+ * unchecked: true if byteCode is being run as verified code.
+ * returns: false, with the VM error set to VMERR_BUDGET_EXHAUSTED.
+ */
+static bool vm_suspend(VM * vm, char * byteCode, size_t byteCodeLen,
+		       bool unchecked) {
+  vm->suspended = true;
+  vm->resumeUnchecked = unchecked;
+  vm->resumeCode = byteCode;
+  vm->resumeCodeLen = byteCodeLen;
+  vm_set_err(vm, VMERR_BUDGET_EXHAUSTED);
+  return false;
+}
+
+/**
+ * Pops frames and operands left over from an execution that did not run
+ * to completion, releasing any objects that they referenced, until only the
+ * given number of each remain.
+ * vm: an instance of VM.
+ * numFrames: the number of frames to keep.
+ * numOperands: the number of operands to keep.
+ */
+static void vm_unwind_to(VM * vm, int numFrames, int numOperands) {
+  VMLibData * data;
+  VarType type;
+  int i;
+
+  /* release variables in every frame */
+  while(frmstk_size(vm->frmStk) > numFrames) {
+    for(i = 0; frmstk_var_read(vm->frmStk, 0, i, &data,
+			       sizeof(VMLibData*), &type); i++) {
+      if(type == TYPE_LIBDATA) {
+	vmlibdata_dec_refcount(data);
+	vmlibdata_check_cleanup(vm, data);
+      }
+    }
+    frmstk_pop(vm->frmStk);
   }
 
-  while(vm->index < byteCodeLen) {
+  /* release operands */
+  while(typestk_size(vm->opStk) > numOperands
+	&& typestk_pop(vm->opStk, &data, sizeof(VMLibData*), &type)) {
+    if(type == TYPE_LIBDATA) {
+      vmlibdata_dec_refcount(data);
+      vmlibdata_check_cleanup(vm, data);
+    }
+  }
+
+  vm->suspended = false;
+}
+
+/**
+ * Pops all frames and operands left over from an execution that did not run
+ * to completion, releasing any objects that they referenced.
+ * vm: an instance of VM.
+ */
+static void vm_unwind(VM * vm) {
+  vm_unwind_to(vm, 0, 0);
+}
+
+/**
+ * Compares two functions by index, for qsort() and bsearch().
+ */
+static int vm_func_compare(const void * a, const void * b) {
+  return (*(VMFunc**)a)->index - (*(VMFunc**)b)->index;
+}
+
+/**
+ * Handles OP_CALL_LAZY at vm->index: loads the called function and turns the
+ * instruction into the OP_CALL_B that it stands for. The verifier already
+ * checked that the target is a function.
+ * vm: an instance of vm.
+ * byteCode: the code, which must be the VM's lazy image.
+ * byteCodeLen: the length of byteCode.
+ * returns: true if success, false if the function could not be loaded.
+ */
+static bool vm_link_call(VM * vm, char * byteCode, size_t byteCodeLen) {
+  VMFunc key;
+  VMFunc * keyPtr = &key;
+  VMFunc ** callee = NULL;
+
+  if(vm->lazyFunctions != NULL && byteCode == vm->lazyImage
+     && vm->index + 3 + sizeof(int) <= byteCodeLen) {
+    memcpy(&key.index, byteCode + vm->index + 3, sizeof(int));
+    callee = bsearch(&keyPtr, vm->lazyFunctions, vm->numLazyFunctions,
+		     sizeof(VMFunc*), vm_func_compare);
+  }
+
+  if(callee == NULL) {
+    vm_set_err(vm, VMERR_INVALID_OPCODE);
+    return false;
+  }
+
+  if(!vm_load_function(vm, *callee)) {
+    return false;
+  }
+
+  byteCode[vm->index] = OP_CALL_B;
+  return true;
+}
+
+/**
+ * Moves a batch on to its next record when the current one returns, without
+ * leaving the interpreter loop. The record's return value is taken and the
+ * next record's frame is pushed, and the next record gets a fresh budget.
+ * vm: an instance of VM.
+ * batch: the batch being run.
+ * byteCodeLen: the length of the code being run.
+ * executed: the interpreter's count of executed instructions.
+ * checkAt: the interpreter's instruction count of the next budget check.
+ * returns: true if the next record was entered. false if the current record
+ * is the last, if its return value can't be taken, or if the next record
+ * can't be entered, in which case batch->enterFailed is set. The interpreter
+ * then returns, and vm_call_batch() finishes batch->record.
+ */
+static bool vm_batch_next(VM * vm, VMBatch * batch, size_t byteCodeLen,
+			  long * executed, long * checkAt) {
+  VMFunc * function = batch->function;
+
+  if(batch->record + 1 >= batch->numRecords
+     || !vm_take_result(vm, batch->results != NULL
+			? &batch->results[batch->record] : NULL)) {
+    return false;
+  }
+  if(batch->errors != NULL) {
+    batch->errors[batch->record] = VMERR_SUCCESS;
+  }
+
+  batch->record++;
+  if(!vm_enter(vm, function,
+	       batch->args + (batch->record * function->numArgs))) {
+    batch->enterFailed = true;
+    return false;
+  }
+  if(vm->profile != NULL) {
+    profile_enter(vm->profile, byteCodeLen, function->index);
+  }
+
+  /* the budget applies to each record separately */
+  *executed = 0;
+  *checkAt = vm_budget_next_check(vm, 0);
+  if(vm->budgetMicros > 0) {
+    vm->sliceStart = vm_clock();
+  }
+  return true;
+}
+
+/**
+ * The interpreter loop. Executes from vm->index until the end of the
+ * bytecode, an error, or the execution budget is spent. If vm->batch is set,
+ * its records are run one after another, each starting where the previous
+ * one returned to the host.
+ * vm: an instance of VM.
+ * byteCode: an array of chars that contain VM byte code.
+ * byteCodeLen: the number of bytes to read from byteCode array.
+ * unchecked: true if byteCode passed verifier_verify() and execution starts
+ * at a function entry. The most frequent instructions are then run inline
+ * without the operand, stack and address checks that the handlers repeat.
+ * returns: true if execution completed, false if an error occurred or the
+ * budget ran out. In the latter case the error is VMERR_BUDGET_EXHAUSTED.
+ */
+static bool vm_run(VM * vm, char * byteCode, size_t byteCodeLen,
+		   bool unchecked) {
+  long executed = 0;
+  long checkAt = vm_budget_next_check(vm, 0);
+  VMBatch * batch = vm->batch;
+
+  /* a native function called from the script may run the VM again */
+  vm->batch = NULL;
+  vm->suspended = false;
+  if(vm->budgetMicros > 0) {
+    vm->sliceStart = vm_clock();
+  }
+
+  /* the inline instructions aren't counted */
+  if(vm->profile != NULL) {
+    unchecked = false;
+  }
+
+  /* inline pushes write straight to the top of the stack */
+  if(unchecked && !typestk_reserve(vm->opStk, vm->maxStack)) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  while(vm->index < byteCodeLen
+	|| (batch != NULL
+	    && vm_batch_next(vm, batch, byteCodeLen, &executed, &checkAt))) {
 
     vm_set_err(vm, VMERR_SUCCESS);
+    executed++;
+
+    /* verified code. the verifier has proven that the operands are within
+     * the code, that jumps land on instructions and that the stack is deep
+     * enough, so only the types are checked here. anything else, including
+     * objects that need reference counting, goes to the handlers below.
+     */
+    if(unchecked) {
+      TypeStkData * top = vm->opStk->stack + vm->opStk->size;
+      char * operands = byteCode + vm->index + 1;
+      double value1;
+      double value2;
+      bool result;
+
+      switch(byteCode[vm->index]) {
+      case OP_VAR_PUSH: {
+	char * var = frmstk_var_addr(vm->frmStk, operands[0], operands[1]);
+	if(*var != TYPE_LIBDATA) {
+	  top->type = *var;
+	  memcpy(top->data, var + 1, VM_VAR_SIZE);
+	  vm->opStk->size++;
+	  vm->index += 3;
+	  continue;
+	}
+	break;
+      }
+      case OP_NUM_PUSH:
+	top->type = TYPE_NUMBER;
+	memcpy(top->data, operands, sizeof(double));
+	vm->opStk->size++;
+	vm->index += 1 + sizeof(double);
+	continue;
+      case OP_BOOL_PUSH:
+	result = operands[0];
+	top->type = TYPE_BOOLEAN;
+	memcpy(top->data, &result, sizeof(bool));
+	vm->opStk->size++;
+	vm->index += 2;
+	continue;
+      case OP_NULL_PUSH:
+	top->type = TYPE_NULL;
+	memset(top->data, 0, VM_VAR_SIZE);
+	vm->opStk->size++;
+	vm->index++;
+	continue;
+      case OP_POP:
+	if(top[-1].type != TYPE_LIBDATA) {
+	  vm->opStk->size--;
+	  vm->index++;
+	  continue;
+	}
+	break;
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_LT:
+      case OP_GT:
+      case OP_LTE:
+      case OP_GTE:
+	if(top[-1].type != TYPE_NUMBER || top[-2].type != TYPE_NUMBER) {
+	  break;
+	}
+	memcpy(&value1, top[-2].data, sizeof(double));
+	memcpy(&value2, top[-1].data, sizeof(double));
+
+	/* arithmetic leaves a number in place of the first operand */
+	if(byteCode[vm->index] <= OP_MUL) {
+	  value1 = byteCode[vm->index] == OP_ADD ? value1 + value2
+	    : byteCode[vm->index] == OP_SUB ? value1 - value2
+	    : value1 * value2;
+	  memcpy(top[-2].data, &value1, sizeof(double));
+	} else {
+	  result = byteCode[vm->index] == OP_LT ? value1 < value2
+	    : byteCode[vm->index] == OP_GT ? value1 > value2
+	    : byteCode[vm->index] == OP_LTE ? value1 <= value2
+	    : value1 >= value2;
+	  top[-2].type = TYPE_BOOLEAN;
+	  memcpy(top[-2].data, &result, sizeof(bool));
+	}
+	vm->opStk->size--;
+	vm->index++;
+	continue;
+      case OP_NUM_ADD:
+      case OP_NUM_SUB:
+      case OP_NUM_MUL:
+      case OP_NUM_DIV:
+      case OP_NUM_MOD:
+	/* the compiler proves that the operands are numbers, but the verifier
+	 * doesn't check types, so imported bytecode could still use these on
+	 * anything. division by zero is left to the handler.
+	 */
+	if(top[-1].type != TYPE_NUMBER || top[-2].type != TYPE_NUMBER) {
+	  break;
+	}
+	memcpy(&value1, top[-2].data, sizeof(double));
+	memcpy(&value2, top[-1].data, sizeof(double));
+	if(byteCode[vm->index] == OP_NUM_DIV && value2 == 0) {
+	  break;
+	}
+	switch(byteCode[vm->index]) {
+	case OP_NUM_ADD:
+	  value1 += value2;
+	  break;
+	case OP_NUM_SUB:
+	  value1 -= value2;
+	  break;
+	case OP_NUM_MUL:
+	  value1 *= value2;
+	  break;
+	case OP_NUM_DIV:
+	  value1 /= value2;
+	  break;
+	default:
+	  value1 = fmod(value1, value2);
+	  break;
+	}
+	top[-2].type = TYPE_NUMBER;
+	memcpy(top[-2].data, &value1, sizeof(double));
+	vm->opStk->size--;
+	vm->index++;
+	continue;
+      case OP_NUM_LT:
+      case OP_NUM_GT:
+      case OP_NUM_LTE:
+      case OP_NUM_GTE:
+      case OP_NUM_EQUALS:
+      case OP_NUM_NOT_EQUALS:
+	if(top[-1].type != TYPE_NUMBER || top[-2].type != TYPE_NUMBER) {
+	  break;
+	}
+	memcpy(&value1, top[-2].data, sizeof(double));
+	memcpy(&value2, top[-1].data, sizeof(double));
+	switch(byteCode[vm->index]) {
+	case OP_NUM_LT:
+	  result = value1 < value2;
+	  break;
+	case OP_NUM_GT:
+	  result = value1 > value2;
+	  break;
+	case OP_NUM_LTE:
+	  result = value1 <= value2;
+	  break;
+	case OP_NUM_GTE:
+	  result = value1 >= value2;
+	  break;
+	case OP_NUM_EQUALS:
+	  result = value1 == value2;
+	  break;
+	default:
+	  result = value1 != value2;
+	  break;
+	}
+	top[-2].type = TYPE_BOOLEAN;
+	memcpy(top[-2].data, &result, sizeof(bool));
+	vm->opStk->size--;
+	vm->index++;
+	continue;
+      case OP_NUM_STOR: {
+	/* only a number replacing a non-object skips the handler, which
+	 * releases the reference of any object that is overwritten.
+	 */
+	char * var = frmstk_var_addr(vm->frmStk, operands[0], operands[1]);
+	if(top[-1].type != TYPE_NUMBER || *var == TYPE_LIBDATA) {
+	  break;
+	}
+	*var = TYPE_NUMBER;
+	memcpy(var + 1, top[-1].data, VM_VAR_SIZE);
+	vm->index += 3;
+	continue;
+      }
+      case OP_FOR_STEP:
+      case OP_FOR_STEP_NUM: {
+	char * var = frmstk_var_addr(vm->frmStk, operands[0], operands[1]);
+	char * limit = operands + 3 + sizeof(double);
+	int len = byteCode[vm->index] == OP_FOR_STEP
+	  ? 6 + sizeof(double) + sizeof(int)
+	  : 4 + (2 * sizeof(double)) + sizeof(int);
+
+	/* a variable limit is read from its slot, after the step */
+	if(byteCode[vm->index] == OP_FOR_STEP) {
+	  limit = (char*)frmstk_var_addr(vm->frmStk, limit[0], limit[1]);
+	  if(*limit != TYPE_NUMBER) {
+	    break;
+	  }
+	  limit++;
+	}
+	if(executed >= checkAt || *var != TYPE_NUMBER) {
+	  break;
+	}
+
+	memcpy(&value1, var + 1, sizeof(double));
+	memcpy(&value2, operands + 3, sizeof(double));
+	value1 += value2;
+	memcpy(var + 1, &value1, sizeof(double));
+	memcpy(&value2, limit, sizeof(double));
+
+	switch(operands[2]) {
+	case OP_LT:
+	  result = value1 < value2;
+	  break;
+	case OP_GT:
+	  result = value1 > value2;
+	  break;
+	case OP_LTE:
+	  result = value1 <= value2;
+	  break;
+	default:
+	  result = value1 >= value2;
+	  break;
+	}
+	if(result) {
+	  memcpy(&vm->index, byteCode + vm->index + len - sizeof(int),
+		 sizeof(int));
+	} else {
+	  vm->index += len;
+	}
+	continue;
+      }
+      case OP_SWITCH_NUM: {
+	char * var = frmstk_var_addr(vm->frmStk, operands[0], operands[1]);
+	int count;
+	int entry;
+
+	if(*var != TYPE_NUMBER && *var != TYPE_NULL) {
+	  break;
+	}
+	memcpy(&value1, var + 1, sizeof(double));
+	memcpy(&value2, operands + 2, sizeof(double));
+	memcpy(&count, operands + 2 + sizeof(double), sizeof(int));
+	entry = count;
+	if(*var == TYPE_NUMBER && value1 == floor(value1)
+	   && value1 - value2 >= 0 && value1 - value2 < count) {
+	  entry = (int)(value1 - value2);
+	}
+
+	/* go to the table's OP_GOTO, which jumps as usual */
+	vm->index += 3 + sizeof(double) + sizeof(int)
+	  + (entry * (1 + sizeof(int)));
+	continue;
+      }
+      case OP_GOTO:
+	if(executed < checkAt) {
+	  memcpy(&vm->index, operands, sizeof(int));
+	  continue;
+	}
+	break;
+      case OP_TCOND_GOTO:
+      case OP_FCOND_GOTO:
+	if(executed < checkAt && top[-1].type == TYPE_BOOLEAN) {
+	  memcpy(&result, top[-1].data, sizeof(bool));
+	  vm->opStk->size--;
+	  if((result != 0) == (byteCode[vm->index] == OP_TCOND_GOTO)) {
+	    memcpy(&vm->index, operands, sizeof(int));
+	  } else {
+	    vm->index += 1 + sizeof(int);
+	  }
+	  continue;
+	}
+	break;
+      }
+    }
+
+    if(vm->profile != NULL) {
+      profile_record(vm->profile, vm, byteCode, byteCodeLen, vm->index);
+    }
 
     switch(byteCode[vm->index]) {
     case OP_VAR_PUSH:
@@ -304,6 +933,32 @@ bool vm_exec(VM * vm, char * byteCode,
 	return false;
       }
       break;
+    case OP_NUM_ADD:
+    case OP_NUM_SUB:
+    case OP_NUM_MUL:
+    case OP_NUM_DIV:
+    case OP_NUM_MOD:
+      if(!op_dual_operand_math(vm, byteCode, byteCodeLen, &vm->index,
+			       byteCode[vm->index])) {
+	return false;
+      }
+      break;
+    case OP_NUM_LT:
+    case OP_NUM_GT:
+    case OP_NUM_LTE:
+    case OP_NUM_GTE:
+    case OP_NUM_EQUALS:
+    case OP_NUM_NOT_EQUALS:
+      if(!op_dual_comparison(vm, byteCode, byteCodeLen,
+			     &vm->index, byteCode[vm->index])) {
+	return false;
+      }
+      break;
+    case OP_NUM_STOR:
+      if(!op_var_stor(vm, byteCode, byteCodeLen, &vm->index)) {
+	return false;
+      }
+      break;
     case OP_AND:
     case OP_OR:
       if(!op_boolean_logic(vm, byteCode, byteCodeLen,
@@ -312,6 +967,10 @@ bool vm_exec(VM * vm, char * byteCode,
       }
       break;
     case OP_GOTO:
+      /* preemption point: stop here if the slice budget is spent */
+      if(executed >= checkAt && vm_budget_spent(vm, executed, &checkAt)) {
+	return vm_suspend(vm, byteCode, byteCodeLen, unchecked);
+      }
       if(!op_goto(vm, byteCode, byteCodeLen,
 			     &vm->index)) {
 	return false;
@@ -345,25 +1004,67 @@ bool vm_exec(VM * vm, char * byteCode,
       }
       break;
     case OP_CALL_B:
+      /* preemption point: stop here if the slice budget is spent */
+      if(executed >= checkAt && vm_budget_spent(vm, executed, &checkAt)) {
+	return vm_suspend(vm, byteCode, byteCodeLen, unchecked);
+      }
       if(!op_frame_push(vm, byteCode, byteCodeLen, &vm->index, true)) {
 	return false;
       }
+
+      /* make room for the callee's stack */
+      if(unchecked && !typestk_reserve(vm->opStk, vm->maxStack)) {
+	vm_set_err(vm, VMERR_ALLOC_FAILED);
+	return false;
+      }
       break;
+    case OP_CALL_LAZY:
+      /* first run of a call to a function that was not loaded. load it and
+       * make this a plain call, then run it again as one.
+       */
+      if(!vm_link_call(vm, byteCode, byteCodeLen)) {
+	return false;
+      }
+      continue;
     case OP_NOT:
       if(!op_not(vm, byteCode, byteCodeLen, &vm->index)) {
 	return false;
       }
       break;
     case OP_TCOND_GOTO:
+      /* preemption point: stop here if the slice budget is spent */
+      if(executed >= checkAt && vm_budget_spent(vm, executed, &checkAt)) {
+	return vm_suspend(vm, byteCode, byteCodeLen, unchecked);
+      }
       if(!op_cond_goto(vm, byteCode, byteCodeLen, &vm->index, false)) {
 	return false;
       }
       break;
     case OP_FCOND_GOTO:
+      /* preemption point: stop here if the slice budget is spent */
+      if(executed >= checkAt && vm_budget_spent(vm, executed, &checkAt)) {
+	return vm_suspend(vm, byteCode, byteCodeLen, unchecked);
+      }
       if(!op_cond_goto(vm, byteCode, byteCodeLen, &vm->index, true)) {
 	return false;
       }
       break;
+    case OP_FOR_STEP:
+    case OP_FOR_STEP_NUM:
+      /* preemption point: stop here if the slice budget is spent */
+      if(executed >= checkAt && vm_budget_spent(vm, executed, &checkAt)) {
+	return vm_suspend(vm, byteCode, byteCodeLen, unchecked);
+      }
+      if(!op_for_step(vm, byteCode, byteCodeLen, &vm->index,
+		      byteCode[vm->index] == OP_FOR_STEP_NUM)) {
+	return false;
+      }
+      break;
+    case OP_SWITCH_NUM:
+      if(!op_switch_num(vm, byteCode, byteCodeLen, &vm->index)) {
+	return false;
+      }
+      break;
     case OP_POP:
       if(!op_pop(vm, byteCode, byteCodeLen, &vm->index)) {
 	return false;
@@ -382,12 +1083,350 @@ bool vm_exec(VM * vm, char * byteCode,
   }
 
   /* make sure that the stack is being cleared after each line. There should
-   * be only 1 item...the entry point return value
+   * be at least 1 item...the entry point return value
    */
-  assert(typestk_size(vm->opStk) == 1);
+  assert(typestk_size(vm->opStk) >= 1);
   return true;
 }
 
+
+/**
+ * Executes a VM bytecode. For more info on the bytecode format, see
+ * ophandlers.c where the opcodes are described and implemented. If the VM
+ * is still suspended from a previous call, that execution is abandoned.
+ * vm: an instance of VM.
+ * byteCode: an array of chars that contain VM byte code.
+ * byteCodeLen: the number of bytes to read from byteCode array.
+ * startIndex: the index to start executing from. The entry point.
+ * numArgs: the number of items to pop off of stack to use as arguments.
+ * returns: true if execution completed, and false if an error occurred or
+ * if the execution budget ran out (VMERR_BUDGET_EXHAUSTED).
+ */
+bool vm_exec(VM * vm, char * byteCode, 
+	     size_t byteCodeLen, int startIndex, int numVarArgs) {
+
+  assert(vm != NULL);
+  assert(startIndex >= 0);
+  assert(startIndex < byteCodeLen);
+  assert(numVarArgs >= 0);
+
+  /* throw away the state of an unfinished execution */
+  if(vm->suspended) {
+    vm_unwind(vm);
+  }
+
+  vm->index = startIndex;
+  if(vm->profile != NULL) {
+    profile_enter(vm->profile, byteCodeLen, startIndex);
+  }
+
+  /* push new frame with selected number of arguments and vars. */
+  if(!frmstk_push(vm->frmStk, VM_HOST_RETURN, numVarArgs)) {
+     vm_set_err(vm, VMERR_STACK_OVERFLOW);
+     return false;
+  }
+
+  return vm_run(vm, byteCode, byteCodeLen, false);
+}
+
+/**
+ * Pushes the entry frame of a host call and writes the arguments into it.
+ * vm: an instance of VM.
+ * function: the function being called.
+ * args: an array of function->numArgs arguments.
+ * returns: true if success, false if the frame stack overflowed.
+ */
+static bool vm_enter(VM * vm, VMFunc * function, VMArg * args) {
+  int i;
+
+  /* functions from a lazy source are loaded on their first call */
+  if(!function->loaded && !vm_load_function(vm, function)) {
+    return false;
+  }
+
+  vm->index = function->index;
+
+  /* push the frame for the function's arguments and variables */
+  if(!frmstk_push(vm->frmStk, VM_HOST_RETURN,
+		  function->numArgs + function->numVars)) {
+    vm_set_err(vm, VMERR_STACK_OVERFLOW);
+    return false;
+  }
+
+  /* write arguments to their variable slots. the frame references objects */
+  for(i = 0; i < function->numArgs; i++) {
+    if(args[i].type == TYPE_LIBDATA) {
+      vmlibdata_inc_refcount(vmarg_libdata(args[i]));
+    }
+    frmstk_var_write(vm->frmStk, FRMSTK_TOP, i, args[i].data,
+		     VM_VAR_SIZE, args[i].type);
+  }
+
+  return true;
+}
+
+/**
+ * Checks whether a call to a function from the host runs its native code.
+ * vm: an instance of VM.
+ * function: the function.
+ * returns: true if the function was compiled ahead of time, and there is no
+ * budget or profile that native code can't honor.
+ */
+static bool vm_runs_native(VM * vm, VMFunc * function) {
+  return function->compiled != NULL && vm->profile == NULL
+    && vm->budgetInstructions == 0 && vm->budgetMicros == 0;
+}
+
+/**
+ * Runs a function whose entry frame was pushed by vm_enter(). Functions that
+ * were compiled ahead of time run their native code, unless an execution
+ * budget is set, since native code can't be suspended, or the VM is being
+ * profiled, since native code isn't counted.
+ * vm: an instance of VM.
+ * function: the function.
+ * byteCode: the VM's code.
+ * byteCodeLen: the length of byteCode.
+ * returns: true if the function returned.
+ */
+static bool vm_run_function(VM * vm, VMFunc * function, char * byteCode,
+			    size_t byteCodeLen) {
+  if(vm->profile != NULL) {
+    profile_enter(vm->profile, byteCodeLen, function->index);
+  } else if(vm_runs_native(vm, function)) {
+    vm->suspended = false;
+    return function->compiled(vm);
+  }
+
+  return vm_run(vm, byteCode, byteCodeLen, vm_verified(vm));
+}
+
+/**
+ * Calls a script function that was looked up ahead of time with
+ * vm_function(). The arguments are written straight into the new frame and
+ * the return value is handed back to the caller, so repeated calls need no
+ * name lookups. The VM keeps references to any object arguments only for
+ * the duration of the call.
+ * vm: an instance of VM.
+ * function: the function to call.
+ * args: an array of numArgs arguments. Build them with vmarg_set_*().
+ * numArgs: the number of arguments. Must match the function declaration.
+ * result: receives the return value, or NULL to throw it away. Objects
+ * returned this way are owned by the caller and must be released with
+ * vmarg_release().
+ * returns: true if the call completed, false if an error occurred or the
+ * execution budget ran out. After a suspended call finishes in vm_resume(),
+ * its return value can be collected with vm_take_result().
+ */
+bool vm_call(VM * vm, VMFunc * function, VMArg * args, int numArgs,
+	     VMArg * result) {
+
+  assert(vm != NULL);
+  assert(function != NULL);
+  assert(numArgs == 0 || args != NULL);
+
+  vm_set_err(vm, VMERR_SUCCESS);
+
+  /* check that the number of arguments matches the declaration */
+  if(numArgs != function->numArgs) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+    return false;
+  }
+
+  /* throw away the state of an unfinished execution */
+  if(vm->suspended) {
+    vm_unwind(vm);
+  }
+
+  if(!vm_enter(vm, function, args)
+     || !vm_run_function(vm, function, vm_code(vm), vm_bytecode_size(vm))) {
+    return false;
+  }
+
+  return vm_take_result(vm, result);
+}
+
+/**
+ * Calls a script function once for each record in an array of argument
+ * tuples, all from a single entry into the interpreter. When a record returns,
+ * the interpreter takes its return value and enters the next record itself,
+ * so each record costs little more than its script code. The interpreter is
+ * only left, and entered again, after a record fails. Functions compiled
+ * ahead of time run their native code one record at a time.
+ * When an execution budget is set it applies to each record separately and
+ * a record that runs out of budget fails with VMERR_BUDGET_EXHAUSTED rather
+ * than being suspended.
+ * vm: an instance of VM.
+ * function: the function to call, from vm_function().
+ * args: numRecords * function->numArgs arguments. The arguments of record i
+ * begin at args[i * function->numArgs].
+ * numRecords: the number of records.
+ * results: an array of numRecords values that receives each record's return
+ * value, or NULL to throw them away. Objects must be released with
+ * vmarg_release(). Records that fail receive null.
+ * errors: an array of numRecords VMErr that receives each record's error,
+ * or NULL. Records that are not run are set to VMERR_NOT_RUN.
+ * continueOnError: if true, a failing record does not stop the batch.
+ * returns: true if every record succeeded. If false, vm_get_err() returns the
+ * error of the first record that failed.
+ */
+bool vm_call_batch(VM * vm, VMFunc * function, VMArg * args, int numRecords,
+		   VMArg * results, VMErr * errors, bool continueOnError) {
+  VMBatch batch;
+  char * byteCode;
+  size_t byteCodeLen;
+  VMErr firstErr = VMERR_SUCCESS;
+  int baseFrames;
+  int baseOperands;
+  int i;
+
+  assert(vm != NULL);
+  assert(function != NULL);
+  assert(numRecords >= 0);
+  assert(function->numArgs == 0 || args != NULL);
+
+  /* throw away the state of an unfinished execution */
+  if(vm->suspended) {
+    vm_unwind(vm);
+  }
+
+  byteCode = vm_code(vm);
+  byteCodeLen = vm_bytecode_size(vm);
+  baseFrames = frmstk_size(vm->frmStk);
+  baseOperands = typestk_size(vm->opStk);
+
+  batch.function = function;
+  batch.args = args;
+  batch.numRecords = numRecords;
+  batch.results = results;
+  batch.errors = errors;
+
+  /* each pass runs records until one fails or all have run */
+  for(i = 0; i < numRecords; i++) {
+    bool success;
+
+    vm_set_err(vm, VMERR_SUCCESS);
+    batch.record = i;
+    batch.enterFailed = false;
+    success = vm_enter(vm, function, args + (i * function->numArgs));
+    if(success) {
+      vm->batch = vm_runs_native(vm, function) ? NULL : &batch;
+      success = vm_run_function(vm, function, byteCode, byteCodeLen)
+	&& !batch.enterFailed;
+      vm->batch = NULL;
+      i = batch.record;
+    }
+
+    if(!success || !vm_take_result(vm, results != NULL ? &results[i] : NULL)) {
+
+      /* record the failure and restore the stacks for the next record */
+      if(firstErr == VMERR_SUCCESS) {
+	firstErr = vm->err;
+      }
+      vm_unwind_to(vm, baseFrames, baseOperands);
+      if(results != NULL) {
+	vmarg_set_null(&results[i]);
+      }
+    }
+
+    if(errors != NULL) {
+      errors[i] = vm->err;
+    }
+
+    if(vm->err != VMERR_SUCCESS && !continueOnError) {
+      break;
+    }
+  }
+
+  /* records that were never run */
+  for(i++; i < numRecords; i++) {
+    if(results != NULL) {
+      vmarg_set_null(&results[i]);
+    }
+    if(errors != NULL) {
+      errors[i] = VMERR_NOT_RUN;
+    }
+  }
+
+  vm_set_err(vm, firstErr);
+  return firstErr == VMERR_SUCCESS;
+}
+
+/**
+ * Pops the return value of a completed call off of the operand stack.
+ * vm: an instance of VM.
+ * result: receives the value, or NULL to release it. Objects returned this
+ * way must be released with vmarg_release().
+ * returns: true if there was a value, and false if the operand stack was
+ * empty.
+ */
+bool vm_take_result(VM * vm, VMArg * result) {
+  VMArg value;
+
+  assert(vm != NULL);
+
+  if(!typestk_pop(vm->opStk, value.data, VM_VAR_SIZE, &value.type)) {
+    vm_set_err(vm, VMERR_STACK_EMPTY);
+    return false;
+  }
+
+  /* an operand owns two references, leave the one that belongs to the value */
+  if(value.type == TYPE_LIBDATA) {
+    vmlibdata_dec_refcount(vmarg_libdata(value));
+  }
+
+  if(result != NULL) {
+    *result = value;
+  } else {
+    vmarg_release(vm, &value);
+  }
+
+  return true;
+}
+
+/**
+ * Continues an execution that was suspended because its budget ran out. The
+ * new slice gets the full budget set with vm_set_budget().
+ * vm: an instance of VM.
+ * returns: true if execution completed, and false if an error occurred or if
+ * the budget ran out again (VMERR_BUDGET_EXHAUSTED).
+ */
+bool vm_resume(VM * vm) {
+  assert(vm != NULL);
+  assert(vm->suspended);
+
+  return vm_run(vm, vm->resumeCode, vm->resumeCodeLen, vm->resumeUnchecked);
+}
+
+/**
+ * Brings the VM back to the state it was in right after its code was loaded,
+ * without freeing and reallocating anything. Any unfinished execution is
+ * thrown away, the error and execution budget are cleared, and the loaded
+ * bytecode, functions and registered callbacks are kept.
+ * vm: an instance of VM.
+ */
+void vm_reset(VM * vm) {
+  assert(vm != NULL);
+
+  vm_unwind(vm);
+  vm->index = 0;
+  vm->budgetInstructions = 0;
+  vm->budgetMicros = 0;
+  vm->resumeCode = NULL;
+  vm->resumeCodeLen = 0;
+  vm_set_err(vm, VMERR_SUCCESS);
+}
+
+/**
+ * Checks if the VM stopped because its execution budget ran out.
+ * vm: an instance of VM.
+ * returns: true if the last execution can be continued with vm_resume().
+ */
+bool vm_suspended(VM * vm) {
+  assert(vm != NULL);
+
+  return vm->suspended;
+}
+
 /**
  * Sets the current error code in the VM.
  * vm: an instance of vm.
@@ -428,10 +1467,14 @@ const char * vm_err_to_string(VMErr err) {
  * Gets the number of bytes of byte code in the bytecode buffer that can be
  * copied out using vm_bytecode().
  * vm: an instance of vm.
- * returns: the size of the byte code buffer.
+ * returns: the size of the byte code buffer, or of the code image if one was
+ * set with vm_set_image().
  */
 size_t vm_bytecode_size(VM * vm) {
   assert(vm != NULL);
+  if(vm->image != NULL) {
+    return vm->imageLen;
+  }
   return buffer_size(vm->buffer);
 }
 
@@ -447,9 +1490,213 @@ char * vm_bytecode(VM * vm) {
     return NULL;
   }
 
+  return vm_code(vm);
+}
+
+/**
+ * Gets the code that the VM runs calls in, regardless of the VM's error
+ * state. This is the code image if one is set, and the bytecode buffer if
+ * not.
+ * vm: an instance of vm.
+ * returns: the code, which is vm_bytecode_size() bytes long.
+ */
+char * vm_code(VM * vm) {
+  assert(vm != NULL);
+  if(vm->image != NULL) {
+    return vm->image;
+  }
   return buffer_get_buffer(vm->buffer);
 }
 
+/**
+ * Sets an external code image for the VM to run calls in instead of its
+ * bytecode buffer, such as a bytecode file mapped into memory. The image is
+ * only read, never copied or freed, and must outlive the VM. Function
+ * indices refer to offsets in the image.
+ * vm: an instance of vm.
+ * image: the code, or NULL to go back to the bytecode buffer.
+ * imageLen: the length of image in bytes.
+ */
+void vm_set_image(VM * vm, char * image, size_t imageLen) {
+  assert(vm != NULL);
+  assert(image != NULL || imageLen == 0);
+
+  vm->image = image;
+  vm->imageLen = imageLen;
+}
+
+/**
+ * Checks whether the VM's code has passed verifier_verify() since it last
+ * changed.
+ * vm: an instance of vm.
+ * returns: true if calls into the code may be run unchecked.
+ */
+bool vm_verified(VM * vm) {
+  assert(vm != NULL);
+  return vm->verifiedCode != NULL
+    && vm->verifiedCode == vm_code(vm)
+    && vm->verifiedCodeLen == vm_bytecode_size(vm);
+}
+
+/**
+ * Marks the VM's current code as verified without running the verifier. This
+ * is only for code that passed verifier_verify() when it was built and can't
+ * have changed since, such as code compiled into the host binary.
+ * vm: an instance of vm.
+ * maxStack: the deepest stack of any function, found by the verifier.
+ */
+void vm_set_verified(VM * vm, int maxStack) {
+  assert(vm != NULL);
+  assert(maxStack >= 0);
+
+  vm->verifiedCode = vm_code(vm);
+  vm->verifiedCodeLen = vm_bytecode_size(vm);
+  vm->maxStack = maxStack;
+}
+
+/**
+ * Allocates the zero filled private copy of a lazy image. An anonymous
+ * mapping only takes memory for the pages that functions are loaded into, so
+ * a large library that is barely used costs little. Elsewhere, this is up to
+ * calloc().
+ * len: the length of the image in bytes.
+ * returns: the image, or NULL if allocation fails.
+ */
+static char * vm_alloc_lazy_image(size_t len) {
+#if defined(_WIN32)
+  return calloc(len, sizeof(char));
+#else
+  void * image = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return image == MAP_FAILED ? NULL : image;
+#endif
+}
+
+/**
+ * Frees the private copy of a lazy image and its sorted function list, so
+ * that a failed vm_set_lazy_source() leaves the VM as it found it.
+ * vm: an instance of vm.
+ */
+static void vm_free_lazy_image(VM * vm) {
+  if(vm->lazyImage != NULL) {
+#if defined(_WIN32)
+    free(vm->lazyImage);
+#else
+    munmap(vm->lazyImage, vm->lazyImageLen);
+#endif
+  }
+  free(vm->lazyFunctions);
+  vm->lazyImage = NULL;
+  vm->lazyImageLen = 0;
+  vm->lazyFunctions = NULL;
+  vm->numLazyFunctions = 0;
+}
+
+/**
+ * Makes the VM load its functions on demand from a code image, such as a
+ * large bytecode library that is mapped into memory. The VM runs in a zero
+ * filled private copy of the image, and each function's code is copied into
+ * it and verified the first time the function is called, so untouched
+ * functions cost neither time nor memory. Every function must already be in
+ * the VM's function table with its codeLen set and loaded set to false. The
+ * source is only read and must outlive the VM.
+ * vm: an instance of vm.
+ * source: the code that functions are loaded from.
+ * sourceLen: the length of source in bytes.
+ * returns: true if success, false if functions overlap or allocation fails.
+ */
+bool vm_set_lazy_source(VM * vm, char * source, size_t sourceLen) {
+  HTIter iter;
+  int i;
+
+  assert(vm != NULL);
+  assert(source != NULL);
+  assert(vm->lazyImage == NULL);
+
+  /* the copy is only backed by memory where functions are loaded */
+  vm->numLazyFunctions = ht_size(vm->functionHT);
+  vm->lazyImage = vm_alloc_lazy_image(sourceLen);
+  vm->lazyImageLen = sourceLen;
+  vm->lazyFunctions = calloc(vm->numLazyFunctions + 1, sizeof(VMFunc*));
+  if(vm->lazyImage == NULL || vm->lazyFunctions == NULL) {
+    vm_free_lazy_image(vm);
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  ht_iter_get(vm->functionHT, &iter);
+  for(i = 0; ht_iter_has_next(&iter); i++) {
+    DSValue value;
+    ht_iter_next(&iter, NULL, 0, &value, NULL, false);
+    vm->lazyFunctions[i] = value.pointerVal;
+  }
+  qsort(vm->lazyFunctions, vm->numLazyFunctions, sizeof(VMFunc*),
+	vm_func_compare);
+
+  /* functions must not overlap, or loading one would overwrite another */
+  for(i = 0; i < vm->numLazyFunctions; i++) {
+    VMFunc * function = vm->lazyFunctions[i];
+    size_t end = i + 1 < vm->numLazyFunctions
+      ? vm->lazyFunctions[i + 1]->index : sourceLen;
+
+    if(function->index < 0 || function->codeLen < 1
+       || function->index + function->codeLen > end) {
+      vm_free_lazy_image(vm);
+      vm_set_err(vm, VMERR_VERIFY_FAILED);
+      return false;
+    }
+  }
+
+  /* only loaded functions are ever entered, and each is verified as it is
+   * loaded, so the whole image runs unchecked.
+   */
+  vm->lazySource = source;
+  vm_set_image(vm, vm->lazyImage, sourceLen);
+  vm->verifiedCode = vm->lazyImage;
+  vm->verifiedCodeLen = sourceLen;
+  vm->maxStack = 0;
+
+  return true;
+}
+
+/**
+ * Loads a function from the VM's lazy source: copies its code into the
+ * image, verifies it, and links its calls. Calls to functions that are not
+ * loaded yet become OP_CALL_LAZY, which loads them when first run.
+ * vm: an instance of vm.
+ * function: the function. Does nothing if it is already loaded.
+ * returns: true if success, false if the function's code fails verification
+ * or allocation fails.
+ */
+bool vm_load_function(VM * vm, VMFunc * function) {
+
+  assert(vm != NULL);
+  assert(function != NULL);
+
+  if(function->loaded) {
+    return true;
+  }
+  assert(vm->lazySource != NULL);
+
+  memcpy(vm->lazyImage + function->index,
+	 vm->lazySource + function->index, function->codeLen);
+
+  /* loaded is set first so that recursive calls are linked directly */
+  function->loaded = true;
+  if(!verifier_verify_function(vm, function, vm->lazyFunctions,
+			       vm->numLazyFunctions)) {
+    function->loaded = false;
+    memset(vm->lazyImage + function->index, 0, function->codeLen);
+    return false;
+  }
+
+  if(function->maxStack > vm->maxStack) {
+    vm->maxStack = function->maxStack;
+  }
+
+  return true;
+}
+
 Buffer * vm_buffer(VM * vm) {
   return vm->buffer;
 }
@@ -474,6 +1721,11 @@ void vm_free(VM * vm) {
 
   assert(vm != NULL);
 
+  /* release objects held by an unfinished execution */
+  if(vm->suspended) {
+    vm_unwind(vm);
+  }
+
   if(vm->opStk != NULL) {
     void * value;
     VarType type;
@@ -501,6 +1753,8 @@ void vm_free(VM * vm) {
     buffer_free(vm->buffer);
   }
 
+  vm_free_lazy_image(vm);
+
   if(vm->functionHT != NULL) {
     HTIter htIterator;
     ht_iter_get(vm->functionHT, &htIterator);
@@ -538,7 +1792,12 @@ VMFunc * vmfunc_new(int index, int numArgs, int numVars,
     vf->index = index;
     vf->numArgs = numArgs;
     vf->numVars = numVars;
-    vf->exported = true;
+    vf->exported = exported;
+    vf->inlineHint = false;
+    vf->maxStack = 0;
+    vf->codeLen = 0;
+    vf->loaded = true;
+    vf->compiled = NULL;
   }
 
   return vf;
@@ -600,6 +1859,72 @@ void * vmarg_data(VMArg * arg) {
   return arg->data;
 }
 
+/**
+ * Sets a VMArg to a number, for passing to vm_call().
+ * arg: the argument to set.
+ * value: the number.
+ */
+void vmarg_set_number(VMArg * arg, double value) {
+  assert(arg != NULL);
+  memcpy(arg->data, &value, sizeof(double));
+  arg->type = TYPE_NUMBER;
+}
+
+/**
+ * Sets a VMArg to a boolean, for passing to vm_call().
+ * arg: the argument to set.
+ * value: the boolean.
+ */
+void vmarg_set_boolean(VMArg * arg, bool value) {
+  assert(arg != NULL);
+  memset(arg->data, 0, VM_VAR_SIZE);
+  memcpy(arg->data, &value, sizeof(bool));
+  arg->type = TYPE_BOOLEAN;
+}
+
+/**
+ * Sets a VMArg to null, for passing to vm_call().
+ * arg: the argument to set.
+ */
+void vmarg_set_null(VMArg * arg) {
+  assert(arg != NULL);
+  memset(arg->data, 0, VM_VAR_SIZE);
+  arg->type = TYPE_NULL;
+}
+
+/**
+ * Sets a VMArg to an object, such as a string from vmarg_new_string(), for
+ * passing to vm_call().
+ * arg: the argument to set.
+ * data: the object.
+ */
+void vmarg_set_libdata(VMArg * arg, VMLibData * data) {
+  assert(arg != NULL);
+  assert(data != NULL);
+  memset(arg->data, 0, VM_VAR_SIZE);
+  memcpy(arg->data, &data, sizeof(VMLibData*));
+  arg->type = TYPE_LIBDATA;
+}
+
+/**
+ * Releases the reference that a return value from vm_call() holds on an
+ * object. Does nothing for other types.
+ * vm: the VM that returned the value.
+ * arg: the value to release.
+ */
+void vmarg_release(VM * vm, VMArg * arg) {
+  assert(vm != NULL);
+  assert(arg != NULL);
+
+  if(arg->type == TYPE_LIBDATA) {
+    VMLibData * data = vmarg_libdata(*arg);
+
+    vmlibdata_dec_refcount(data);
+    vmlibdata_check_cleanup(vm, data);
+    vmarg_set_null(arg);
+  }
+}
+
 /**
  * Gets the type of a VMArg.
  */
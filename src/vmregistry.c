@@ -0,0 +1,316 @@
+/**
+ * vmregistry.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * A registry of native functions that can be shared by any number of VMs.
+ * Natives are added while the registry is being built and it is then frozen,
+ * after which it is never modified and can be read by several VMs, or
+ * threads, at once. Freezing builds a perfect hash of the names, so looking
+ * up a name costs one hash and one string comparison. The index of a native
+ * is its registration order, so bytecode compiled against one registry can
+ * run in any VM that uses a registry built the same way.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vmregistry.h"
+#include <string.h>
+#include <assert.h>
+
+/* the number of seeds tried for each table size before growing the table */
+static const unsigned int maxSeeds = 256;
+
+/**
+ * Hashes a name with FNV-1a, mixed with a seed.
+ * name: the name.
+ * nameLen: the length of name.
+ * seed: the seed.
+ * returns: the hash.
+ */
+static unsigned int vmregistry_hash(char * name, size_t nameLen,
+				    unsigned int seed) {
+  unsigned int hash = 2166136261u ^ (seed * 16777619u);
+  size_t i;
+
+  for(i = 0; i < nameLen; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+
+  return hash ^ (hash >> 15);
+}
+
+/**
+ * Creates a new, empty registry.
+ * size: the maximum number of natives that can be added.
+ * returns: a new registry, or NULL if allocation fails.
+ */
+VMRegistry * vmregistry_new(int size) {
+  VMRegistry * registry;
+
+  assert(size > 0);
+
+  registry = calloc(1, sizeof(VMRegistry));
+  if(registry == NULL) {
+    return NULL;
+  }
+
+  registry->natives = calloc(size, sizeof(VMNative));
+  if(registry->natives == NULL) {
+    free(registry);
+    return NULL;
+  }
+  registry->size = size;
+
+  return registry;
+}
+
+/**
+ * Adds a native function entry to a registry that has not been frozen yet.
+ * registry: an instance of VMRegistry.
+ * name: the name that scripts call the function by.
+ * nameLen: the length of name.
+ * callback: the native implementation.
+ * pure: whether the native has no side effects.
+ * returns: true on success, and false if the registry is full or frozen, a
+ * function with this name was already added, or an allocation fails.
+ */
+static bool vmregistry_insert(VMRegistry * registry, char * name,
+			      size_t nameLen, VMCallback callback, bool pure) {
+  VMNative * native;
+  int i;
+
+  assert(registry != NULL);
+  assert(name != NULL);
+  assert(nameLen > 0);
+  assert(callback != NULL);
+
+  if(registry->frozen || registry->numNatives >= registry->size) {
+    return false;
+  }
+
+  /* check for duplicates */
+  for(i = 0; i < registry->numNatives; i++) {
+    if(registry->natives[i].nameLen == nameLen
+       && memcmp(registry->natives[i].name, name, nameLen) == 0) {
+      return false;
+    }
+  }
+
+  native = &registry->natives[registry->numNatives];
+  native->name = malloc(nameLen);
+  if(native->name == NULL) {
+    return false;
+  }
+  memcpy(native->name, name, nameLen);
+  native->nameLen = nameLen;
+  native->callback = callback;
+  native->pure = pure;
+
+  registry->numNatives++;
+  return true;
+}
+
+/**
+ * Adds a native function to a registry that has not been frozen yet.
+ * registry: an instance of VMRegistry.
+ * name: the name that scripts call the function by.
+ * nameLen: the length of name.
+ * callback: the native implementation.
+ * returns: true on success, and false if the registry is full or frozen, a
+ * function with this name was already added, or an allocation fails.
+ */
+bool vmregistry_add(VMRegistry * registry, char * name, size_t nameLen,
+		    VMCallback callback) {
+  return vmregistry_insert(registry, name, nameLen, callback, false);
+}
+
+/**
+ * Adds a pure native function to a registry that has not been frozen yet. A
+ * pure native has no side effects and always returns a number or boolean that
+ * depends only on its arguments, so the optimizer may move calls to it.
+ * registry: an instance of VMRegistry.
+ * name: the name that scripts call the function by.
+ * nameLen: the length of name.
+ * callback: the native implementation.
+ * returns: true on success, and false if the registry is full or frozen, a
+ * function with this name was already added, or an allocation fails.
+ */
+bool vmregistry_add_pure(VMRegistry * registry, char * name, size_t nameLen,
+			 VMCallback callback) {
+  return vmregistry_insert(registry, name, nameLen, callback, true);
+}
+
+/**
+ * Tries to fill the hash table with a seed. The table must be cleared.
+ * registry: an instance of VMRegistry with an allocated table.
+ * seed: the seed to try.
+ * returns: true if no two names collided.
+ */
+static bool vmregistry_try_seed(VMRegistry * registry, unsigned int seed) {
+  int i;
+
+  memset(registry->table, 0, (registry->tableMask + 1) * sizeof(int));
+
+  for(i = 0; i < registry->numNatives; i++) {
+    unsigned int slot = vmregistry_hash(registry->natives[i].name,
+					registry->natives[i].nameLen,
+					seed) & registry->tableMask;
+    if(registry->table[slot] != 0) {
+      return false;
+    }
+    registry->table[slot] = i + 1;
+  }
+
+  registry->seed = seed;
+  return true;
+}
+
+/**
+ * Freezes the registry so that it may be shared, and builds its perfect hash
+ * table. No natives can be added afterwards.
+ * registry: an instance of VMRegistry.
+ * returns: true on success, and false if an allocation fails.
+ */
+bool vmregistry_freeze(VMRegistry * registry) {
+  unsigned int tableSize = 1;
+
+  assert(registry != NULL);
+  assert(!registry->frozen);
+
+  /* start with a table at least twice the number of natives */
+  while(tableSize < 2 * (unsigned int)registry->numNatives) {
+    tableSize <<= 1;
+  }
+
+  /* search for a seed that gives no collisions, growing the table when
+   * none of the seeds for the current size work.
+   */
+  for(;;) {
+    unsigned int seed;
+
+    registry->table = calloc(tableSize, sizeof(int));
+    if(registry->table == NULL) {
+      return false;
+    }
+    registry->tableMask = tableSize - 1;
+
+    for(seed = 0; seed < maxSeeds; seed++) {
+      if(vmregistry_try_seed(registry, seed)) {
+	registry->frozen = true;
+	return true;
+      }
+    }
+
+    free(registry->table);
+    registry->table = NULL;
+    tableSize <<= 1;
+  }
+}
+
+/**
+ * Looks up the index of a native by name.
+ * registry: a frozen instance of VMRegistry.
+ * name: the name of the native.
+ * nameLen: the length of name.
+ * returns: the index of the native, or -1 if there is none by this name.
+ */
+int vmregistry_index(VMRegistry * registry, char * name, size_t nameLen) {
+  VMNative * native;
+  int entry;
+
+  assert(registry != NULL);
+  assert(registry->frozen);
+  assert(name != NULL);
+
+  entry = registry->table[vmregistry_hash(name, nameLen, registry->seed)
+			  & registry->tableMask];
+  if(entry == 0) {
+    return -1;
+  }
+
+  /* the slot may belong to another name */
+  native = &registry->natives[entry - 1];
+  if(native->nameLen != nameLen || memcmp(native->name, name, nameLen) != 0) {
+    return -1;
+  }
+
+  return entry - 1;
+}
+
+/**
+ * Gets the native function with the given index.
+ * registry: an instance of VMRegistry.
+ * index: an index from vmregistry_index().
+ * returns: the callback, or NULL if the index is out of range.
+ */
+VMCallback vmregistry_callback(VMRegistry * registry, int index) {
+  assert(registry != NULL);
+
+  if(index < 0 || index >= registry->numNatives) {
+    return NULL;
+  }
+
+  return registry->natives[index].callback;
+}
+
+/**
+ * Gets whether the native function with the given index is pure.
+ * registry: an instance of VMRegistry.
+ * index: an index from vmregistry_index().
+ * returns: true if the native was added with vmregistry_add_pure().
+ */
+bool vmregistry_pure(VMRegistry * registry, int index) {
+  assert(registry != NULL);
+
+  if(index < 0 || index >= registry->numNatives) {
+    return false;
+  }
+
+  return registry->natives[index].pure;
+}
+
+/**
+ * Gets the number of natives in the registry.
+ * registry: an instance of VMRegistry.
+ * returns: the number of natives.
+ */
+int vmregistry_size(VMRegistry * registry) {
+  assert(registry != NULL);
+  return registry->numNatives;
+}
+
+/**
+ * Frees a registry. No VM may be using it.
+ * registry: an instance of VMRegistry.
+ */
+void vmregistry_free(VMRegistry * registry) {
+  int i;
+
+  assert(registry != NULL);
+
+  for(i = 0; i < registry->numNatives; i++) {
+    free(registry->natives[i].name);
+  }
+
+  free(registry->natives);
+  if(registry->table != NULL) {
+    free(registry->table);
+  }
+  free(registry);
+}